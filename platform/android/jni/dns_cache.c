@@ -0,0 +1,357 @@
+/*
+ * dns_cache.c — DNS message parsing and answer cache for the UDP relay
+ */
+
+#include "dns_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DNS_TYPE_SOA   6
+#define DNS_TYPE_OPT   41
+#define DNS_RCODE_NXDOMAIN 3
+
+struct dns_entry {
+    dns_entry_t *chain;       /* next in the hash bucket */
+    dns_entry_t *newer;
+    dns_entry_t *older;
+    uint32_t hash;
+    int64_t  stored_ms;
+    int64_t  expire_ms;
+    int      key_len;
+    int      msg_len;
+    uint8_t  data[];          /* key, then the response */
+};
+
+static inline uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint8_t lower(uint8_t c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Messages                                                           */
+/* ------------------------------------------------------------------ */
+
+/* Offset past the (possibly compressed) name at pos, or -1 */
+static int skip_name(const uint8_t *msg, int len, int pos)
+{
+    while (pos < len) {
+        uint8_t b = msg[pos];
+        if (b == 0)
+            return pos + 1;
+        if ((b & 0xC0) == 0xC0)
+            return pos + 2 <= len ? pos + 2 : -1;
+        if (b & 0xC0)
+            return -1;
+        pos += 1 + b;
+    }
+    return -1;
+}
+
+/* Length of the uncompressed question name at pos, or -1 */
+static int question_name_len(const uint8_t *msg, int len, int pos)
+{
+    int start = pos;
+
+    while (pos < len && msg[pos] != 0) {
+        if (msg[pos] & 0xC0)
+            return -1;
+        pos += 1 + msg[pos];
+    }
+    if (pos >= len || pos + 1 - start > DNS_MAX_NAME)
+        return -1;
+    return pos + 1 - start;
+}
+
+/*
+ * Walk the resource records after the question. fn sees each record's
+ * type, the offset of its TTL and its rdata; returns false on a malformed
+ * message.
+ */
+typedef void (*rr_fn)(uint8_t *msg, int section, uint16_t type, int ttl_off,
+                      int rdata_off, int rdlen, void *ctx);
+
+static bool walk_records(uint8_t *msg, int len, int pos, rr_fn fn, void *ctx)
+{
+    int counts[3] = { rd16(msg + 6), rd16(msg + 8), rd16(msg + 10) };
+
+    for (int section = 0; section < 3; section++) {
+        for (int i = 0; i < counts[section]; i++) {
+            pos = skip_name(msg, len, pos);
+            if (pos < 0 || pos + 10 > len)
+                return false;
+            int rdlen = rd16(msg + pos + 8);
+            if (pos + 10 + rdlen > len)
+                return false;
+            fn(msg, section, rd16(msg + pos), pos + 4, pos + 10, rdlen, ctx);
+            pos += 10 + rdlen;
+        }
+    }
+    return true;
+}
+
+int dns_parse_query(const uint8_t *msg, int len,
+                    const dpi_addr_t *server, uint16_t port, dns_query_t *q)
+{
+    if (len < DNS_HEADER_LEN || len > DNS_MAX_MSG)
+        return -1;
+
+    /* QR = 0, opcode QUERY, one question, nothing but an OPT record */
+    if ((msg[2] & 0xF8) != 0 || rd16(msg + 4) != 1 ||
+        rd16(msg + 6) != 0 || rd16(msg + 8) != 0 || rd16(msg + 10) > 1)
+        return -1;
+
+    int name_len = question_name_len(msg, len, DNS_HEADER_LEN);
+    if (name_len < 0 || DNS_HEADER_LEN + name_len + 4 > len)
+        return -1;
+    q->question_len = name_len + 4;
+
+    /* Header bits the answer depends on: RD, CD, EDNS present, DO */
+    uint8_t flags = (msg[2] & 0x01) | (msg[3] & 0x10);
+    int pos = DNS_HEADER_LEN + q->question_len;
+    if (rd16(msg + 10) == 1) {
+        pos = skip_name(msg, len, pos);
+        if (pos < 0 || pos + 10 > len || rd16(msg + pos) != DNS_TYPE_OPT)
+            return -1;
+        flags |= 0x02;
+        if (msg[pos + 6] & 0x80)
+            flags |= 0x04;
+    }
+
+    uint8_t *k = q->key;
+    memcpy(k, server->b, 16);
+    k[16] = (uint8_t)(port >> 8);
+    k[17] = (uint8_t)port;
+    k[18] = flags;
+    for (int i = 0; i < name_len; i++)
+        k[19 + i] = lower(msg[DNS_HEADER_LEN + i]);
+    memcpy(k + 19 + name_len, msg + DNS_HEADER_LEN + name_len, 4);
+    q->key_len = 19 + q->question_len;
+
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < q->key_len; i++)
+        h = (h ^ k[i]) * 16777619u;
+    q->hash = h;
+    return 0;
+}
+
+bool dns_response_matches(const uint8_t *msg, int len,
+                          const uint8_t *question, int question_len)
+{
+    if (len < DNS_HEADER_LEN + question_len || !(msg[2] & 0x80) || rd16(msg + 4) != 1)
+        return false;
+
+    const uint8_t *p = msg + DNS_HEADER_LEN;
+    int name_len = question_len - 4;
+    for (int i = 0; i < name_len; i++) {
+        if (lower(p[i]) != lower(question[i]))
+            return false;
+    }
+    return memcmp(p + name_len, question + name_len, 4) == 0;
+}
+
+typedef struct {
+    uint32_t min_ttl;
+    uint32_t soa_ttl;         /* negative caching time, UINT32_MAX = no SOA */
+} ttl_scan_t;
+
+static void scan_ttl(uint8_t *msg, int section, uint16_t type, int ttl_off,
+                     int rdata_off, int rdlen, void *ctx)
+{
+    ttl_scan_t *s = ctx;
+    if (type == DNS_TYPE_OPT)
+        return;
+
+    uint32_t ttl = rd32(msg + ttl_off);
+    if (ttl > INT32_MAX)
+        ttl = 0;   /* RFC 2181 §8 */
+    if (ttl < s->min_ttl)
+        s->min_ttl = ttl;
+
+    /* RFC 2308: negative answers live for min(SOA TTL, SOA MINIMUM) */
+    if (section == 1 && type == DNS_TYPE_SOA && rdlen >= 20) {
+        uint32_t minimum = rd32(msg + rdata_off + rdlen - 4);
+        s->soa_ttl = ttl < minimum ? ttl : minimum;
+    }
+}
+
+uint32_t dns_response_ttl(const uint8_t *msg, int len)
+{
+    if (len < DNS_HEADER_LEN || len > DNS_MAX_MSG)
+        return 0;
+
+    /* Complete (TC = 0) answers with NOERROR or NXDOMAIN only */
+    int rcode = msg[3] & 0x0F;
+    if (!(msg[2] & 0x80) || (msg[2] & 0x02) || (rcode != 0 && rcode != DNS_RCODE_NXDOMAIN) ||
+        rd16(msg + 4) != 1)
+        return 0;
+
+    int pos = skip_name(msg, len, DNS_HEADER_LEN);
+    if (pos < 0 || pos + 4 > len)
+        return 0;
+
+    ttl_scan_t s = { UINT32_MAX, UINT32_MAX };
+    if (!walk_records((uint8_t *)msg, len, pos + 4, scan_ttl, &s))
+        return 0;
+
+    uint32_t ttl = (rcode == 0 && rd16(msg + 6) > 0) ? s.min_ttl : s.soa_ttl;
+    if (ttl == UINT32_MAX)
+        return 0;
+    return ttl < DNS_CACHE_MAX_TTL ? ttl : DNS_CACHE_MAX_TTL;
+}
+
+static void age_ttl(uint8_t *msg, int section, uint16_t type, int ttl_off,
+                    int rdata_off, int rdlen, void *ctx)
+{
+    (void)section;
+    (void)rdata_off;
+    (void)rdlen;
+
+    uint32_t elapsed = *(const uint32_t *)ctx;
+    if (type == DNS_TYPE_OPT)
+        return;
+
+    uint32_t ttl = rd32(msg + ttl_off);
+    ttl = ttl > elapsed ? ttl - elapsed : 0;
+    msg[ttl_off]     = (uint8_t)(ttl >> 24);
+    msg[ttl_off + 1] = (uint8_t)(ttl >> 16);
+    msg[ttl_off + 2] = (uint8_t)(ttl >> 8);
+    msg[ttl_off + 3] = (uint8_t)ttl;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Cache                                                              */
+/* ------------------------------------------------------------------ */
+
+void dns_cache_init(dns_cache_t *c, int capacity)
+{
+    memset(c, 0, sizeof(*c));
+    c->capacity = capacity;
+}
+
+static void lru_unlink(dns_cache_t *c, dns_entry_t *e)
+{
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        c->newest = e->older;
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        c->oldest = e->newer;
+}
+
+static void lru_push(dns_cache_t *c, dns_entry_t *e)
+{
+    e->newer = NULL;
+    e->older = c->newest;
+    if (c->newest)
+        c->newest->newer = e;
+    else
+        c->oldest = e;
+    c->newest = e;
+}
+
+static dns_entry_t **bucket(dns_cache_t *c, uint32_t hash)
+{
+    return &c->buckets[hash & (DNS_CACHE_BUCKETS - 1)];
+}
+
+static void remove_entry(dns_cache_t *c, dns_entry_t *e)
+{
+    for (dns_entry_t **pp = bucket(c, e->hash); *pp; pp = &(*pp)->chain) {
+        if (*pp == e) {
+            *pp = e->chain;
+            break;
+        }
+    }
+    lru_unlink(c, e);
+    c->count--;
+    free(e);
+}
+
+static dns_entry_t *find(dns_cache_t *c, const dns_query_t *q)
+{
+    for (dns_entry_t *e = *bucket(c, q->hash); e; e = e->chain) {
+        if (e->hash == q->hash && e->key_len == q->key_len &&
+            memcmp(e->data, q->key, q->key_len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+void dns_cache_free(dns_cache_t *c)
+{
+    while (c->oldest)
+        remove_entry(c, c->oldest);
+    memset(c, 0, sizeof(*c));
+}
+
+void dns_cache_put(dns_cache_t *c, const dns_query_t *q,
+                   const uint8_t *msg, int len, uint32_t ttl, int64_t now_ms)
+{
+    if (ttl == 0 || len > DNS_MAX_MSG || c->capacity <= 0)
+        return;
+
+    dns_entry_t *old = find(c, q);
+    if (old)
+        remove_entry(c, old);
+    if (c->count >= c->capacity)
+        remove_entry(c, c->oldest);
+
+    dns_entry_t *e = malloc(sizeof(*e) + q->key_len + len);
+    if (!e)
+        return;
+    e->hash      = q->hash;
+    e->stored_ms = now_ms;
+    e->expire_ms = now_ms + (int64_t)ttl * 1000;
+    e->key_len   = q->key_len;
+    e->msg_len   = len;
+    memcpy(e->data, q->key, q->key_len);
+    memcpy(e->data + q->key_len, msg, len);
+
+    dns_entry_t **b = bucket(c, q->hash);
+    e->chain = *b;
+    *b = e;
+    lru_push(c, e);
+    c->count++;
+}
+
+int dns_cache_answer(dns_cache_t *c, const dns_query_t *q, const uint8_t *query,
+                     uint8_t *out, int cap, int64_t now_ms)
+{
+    dns_entry_t *e = find(c, q);
+    if (!e)
+        return 0;
+    if (now_ms >= e->expire_ms) {
+        remove_entry(c, e);
+        return 0;
+    }
+    if (e->msg_len > cap)
+        return 0;
+
+    lru_unlink(c, e);
+    lru_push(c, e);
+
+    /* The cached answer, in the querier's id and spelling of the name */
+    int len = e->msg_len;
+    memcpy(out, e->data + e->key_len, len);
+    dns_set_id(out, dns_id(query));
+    memcpy(out + DNS_HEADER_LEN, query + DNS_HEADER_LEN, q->question_len);
+
+    uint32_t elapsed = (uint32_t)((now_ms - e->stored_ms) / 1000);
+    if (elapsed > 0)
+        walk_records(out, len, DNS_HEADER_LEN + q->question_len, age_ttl, &elapsed);
+    return len;
+}
@@ -0,0 +1,91 @@
+/*
+ * dns_cache.h — DNS message parsing and answer cache for the UDP relay
+ *
+ * Only plain queries are handled here: one question, standard opcode,
+ * at most an EDNS OPT record besides it. Anything else is relayed as an
+ * ordinary UDP session.
+ *
+ * Answers are keyed by server, question (name compared case-insensitively)
+ * and the header bits that change the answer (RD, CD, EDNS, DO). They are
+ * kept for the smallest TTL in the response, or for negative answers the
+ * SOA's, capped at DNS_CACHE_MAX_TTL, and served with the querier's id
+ * and question and every TTL reduced by the time spent in the cache.
+ * The least recently used entry makes room for a new one.
+ */
+
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dpi_bypass.h"
+
+#define DNS_PORT           53
+#define DNS_HEADER_LEN     12
+#define DNS_MAX_NAME       255
+#define DNS_MAX_QUESTION   (DNS_MAX_NAME + 4)
+#define DNS_MAX_KEY        (16 + 2 + 1 + DNS_MAX_QUESTION)
+#define DNS_MAX_MSG        1232   /* largest query handled and response cached */
+#define DNS_CACHE_MAX_TTL  3600   /* seconds */
+#define DNS_CACHE_BUCKETS  256
+
+/* A parsed query; the question section is msg[DNS_HEADER_LEN .. + question_len) */
+typedef struct {
+    uint8_t  key[DNS_MAX_KEY];   /* server, port, flags, lowercase question */
+    int      key_len;
+    uint32_t hash;
+    int      question_len;
+} dns_query_t;
+
+typedef struct dns_entry dns_entry_t;
+
+typedef struct {
+    dns_entry_t *buckets[DNS_CACHE_BUCKETS];
+    dns_entry_t *newest;      /* LRU list, most recently used first */
+    dns_entry_t *oldest;
+    int count;
+    int capacity;
+} dns_cache_t;
+
+/* Parse a query to server:port; returns 0, or -1 if it is not a plain query */
+int  dns_parse_query(const uint8_t *msg, int len,
+                     const dpi_addr_t *server, uint16_t port, dns_query_t *q);
+
+static inline uint16_t dns_id(const uint8_t *msg)
+{
+    return (uint16_t)(msg[0] << 8 | msg[1]);
+}
+
+static inline void dns_set_id(uint8_t *msg, uint16_t id)
+{
+    msg[0] = (uint8_t)(id >> 8);
+    msg[1] = (uint8_t)id;
+}
+
+/*
+ * Check that msg is a response to question (question_len bytes, as sent):
+ * same name up to case, same type and class.
+ */
+bool dns_response_matches(const uint8_t *msg, int len,
+                          const uint8_t *question, int question_len);
+
+/* Seconds a response may be cached, 0 if it must not be */
+uint32_t dns_response_ttl(const uint8_t *msg, int len);
+
+void dns_cache_init(dns_cache_t *c, int capacity);
+void dns_cache_free(dns_cache_t *c);
+
+/* Store a copy of the response to q for ttl seconds (ignored if too large) */
+void dns_cache_put(dns_cache_t *c, const dns_query_t *q,
+                   const uint8_t *msg, int len, uint32_t ttl, int64_t now_ms);
+
+/*
+ * Answer query (parsed into q) from the cache into out, cap bytes: the
+ * cached response with the query's id and question and its TTLs aged.
+ * Returns the length, or 0 if nothing fresh is cached.
+ */
+int  dns_cache_answer(dns_cache_t *c, const dns_query_t *q, const uint8_t *query,
+                      uint8_t *out, int cap, int64_t now_ms);
+
+#endif /* DNS_CACHE_H */
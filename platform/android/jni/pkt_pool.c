@@ -0,0 +1,67 @@
+/*
+ * pkt_pool.c — reusable packet buffers with header headroom
+ */
+
+#include "pkt_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BUF_ALIGN  64
+
+static uint8_t *buf_alloc(const pkt_pool_t *p)
+{
+    void *buf;
+    if (posix_memalign(&buf, BUF_ALIGN, PKT_HEADROOM + p->payload_size) != 0)
+        return NULL;
+    return buf;
+}
+
+int pkt_pool_init(pkt_pool_t *p, uint32_t payload_size, int capacity, int prealloc)
+{
+    memset(p, 0, sizeof(*p));
+    p->payload_size = payload_size;
+    p->capacity     = capacity;
+
+    p->stack = malloc(capacity * sizeof(*p->stack));
+    if (!p->stack)
+        return -1;
+
+    if (prealloc > capacity)
+        prealloc = capacity;
+    while (p->free_count < prealloc) {
+        uint8_t *buf = buf_alloc(p);
+        if (!buf) {
+            pkt_pool_free(p);
+            return -1;
+        }
+        p->stack[p->free_count++] = buf;
+    }
+    return 0;
+}
+
+void pkt_pool_free(pkt_pool_t *p)
+{
+    for (int i = 0; i < p->free_count; i++)
+        free(p->stack[i]);
+    free(p->stack);
+    memset(p, 0, sizeof(*p));
+}
+
+uint8_t *pkt_pool_get(pkt_pool_t *p)
+{
+    if (p->free_count > 0) {
+        p->hits++;
+        return p->stack[--p->free_count];
+    }
+    p->misses++;
+    return buf_alloc(p);
+}
+
+void pkt_pool_put(pkt_pool_t *p, uint8_t *buf)
+{
+    if (p->free_count < p->capacity)
+        p->stack[p->free_count++] = buf;
+    else
+        free(buf);
+}
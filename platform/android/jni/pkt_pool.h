@@ -0,0 +1,47 @@
+/*
+ * pkt_pool.h — reusable packet buffers with header headroom
+ *
+ * Every buffer keeps PKT_HEADROOM bytes free in front of its payload
+ * area. Server data is received straight into the payload area and the
+ * IP + TCP/UDP header is then written in place in front of it, so the
+ * packet goes to the TUN as one contiguous write with nothing copied.
+ *
+ * Free buffers sit on a LIFO stack (the last one returned, still warm
+ * in cache, is handed out next). A get from an empty pool mallocs a new
+ * buffer and counts a miss; a put onto a full stack frees the buffer.
+ * The hit and miss counters show how large the pool should be.
+ */
+
+#ifndef PKT_POOL_H
+#define PKT_POOL_H
+
+#include <stdint.h>
+
+#define PKT_HEADROOM  128   /* >= DPI_TEMPLATE_MAX_HDR; keeps the payload cache-line aligned */
+
+typedef struct {
+    uint8_t **stack;         /* free buffers, most recently returned on top */
+    int       free_count;
+    int       capacity;      /* buffers kept when returned */
+    uint32_t  payload_size;  /* bytes after the headroom */
+    uint64_t  hits;          /* gets served from the stack */
+    uint64_t  misses;        /* gets that had to malloc */
+} pkt_pool_t;
+
+/*
+ * Keep up to capacity buffers of PKT_HEADROOM + payload_size bytes,
+ * allocating prealloc of them now. Returns 0, or -1 on allocation failure.
+ */
+int  pkt_pool_init(pkt_pool_t *p, uint32_t payload_size, int capacity, int prealloc);
+void pkt_pool_free(pkt_pool_t *p);
+
+/* A buffer (NULL when out of memory); its payload starts at pkt_payload() */
+uint8_t *pkt_pool_get(pkt_pool_t *p);
+void     pkt_pool_put(pkt_pool_t *p, uint8_t *buf);
+
+static inline uint8_t *pkt_payload(uint8_t *buf)
+{
+    return buf + PKT_HEADROOM;
+}
+
+#endif /* PKT_POOL_H */
@@ -0,0 +1,125 @@
+/*
+ * session_pool.c — chunked session storage for the Android relays
+ */
+
+#include "session_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_MASK  (SESSION_POOL_CHUNK - 1)
+
+int session_pool_init(session_pool_t *p, size_t obj_size, int capacity)
+{
+    memset(p, 0, sizeof(*p));
+
+    if (capacity < 1)
+        capacity = 1;
+    p->max_chunks = (capacity + CHUNK_MASK) >> SESSION_POOL_CHUNK_BITS;
+    p->capacity   = p->max_chunks << SESSION_POOL_CHUNK_BITS;
+    p->obj_size   = obj_size;
+
+    p->chunks = calloc(p->max_chunks, sizeof(*p->chunks));
+    return p->chunks ? 0 : -1;
+}
+
+void session_pool_free(session_pool_t *p)
+{
+    for (int c = 0; c < p->chunk_count; c++)
+        free(p->chunks[c].mem);
+    free(p->chunks);
+    memset(p, 0, sizeof(*p));
+}
+
+int session_pool_alloc(session_pool_t *p)
+{
+    for (int c = p->hint; c < p->max_chunks; c++) {
+        session_chunk_t *chunk = &p->chunks[c];
+
+        if (!chunk->mem) {
+            chunk->mem = malloc(SESSION_POOL_CHUNK * p->obj_size);
+            if (!chunk->mem)
+                return -1;
+            chunk->used = 0;
+            chunk->retired = 0;
+            p->allocated++;
+            p->empty_chunks++;
+            if (c >= p->chunk_count)
+                p->chunk_count = c + 1;
+        }
+        uint64_t taken = chunk->used | chunk->retired;
+        if (taken == UINT64_MAX)
+            continue;
+
+        if (taken == 0)
+            p->empty_chunks--;
+        int bit = __builtin_ctzll(~taken);
+        chunk->used |= 1ull << bit;
+        p->hint = c;
+
+        if (++p->count > p->peak)
+            p->peak = p->count;
+        return (c << SESSION_POOL_CHUNK_BITS) | bit;
+    }
+    return -1;
+}
+
+void session_pool_release(session_pool_t *p, int index)
+{
+    int c = index >> SESSION_POOL_CHUNK_BITS;
+    session_chunk_t *chunk = &p->chunks[c];
+    uint64_t bit = 1ull << (index & CHUNK_MASK);
+
+    if (!(chunk->used & bit))
+        return;
+    chunk->used &= ~bit;
+    chunk->retired |= bit;
+    p->count--;
+    p->retired++;
+}
+
+int session_pool_next(const session_pool_t *p, int index)
+{
+    int c = index >> SESSION_POOL_CHUNK_BITS;
+    uint64_t bits = c < p->chunk_count
+                  ? p->chunks[c].used & (UINT64_MAX << (index & CHUNK_MASK)) : 0;
+
+    while (!bits) {
+        if (++c >= p->chunk_count)
+            return -1;
+        bits = p->chunks[c].used;
+    }
+    return (c << SESSION_POOL_CHUNK_BITS) | __builtin_ctzll(bits);
+}
+
+void session_pool_trim(session_pool_t *p)
+{
+    /* The event batch is over: indexes released during it are free again */
+    for (int c = 0; p->retired > 0 && c < p->chunk_count; c++) {
+        session_chunk_t *chunk = &p->chunks[c];
+        if (!chunk->retired)
+            continue;
+        p->retired -= __builtin_popcountll(chunk->retired);
+        chunk->retired = 0;
+        if (chunk->used == 0)
+            p->empty_chunks++;
+        if (c < p->hint)
+            p->hint = c;
+    }
+
+    if (p->empty_chunks <= SESSION_POOL_SPARE)
+        return;
+
+    /* Highest first: allocation refills from the bottom */
+    for (int c = p->chunk_count - 1; c >= 0 && p->empty_chunks > SESSION_POOL_SPARE; c--) {
+        session_chunk_t *chunk = &p->chunks[c];
+        if (!chunk->mem || chunk->used)
+            continue;
+        free(chunk->mem);
+        chunk->mem = NULL;
+        p->allocated--;
+        p->empty_chunks--;
+    }
+    while (p->chunk_count > 0 && !p->chunks[p->chunk_count - 1].mem)
+        p->chunk_count--;
+}
@@ -0,0 +1,73 @@
+/*
+ * session_pool.h — chunked session storage for the Android relays
+ *
+ * Sessions live in chunks of SESSION_POOL_CHUNK, malloc'd on demand up
+ * to the relay's limit, so an idle relay holds one chunk instead of its
+ * whole session array. New sessions take the lowest free index, which
+ * keeps the live ones packed into the first chunks; chunks left empty
+ * are returned by session_pool_trim, keeping one spare against churn.
+ *
+ * Sessions never move (epoll events carry their address). A released
+ * session stays readable, and its index is not handed out again, until
+ * the next trim: a later event of the same epoll batch for the closed
+ * socket then finds the session inactive rather than a new session in
+ * its slot. The relays trim only between event batches.
+ */
+
+#ifndef SESSION_POOL_H
+#define SESSION_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SESSION_POOL_CHUNK_BITS  6
+#define SESSION_POOL_CHUNK       (1 << SESSION_POOL_CHUNK_BITS) /* sessions per chunk */
+#define SESSION_POOL_SPARE       1   /* empty chunks kept by trim */
+
+typedef struct {
+    uint8_t  *mem;        /* SESSION_POOL_CHUNK sessions, NULL = not allocated */
+    uint64_t  used;       /* bit per live session */
+    uint64_t  retired;    /* released since the last trim, not yet reusable */
+} session_chunk_t;
+
+typedef struct {
+    session_chunk_t *chunks;
+    int      max_chunks;
+    int      chunk_count;    /* highest chunk ever allocated + 1 */
+    size_t   obj_size;
+    int      capacity;       /* session limit, a multiple of SESSION_POOL_CHUNK */
+    int      count;          /* live sessions */
+    int      peak;           /* most live sessions at once */
+    int      hint;           /* every chunk below this is full */
+    int      empty_chunks;   /* allocated chunks without a live session */
+    int      allocated;      /* chunks currently allocated */
+    int      retired;        /* released sessions awaiting the next trim */
+} session_pool_t;
+
+/* Room for capacity sessions of obj_size bytes; returns 0, or -1 on allocation failure */
+int  session_pool_init(session_pool_t *p, size_t obj_size, int capacity);
+void session_pool_free(session_pool_t *p);
+
+/*
+ * Take the lowest free index (-1 at the limit or when a new chunk cannot
+ * be allocated). The session's previous contents are left as they were.
+ */
+int  session_pool_alloc(session_pool_t *p);
+void session_pool_release(session_pool_t *p, int index);
+
+static inline void *session_pool_get(const session_pool_t *p, int index)
+{
+    const session_chunk_t *c = &p->chunks[index >> SESSION_POOL_CHUNK_BITS];
+    return c->mem + (size_t)(index & (SESSION_POOL_CHUNK - 1)) * p->obj_size;
+}
+
+/* First live index >= index, or -1: for (i = next(p, 0); i >= 0; i = next(p, i + 1)) */
+int  session_pool_next(const session_pool_t *p, int index);
+
+/*
+ * Make released indexes reusable, then free empty chunks beyond
+ * SESSION_POOL_SPARE; never while events are being handled.
+ */
+void session_pool_trim(session_pool_t *p);
+
+#endif /* SESSION_POOL_H */
@@ -0,0 +1,162 @@
+/*
+ * session_table.c — O(1) session lookup for the Android relays
+ */
+
+#include "session_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint32_t hash_mix(uint32_t h, uint32_t w)
+{
+    w *= 0xcc9e2d51u;
+    w = (w << 15) | (w >> 17);
+    w *= 0x1b873593u;
+    h ^= w;
+    h = (h << 13) | (h >> 19);
+    return h * 5 + 0xe6546b64u;
+}
+
+uint32_t session_key_hash(const session_key_t *key)
+{
+    uint32_t h = 0;
+    uint32_t w;
+
+    for (int i = 0; i < 16; i += 4) {
+        memcpy(&w, key->dst_addr.b + i, 4);
+        h = hash_mix(h, w);
+    }
+    h = hash_mix(h, ((uint32_t)key->src_port << 16) | key->dst_port);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline int key_equal(const session_key_t *a, const session_key_t *b)
+{
+    return a->src_port == b->src_port && a->dst_port == b->dst_port &&
+           dpi_addr_equal(&a->dst_addr, &b->dst_addr);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Setup                                                              */
+/* ------------------------------------------------------------------ */
+
+static int alloc_slots(session_table_t *t, uint32_t slots)
+{
+    t->slots = malloc(slots * sizeof(*t->slots));
+    if (!t->slots)
+        return -1;
+    t->mask = slots - 1;
+    for (uint32_t i = 0; i < slots; i++)
+        t->slots[i].index = -1;
+    return 0;
+}
+
+static void place(session_table_t *t, const session_slot_t *entry)
+{
+    uint32_t i = entry->hash & t->mask;
+
+    while (t->slots[i].index >= 0)
+        i = (i + 1) & t->mask;
+    t->slots[i] = *entry;
+}
+
+/* Double the slot count, rehashing from the stored hashes */
+static int grow(session_table_t *t)
+{
+    session_slot_t *old = t->slots;
+    uint32_t old_slots = t->mask + 1;
+
+    if (alloc_slots(t, old_slots * 2) < 0) {
+        t->slots = old;
+        t->mask  = old_slots - 1;
+        return -1;
+    }
+    for (uint32_t i = 0; i < old_slots; i++) {
+        if (old[i].index >= 0)
+            place(t, &old[i]);
+    }
+    free(old);
+    return 0;
+}
+
+int session_table_init(session_table_t *t, int capacity)
+{
+    memset(t, 0, sizeof(*t));
+
+    uint32_t slots = 16;
+    while (slots < (uint32_t)capacity * 2)
+        slots <<= 1;
+    return alloc_slots(t, slots);
+}
+
+void session_table_free(session_table_t *t)
+{
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+/* ------------------------------------------------------------------ */
+/*  Key index                                                          */
+/* ------------------------------------------------------------------ */
+
+int session_table_insert(session_table_t *t, const session_key_t *key, int index)
+{
+    /* Keep at most half full; past that, a failed grow still works until one slot is left */
+    if ((t->count + 1) * 2 > t->mask + 1 && grow(t) < 0 && t->count + 1 > t->mask)
+        return -1;
+
+    session_slot_t entry = { .key = *key, .hash = session_key_hash(key), .index = index };
+    place(t, &entry);
+    t->count++;
+    return 0;
+}
+
+static int find_slot(const session_table_t *t, const session_key_t *key)
+{
+    uint32_t h = session_key_hash(key);
+
+    for (uint32_t i = h & t->mask; t->slots[i].index >= 0; i = (i + 1) & t->mask) {
+        if (t->slots[i].hash == h && key_equal(&t->slots[i].key, key))
+            return (int)i;
+    }
+    return -1;
+}
+
+int session_table_find(const session_table_t *t, const session_key_t *key)
+{
+    int slot = find_slot(t, key);
+    return slot < 0 ? -1 : t->slots[slot].index;
+}
+
+void session_table_remove(session_table_t *t, const session_key_t *key)
+{
+    int found = find_slot(t, key);
+    if (found < 0)
+        return;
+
+    /*
+     * Backward-shift deletion: pull later entries of the probe run into
+     * the hole unless that would move them before their home slot, so
+     * lookups never need tombstones.
+     */
+    uint32_t hole = (uint32_t)found;
+    uint32_t j = hole;
+    for (;;) {
+        j = (j + 1) & t->mask;
+        if (t->slots[j].index < 0)
+            break;
+        uint32_t home = t->slots[j].hash & t->mask;
+        if (((j - home) & t->mask) >= ((j - hole) & t->mask)) {
+            t->slots[hole] = t->slots[j];
+            hole = j;
+        }
+    }
+    t->slots[hole].index = -1;
+    t->count--;
+}
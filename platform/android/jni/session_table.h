@@ -0,0 +1,65 @@
+/*
+ * session_table.h — O(1) session lookup for the Android relays
+ *
+ * Indexes a relay's sessions (session_pool.h) by flow key (src_port,
+ * dst_addr, dst_port) in an open-addressing hash table with linear
+ * probing, kept at most half full by doubling as sessions are added.
+ * Sockets need no index: their epoll events carry the session pointer.
+ */
+
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include <stdint.h>
+
+#include "dpi_bypass.h"
+
+/*
+ * First member of everything registered in the VPN thread's epoll set,
+ * so epoll_event.data.ptr can be dispatched without a lookup.
+ */
+typedef enum {
+    SESSION_KIND_TUN = 1,
+    SESSION_KIND_TCP,
+    SESSION_KIND_UDP,
+    SESSION_KIND_DNS     /* a UDP relay's shared upstream DNS socket */
+} session_kind_t;
+
+typedef struct {
+    dpi_addr_t dst_addr;  /* destination IP (IPv4-mapped for IPv4) */
+    uint16_t   src_port;  /* app-side source port */
+    uint16_t   dst_port;
+} session_key_t;
+
+typedef struct {
+    session_key_t key;
+    uint32_t      hash;
+    int32_t       index;  /* session index, -1 = empty */
+} session_slot_t;
+
+typedef struct {
+    session_slot_t *slots;
+    uint32_t        mask;         /* slot count - 1 */
+    uint32_t        count;        /* keys indexed */
+} session_table_t;
+
+/*
+ * 32-bit hash of a flow key. The table indexes by the low bits; the VPN
+ * thread picks a flow's shard from the high bits, so the two stay
+ * independent.
+ */
+uint32_t session_key_hash(const session_key_t *key);
+
+/* Sized for capacity keys to start with. Returns 0, or -1 on allocation failure */
+int  session_table_init(session_table_t *t, int capacity);
+void session_table_free(session_table_t *t);
+
+/*
+ * Key index. insert expects the key to be absent; it returns -1 only
+ * when the table is full and cannot grow.
+ */
+int  session_table_insert(session_table_t *t, const session_key_t *key, int index);
+int  session_table_find(const session_table_t *t, const session_key_t *key);
+void session_table_remove(session_table_t *t, const session_key_t *key);
+
+#endif /* SESSION_TABLE_H */
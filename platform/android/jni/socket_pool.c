@@ -0,0 +1,268 @@
+/*
+ * socket_pool.c — protected sockets made ahead of the sessions that need them
+ */
+
+#include "socket_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <android/log.h>
+
+#define TAG "socket-pool"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+
+static const char *const kind_names[SOCKET_KINDS] = { "TCP4", "TCP6", "UDP4", "UDP6" };
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void wake(int fd)
+{
+    uint64_t one = 1;
+    write(fd, &one, sizeof(one));
+}
+
+int socket_pool_create(JNIEnv *env, jobject vpn_service, jmethodID protect_method,
+                       socket_kind_t kind)
+{
+    bool tcp = kind == SOCKET_TCP4 || kind == SOCKET_TCP6;
+    int family = kind == SOCKET_TCP4 || kind == SOCKET_UDP4 ? AF_INET : AF_INET6;
+
+    int fd = socket(family, tcp ? SOCK_STREAM | SOCK_NONBLOCK : SOCK_DGRAM, 0);
+    if (fd < 0) {
+        LOGE("socket(%s): %s", kind_names[kind], strerror(errno));
+        return -1;
+    }
+
+    /* Protect from VPN routing (bypass the tunnel) */
+    jboolean ok = (*env)->CallBooleanMethod(env, vpn_service, protect_method, fd);
+    if (!ok) {
+        LOGE("VpnService.protect() failed for %s fd=%d", kind_names[kind], fd);
+        close(fd);
+        return -1;
+    }
+
+    if (tcp) {
+        /* Disable Nagle for low-latency relay */
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Shard side                                                         */
+/* ------------------------------------------------------------------ */
+
+int socket_pool_take(socket_pool_shard_t *s, socket_kind_t kind)
+{
+    spsc_ring_t *ring = &s->ready[kind];
+    uint32_t n = spsc_ring_available(ring);
+
+    if (n == 0) {
+        s->misses[kind]++;
+        atomic_store_explicit(&s->wanted[kind], true, memory_order_relaxed);
+        wake(s->wake_fd);
+        return -1;
+    }
+
+    uint32_t len;
+    int fd;
+    memcpy(&fd, spsc_ring_slot(ring, 0, &len), sizeof(fd));
+    spsc_ring_release(ring, 1);
+
+    s->hits[kind]++;
+    if (n - 1 < s->low[kind])
+        s->low[kind] = n - 1;
+    if (n - 1 == s->half)
+        wake(s->wake_fd);   /* once per trip down; the ring still has half left */
+    return fd;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Pool thread                                                        */
+/* ------------------------------------------------------------------ */
+
+/* Top up every wanted ring; a kind that fails to open waits for the next round */
+static void refill(socket_pool_t *p, JNIEnv *env)
+{
+    uint64_t start = monotonic_ns();
+    uint64_t made = 0;
+
+    for (int i = 0; i < p->shard_count; i++) {
+        socket_pool_shard_t *s = &p->shards[i];
+
+        for (int kind = 0; kind < SOCKET_KINDS; kind++) {
+            if (!atomic_load_explicit(&s->wanted[kind], memory_order_relaxed))
+                continue;
+
+            uint8_t *slot;
+            while (!atomic_load_explicit(&p->stop, memory_order_relaxed) &&
+                   (slot = spsc_ring_reserve(&s->ready[kind])) != NULL) {
+                uint64_t t0 = monotonic_ns();
+                int fd = socket_pool_create(env, p->vpn_service, p->protect_method,
+                                            (socket_kind_t)kind);
+                if (fd < 0)
+                    break;
+                p->create_ns += monotonic_ns() - t0;
+                p->created++;
+                made++;
+
+                memcpy(slot, &fd, sizeof(fd));
+                spsc_ring_commit(&s->ready[kind], sizeof(fd));
+            }
+        }
+    }
+
+    if (made) {
+        uint64_t ns = monotonic_ns() - start;
+        p->rounds++;
+        p->round_ns += ns;
+        if (ns > p->round_max_ns)
+            p->round_max_ns = ns;
+    }
+}
+
+static void *pool_thread_func(void *arg)
+{
+    socket_pool_t *p = arg;
+
+    /* JNIEnv is per thread: protect() must go through this one */
+    JNIEnv *env;
+    if ((*p->jvm)->AttachCurrentThread(p->jvm, &env, NULL) != 0) {
+        LOGE("Failed to attach socket pool thread to JVM");
+        return NULL;
+    }
+
+    while (!atomic_load(&p->stop)) {
+        refill(p, env);
+
+        struct pollfd pfd = { .fd = p->wake_fd, .events = POLLIN };
+        if (poll(&pfd, 1, SOCKET_POOL_IDLE_MS) > 0) {
+            uint64_t count;
+            read(p->wake_fd, &count, sizeof(count));
+        }
+    }
+
+    (*p->jvm)->DetachCurrentThread(p->jvm);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Lifetime                                                           */
+/* ------------------------------------------------------------------ */
+
+int socket_pool_init(socket_pool_t *p, int shards, JNIEnv *env, jobject vpn_service)
+{
+    memset(p, 0, sizeof(*p));
+    p->wake_fd     = -1;
+    p->vpn_service = vpn_service;
+    if ((*env)->GetJavaVM(env, &p->jvm) != 0)
+        return -1;
+
+    jclass cls = (*env)->GetObjectClass(env, vpn_service);
+    p->protect_method = (*env)->GetMethodID(env, cls, "protect", "(I)Z");
+
+    p->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    p->shards  = calloc(shards, sizeof(*p->shards));
+    if (p->wake_fd < 0 || !p->shards) {
+        LOGE("Cannot set up the socket pool");
+        socket_pool_destroy(p);
+        return -1;
+    }
+    p->shard_count = shards;
+
+    for (int i = 0; i < shards; i++) {
+        socket_pool_shard_t *s = &p->shards[i];
+        s->wake_fd = p->wake_fd;
+        s->half    = SOCKET_POOL_DEPTH / 2;
+        for (int kind = 0; kind < SOCKET_KINDS; kind++) {
+            if (spsc_ring_init(&s->ready[kind], SOCKET_POOL_DEPTH, sizeof(int)) < 0) {
+                LOGE("Cannot allocate socket pool rings");
+                socket_pool_destroy(p);
+                return -1;
+            }
+            s->low[kind] = SOCKET_POOL_DEPTH;
+        }
+        /* IPv6 only once a shard meets an IPv6 destination */
+        atomic_init(&s->wanted[SOCKET_TCP4], true);
+        atomic_init(&s->wanted[SOCKET_UDP4], true);
+    }
+
+    if (pthread_create(&p->thread, NULL, pool_thread_func, p) != 0) {
+        LOGE("pthread_create(socket pool) failed");
+        socket_pool_destroy(p);
+        return -1;
+    }
+    p->started = true;
+    return 0;
+}
+
+void socket_pool_destroy(socket_pool_t *p)
+{
+    if (p->started) {
+        atomic_store(&p->stop, true);
+        wake(p->wake_fd);
+        pthread_join(p->thread, NULL);
+    }
+
+    for (int kind = 0; kind < SOCKET_KINDS; kind++) {
+        uint64_t hits = 0, misses = 0;
+        uint32_t low = SOCKET_POOL_DEPTH;
+
+        for (int i = 0; i < p->shard_count; i++) {
+            socket_pool_shard_t *s = &p->shards[i];
+            spsc_ring_t *ring = &s->ready[kind];
+
+            /* Made but never taken */
+            uint32_t n = spsc_ring_available(ring);
+            for (uint32_t j = 0; j < n; j++) {
+                uint32_t len;
+                int fd;
+                memcpy(&fd, spsc_ring_slot(ring, j, &len), sizeof(fd));
+                close(fd);
+            }
+            spsc_ring_release(ring, n);
+
+            hits   += s->hits[kind];
+            misses += s->misses[kind];
+            if (s->low[kind] < low)
+                low = s->low[kind];
+        }
+        if (hits || misses)
+            LOGD("Socket pool %s: %llu taken ready, %llu made inline, lowest depth %u of %d",
+                 kind_names[kind], (unsigned long long)hits, (unsigned long long)misses,
+                 low, SOCKET_POOL_DEPTH);
+    }
+    if (p->created)
+        LOGD("Socket pool: %llu sockets made, %llu us each; refills %llu us avg, "
+             "%llu us max over %llu rounds",
+             (unsigned long long)p->created,
+             (unsigned long long)(p->create_ns / p->created / 1000),
+             (unsigned long long)(p->rounds ? p->round_ns / p->rounds / 1000 : 0),
+             (unsigned long long)(p->round_max_ns / 1000),
+             (unsigned long long)p->rounds);
+
+    for (int i = 0; i < p->shard_count; i++) {
+        for (int kind = 0; kind < SOCKET_KINDS; kind++)
+            spsc_ring_free(&p->shards[i].ready[kind]);
+    }
+    free(p->shards);
+    if (p->wake_fd >= 0)
+        close(p->wake_fd);
+    memset(p, 0, sizeof(*p));
+    p->wake_fd = -1;
+}
@@ -0,0 +1,96 @@
+/*
+ * socket_pool.h — protected sockets made ahead of the sessions that need them
+ *
+ * Opening a relay session costs socket(), a JNI round-trip into
+ * VpnService.protect() and connect(). DNS and QUIC open many short
+ * sessions, so a background thread keeps a few sockets of each kind
+ * (TCP/UDP × IPv4/IPv6) created, protected and configured for every
+ * shard, and a new session only pops one and connects it.
+ *
+ * Each shard has an SPSC ring of fds per kind: the pool thread is the
+ * only producer and the shard the only consumer, so the packet path
+ * stays lock-free. A take that leaves a ring half empty wakes the pool
+ * thread; a take from an empty ring is a miss and the relay creates the
+ * socket inline. IPv6 rings are only stocked once a shard has asked.
+ */
+
+#ifndef SOCKET_POOL_H
+#define SOCKET_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <jni.h>
+
+#include "spsc_ring.h"
+
+#define SOCKET_POOL_DEPTH    8     /* ready sockets per kind per shard */
+#define SOCKET_POOL_IDLE_MS  1000  /* pool thread recheck without a wakeup */
+
+typedef enum {
+    SOCKET_TCP4,
+    SOCKET_TCP6,
+    SOCKET_UDP4,
+    SOCKET_UDP6,
+    SOCKET_KINDS
+} socket_kind_t;
+
+/* One shard's sockets; everything but the rings' producer side is the shard's */
+typedef struct {
+    spsc_ring_t ready[SOCKET_KINDS];   /* protected fds, pool thread → shard */
+    atomic_bool wanted[SOCKET_KINDS];  /* stock this kind */
+    int      wake_fd;                  /* the pool thread's eventfd */
+    uint32_t half;                     /* depth at which a take wakes the pool thread */
+    uint32_t low[SOCKET_KINDS];        /* lowest depth left by a take */
+    uint64_t hits[SOCKET_KINDS];       /* takes served from the ring */
+    uint64_t misses[SOCKET_KINDS];     /* takes that found it empty */
+} socket_pool_shard_t;
+
+typedef struct {
+    socket_pool_shard_t *shards;
+    int        shard_count;
+    int        wake_fd;
+    pthread_t  thread;
+    bool       started;
+    atomic_bool stop;
+
+    JavaVM    *jvm;
+    jobject    vpn_service;
+    jmethodID  protect_method;
+
+    /* Pool thread statistics, logged on destroy */
+    uint64_t   created;       /* sockets made ready */
+    uint64_t   create_ns;     /* total socket() + protect() time */
+    uint64_t   rounds;        /* refills that made at least one socket */
+    uint64_t   round_ns;      /* total wakeup-to-full time of those */
+    uint64_t   round_max_ns;
+} socket_pool_t;
+
+static inline socket_kind_t socket_pool_kind(bool tcp, bool ipv4)
+{
+    return tcp ? (ipv4 ? SOCKET_TCP4 : SOCKET_TCP6) : (ipv4 ? SOCKET_UDP4 : SOCKET_UDP6);
+}
+
+/*
+ * Set up rings for shards shards and start the pool thread, which
+ * attaches to env's JavaVM and protects through vpn_service (borrowed;
+ * it must outlive the pool). Returns 0, or -1 on failure.
+ */
+int  socket_pool_init(socket_pool_t *p, int shards, JNIEnv *env, jobject vpn_service);
+
+/* Stop the pool thread and close the sockets nobody took; after the shards stop */
+void socket_pool_destroy(socket_pool_t *p);
+
+/* A ready socket of kind (not yet connected), or -1 when none is left */
+int  socket_pool_take(socket_pool_shard_t *s, socket_kind_t kind);
+
+/*
+ * Create a socket of kind and protect it from the VPN: non-blocking with
+ * TCP_NODELAY for TCP, blocking for UDP. Returns the fd or -1. This is
+ * what the pool thread stocks, and what the relays fall back to.
+ */
+int  socket_pool_create(JNIEnv *env, jobject vpn_service, jmethodID protect_method,
+                        socket_kind_t kind);
+
+#endif /* SOCKET_POOL_H */
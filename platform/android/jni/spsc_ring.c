@@ -0,0 +1,37 @@
+/*
+ * spsc_ring.c — lock-free single-producer/single-consumer packet ring
+ */
+
+#include "spsc_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int spsc_ring_init(spsc_ring_t *r, uint32_t count, uint32_t slot_size)
+{
+    memset(r, 0, sizeof(*r));
+
+    uint32_t slots = 2;
+    while (slots < count)
+        slots <<= 1;
+
+    r->lens = malloc(slots * sizeof(*r->lens));
+    r->data = malloc((size_t)slots * slot_size);
+    if (!r->lens || !r->data) {
+        spsc_ring_free(r);
+        return -1;
+    }
+
+    r->mask      = slots - 1;
+    r->slot_size = slot_size;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    return 0;
+}
+
+void spsc_ring_free(spsc_ring_t *r)
+{
+    free(r->lens);
+    free(r->data);
+    memset(r, 0, sizeof(*r));
+}
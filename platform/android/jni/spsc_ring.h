@@ -0,0 +1,101 @@
+/*
+ * spsc_ring.h — lock-free single-producer/single-consumer packet ring
+ *
+ * Carries whole packets between the TUN thread and the relay shards.
+ * The ring is a power-of-two array of fixed-size slots; the producer
+ * fills a slot in place (reserve, then commit) and the consumer reads
+ * slots in place and releases them in bulk, so no packet is copied
+ * twice. Indices run free and are masked on use.
+ *
+ * The producer and consumer indices sit on their own cache lines, and
+ * each side keeps a cached copy of the other's index so the shared line
+ * is only touched when the cached view says full/empty.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define SPSC_CACHE_LINE 64
+
+typedef struct {
+    /* Producer side */
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t tail;
+    uint32_t head_cache;        /* last head seen by the producer */
+
+    /* Consumer side */
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t head;
+    uint32_t tail_cache;        /* last tail seen by the consumer */
+
+    /* Read-only after init */
+    _Alignas(SPSC_CACHE_LINE) uint32_t mask;   /* slot count - 1 */
+    uint32_t  slot_size;
+    uint32_t *lens;
+    uint8_t  *data;
+} spsc_ring_t;
+
+/*
+ * Allocate count slots of slot_size bytes each; count is rounded up to a
+ * power of two. Returns 0, or -1 on allocation failure.
+ */
+int  spsc_ring_init(spsc_ring_t *r, uint32_t count, uint32_t slot_size);
+void spsc_ring_free(spsc_ring_t *r);
+
+/* ---- Producer ---- */
+
+/* Next free slot (slot_size bytes), or NULL while the ring is full */
+static inline uint8_t *spsc_ring_reserve(spsc_ring_t *r)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (tail - r->head_cache > r->mask) {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail - r->head_cache > r->mask)
+            return NULL;
+    }
+    return r->data + (size_t)(tail & r->mask) * r->slot_size;
+}
+
+/* Publish the slot returned by the last reserve, holding len bytes */
+static inline void spsc_ring_commit(spsc_ring_t *r, uint32_t len)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    r->lens[tail & r->mask] = len;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/* ---- Consumer ---- */
+
+/* Number of committed slots ready to read */
+static inline uint32_t spsc_ring_available(spsc_ring_t *r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if (r->tail_cache == head)
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    return r->tail_cache - head;
+}
+
+/* i-th ready slot (i < spsc_ring_available) and its length */
+static inline const uint8_t *spsc_ring_slot(const spsc_ring_t *r, uint32_t i,
+                                            uint32_t *len)
+{
+    uint32_t idx = (atomic_load_explicit(&r->head, memory_order_relaxed) + i) & r->mask;
+
+    *len = r->lens[idx];
+    return r->data + (size_t)idx * r->slot_size;
+}
+
+/* Hand the first n ready slots back to the producer */
+static inline void spsc_ring_release(spsc_ring_t *r, uint32_t n)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+}
+
+#endif /* SPSC_RING_H */
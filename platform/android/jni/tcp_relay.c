@@ -3,7 +3,6 @@
  */
 
 #include "tcp_relay.h"
-#include "dpi_bypass.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +11,8 @@
 #include <time.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <android/log.h>
@@ -20,9 +21,6 @@
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
 
-#define MAX_PKT_SIZE 65536
-#define TUN_ADDR     0x0A780001  /* 10.120.0.1 */
-
 static int64_t monotonic_seconds(void)
 {
     struct timespec ts;
@@ -30,47 +28,107 @@ static int64_t monotonic_seconds(void)
     return (int64_t)ts.tv_sec;
 }
 
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t monotonic_ms(void)
+{
+    return monotonic_ns() / 1000000;
+}
+
 static tcp_session_t *find_session(tcp_relay_t *relay,
-                                   uint16_t src_port, uint32_t dst_addr, uint16_t dst_port)
-{
-    for (int i = 0; i < relay->session_count; i++) {
-        tcp_session_t *s = &relay->sessions[i];
-        if (s->active &&
-            s->src_port == src_port &&
-            s->dst_addr == dst_addr &&
-            s->dst_port == dst_port) {
-            return s;
-        }
-    }
-    return NULL;
+                                   uint16_t src_port, const dpi_addr_t *dst_addr,
+                                   uint16_t dst_port)
+{
+    session_key_t key = { .dst_addr = *dst_addr, .src_port = src_port, .dst_port = dst_port };
+    int index = session_table_find(&relay->table, &key);
+    return index < 0 ? NULL : session_pool_get(&relay->pool, index);
 }
 
-static tcp_session_t *find_session_by_fd(tcp_relay_t *relay, int fd)
+/* Sequence space comparison, modulo 2^32 (RFC 9293 §3.4) */
+static inline bool seq_after(uint32_t a, uint32_t b)
 {
-    for (int i = 0; i < relay->session_count; i++) {
-        if (relay->sessions[i].active && relay->sessions[i].fd == fd)
-            return &relay->sessions[i];
-    }
-    return NULL;
+    return (int32_t)(a - b) > 0;
 }
 
-/* Send a TCP packet to the TUN (towards the app) */
-static void send_to_tun(tcp_relay_t *relay, tcp_session_t *session,
-                         uint8_t flags, const uint8_t *payload, int payload_len)
-{
-    uint8_t pkt[MAX_PKT_SIZE];
-    int pkt_len = dpi_build_ipv4_tcp(pkt, sizeof(pkt),
-                                      session->dst_addr,
-                                      relay->tun_addr,
-                                      session->dst_port,
-                                      session->src_port,
-                                      session->tun_seq,
-                                      session->tun_ack,
-                                      flags,
-                                      32768,  /* window */
-                                      payload, payload_len);
+static inline uint32_t min_u32(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+/*
+ * New server data we may send: what the app's window and our congestion
+ * window admit beyond the bytes in flight, within the retransmission
+ * ring. Nothing before the app has acked our SYN.
+ */
+static uint32_t send_budget(const tcp_session_t *session)
+{
+    if (seq_after(session->unacked_seq, session->snd_una))
+        return 0;
+
+    uint32_t in_flight = session->tun_seq - session->snd_una;
+    uint32_t wnd = min_u32(session->app_window, session->cwnd);
+    if (wnd <= in_flight)
+        return 0;
+    return min_u32(wnd - in_flight, TCP_UNACKED_SIZE - session->unacked_len);
+}
+
+/* App data we have acknowledged but the server socket has not taken yet */
+static uint32_t rcv_buffered(const tcp_session_t *session)
+{
+    return session->sndq_len + (uint32_t)session->early_len + (uint32_t)session->hello_len;
+}
+
+/* Receive window in bytes: what is left of TCP_RCV_WINDOW */
+static uint32_t rcv_window(const tcp_session_t *session)
+{
+    uint32_t used = rcv_buffered(session);
+    return used >= TCP_RCV_WINDOW ? 0 : TCP_RCV_WINDOW - used;
+}
+
+/* Window field towards the app; the one in a SYN is never scaled (RFC 7323 §2.2) */
+static uint16_t tun_window(tcp_session_t *session, uint8_t flags)
+{
+    uint32_t wnd = rcv_window(session);
+    session->rcv_wnd_adv = wnd;
+
+    if ((flags & DPI_TCP_SYN) || session->app_wscale < 0)
+        return wnd > 0xFFFF ? 0xFFFF : (uint16_t)wnd;
+    session->rcv_wnd_adv = wnd & ~((1u << TCP_RCV_WSCALE) - 1);
+    return (uint16_t)(wnd >> TCP_RCV_WSCALE);
+}
+
+/* Write one segment to the TUN with an explicit sequence number */
+static void emit_segment(tcp_relay_t *relay, tcp_session_t *session,
+                         uint32_t seq, uint8_t flags,
+                         const uint8_t *opts, int opts_len,
+                         const uint8_t *payload, int payload_len)
+{
+    /* Header only; the payload is gathered from the caller's buffer */
+    uint8_t hdr[DPI_TEMPLATE_MAX_HDR];
+    struct iovec iov[2];
+    int pkt_len = dpi_template_iov_tcp_opts(&session->tun_hdr, hdr,
+                                            seq,
+                                            session->tun_ack,
+                                            flags,
+                                            tun_window(session, flags),
+                                            opts, opts_len,
+                                            payload, payload_len, iov);
     if (pkt_len > 0)
-        write(relay->tun_fd, pkt, pkt_len);
+        tun_out_writev(relay->tun_out, iov, 2);
+}
+
+/* Send a TCP packet with options to the TUN (towards the app) */
+static void send_to_tun_opts(tcp_relay_t *relay, tcp_session_t *session,
+                             uint8_t flags, const uint8_t *opts, int opts_len,
+                             const uint8_t *payload, int payload_len)
+{
+    emit_segment(relay, session, session->tun_seq, flags,
+                 opts, opts_len, payload, payload_len);
 
     /* Advance our seq for data/SYN/FIN (they consume sequence space) */
     if (payload_len > 0)
@@ -79,39 +137,88 @@ static void send_to_tun(tcp_relay_t *relay, tcp_session_t *session,
         session->tun_seq += 1;
 }
 
+/* Send a TCP packet to the TUN (towards the app) */
+static void send_to_tun(tcp_relay_t *relay, tcp_session_t *session,
+                        uint8_t flags, const uint8_t *payload, int payload_len)
+{
+    send_to_tun_opts(relay, session, flags, NULL, 0, payload, payload_len);
+}
+
+/* Largest segment that fits the TUN MTU for this session's family */
+static uint16_t tun_mss(const tcp_session_t *session)
+{
+    int ip_hdr = dpi_addr_is_ipv4(&session->app_addr) ? 20 : 40;
+    return (uint16_t)(TCP_TUN_MTU - ip_hdr - 20);
+}
+
+/* Record what the app's SYN offered; send_syn_ack answers in kind */
+static void negotiate_options(tcp_session_t *session, uint16_t window,
+                              const dpi_tcp_opts_t *opts)
+{
+    session->app_mss = (opts && opts->mss) ? opts->mss : TCP_DEFAULT_MSS;
+    if (session->app_mss > tun_mss(session))
+        session->app_mss = tun_mss(session);
+    session->app_wscale = opts ? opts->wscale : -1;
+    session->sack_ok    = opts && opts->sack_ok;
+    session->app_window = window;   /* SYN window is unscaled */
+}
+
+static void send_syn_ack(tcp_relay_t *relay, tcp_session_t *session)
+{
+    dpi_tcp_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+
+    /* Full-size segments from the app: the TUN MTU minus headers */
+    opts.mss     = tun_mss(session);
+    opts.wscale  = session->app_wscale >= 0 ? TCP_RCV_WSCALE : -1;
+    opts.sack_ok = session->sack_ok;
+
+    uint8_t buf[DPI_TCP_MAX_OPTIONS];
+    int len = dpi_tcp_write_options(buf, sizeof(buf), &opts);
+
+    /* Our SYN sits at snd_una until acked, so this also resends it */
+    emit_segment(relay, session, session->snd_una, DPI_TCP_SYN | DPI_TCP_ACK,
+                 buf, len > 0 ? len : 0, NULL, 0);
+    if (session->tun_seq == session->snd_una)
+        session->tun_seq++;
+}
+
 /* Create a non-blocking protected TCP socket and initiate connect */
-static int create_protected_socket(tcp_relay_t *relay,
-                                   uint32_t dst_addr, uint16_t dst_port)
+static socklen_t fill_sockaddr(struct sockaddr_storage *ss,
+                               const dpi_addr_t *addr, uint16_t port)
 {
-    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-    if (fd < 0) {
-        LOGE("socket(SOCK_STREAM): %s", strerror(errno));
-        return -1;
+    memset(ss, 0, sizeof(*ss));
+    if (dpi_addr_is_ipv4(addr)) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sin->sin_addr.s_addr = htonl(dpi_addr_to_ipv4(addr));
+        return sizeof(*sin);
     }
 
-    /* Protect from VPN routing */
-    jboolean ok = (*relay->env)->CallBooleanMethod(relay->env,
-                                                    relay->vpn_service,
-                                                    relay->protect_method,
-                                                    fd);
-    if (!ok) {
-        LOGE("VpnService.protect() failed for tcp fd=%d", fd);
-        close(fd);
-        return -1;
-    }
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons(port);
+    memcpy(&sin6->sin6_addr, addr->b, 16);
+    return sizeof(*sin6);
+}
 
-    /* Disable Nagle for low-latency relay */
-    int one = 1;
-    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+static int create_protected_socket(tcp_relay_t *relay,
+                                   const dpi_addr_t *dst_addr, uint16_t dst_port)
+{
+    struct sockaddr_storage dst;
+    socklen_t dst_len = fill_sockaddr(&dst, dst_addr, dst_port);
 
-    /* Initiate non-blocking connect */
-    struct sockaddr_in dst;
-    memset(&dst, 0, sizeof(dst));
-    dst.sin_family = AF_INET;
-    dst.sin_port = htons(dst_port);
-    dst.sin_addr.s_addr = htonl(dst_addr);
+    /* Already protected and set up, unless the pool has run dry */
+    socket_kind_t kind = socket_pool_kind(true, dst.ss_family == AF_INET);
+    int fd = relay->sockets ? socket_pool_take(relay->sockets, kind) : -1;
+    if (fd < 0)
+        fd = socket_pool_create(relay->env, relay->vpn_service, relay->protect_method, kind);
+    if (fd < 0)
+        return -1;
 
-    int ret = connect(fd, (struct sockaddr *)&dst, sizeof(dst));
+    /* Initiate non-blocking connect */
+    int ret = connect(fd, (struct sockaddr *)&dst, dst_len);
     if (ret < 0 && errno != EINPROGRESS) {
         LOGE("connect(tcp): %s", strerror(errno));
         close(fd);
@@ -121,100 +228,775 @@ static int create_protected_socket(tcp_relay_t *relay,
     return fd;
 }
 
-static void close_session(tcp_session_t *session)
+static void rto_stop(tcp_relay_t *relay, tcp_session_t *session)
+{
+    timer_cancel(&relay->timers, &session->rto_timer);
+}
+
+/* (Re)start the retransmission timer */
+static void rto_start(tcp_relay_t *relay, tcp_session_t *session, int64_t now_ms)
+{
+    timer_arm(&relay->timers, &session->rto_timer, now_ms + session->rto_ms);
+}
+
+/*
+ * When the session's current state runs out: the connect is bounded from
+ * the SYN, the other states from the last data relayed. Activity does not
+ * touch the timer; it is re-armed from here when it fires early.
+ */
+static int64_t expiry_deadline_ms(const tcp_session_t *session)
 {
-    if (session->fd >= 0)
+    if (!session->connected)
+        return session->connect_start_ns / 1000000 + TCP_CONNECT_TIMEOUT * 1000;
+    if (session->state == TCP_STATE_FIN_WAIT || session->server_eof)
+        return session->last_activity_ms + TCP_FIN_TIMEOUT * 1000;
+    return session->last_activity_ms + TCP_IDLE_TIMEOUT * 1000;
+}
+
+/* Re-arm the expiry timer after a state change */
+static void expiry_update(tcp_relay_t *relay, tcp_session_t *session)
+{
+    timer_arm(&relay->timers, &session->expiry_timer, expiry_deadline_ms(session));
+}
+
+/* Unindex the session and return its slot to the table */
+static void close_session(tcp_relay_t *relay, tcp_session_t *session)
+{
+    session_key_t key = { .dst_addr = session->dst_addr,
+                          .src_port = session->src_port,
+                          .dst_port = session->dst_port };
+    session_table_remove(&relay->table, &key);
+    session_pool_release(&relay->pool, session->pool_index);
+
+    if (session->fd >= 0) {
+        if (session->epoll_events)
+            epoll_ctl(relay->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
         close(session->fd);
+    }
+    free(session->hello_buf);
+    session->hello_buf = NULL;
+    session->hello_len = 0;
+    free(session->early_buf);
+    session->early_buf = NULL;
+    session->early_len = 0;
+    free(session->sndq);
+    session->sndq = NULL;
+    session->sndq_head = 0;
+    session->sndq_len = 0;
+    free(session->unacked);
+    session->unacked = NULL;
+    session->unacked_len = 0;
+    rto_stop(relay, session);
+    timer_cancel(&relay->timers, &session->expiry_timer);
     session->fd = -1;
     session->state = TCP_STATE_CLOSED;
     session->active = false;
 }
 
-static void handle_syn(tcp_relay_t *relay,
-                       uint32_t src_addr, uint32_t dst_addr,
-                       uint16_t src_port, uint16_t dst_port,
-                       uint32_t seq)
+/* ------------------------------------------------------------------ */
+/*  Upstream send queue                                                */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Once connected, wait for EPOLLOUT exactly while there is something to
+ * drain, and for EPOLLIN only while the app's window has room and the
+ * server has not closed. A socket waiting for nothing leaves the epoll
+ * set, so a pending EPOLLHUP cannot spin the loop meanwhile.
+ */
+static void update_epoll(tcp_relay_t *relay, tcp_session_t *session)
 {
-    /* Find existing or allocate new session */
-    tcp_session_t *session = find_session(relay, src_port, dst_addr, dst_port);
-    if (session) {
-        /* Re-SYN: close old connection and start fresh */
-        close_session(session);
+    if (!session->connected)
+        return;
+
+    uint32_t want = (!session->server_eof && send_budget(session) > 0 ? EPOLLIN : 0) |
+                    (session->sndq_len > 0 ? EPOLLOUT : 0);
+    if (want == session->epoll_events)
+        return;
+
+    int op = want == 0 ? EPOLL_CTL_DEL
+           : session->epoll_events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    struct epoll_event ev = { .events = want, .data.ptr = session };
+    if (epoll_ctl(relay->epoll_fd, op, session->fd, &ev) == 0)
+        session->epoll_events = want;
+}
+
+static void sndq_push(tcp_session_t *session, const uint8_t *data, int len)
+{
+    if (!session->sndq) {
+        session->sndq = malloc(TCP_SNDQ_SIZE);
+        if (!session->sndq) {
+            LOGE("send queue allocation failed, dropping %d bytes", len);
+            return;
+        }
+        session->sndq_head = 0;
+    }
+
+    /* handle_data admits no more than the window, so this always fits */
+    if ((uint32_t)len > TCP_SNDQ_SIZE - session->sndq_len) {
+        LOGE("send queue overflow, dropping %d bytes", len);
+        len = (int)(TCP_SNDQ_SIZE - session->sndq_len);
+    }
+
+    uint32_t tail = (session->sndq_head + session->sndq_len) % TCP_SNDQ_SIZE;
+    uint32_t first = TCP_SNDQ_SIZE - tail;
+    if (first > (uint32_t)len)
+        first = (uint32_t)len;
+    memcpy(session->sndq + tail, data, first);
+    memcpy(session->sndq, data + first, len - first);
+    session->sndq_len += len;
+}
+
+/*
+ * Send to the server, queueing whatever the socket does not take now.
+ * Queued data keeps its order: nothing bypasses a non-empty queue.
+ * Hard errors are left to the EPOLLERR/recv() path, which resets the app.
+ */
+static void upstream_send(tcp_relay_t *relay, tcp_session_t *session,
+                          const uint8_t *data, int len)
+{
+    if (session->sndq_len == 0) {
+        ssize_t n = send(session->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOGD("send(tcp fd=%d): %s", session->fd, strerror(errno));
+                return;
+            }
+            n = 0;
+        }
+        data += n;
+        len  -= (int)n;
+        if (len == 0)
+            return;
+    }
+
+    sndq_push(session, data, len);
+    update_epoll(relay, session);
+}
+
+/* Half-close towards the server once the app's FIN and all data went out */
+static void maybe_shutdown(tcp_session_t *session)
+{
+    if (session->state == TCP_STATE_FIN_WAIT && session->connected &&
+        session->sndq_len == 0)
+        shutdown(session->fd, SHUT_WR);
+}
+
+/*
+ * EPOLLOUT: push queued data into the socket. Once the window has
+ * reopened by a segment (or half the buffer) tell the app with a window
+ * update — it may be stalled on a zero window (RFC 1122 §4.2.3.3).
+ */
+static void drain_send_queue(tcp_relay_t *relay, tcp_session_t *session)
+{
+    while (session->sndq_len > 0) {
+        uint32_t chunk = TCP_SNDQ_SIZE - session->sndq_head;
+        if (chunk > session->sndq_len)
+            chunk = session->sndq_len;
+
+        ssize_t n = send(session->fd, session->sndq + session->sndq_head, chunk,
+                         MSG_NOSIGNAL);
+        if (n <= 0)
+            break;   /* EAGAIN, or an error the recv() path reports */
+
+        session->sndq_head = (session->sndq_head + (uint32_t)n) % TCP_SNDQ_SIZE;
+        session->sndq_len -= (uint32_t)n;
+    }
+
+    if (session->sndq_len == 0) {
+        free(session->sndq);
+        session->sndq = NULL;
+        session->sndq_head = 0;
+        maybe_shutdown(session);
+    }
+    update_epoll(relay, session);
+
+    uint32_t threshold = tun_mss(session);
+    if (threshold > TCP_RCV_WINDOW / 2)
+        threshold = TCP_RCV_WINDOW / 2;
+    if (session->state == TCP_STATE_ESTABLISHED &&
+        rcv_window(session) >= session->rcv_wnd_adv + threshold)
+        send_to_tun(relay, session, DPI_TCP_ACK, NULL, 0);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Reliability towards the app                                        */
+/* ------------------------------------------------------------------ */
+
+/* RTO from SRTT and RTTVAR (RFC 6298 §2); also undoes timeout backoff */
+static void rto_update(tcp_session_t *session)
+{
+    if (!session->srtt_us)
+        return;
+
+    uint32_t var = 4 * session->rttvar_us;
+    if (var < TCP_TIMER_TICK_MS * 1000)
+        var = TCP_TIMER_TICK_MS * 1000;
+    uint32_t rto = (session->srtt_us + var) / 1000;
+    session->rto_ms = rto < TCP_RTO_MIN_MS ? TCP_RTO_MIN_MS
+                    : rto > TCP_RTO_MAX_MS ? TCP_RTO_MAX_MS : rto;
+}
+
+/* RTT sample → SRTT, RTTVAR and RTO (RFC 6298 §2) */
+static void rtt_sample(tcp_session_t *session, uint32_t rtt_us)
+{
+    if (!session->srtt_us) {
+        session->srtt_us   = rtt_us ? rtt_us : 1;
+        session->rttvar_us = rtt_us / 2;
+    } else {
+        uint32_t delta = session->srtt_us > rtt_us ? session->srtt_us - rtt_us
+                                                   : rtt_us - session->srtt_us;
+        session->rttvar_us = (3 * session->rttvar_us + delta) / 4;
+        session->srtt_us   = (7 * session->srtt_us + rtt_us) / 8;
+    }
+    rto_update(session);
+}
+
+/* Receive server data straight into the free end of the unacked ring */
+static ssize_t recv_unacked(tcp_session_t *session, uint32_t max)
+{
+    if (!session->unacked) {
+        session->unacked = malloc(TCP_UNACKED_SIZE);
+        if (!session->unacked) {
+            LOGE("unacked buffer allocation failed");
+            errno = ENOMEM;
+            return -1;
+        }
+        session->unacked_head = 0;
     }
 
-    /* Find free slot */
-    tcp_session_t *slot = NULL;
-    for (int i = 0; i < relay->session_count; i++) {
-        if (!relay->sessions[i].active) {
-            slot = &relay->sessions[i];
-            break;
+    uint32_t tail = (session->unacked_head + session->unacked_len) % TCP_UNACKED_SIZE;
+    struct iovec iov[2];
+    iov[0].iov_base = session->unacked + tail;
+    iov[0].iov_len  = min_u32(max, TCP_UNACKED_SIZE - tail);
+    iov[1].iov_base = session->unacked;
+    iov[1].iov_len  = max - iov[0].iov_len;
+
+    ssize_t n = readv(session->fd, iov, iov[1].iov_len ? 2 : 1);
+    if (n > 0)
+        session->unacked_len += (uint32_t)n;
+    return n;
+}
+
+/*
+ * Send [seq, seq + len) from the unacked ring in segments of at most
+ * app_mss, with PSH on the last one when push is set.
+ */
+static void transmit_range(tcp_relay_t *relay, tcp_session_t *session,
+                           uint32_t seq, uint32_t len, bool push)
+{
+    uint32_t off = seq - session->unacked_seq;
+
+    while (len > 0) {
+        uint32_t pos = (session->unacked_head + off) % TCP_UNACKED_SIZE;
+        uint32_t chunk = min_u32(min_u32(len, session->app_mss), TCP_UNACKED_SIZE - pos);
+        uint8_t flags = DPI_TCP_ACK | (push && chunk == len ? DPI_TCP_PSH : 0);
+
+        emit_segment(relay, session, seq, flags, NULL, 0,
+                     session->unacked + pos, (int)chunk);
+        seq += chunk;
+        off += chunk;
+        len -= chunk;
+    }
+}
+
+/*
+ * Resend the first unacked segment; with SACK blocks it is cut where
+ * the app's lowest reported block begins (RFC 2018). A lone unacked FIN
+ * is resent as such.
+ */
+static void retransmit_head(tcp_relay_t *relay, tcp_session_t *session,
+                            const dpi_tcp_opts_t *opts)
+{
+    uint32_t len = min_u32(session->unacked_len, session->app_mss);
+
+    if (opts && session->sack_ok) {
+        for (int i = 0; i < opts->sack_count; i++) {
+            uint32_t left = opts->sack_left[i];
+            if (seq_after(left, session->unacked_seq) && left - session->unacked_seq < len)
+                len = left - session->unacked_seq;
         }
     }
-    if (!slot) {
-        if (relay->session_count >= TCP_MAX_SESSIONS) {
-            LOGE("TCP session limit reached");
+
+    if (len > 0)
+        transmit_range(relay, session, session->unacked_seq, len, true);
+    else if (session->server_eof && session->snd_una == session->tun_seq - 1)
+        emit_segment(relay, session, session->tun_seq - 1,
+                     DPI_TCP_FIN | DPI_TCP_ACK, NULL, 0, NULL, 0);
+    else
+        return;
+
+    session->rtt_start_us = 0;   /* Karn: no samples across a retransmission */
+    relay->retransmits++;
+}
+
+/*
+ * After a timeout everything past snd_una counts as lost: resend it in
+ * order as the (restarting) congestion window allows.
+ */
+static void retransmit_lost(tcp_relay_t *relay, tcp_session_t *session)
+{
+    uint32_t data_end = session->unacked_seq + session->unacked_len;
+
+    if (seq_after(session->snd_una, session->rtx_next))
+        session->rtx_next = session->snd_una;
+
+    while (seq_after(data_end, session->rtx_next) &&
+           seq_after(session->recover, session->rtx_next) &&
+           session->rtx_next - session->snd_una < session->cwnd) {
+        uint32_t len = min_u32(session->app_mss, data_end - session->rtx_next);
+        transmit_range(relay, session, session->rtx_next, len, false);
+        session->rtx_next += len;
+        relay->retransmits++;
+    }
+
+    /* The FIN follows the data once that has been resent */
+    if (session->server_eof && session->rtx_next == data_end &&
+        seq_after(session->recover, data_end) &&
+        session->rtx_next - session->snd_una < session->cwnd) {
+        emit_segment(relay, session, data_end, DPI_TCP_FIN | DPI_TCP_ACK,
+                     NULL, 0, NULL, 0);
+        session->rtx_next++;
+        relay->retransmits++;
+    }
+}
+
+/* Bytes in flight for the ssthresh computations (RFC 5681 eq. 4) */
+static uint32_t loss_ssthresh(const tcp_session_t *session)
+{
+    uint32_t half = (session->tun_seq - session->snd_una) / 2;
+    uint32_t floor = 2u * session->app_mss;
+    return half > floor ? half : floor;
+}
+
+/*
+ * The app's cumulative ACK and duplicate ACKs: release acked data from
+ * the ring, sample the RTT, grow or cut the congestion window and run
+ * fast retransmit / NewReno recovery.
+ */
+static void handle_ack(tcp_relay_t *relay, tcp_session_t *session,
+                       uint32_t ack, bool window_changed, bool pure,
+                       const dpi_tcp_opts_t *opts)
+{
+    if (seq_after(ack, session->tun_seq))
+        return;   /* acks something we never sent */
+
+    uint32_t mss = session->app_mss;
+
+    if (!seq_after(ack, session->snd_una)) {
+        /* Duplicate ACK (RFC 5681 §2): no new data, same window */
+        if (ack != session->snd_una || !pure || window_changed ||
+            session->tun_seq == session->snd_una)
             return;
+
+        if (session->recovery == TCP_RECOVERY_FAST) {
+            session->cwnd += mss;   /* each dup ACK: a segment left the network */
+        } else if (++session->dupacks == 3) {
+            /* Also after a timeout: a resent segment was lost again */
+            if (session->recovery == TCP_RECOVERY_NONE) {
+                session->ssthresh = loss_ssthresh(session);
+                session->cwnd     = session->ssthresh + 3 * mss;
+                session->recovery = TCP_RECOVERY_FAST;
+                session->recover  = session->tun_seq;
+            }
+            retransmit_head(relay, session, opts);
         }
-        slot = &relay->sessions[relay->session_count++];
+        return;
     }
 
-    int fd = create_protected_socket(relay, dst_addr, dst_port);
-    if (fd < 0)
+    uint32_t acked = ack - session->snd_una;
+    session->snd_una = ack;
+    session->dupacks = 0;
+    session->retries = 0;
+
+    if (seq_after(ack, session->unacked_seq)) {
+        uint32_t drop = min_u32(ack - session->unacked_seq, session->unacked_len);
+        session->unacked_head = (session->unacked_head + drop) % TCP_UNACKED_SIZE;
+        session->unacked_len -= drop;
+        session->unacked_seq += drop;
+        if (session->unacked_len == 0) {
+            free(session->unacked);
+            session->unacked = NULL;
+            session->unacked_head = 0;
+        }
+    }
+
+    int64_t now_us = monotonic_ns() / 1000;
+    if (session->rtt_start_us && seq_after(ack, session->rtt_seq)) {
+        rtt_sample(session, (uint32_t)(now_us - session->rtt_start_us));
+        session->rtt_start_us = 0;
+    } else {
+        rto_update(session);   /* progress: drop the timeout backoff */
+    }
+
+    if (session->recovery != TCP_RECOVERY_NONE) {
+        if (!seq_after(session->recover, ack)) {
+            /* Everything outstanding at the loss is acked: recovery done */
+            if (session->recovery == TCP_RECOVERY_FAST)
+                session->cwnd = min_u32(session->ssthresh,
+                                        (session->tun_seq - ack) + mss);
+            session->recovery = TCP_RECOVERY_NONE;
+        } else if (session->recovery == TCP_RECOVERY_FAST) {
+            /* Partial ACK: the next hole is lost too (RFC 6582 §3.2) */
+            retransmit_head(relay, session, opts);
+            session->cwnd = session->cwnd > acked ? session->cwnd - acked : 0;
+            session->cwnd += mss;
+        } else {
+            session->cwnd += min_u32(acked, mss);
+            retransmit_lost(relay, session);
+        }
+    } else if (session->cwnd < session->ssthresh) {
+        session->cwnd += min_u32(acked, mss);            /* slow start */
+    } else {
+        uint32_t inc = mss * mss / session->cwnd;         /* congestion avoidance */
+        session->cwnd += inc ? inc : 1;
+    }
+
+    if (session->tun_seq != session->snd_una)
+        rto_start(relay, session, now_us / 1000);
+    else
+        rto_stop(relay, session);
+}
+
+/* Retransmission timeout: back off and go back to snd_una (RFC 6298 §5) */
+static void handle_rto(tcp_relay_t *relay, tcp_session_t *session, int64_t now_ms)
+{
+    if (++session->retries > TCP_MAX_RETRIES) {
+        LOGD("app stopped acking on port %u, resetting", session->dst_port);
+        send_to_tun(relay, session, DPI_TCP_RST | DPI_TCP_ACK, NULL, 0);
+        close_session(relay, session);
+        return;
+    }
+
+    relay->timeouts++;
+    if (session->retries == 1)
+        session->ssthresh = loss_ssthresh(session);
+    session->cwnd     = session->app_mss;
+    session->dupacks  = 0;
+    session->recovery = TCP_RECOVERY_RTO;
+    session->recover  = session->tun_seq;
+    session->rto_ms   = min_u32(session->rto_ms * 2, TCP_RTO_MAX_MS);
+
+    /* The head segment goes out regardless of the window */
+    retransmit_head(relay, session, NULL);
+    session->rtx_next = session->unacked_seq + min_u32(session->unacked_len, session->app_mss);
+    if (session->unacked_len == 0)
+        session->rtx_next = session->tun_seq;
+    rto_start(relay, session, now_ms);
+}
+
+/*
+ * Both directions are finished and the app acked our FIN: nothing is
+ * left to send or resend. Returns true if the session was closed.
+ */
+static bool maybe_close(tcp_relay_t *relay, tcp_session_t *session)
+{
+    if (session->server_eof && session->state == TCP_STATE_FIN_WAIT &&
+        session->snd_una == session->tun_seq && session->sndq_len == 0) {
+        close_session(relay, session);
+        return true;
+    }
+    return false;
+}
+
+static void on_rto(timer_node_t *t, void *ctx, int64_t now_ms)
+{
+    handle_rto(ctx, timer_entry(t, tcp_session_t, rto_timer), now_ms);
+}
+
+/* The session's state timeout: reset it unless data moved since arming */
+static void on_expiry(timer_node_t *t, void *ctx, int64_t now_ms)
+{
+    tcp_relay_t *relay = ctx;
+    tcp_session_t *session = timer_entry(t, tcp_session_t, expiry_timer);
+
+    int64_t deadline = expiry_deadline_ms(session);
+    if (now_ms < deadline) {
+        timer_arm(&relay->timers, t, deadline);
+        return;
+    }
+
+    LOGD("tcp session to port %u expired in state %d", session->dst_port, session->state);
+    relay->expired++;
+    send_to_tun(relay, session, DPI_TCP_RST, NULL, 0);
+    close_session(relay, session);
+}
+
+/* ------------------------------------------------------------------ */
+/*  App-side TCP                                                       */
+/* ------------------------------------------------------------------ */
+
+static void handle_syn(tcp_relay_t *relay,
+                       const dpi_addr_t *src_addr, const dpi_addr_t *dst_addr,
+                       uint16_t src_port, uint16_t dst_port,
+                       uint32_t seq, uint16_t window,
+                       const dpi_tcp_opts_t *opts)
+{
+    /* Find existing or allocate new session */
+    tcp_session_t *session = find_session(relay, src_port, dst_addr, dst_port);
+    if (session && session->app_isn == seq) {
+        /* Retransmitted SYN: still connecting, or our SYN-ACK went missing */
+        if (session->state != TCP_STATE_SYN_RECEIVED &&
+            seq_after(session->unacked_seq, session->snd_una))
+            send_syn_ack(relay, session);
+        if (session->state == TCP_STATE_SYN_RECEIVED ||
+            seq_after(session->unacked_seq, session->snd_una))
+            return;
+    }
+    if (session) {
+        /* Re-SYN: close old connection and start fresh */
+        close_session(relay, session);
+    }
+
+    int index = session_pool_alloc(&relay->pool);
+    if (index < 0) {
+        LOGE("TCP session limit reached (%d)", relay->pool.capacity);
         return;
+    }
+    tcp_session_t *slot = session_pool_get(&relay->pool, index);
 
     memset(slot, 0, sizeof(*slot));
+    slot->kind           = SESSION_KIND_TCP;
+    slot->pool_index     = index;
+    timer_init(&slot->rto_timer, on_rto);
+    timer_init(&slot->expiry_timer, on_expiry);
     slot->src_port       = src_port;
-    slot->dst_addr       = dst_addr;
+    slot->dst_addr       = *dst_addr;
     slot->dst_port       = dst_port;
+    slot->app_addr       = *src_addr;
+    dpi_template_init_tcp(&slot->tun_hdr, dst_addr, src_addr, dst_port, src_port);
+    negotiate_options(slot, window, opts);
+
+    int fd = create_protected_socket(relay, dst_addr, dst_port);
+    if (fd >= 0) {
+        slot->epoll_events = EPOLLIN | EPOLLOUT;
+        /* Registered once for the socket's lifetime; events carry the session.
+         * EPOLLOUT reports connect completion and is dropped after it. */
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = slot };
+        if (epoll_ctl(relay->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("epoll_ctl(ADD, tcp fd=%d): %s", fd, strerror(errno));
+            close(fd);
+            fd = -1;
+        }
+    }
+    session_key_t key = { .dst_addr = *dst_addr, .src_port = src_port, .dst_port = dst_port };
+    if (fd >= 0 && session_table_insert(&relay->table, &key, index) < 0) {
+        LOGE("Cannot grow the TCP session table");
+        epoll_ctl(relay->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        /* Refuse right away so the app falls back (e.g. IPv6 → IPv4)
+         * instead of waiting out its SYN retransmissions */
+        slot->tun_ack = seq + 1;
+        send_to_tun(relay, slot, DPI_TCP_RST | DPI_TCP_ACK, NULL, 0);
+        slot->fd = -1;
+        session_pool_release(&relay->pool, index);
+        return;
+    }
+
     slot->fd             = fd;
     slot->state          = TCP_STATE_SYN_RECEIVED;
     slot->active         = true;
     slot->first_data_sent = false;
-    slot->last_activity  = monotonic_seconds();
+    slot->connect_start_ns = monotonic_ns();
+    slot->last_activity_ms = slot->connect_start_ns / 1000000;
     slot->app_isn        = seq;
 
     /* Our ISN: use a simple counter derived from time */
-    slot->tun_seq = (uint32_t)(monotonic_seconds() * 1000) ^ (dst_port << 16 | src_port);
+    slot->tun_seq = (uint32_t)(monotonic_seconds() * 1000) ^ ((uint32_t)dst_port << 16 | src_port);
     slot->tun_ack = seq + 1;  /* ACK the SYN */
+    slot->snd_una = slot->tun_seq;
+    slot->unacked_seq = slot->tun_seq + 1;   /* data starts after our SYN */
+
+    slot->rto_ms   = TCP_RTO_INIT_MS;
+    slot->cwnd     = TCP_INIT_CWND_SEGS * slot->app_mss;
+    slot->ssthresh = UINT32_MAX;
+    expiry_update(relay, slot);
+
+    if (relay->defer_syn_ack)
+        return;   /* SYN-ACK once the server accepts, see finish_connect */
 
-    /* Send SYN-ACK back to the app via TUN */
-    send_to_tun(relay, slot, DPI_TCP_SYN | DPI_TCP_ACK, NULL, 0);
+    /* Send SYN-ACK back to the app via TUN; data waits in early_buf */
+    send_syn_ack(relay, slot);
 
     slot->state = TCP_STATE_ESTABLISHED;
 }
 
+/* Hostlist decision; h is NULL when the ClientHello could not be located */
+static bool host_wants_desync(tcp_relay_t *relay, const uint8_t *data,
+                              const dpi_tls_hello_t *h)
+{
+    if (!h || h->host_off < 0)
+        return dpi_hostlist_allows(relay->hostlist, relay->hostlist_exclude, NULL, 0);
+
+    return dpi_hostlist_allows(relay->hostlist, relay->hostlist_exclude,
+                               (const char *)data + h->host_off, h->host_len);
+}
+
+/* Send data to the server cut at every split marker that resolves */
+static void send_split(tcp_relay_t *relay, tcp_session_t *session,
+                       const uint8_t *data, int len, const dpi_tls_hello_t *h)
+{
+    int cuts[DPI_MAX_SPLIT_MARKERS + 2];
+    int n = 0;
+
+    cuts[n++] = 0;
+    for (int m = 0; m < relay->split_marker_count; m++) {
+        int pos = dpi_split_marker_resolve(&relay->split_markers[m], data, len, h);
+        if (pos < 0)
+            continue;
+
+        /* Insert keeping cuts sorted and unique */
+        int i = n;
+        while (cuts[i - 1] > pos)
+            i--;
+        if (cuts[i - 1] == pos)
+            continue;
+        memmove(&cuts[i + 1], &cuts[i], (n - i) * sizeof(int));
+        cuts[i] = pos;
+        n++;
+    }
+    cuts[n++] = len;
+
+    if (n > 2)
+        LOGD("TLS ClientHello split into %d segments", n - 1);
+
+    if (relay->use_disorder) {
+        /* Send the last part first (disorder) */
+        for (int i = n - 2; i >= 0; i--)
+            upstream_send(relay, session, data + cuts[i], cuts[i + 1] - cuts[i]);
+    } else {
+        for (int i = 0; i < n - 1; i++)
+            upstream_send(relay, session, data + cuts[i], cuts[i + 1] - cuts[i]);
+    }
+}
+
+/*
+ * Handle the start of the stream: collect a ClientHello that spans
+ * several segments, then split it (or forward it untouched).
+ * Returns true while more segments are needed.
+ */
+static bool handle_first_data(tcp_relay_t *relay, tcp_session_t *session,
+                              const uint8_t *payload, int payload_len)
+{
+    const uint8_t *data = payload;
+    int len = payload_len;
+
+    if (session->hello_buf) {
+        if (session->hello_len + payload_len > TCP_HELLO_BUF_SIZE) {
+            /* Not a sane ClientHello — give up and pass everything through */
+            upstream_send(relay, session, session->hello_buf, session->hello_len);
+            upstream_send(relay, session, payload, payload_len);
+            return false;
+        }
+        memcpy(session->hello_buf + session->hello_len, payload, payload_len);
+        session->hello_len += payload_len;
+        data = session->hello_buf;
+        len = session->hello_len;
+    }
+
+    dpi_tls_hello_t hello;
+    int ret = dpi_tls_parse_client_hello(data, len, &hello);
+
+    if (ret == DPI_TLS_INCOMPLETE && len < TCP_HELLO_BUF_SIZE) {
+        if (!session->hello_buf) {
+            session->hello_buf = malloc(TCP_HELLO_BUF_SIZE);
+            if (session->hello_buf) {
+                memcpy(session->hello_buf, payload, payload_len);
+                session->hello_len = payload_len;
+                return true;
+            }
+            /* Out of memory: split what we have */
+        } else {
+            return true;
+        }
+    }
+
+    const dpi_tls_hello_t *h = (ret == DPI_TLS_OK) ? &hello : NULL;
+    if ((h || dpi_is_tls_client_hello(data, len)) &&
+        host_wants_desync(relay, data, h)) {
+        send_split(relay, session, data, len, h);
+    } else {
+        upstream_send(relay, session, data, len);
+    }
+    return false;
+}
+
+/* Pass app data to the server, splitting the start of the stream */
+static void forward_data(tcp_relay_t *relay, tcp_session_t *session,
+                         const uint8_t *payload, int payload_len)
+{
+    if (!session->first_data_sent && relay->split_marker_count > 0) {
+        if (!handle_first_data(relay, session, payload, payload_len)) {
+            free(session->hello_buf);
+            session->hello_buf = NULL;
+            session->hello_len = 0;
+            session->first_data_sent = true;
+        }
+    } else {
+        /* Forward as-is */
+        upstream_send(relay, session, payload, payload_len);
+        session->first_data_sent = true;
+    }
+}
+
+/* Hold app data until the server connect completes; -1 when full */
+static int buffer_early_data(tcp_session_t *session,
+                             const uint8_t *payload, int payload_len)
+{
+    if (session->early_len + payload_len > TCP_EARLY_BUF_MAX)
+        return -1;
+
+    uint8_t *buf = realloc(session->early_buf, session->early_len + payload_len);
+    if (!buf)
+        return -1;
+
+    memcpy(buf + session->early_len, payload, payload_len);
+    session->early_buf = buf;
+    session->early_len += payload_len;
+    return 0;
+}
+
 static void handle_data(tcp_relay_t *relay, tcp_session_t *session,
                         const uint8_t *payload, int payload_len, uint32_t seq)
 {
     if (session->state != TCP_STATE_ESTABLISHED)
         return;
 
-    session->last_activity = monotonic_seconds();
-    session->tun_ack = seq + payload_len;
+    session->last_activity_ms = monotonic_ms();
 
-    /* Check if this is the first data segment and contains a TLS ClientHello */
-    if (!session->first_data_sent && relay->split_pos > 0 &&
-        payload_len > relay->split_pos &&
-        dpi_is_tls_client_hello(payload, payload_len)) {
+    /* Skip what we already have; past a gap, a duplicate ACK asks the
+     * app to fill it (we keep no out-of-order data) */
+    if (seq_after(session->tun_ack, seq)) {
+        uint32_t have = session->tun_ack - seq;
+        if (have >= (uint32_t)payload_len) {
+            send_to_tun(relay, session, DPI_TCP_ACK, NULL, 0);
+            return;
+        }
+        payload     += have;
+        payload_len -= (int)have;
+        seq          = session->tun_ack;
+    } else if (seq != session->tun_ack) {
+        send_to_tun(relay, session, DPI_TCP_ACK, NULL, 0);
+        return;
+    }
 
-        LOGD("TLS ClientHello detected, splitting at pos %d", relay->split_pos);
+    /* Beyond the window we advertise: leave it unacked, the ACK tells
+     * the app how much room there is */
+    if ((uint32_t)payload_len > rcv_window(session)) {
+        send_to_tun(relay, session, DPI_TCP_ACK, NULL, 0);
+        return;
+    }
 
-        int pos = relay->split_pos;
-        if (relay->use_disorder) {
-            /* Send second part first (disorder) */
-            send(session->fd, payload + pos, payload_len - pos, 0);
-            send(session->fd, payload, pos, 0);
-        } else {
-            /* Normal split: first part, then second */
-            send(session->fd, payload, pos, 0);
-            send(session->fd, payload + pos, payload_len - pos, 0);
-        }
-        session->first_data_sent = true;
+    if (!session->connected) {
+        /* Left unacknowledged when full: the app retransmits it later */
+        if (buffer_early_data(session, payload, payload_len) < 0)
+            return;
+        session->tun_ack = seq + payload_len;
     } else {
-        /* Forward as-is */
-        send(session->fd, payload, payload_len, 0);
-        if (payload_len > 0)
-            session->first_data_sent = true;
+        session->tun_ack = seq + payload_len;
+        forward_data(relay, session, payload, payload_len);
     }
 
     /* ACK the data back to the app */
@@ -223,50 +1005,143 @@ static void handle_data(tcp_relay_t *relay, tcp_session_t *session,
 
 static void handle_fin(tcp_relay_t *relay, tcp_session_t *session, uint32_t seq)
 {
+    /* Only in sequence, once all data before it has been taken */
+    if (seq != session->tun_ack || session->state != TCP_STATE_ESTABLISHED) {
+        send_to_tun(relay, session, DPI_TCP_ACK, NULL, 0);
+        return;
+    }
     session->tun_ack = seq + 1;
 
     /* ACK the FIN */
     send_to_tun(relay, session, DPI_TCP_ACK, NULL, 0);
 
-    /* Shutdown our side of the real connection */
-    if (session->fd >= 0)
-        shutdown(session->fd, SHUT_WR);
+    /* A ClientHello cut short by the FIN will not complete: pass it on */
+    if (session->hello_buf) {
+        upstream_send(relay, session, session->hello_buf, session->hello_len);
+        free(session->hello_buf);
+        session->hello_buf = NULL;
+        session->hello_len = 0;
+        session->first_data_sent = true;
+    }
 
+    /* Shutdown our side of the real connection once everything
+     * buffered reached the server */
     session->state = TCP_STATE_FIN_WAIT;
+    maybe_shutdown(session);
+    if (!maybe_close(relay, session))
+        expiry_update(relay, session);
 }
 
 static void handle_rst(tcp_relay_t *relay, tcp_session_t *session)
 {
-    (void)relay;
-    close_session(session);
+    close_session(relay, session);
 }
 
-void tcp_relay_init(tcp_relay_t *relay, int tun_fd,
-                    int split_pos, bool use_disorder,
-                    JNIEnv *env, jobject vpn_service)
+/*
+ * The server socket became writable or failed: conclude the
+ * non-blocking connect. On success answer a deferred SYN and flush the
+ * early data; on failure refuse the app's connection.
+ * Returns 0, or -1 if the session was closed.
+ */
+static int finish_connect(tcp_relay_t *relay, tcp_session_t *session)
+{
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(session->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0)
+        err = errno;
+
+    int64_t us = (monotonic_ns() - session->connect_start_ns) / 1000;
+
+    if (err) {
+        LOGD("connect to port %u failed after %lld us: %s",
+             session->dst_port, (long long)us, strerror(err));
+        relay->connects_failed++;
+        send_to_tun(relay, session, DPI_TCP_RST | DPI_TCP_ACK, NULL, 0);
+        close_session(relay, session);
+        return -1;
+    }
+
+    session->connected  = true;
+    session->connect_us = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    relay->connects_ok++;
+    relay->connect_us_total += session->connect_us;
+    if (session->connect_us > relay->connect_us_max)
+        relay->connect_us_max = session->connect_us;
+    LOGD("connected to port %u in %u us", session->dst_port, session->connect_us);
+    expiry_update(relay, session);
+
+    if (session->state == TCP_STATE_SYN_RECEIVED) {
+        send_syn_ack(relay, session);
+        session->state = TCP_STATE_ESTABLISHED;
+    }
+
+    if (session->early_buf) {
+        forward_data(relay, session, session->early_buf, session->early_len);
+        free(session->early_buf);
+        session->early_buf = NULL;
+        session->early_len = 0;
+    }
+
+    update_epoll(relay, session);
+    maybe_shutdown(session);
+    return 0;
+}
+
+int tcp_relay_init(tcp_relay_t *relay, tun_out_t *tun_out, int epoll_fd,
+                   int split_pos, const char *split_markers,
+                   bool use_disorder, bool defer_syn_ack,
+                   const dpi_hostlist_t *hostlist,
+                   const dpi_hostlist_t *hostlist_exclude,
+                   int max_sessions,
+                   JNIEnv *env, jobject vpn_service)
 {
     memset(relay, 0, sizeof(*relay));
-    relay->tun_fd       = tun_fd;
-    relay->tun_addr     = TUN_ADDR;
-    relay->split_pos    = split_pos;
-    relay->use_disorder = use_disorder;
+    if (session_pool_init(&relay->pool, sizeof(tcp_session_t),
+                          max_sessions > 0 ? max_sessions : TCP_MAX_SESSIONS) < 0 ||
+        session_table_init(&relay->table, SESSION_POOL_CHUNK) < 0) {
+        LOGE("Cannot allocate the TCP session table");
+        session_pool_free(&relay->pool);
+        return -1;
+    }
+
+    relay->tun_out          = tun_out;
+    relay->epoll_fd         = epoll_fd;
+    timer_wheel_init(&relay->timers, monotonic_ms(), TCP_TIMER_TICK_MS);
+    relay->use_disorder     = use_disorder;
+    relay->defer_syn_ack    = defer_syn_ack;
+    relay->hostlist         = hostlist;
+    relay->hostlist_exclude = hostlist_exclude;
+
+    if (split_markers && split_markers[0]) {
+        int n = dpi_split_markers_parse(split_markers, relay->split_markers,
+                                        DPI_MAX_SPLIT_MARKERS);
+        if (n < 0)
+            LOGE("Invalid split markers '%s', using split_pos=%d",
+                 split_markers, split_pos);
+        else
+            relay->split_marker_count = n;
+    }
+    if (relay->split_marker_count == 0 && split_pos > 0) {
+        relay->split_markers[0].base   = DPI_SPLIT_ABS;
+        relay->split_markers[0].offset = split_pos;
+        relay->split_marker_count = 1;
+    }
     relay->env          = env;
     relay->vpn_service  = vpn_service;
 
     jclass cls = (*env)->GetObjectClass(env, vpn_service);
     relay->protect_method = (*env)->GetMethodID(env, cls, "protect", "(I)Z");
+    return 0;
 }
 
 void tcp_relay_process(tcp_relay_t *relay,
-                       uint32_t src_addr, uint32_t dst_addr,
+                       const dpi_addr_t *src_addr, const dpi_addr_t *dst_addr,
                        uint16_t src_port, uint16_t dst_port,
                        uint32_t seq, uint32_t ack,
-                       uint8_t flags,
+                       uint8_t flags, uint16_t window,
+                       const dpi_tcp_opts_t *opts,
                        const uint8_t *payload, int payload_len)
 {
-    (void)src_addr;
-    (void)ack;
-
     if (flags & DPI_TCP_RST) {
         tcp_session_t *session = find_session(relay, src_port, dst_addr, dst_port);
         if (session)
@@ -275,7 +1150,7 @@ void tcp_relay_process(tcp_relay_t *relay,
     }
 
     if (flags & DPI_TCP_SYN) {
-        handle_syn(relay, src_addr, dst_addr, src_port, dst_port, seq);
+        handle_syn(relay, src_addr, dst_addr, src_port, dst_port, seq, window, opts);
         return;
     }
 
@@ -283,36 +1158,96 @@ void tcp_relay_process(tcp_relay_t *relay,
     if (!session)
         return;
 
-    if (flags & DPI_TCP_FIN) {
-        handle_fin(relay, session, seq);
-        return;
+    uint32_t old_window = session->app_window;
+    session->app_window = session->app_wscale > 0
+                        ? (uint32_t)window << session->app_wscale : window;
+    if (flags & DPI_TCP_ACK) {
+        handle_ack(relay, session, ack, session->app_window != old_window,
+                   payload_len == 0 && !(flags & DPI_TCP_FIN), opts);
+        if (!session->active || maybe_close(relay, session))
+            return;
     }
 
-    if (payload_len > 0) {
+    if (payload_len > 0)
         handle_data(relay, session, payload, payload_len, seq);
+
+    if (flags & DPI_TCP_FIN) {
+        handle_fin(relay, session, seq + payload_len);
+        if (!session->active)
+            return;
     }
+
+    /* The ACK may have opened the app's window: resume reading */
+    update_epoll(relay, session);
 }
 
-int tcp_relay_handle_response(tcp_relay_t *relay, int fd)
+int tcp_relay_handle_response(tcp_relay_t *relay, tcp_session_t *session,
+                              uint32_t events)
 {
-    tcp_session_t *session = find_session_by_fd(relay, fd);
-    if (!session)
+    /* Closed earlier in the same epoll_wait batch */
+    if (!session->active)
         return 0;
 
-    uint8_t buf[MAX_PKT_SIZE];
-    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (!session->connected) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return 1;
+        if (finish_connect(relay, session) < 0)
+            return -1;
+    } else if (events & EPOLLOUT) {
+        drain_send_queue(relay, session);
+    }
+
+    if (events & EPOLLERR) {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        getsockopt(session->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        LOGD("tcp fd=%d: %s", session->fd, strerror(err));
+        send_to_tun(relay, session, DPI_TCP_RST, NULL, 0);
+        close_session(relay, session);
+        return -1;
+    }
+
+    if (!(events & (EPOLLIN | EPOLLHUP)))
+        return 1;
+
+    /* Read no more than the app can take; EPOLLIN stays off until it acks */
+    uint32_t budget = min_u32(send_budget(session), TCP_RX_BUF_SIZE);
+    if (budget == 0 || session->server_eof) {
+        update_epoll(relay, session);
+        return 1;
+    }
+
+    ssize_t n = recv_unacked(session, budget);
 
     if (n > 0) {
-        session->last_activity = monotonic_seconds();
-        /* Send data to app via TUN */
-        send_to_tun(relay, session, DPI_TCP_ACK | DPI_TCP_PSH, buf, (int)n);
+        int64_t now_ns = monotonic_ns();
+        uint32_t seq = session->tun_seq;
+
+        session->last_activity_ms = now_ns / 1000000;
+        session->tun_seq += (uint32_t)n;
+        transmit_range(relay, session, seq, (uint32_t)n, true);
+
+        if (!session->rtt_start_us) {
+            session->rtt_seq      = seq;
+            session->rtt_start_us = now_ns / 1000;
+        }
+        if (!timer_armed(&session->rto_timer))
+            rto_start(relay, session, now_ns / 1000000);
+        update_epoll(relay, session);
         return 1;
     }
 
     if (n == 0) {
-        /* Server closed connection — send FIN to app */
+        /* Server closed connection — FIN to the app, after any data it
+         * still has to ack; the session lives on until that is done */
         send_to_tun(relay, session, DPI_TCP_FIN | DPI_TCP_ACK, NULL, 0);
-        close_session(session);
+        session->server_eof = true;
+        if (!timer_armed(&session->rto_timer))
+            rto_start(relay, session, monotonic_ms());
+        if (!maybe_close(relay, session)) {
+            expiry_update(relay, session);
+            update_epoll(relay, session);
+        }
         return 1;
     }
 
@@ -322,38 +1257,38 @@ int tcp_relay_handle_response(tcp_relay_t *relay, int fd)
 
     /* Error — send RST to app */
     send_to_tun(relay, session, DPI_TCP_RST, NULL, 0);
-    close_session(session);
+    close_session(relay, session);
     return -1;
 }
 
-int tcp_relay_get_fds(tcp_relay_t *relay, int *out_fds, int max_fds)
+void tcp_relay_timers(tcp_relay_t *relay)
 {
-    int count = 0;
-    for (int i = 0; i < relay->session_count && count < max_fds; i++) {
-        if (relay->sessions[i].active && relay->sessions[i].fd >= 0)
-            out_fds[count++] = relay->sessions[i].fd;
-    }
-    return count;
+    timer_wheel_advance(&relay->timers, monotonic_ms(), relay);
+    session_pool_trim(&relay->pool);
 }
 
-void tcp_relay_cleanup(tcp_relay_t *relay)
+int tcp_relay_poll_timeout(const tcp_relay_t *relay, int idle_ms)
 {
-    int64_t now = monotonic_seconds();
-    for (int i = 0; i < relay->session_count; i++) {
-        tcp_session_t *s = &relay->sessions[i];
-        if (s->active && (now - s->last_activity) > TCP_SESSION_TIMEOUT) {
-            /* Send RST to app before closing */
-            send_to_tun(relay, s, DPI_TCP_RST, NULL, 0);
-            close_session(s);
-        }
-    }
+    return timer_wheel_timeout(&relay->timers, monotonic_ms(), idle_ms);
 }
 
 void tcp_relay_destroy(tcp_relay_t *relay)
 {
-    for (int i = 0; i < relay->session_count; i++) {
-        if (relay->sessions[i].active)
-            close_session(&relay->sessions[i]);
-    }
-    relay->session_count = 0;
+    for (int i = session_pool_next(&relay->pool, 0); i >= 0;
+         i = session_pool_next(&relay->pool, i + 1))
+        close_session(relay, session_pool_get(&relay->pool, i));
+
+    if (relay->pool.peak)
+        LOGD("TCP sessions: peak %d of %d", relay->pool.peak, relay->pool.capacity);
+    session_pool_free(&relay->pool);
+    session_table_free(&relay->table);
+
+    if (relay->connects_ok || relay->connects_failed)
+        LOGD("TCP connects: %u ok (avg %llu us, max %u us), %u failed; "
+             "%u segments resent, %u timeouts, %u sessions expired",
+             relay->connects_ok,
+             (unsigned long long)(relay->connects_ok
+                                  ? relay->connect_us_total / relay->connects_ok : 0),
+             relay->connect_us_max, relay->connects_failed,
+             relay->retransmits, relay->timeouts, relay->expired);
 }
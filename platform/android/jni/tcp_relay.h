@@ -5,8 +5,12 @@
  * Implements a lightweight TCP state machine for the TUN side,
  * while using connected sockets for the real-internet side.
  *
- * For TLS ClientHello, splits the first data segment at split_pos
- * to bypass DPI inspection.
+ * For TLS ClientHello, splits the first data segment at split markers
+ * (absolute or SNI-relative, e.g. "1,midsld") to bypass DPI inspection.
+ * A ClientHello spanning several segments is reassembled first.
+ *
+ * Towards the app, server data is kept until acked and resent on timeout
+ * or duplicate ACKs, paced by a Reno congestion window.
  */
 
 #ifndef TCP_RELAY_H
@@ -16,49 +20,154 @@
 #include <stdbool.h>
 #include <jni.h>
 
-#define TCP_MAX_SESSIONS   2048
-#define TCP_SESSION_TIMEOUT 300  /* seconds */
+#include "dpi_bypass.h"
+#include "session_pool.h"
+#include "session_table.h"
+#include "socket_pool.h"
+#include "timer_wheel.h"
+#include "tun_out.h"
+
+#define TCP_MAX_SESSIONS    2048         /* default session limit per relay */
+#define TCP_HELLO_BUF_SIZE  (16384 + 5)  /* one maximal TLS record */
+#define TCP_RX_BUF_SIZE     65536        /* most read from a server socket per wakeup */
+#define TCP_UNACKED_SIZE    131072       /* server data sent to the app, kept until acked */
+#define TCP_EARLY_BUF_MAX   65536        /* app data held while the server connect is pending */
+#define TCP_TUN_MTU         1500         /* VpnService.Builder.setMtu() in ZapretVpnService */
+#define TCP_DEFAULT_MSS     536          /* RFC 9293: assumed when the SYN has no MSS */
+#define TCP_RCV_WINDOW      262144       /* receive window advertised to the app */
+#define TCP_RCV_WSCALE      3            /* our window shift; TCP_RCV_WINDOW >> 3 fits 16 bits */
+#define TCP_SNDQ_SIZE       TCP_RCV_WINDOW /* app data acked but not yet taken by the server socket */
+
+/* Retransmission towards the app (RFC 6298) and congestion control (RFC 5681) */
+#define TCP_RTO_INIT_MS     1000
+#define TCP_RTO_MIN_MS      200
+#define TCP_RTO_MAX_MS      60000
+#define TCP_MAX_RETRIES     8            /* timeouts in a row before the app is reset */
+#define TCP_INIT_CWND_SEGS  10           /* RFC 6928 */
+#define TCP_TIMER_TICK_MS   20           /* timer wheel granularity */
+
+/* Session lifetime by state, in seconds; expired sessions are reset */
+#define TCP_CONNECT_TIMEOUT 30           /* app's SYN until the server accepts */
+#define TCP_IDLE_TIMEOUT    300          /* established, since data last moved */
+#define TCP_FIN_TIMEOUT     60           /* after either side closed, since data last moved */
 
 typedef enum {
     TCP_STATE_IDLE = 0,
-    TCP_STATE_SYN_RECEIVED,    /* Got SYN from app, connecting to dst */
+    TCP_STATE_SYN_RECEIVED,    /* Got SYN from app, connecting to dst; no SYN-ACK yet */
     TCP_STATE_ESTABLISHED,     /* Connected, relaying data */
     TCP_STATE_FIN_WAIT,        /* App sent FIN, waiting for dst close */
     TCP_STATE_CLOSED
 } tcp_state_t;
 
 typedef struct {
+    session_kind_t kind;  /* SESSION_KIND_TCP; epoll data.ptr points here */
+    int pool_index;       /* slot in the relay's session pool */
+
     /* Session key */
     uint16_t src_port;    /* app-side source port */
-    uint32_t dst_addr;    /* destination IP */
+    dpi_addr_t dst_addr;  /* destination IP (IPv4-mapped for IPv4) */
     uint16_t dst_port;    /* destination port */
 
+    dpi_addr_t app_addr;  /* app-side source IP (destination of TUN responses) */
+    dpi_hdr_template_t tun_hdr; /* prebuilt server→app IP+TCP header */
+
     /* State */
     tcp_state_t state;
     int fd;               /* protected TCP socket to real server */
     bool active;
+    bool connected;       /* server connect() has completed */
     bool first_data_sent; /* have we sent the first data segment? (for split) */
-    int64_t last_activity;
+    uint8_t *hello_buf;   /* partial ClientHello awaiting reassembly (malloc'd) */
+    int hello_len;
+    uint8_t *early_buf;   /* app data received before connected (malloc'd) */
+    int early_len;
+
+    /* Upstream send queue: ring of TCP_SNDQ_SIZE bytes (malloc'd while
+     * non-empty), drained on EPOLLOUT. Its occupancy sets our window. */
+    uint8_t *sndq;
+    uint32_t sndq_head;
+    uint32_t sndq_len;
+    uint32_t epoll_events; /* the socket's current epoll registration */
+    uint32_t rcv_wnd_adv; /* window last advertised to the app, bytes */
+    int64_t last_activity_ms; /* data last relayed either way */
+    timer_node_t expiry_timer; /* per-state lifetime; checked lazily against last_activity_ms */
+
+    /* Connect latency: SYN from the app to connect() completion */
+    int64_t connect_start_ns;
+    uint32_t connect_us;
 
     /* Sequence/ack tracking for TUN side */
     uint32_t tun_seq;     /* our seq number (server→app direction) */
+    uint32_t snd_una;     /* oldest of our bytes the app has not acked */
     uint32_t tun_ack;     /* our ack number (what we've received from app) */
     uint32_t app_isn;     /* app's initial sequence number from SYN */
+
+    /* Negotiated from the app's SYN options */
+    uint16_t app_mss;     /* largest segment we may send to the app */
+    int8_t   app_wscale;  /* app's window shift, -1 = window scaling off */
+    bool     sack_ok;     /* app accepts SACK blocks (RFC 2018) */
+    uint32_t app_window;  /* app's receive window in bytes (scaled) */
+
+    /* Server data sent to the app and not yet acked: ring of
+     * TCP_UNACKED_SIZE (malloc'd while non-empty) from unacked_seq */
+    uint8_t *unacked;
+    uint32_t unacked_head;
+    uint32_t unacked_len;
+    uint32_t unacked_seq; /* seq of the ring's first byte; past snd_una only while our SYN is unacked */
+    bool server_eof;      /* server closed; our FIN sits at tun_seq - 1 */
+
+    /* Retransmission timer and RTT estimate (RFC 6298) */
+    timer_node_t rto_timer;
+    uint32_t rto_ms;
+    uint32_t srtt_us;     /* 0 = no sample yet */
+    uint32_t rttvar_us;
+    uint32_t rtt_seq;     /* timed segment; never a retransmitted one (Karn) */
+    int64_t rtt_start_us; /* 0 = nothing timed */
+    uint8_t retries;
+
+    /* Congestion control (RFC 5681, NewReno recovery per RFC 6582) */
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint8_t dupacks;
+    uint8_t recovery;     /* TCP_RECOVERY_* */
+    uint32_t recover;     /* tun_seq when recovery began */
+    uint32_t rtx_next;    /* after a timeout: resend from here (go-back-N) */
 } tcp_session_t;
 
+enum {
+    TCP_RECOVERY_NONE = 0,
+    TCP_RECOVERY_FAST,    /* fast retransmit after three duplicate ACKs */
+    TCP_RECOVERY_RTO      /* after a retransmission timeout */
+};
+
 typedef struct {
-    tcp_session_t sessions[TCP_MAX_SESSIONS];
-    int session_count;
+    session_pool_t pool;      /* tcp_session_t storage, grown up to the session limit */
+    session_table_t table;    /* key index into the pool */
 
     /* DPI bypass config */
-    int split_pos;        /* position to split TLS ClientHello (0 = no split) */
-    bool use_disorder;    /* send second segment first (disorder mode) */
-
-    /* TUN fd for sending responses back to app */
-    int tun_fd;
-
-    /* Source address for TUN responses (10.120.0.1) */
-    uint32_t tun_addr;
+    dpi_split_marker_t split_markers[DPI_MAX_SPLIT_MARKERS];
+    int split_marker_count;   /* 0 = no split */
+    bool use_disorder;        /* send segments in reverse order (disorder mode) */
+    bool defer_syn_ack;       /* answer the app's SYN only once the server accepted */
+    const dpi_hostlist_t *hostlist;         /* desync only these hosts (NULL = all) */
+    const dpi_hostlist_t *hostlist_exclude; /* never desync these hosts */
+
+    /* Responses back to the app: the TUN fd or a shard's outbound ring */
+    tun_out_t *tun_out;
+    int epoll_fd;             /* session sockets are registered here */
+    timer_wheel_t timers;     /* retransmission and expiry timers of all sessions */
+
+    /* Connect and retransmission statistics, logged on destroy */
+    uint32_t connects_ok;
+    uint32_t connects_failed;
+    uint64_t connect_us_total;
+    uint32_t connect_us_max;
+    uint32_t retransmits;
+    uint32_t timeouts;
+    uint32_t expired;         /* sessions reset by their state timeout */
+
+    /* Protected sockets made ahead by the pool thread (NULL = always inline) */
+    socket_pool_shard_t *sockets;
 
     /* JNI references for socket protection */
     JNIEnv *env;
@@ -68,38 +177,64 @@ typedef struct {
 
 /*
  * Initialize the TCP relay.
+ * split_markers overrides split_pos when set (NULL or "" = use split_pos).
+ * Hostlists are borrowed and must outlive the relay; either may be NULL.
+ * With defer_syn_ack the app's SYN is answered when the server connect
+ * completes (and refused with RST if it fails); otherwise right away,
+ * and early app data is held until the connect completes.
+ * Session sockets are added to epoll_fd with data.ptr = the session;
+ * packets for the app go through tun_out, which must outlive the relay.
+ * max_sessions caps concurrent sessions (<= 0 = TCP_MAX_SESSIONS); their
+ * memory is allocated as they open.
+ * Returns 0, or -1 if the session table cannot be allocated.
  */
-void tcp_relay_init(tcp_relay_t *relay, int tun_fd,
-                    int split_pos, bool use_disorder,
-                    JNIEnv *env, jobject vpn_service);
+int tcp_relay_init(tcp_relay_t *relay, tun_out_t *tun_out, int epoll_fd,
+                   int split_pos, const char *split_markers,
+                   bool use_disorder, bool defer_syn_ack,
+                   const dpi_hostlist_t *hostlist,
+                   const dpi_hostlist_t *hostlist_exclude,
+                   int max_sessions,
+                   JNIEnv *env, jobject vpn_service);
 
 /*
  * Process an outgoing TCP packet from the TUN (app → internet).
- * Handles SYN, data, FIN, RST.
+ * Handles SYN, data, FIN, RST. Addresses may be IPv4 or IPv6.
+ * window is the raw header field; opts may be NULL when the segment
+ * carries no options.
  */
 void tcp_relay_process(tcp_relay_t *relay,
-                       uint32_t src_addr, uint32_t dst_addr,
+                       const dpi_addr_t *src_addr, const dpi_addr_t *dst_addr,
                        uint16_t src_port, uint16_t dst_port,
                        uint32_t seq, uint32_t ack,
-                       uint8_t flags,
+                       uint8_t flags, uint16_t window,
+                       const dpi_tcp_opts_t *opts,
                        const uint8_t *payload, int payload_len);
 
 /*
- * Check a relay socket fd for incoming response data.
- * Reads from server, constructs IP+TCP response, writes to TUN.
- * Returns: 1 if data was processed, 0 if fd doesn't belong to relay, -1 on error.
+ * Handle a readiness event on a session socket (the epoll data.ptr and
+ * events). Completes a pending connect or drains the send queue on
+ * EPOLLOUT, then reads as much from the server as the app's window
+ * admits and writes it to the TUN in MSS-sized segments.
+ * Returns: 1 if data was processed, 0 if the session is already closed,
+ * -1 on error (the session is closed).
  */
-int tcp_relay_handle_response(tcp_relay_t *relay, int fd);
+int tcp_relay_handle_response(tcp_relay_t *relay, tcp_session_t *session,
+                              uint32_t events);
 
 /*
- * Get all active session fds for epoll registration.
+ * Run due retransmission timers and reset sessions that outlived their
+ * state's timeout (TCP_CONNECT/IDLE/FIN_TIMEOUT), then free the slots
+ * of closed sessions for reuse and return idle session memory. Call
+ * after every epoll_wait, once its events are handled; timers run at
+ * most every TCP_TIMER_TICK_MS.
  */
-int tcp_relay_get_fds(tcp_relay_t *relay, int *out_fds, int max_fds);
+void tcp_relay_timers(tcp_relay_t *relay);
 
 /*
- * Clean up expired sessions.
+ * epoll_wait timeout that keeps tcp_relay_timers on time: until the next
+ * timer falls due, at most idle_ms.
  */
-void tcp_relay_cleanup(tcp_relay_t *relay);
+int tcp_relay_poll_timeout(const tcp_relay_t *relay, int idle_ms);
 
 /*
  * Destroy all sessions.
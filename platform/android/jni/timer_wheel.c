@@ -0,0 +1,208 @@
+/*
+ * timer_wheel.c — hierarchical timing wheel for the relays' session timers
+ */
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK  (TIMER_WHEEL_SLOTS - 1)
+#define MAX_DELTA  ((1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+static inline void list_init(timer_node_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static inline bool list_empty(const timer_node_t *head)
+{
+    return head->next == head;
+}
+
+static inline void list_add_tail(timer_node_t *head, timer_node_t *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+/* Move all of src onto the (empty) head dst */
+static inline void list_splice(timer_node_t *src, timer_node_t *dst)
+{
+    if (list_empty(src)) {
+        list_init(dst);
+        return;
+    }
+    dst->next = src->next;
+    dst->prev = src->prev;
+    dst->next->prev = dst;
+    dst->prev->next = dst;
+    list_init(src);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Slots                                                              */
+/* ------------------------------------------------------------------ */
+
+/* Place t by how far its expiry is from the current tick */
+static void insert(timer_wheel_t *w, timer_node_t *t)
+{
+    uint64_t delta = t->expires - w->tick;
+    if (delta > MAX_DELTA) {
+        t->expires = w->tick + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ull << (TIMER_WHEEL_BITS * (level + 1))))
+        level++;
+
+    unsigned slot = (unsigned)(t->expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    t->where = (uint16_t)(level * TIMER_WHEEL_SLOTS + slot);
+    list_add_tail(&w->slots[level][slot], t);
+    w->occupied[level] |= 1ull << slot;
+}
+
+static void unlink_node(timer_wheel_t *w, timer_node_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = NULL;
+    t->next = NULL;
+
+    unsigned level = t->where / TIMER_WHEEL_SLOTS;
+    unsigned slot  = t->where % TIMER_WHEEL_SLOTS;
+    if (list_empty(&w->slots[level][slot]))
+        w->occupied[level] &= ~(1ull << slot);
+}
+
+/* Redistribute one slot of a higher level over the levels below */
+static void cascade(timer_wheel_t *w, int level, unsigned slot)
+{
+    timer_node_t list;
+
+    list_splice(&w->slots[level][slot], &list);
+    w->occupied[level] &= ~(1ull << slot);
+
+    while (!list_empty(&list)) {
+        timer_node_t *t = list.next;
+        t->prev->next = t->next;
+        t->next->prev = t->prev;
+        insert(w, t);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  API                                                                */
+/* ------------------------------------------------------------------ */
+
+void timer_wheel_init(timer_wheel_t *w, int64_t now_ms, uint32_t tick_ms)
+{
+    for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        for (int s = 0; s < TIMER_WHEEL_SLOTS; s++)
+            list_init(&w->slots[l][s]);
+        w->occupied[l] = 0;
+    }
+    w->tick    = 0;
+    w->base_ms = now_ms;
+    w->tick_ms = tick_ms;
+    w->count   = 0;
+}
+
+void timer_arm(timer_wheel_t *w, timer_node_t *t, int64_t deadline_ms)
+{
+    if (timer_armed(t))
+        unlink_node(w, t);
+    else
+        w->count++;
+
+    /* Round up: never fire before the deadline */
+    int64_t rel = deadline_ms - w->base_ms;
+    uint64_t expires = rel > 0 ? ((uint64_t)rel + w->tick_ms - 1) / w->tick_ms : 0;
+    t->expires = expires > w->tick ? expires : w->tick + 1;
+    insert(w, t);
+}
+
+void timer_cancel(timer_wheel_t *w, timer_node_t *t)
+{
+    if (!timer_armed(t))
+        return;
+    unlink_node(w, t);
+    w->count--;
+}
+
+void timer_wheel_advance(timer_wheel_t *w, int64_t now_ms, void *ctx)
+{
+    if (now_ms < w->base_ms)
+        return;
+    uint64_t target = (uint64_t)(now_ms - w->base_ms) / w->tick_ms;
+
+    while (w->tick < target) {
+        if (w->count == 0) {
+            w->tick = target;
+            break;
+        }
+        w->tick++;
+
+        /* Lower levels first: each wraps once per turn of the one above */
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if ((w->tick >> (TIMER_WHEEL_BITS * (level - 1))) & SLOT_MASK)
+                break;
+            cascade(w, level, (unsigned)(w->tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK);
+        }
+
+        unsigned slot = (unsigned)w->tick & SLOT_MASK;
+        if (!(w->occupied[0] & (1ull << slot)))
+            continue;
+
+        /*
+         * Detach the slot first: callbacks may cancel timers still on it
+         * (a session closing drops both of its timers) or arm new ones.
+         */
+        timer_node_t due;
+        list_splice(&w->slots[0][slot], &due);
+        w->occupied[0] &= ~(1ull << slot);
+
+        while (!list_empty(&due)) {
+            timer_node_t *t = due.next;
+            t->prev->next = t->next;
+            t->next->prev = t->prev;
+            t->prev = NULL;
+            t->next = NULL;
+            w->count--;
+            t->fn(t, ctx, now_ms);
+        }
+    }
+}
+
+int timer_wheel_timeout(const timer_wheel_t *w, int64_t now_ms, int max_ms)
+{
+    if (w->count == 0)
+        return max_ms;
+
+    /* Next occupied level-0 slot within one turn */
+    uint64_t ticks = UINT64_MAX;
+    unsigned from = (unsigned)(w->tick + 1) & SLOT_MASK;
+    uint64_t bits = w->occupied[0];
+    if (bits) {
+        uint64_t rot = from ? (bits >> from) | (bits << (TIMER_WHEEL_SLOTS - from)) : bits;
+        ticks = 1 + (uint64_t)__builtin_ctzll(rot);
+    }
+
+    /* Anything higher up: wake for the next cascade and look again */
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (w->occupied[level]) {
+            uint64_t wrap = TIMER_WHEEL_SLOTS - (w->tick & SLOT_MASK);
+            if (wrap < ticks)
+                ticks = wrap;
+            break;
+        }
+    }
+
+    int64_t due_ms = w->base_ms + (int64_t)((w->tick + ticks) * w->tick_ms);
+    int64_t wait = due_ms - now_ms;
+    if (wait < 0)
+        return 0;
+    return wait < max_ms ? (int)wait : max_ms;
+}
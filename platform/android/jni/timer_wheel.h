@@ -0,0 +1,79 @@
+/*
+ * timer_wheel.h — hierarchical timing wheel for the relays' session timers
+ *
+ * Four levels of 64 slots; level n holds timers due within 64^(n+1)
+ * ticks and is cascaded into the level below when the lower one wraps.
+ * Arming and cancelling are O(1): timers are intrusive list nodes
+ * embedded in the sessions, so a relay with thousands of sessions pays
+ * only for the timers that actually fall due.
+ *
+ * Timers fire on the tick after their deadline at the latest; with the
+ * TCP relay's 20 ms tick the wheel spans about 93 hours, and later
+ * deadlines are clamped to that.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS  4
+
+struct timer_node;
+
+/* Called with the timer already disarmed; it may re-arm it or close the session */
+typedef void (*timer_fn)(struct timer_node *t, void *ctx, int64_t now_ms);
+
+typedef struct timer_node {
+    struct timer_node *next;
+    struct timer_node *prev;   /* NULL = not armed */
+    uint64_t expires;          /* tick */
+    uint16_t where;            /* level * TIMER_WHEEL_SLOTS + slot */
+    timer_fn fn;
+} timer_node_t;
+
+typedef struct {
+    timer_node_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; /* list heads */
+    uint64_t occupied[TIMER_WHEEL_LEVELS];  /* bit per non-empty slot */
+    uint64_t tick;             /* last tick processed */
+    int64_t  base_ms;          /* time of tick 0 */
+    uint32_t tick_ms;
+    uint32_t count;            /* armed timers */
+} timer_wheel_t;
+
+/* Session owning the embedded timer ptr (its member field) */
+#define timer_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+void timer_wheel_init(timer_wheel_t *w, int64_t now_ms, uint32_t tick_ms);
+
+/* A zeroed node is valid and disarmed; this only sets the callback */
+static inline void timer_init(timer_node_t *t, timer_fn fn)
+{
+    t->prev = NULL;
+    t->fn   = fn;
+}
+
+static inline bool timer_armed(const timer_node_t *t)
+{
+    return t->prev != NULL;
+}
+
+/* Arm, or move an armed timer, to fire at deadline_ms */
+void timer_arm(timer_wheel_t *w, timer_node_t *t, int64_t deadline_ms);
+void timer_cancel(timer_wheel_t *w, timer_node_t *t);
+
+/* Fire everything due by now_ms, passing ctx to the callbacks */
+void timer_wheel_advance(timer_wheel_t *w, int64_t now_ms, void *ctx);
+
+/*
+ * Milliseconds until the wheel next has work (a timer due or a level to
+ * cascade), at most max_ms: the epoll timeout for the relay's loop.
+ */
+int timer_wheel_timeout(const timer_wheel_t *w, int64_t now_ms, int max_ms);
+
+#endif /* TIMER_WHEEL_H */
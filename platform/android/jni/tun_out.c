@@ -0,0 +1,89 @@
+/*
+ * tun_out.c — where the relays write packets bound for the app
+ */
+
+#include "tun_out.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <android/log.h>
+
+#define TAG "tun-out"
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+
+void tun_out_init_direct(tun_out_t *out, int tun_fd)
+{
+    memset(out, 0, sizeof(*out));
+    out->fd      = tun_fd;
+    out->wake_fd = -1;
+}
+
+void tun_out_init_ring(tun_out_t *out, spsc_ring_t *ring, int wake_fd, int tun_fd)
+{
+    memset(out, 0, sizeof(*out));
+    out->fd      = tun_fd;
+    out->ring    = ring;
+    out->wake_fd = wake_fd;
+}
+
+/* Straight to the TUN; the first failure is logged, the rest only counted */
+static void write_direct(tun_out_t *out, const struct iovec *iov, int iovcnt)
+{
+    if (writev(out->fd, iov, iovcnt) >= 0)
+        return;
+    if (out->write_errors++ == 0)
+        LOGE("TUN write: %s", strerror(errno));
+}
+
+void tun_out_writev(tun_out_t *out, const struct iovec *iov, int iovcnt)
+{
+    if (!out->ring) {
+        write_direct(out, iov, iovcnt);
+        return;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+    if (total > out->ring->slot_size) {
+        /* Rare (UDP responses beyond a slot): not worth 64 KB slots */
+        write_direct(out, iov, iovcnt);
+        return;
+    }
+
+    uint8_t *slot = spsc_ring_reserve(out->ring);
+    if (!slot) {
+        /* Let the writer catch up before the next packet */
+        tun_out_flush(out);
+        out->drops++;
+        return;
+    }
+
+    uint32_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0)
+            continue;
+        memcpy(slot + len, iov[i].iov_base, iov[i].iov_len);
+        len += (uint32_t)iov[i].iov_len;
+    }
+    spsc_ring_commit(out->ring, len);
+    out->pending = true;
+}
+
+void tun_out_write(tun_out_t *out, const uint8_t *pkt, int len)
+{
+    struct iovec iov = { .iov_base = (void *)pkt, .iov_len = (size_t)len };
+    tun_out_writev(out, &iov, 1);
+}
+
+void tun_out_flush(tun_out_t *out)
+{
+    if (!out->pending)
+        return;
+
+    /* Can only fail on a saturated counter, i.e. a wakeup already pending */
+    uint64_t one = 1;
+    write(out->wake_fd, &one, sizeof(one));
+    out->pending = false;
+}
@@ -0,0 +1,45 @@
+/*
+ * tun_out.h — where the relays write packets bound for the app
+ *
+ * Either straight to the TUN fd, or into a shard's outbound ring that
+ * the TUN thread drains. In ring mode the writer is woken through an
+ * eventfd at most once per tun_out_flush, not once per packet, and a
+ * packet too large for a ring slot (a big UDP response) bypasses the
+ * ring with a direct write.
+ */
+
+#ifndef TUN_OUT_H
+#define TUN_OUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#include "spsc_ring.h"
+
+typedef struct {
+    int          fd;        /* TUN fd: every packet in direct mode, oversize ones in ring mode */
+    spsc_ring_t *ring;      /* outbound ring (ring mode) */
+    int          wake_fd;   /* eventfd the TUN thread waits on */
+    bool         pending;   /* committed since the last flush */
+    uint32_t     drops;     /* packets lost to a full ring */
+    uint32_t     write_errors; /* packets the TUN fd refused */
+} tun_out_t;
+
+void tun_out_init_direct(tun_out_t *out, int tun_fd);
+void tun_out_init_ring(tun_out_t *out, spsc_ring_t *ring, int wake_fd, int tun_fd);
+
+/*
+ * Write one packet gathered from iov. A packet that meets a full ring,
+ * or that the TUN refuses (the fd is non-blocking), is dropped: TCP
+ * retransmits it and UDP was never reliable.
+ */
+void tun_out_writev(tun_out_t *out, const struct iovec *iov, int iovcnt);
+
+/* Write one contiguous packet (e.g. built in a pkt_pool buffer); same rules */
+void tun_out_write(tun_out_t *out, const uint8_t *pkt, int len);
+
+/* Wake the TUN thread if anything was queued since the last flush */
+void tun_out_flush(tun_out_t *out);
+
+#endif /* TUN_OUT_H */
@@ -2,8 +2,9 @@
  * udp_relay.c — Android UDP relay with QUIC fake injection
  */
 
+#define _GNU_SOURCE   /* recvmmsg, sendmmsg */
+
 #include "udp_relay.h"
-#include "dpi_bypass.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,8 @@
 #include <errno.h>
 #include <time.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <android/log.h>
 
@@ -18,70 +21,82 @@
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
 
-#define MAX_PKT_SIZE 65536
 
-static int64_t monotonic_seconds(void)
+/* Client Initials of one connection collected until the SNI is known */
+struct udp_quic_pending {
+    dpi_quic_crypto_t crypto;
+    int      held_count;
+    int      held_len[UDP_QUIC_MAX_HELD];
+    uint8_t *held[UDP_QUIC_MAX_HELD];
+    int64_t  deadline_ms;   /* released undecided after this */
+};
+
+static int64_t monotonic_ms(void)
 {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (int64_t)ts.tv_sec;
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_timer(timer_node_t *t, void *ctx, int64_t now_ms);
+static void on_dns_timer(timer_node_t *t, void *ctx, int64_t now_ms);
+
+/* When the session's timer should next fire: idle expiry or the QUIC hold */
+static int64_t session_deadline_ms(const udp_session_t *session)
+{
+    int timeout = session->dst_port == 53 ? UDP_DNS_TIMEOUT : UDP_IDLE_TIMEOUT;
+    int64_t deadline = session->last_activity_ms + (int64_t)timeout * 1000;
+    if (session->quic_pending && session->quic_pending->deadline_ms < deadline)
+        deadline = session->quic_pending->deadline_ms;
+    return deadline;
 }
 
 /* Find existing session or return NULL */
 static udp_session_t *find_session(udp_relay_t *relay,
-                                   uint16_t src_port, uint32_t dst_addr, uint16_t dst_port)
+                                   uint16_t src_port, const dpi_addr_t *dst_addr,
+                                   uint16_t dst_port)
 {
-    for (int i = 0; i < relay->session_count; i++) {
-        udp_session_t *s = &relay->sessions[i];
-        if (s->active &&
-            s->src_port == src_port &&
-            s->dst_addr == dst_addr &&
-            s->dst_port == dst_port) {
-            return s;
-        }
-    }
-    return NULL;
+    session_key_t key = { .dst_addr = *dst_addr, .src_port = src_port, .dst_port = dst_port };
+    int index = session_table_find(&relay->table, &key);
+    return index < 0 ? NULL : session_pool_get(&relay->pool, index);
 }
 
-/* Find session by its socket fd */
-static udp_session_t *find_session_by_fd(udp_relay_t *relay, int fd)
+static socklen_t fill_sockaddr(struct sockaddr_storage *ss,
+                               const dpi_addr_t *addr, uint16_t port)
 {
-    for (int i = 0; i < relay->session_count; i++) {
-        if (relay->sessions[i].active && relay->sessions[i].fd == fd)
-            return &relay->sessions[i];
+    memset(ss, 0, sizeof(*ss));
+    if (dpi_addr_is_ipv4(addr)) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sin->sin_addr.s_addr = htonl(dpi_addr_to_ipv4(addr));
+        return sizeof(*sin);
     }
-    return NULL;
+
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons(port);
+    memcpy(&sin6->sin6_addr, addr->b, 16);
+    return sizeof(*sin6);
 }
 
 /* Create a protected UDP socket and connect it to dst */
 static int create_protected_socket(udp_relay_t *relay,
-                                   uint32_t dst_addr, uint16_t dst_port)
+                                   const dpi_addr_t *dst_addr, uint16_t dst_port)
 {
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        LOGE("socket(SOCK_DGRAM): %s", strerror(errno));
-        return -1;
-    }
+    struct sockaddr_storage dst;
+    socklen_t dst_len = fill_sockaddr(&dst, dst_addr, dst_port);
 
-    /* Protect socket from VPN routing (bypass the tunnel) */
-    jboolean ok = (*relay->env)->CallBooleanMethod(relay->env,
-                                                    relay->vpn_service,
-                                                    relay->protect_method,
-                                                    fd);
-    if (!ok) {
-        LOGE("VpnService.protect() failed for fd=%d", fd);
-        close(fd);
+    /* Already protected, unless the pool has run dry */
+    socket_kind_t kind = socket_pool_kind(false, dst.ss_family == AF_INET);
+    int fd = relay->sockets ? socket_pool_take(relay->sockets, kind) : -1;
+    if (fd < 0)
+        fd = socket_pool_create(relay->env, relay->vpn_service, relay->protect_method, kind);
+    if (fd < 0)
         return -1;
-    }
 
     /* Connect to destination so recv() returns only packets from this peer */
-    struct sockaddr_in dst;
-    memset(&dst, 0, sizeof(dst));
-    dst.sin_family = AF_INET;
-    dst.sin_port = htons(dst_port);
-    dst.sin_addr.s_addr = htonl(dst_addr);
-
-    if (connect(fd, (struct sockaddr *)&dst, sizeof(dst)) < 0) {
+    if (connect(fd, (struct sockaddr *)&dst, dst_len) < 0) {
         LOGE("connect(udp): %s", strerror(errno));
         close(fd);
         return -1;
@@ -92,160 +107,853 @@ static int create_protected_socket(udp_relay_t *relay,
 
 /* Create or get existing session */
 static udp_session_t *get_or_create_session(udp_relay_t *relay,
-                                            uint16_t src_port,
-                                            uint32_t dst_addr, uint16_t dst_port)
+                                            const dpi_addr_t *src_addr, uint16_t src_port,
+                                            const dpi_addr_t *dst_addr, uint16_t dst_port)
 {
     udp_session_t *s = find_session(relay, src_port, dst_addr, dst_port);
     if (s) {
-        s->last_activity = monotonic_seconds();
+        s->last_activity_ms = monotonic_ms();
         return s;
     }
 
-    /* Find a free slot (reuse inactive) */
-    udp_session_t *slot = NULL;
-    for (int i = 0; i < relay->session_count; i++) {
-        if (!relay->sessions[i].active) {
-            slot = &relay->sessions[i];
-            break;
-        }
-    }
-    if (!slot) {
-        if (relay->session_count >= UDP_MAX_SESSIONS) {
-            LOGE("UDP session limit reached (%d)", UDP_MAX_SESSIONS);
-            return NULL;
-        }
-        slot = &relay->sessions[relay->session_count++];
+    int index = session_pool_alloc(&relay->pool);
+    if (index < 0) {
+        LOGE("UDP session limit reached (%d)", relay->pool.capacity);
+        return NULL;
     }
 
+    udp_session_t *slot = session_pool_get(&relay->pool, index);
     int fd = create_protected_socket(relay, dst_addr, dst_port);
-    if (fd < 0)
+    if (fd >= 0) {
+        /* Registered once for the socket's lifetime; events carry the session */
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = slot };
+        if (epoll_ctl(relay->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("epoll_ctl(ADD, udp fd=%d): %s", fd, strerror(errno));
+            close(fd);
+            fd = -1;
+        }
+    }
+    session_key_t key = { .dst_addr = *dst_addr, .src_port = src_port, .dst_port = dst_port };
+    if (fd >= 0 && session_table_insert(&relay->table, &key, index) < 0) {
+        LOGE("Cannot grow the UDP session table");
+        epoll_ctl(relay->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        session_pool_release(&relay->pool, index);
         return NULL;
+    }
 
+    slot->kind          = SESSION_KIND_UDP;
+    slot->pool_index    = index;
     slot->src_port      = src_port;
-    slot->dst_addr      = dst_addr;
+    slot->dst_addr      = *dst_addr;
     slot->dst_port      = dst_port;
+    slot->app_addr      = *src_addr;
+    dpi_template_init_udp(&slot->tun_hdr, dst_addr, src_addr, dst_port, src_port);
     slot->fd            = fd;
-    slot->last_activity = monotonic_seconds();
+    slot->last_activity_ms = monotonic_ms();
     slot->active        = true;
+    slot->quic_desync   = -1;
+    slot->quic_pending  = NULL;
+    slot->quic_dcid_len = 0;
+    slot->quic_bursts   = 0;
+    slot->quic_moved_on = false;
+    timer_init(&slot->timer, on_timer);
+    timer_arm(&relay->timers, &slot->timer, session_deadline_ms(slot));
 
     return slot;
 }
 
-/* Send fake QUIC packets with low TTL, then the original */
+/* sendmmsg until all of msgs went out; a datagram the socket refuses is dropped */
+static void send_batch(udp_relay_t *relay, int fd, struct mmsghdr *msgs, int count)
+{
+    int sent = 0;
+
+    while (sent < count) {
+        int n = sendmmsg(fd, msgs + sent, count - sent, MSG_DONTWAIT);
+        relay->tx_calls++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            n = 1;   /* skip the datagram it failed on, like send() did */
+        } else {
+            relay->tx_datagrams += n;
+        }
+        sent += n;
+    }
+}
+
+/* Set TTL (IPv4) or hop limit (IPv6) for subsequent sends */
+static void set_socket_ttl(udp_session_t *session, int ttl)
+{
+    if (dpi_addr_is_ipv4(&session->dst_addr))
+        setsockopt(session->fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+    else
+        setsockopt(session->fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
+}
+
+/* One IP_TTL or IPV6_HOPLIMIT control message */
+typedef union {
+    struct cmsghdr hdr;
+    uint8_t buf[CMSG_SPACE(sizeof(int))];
+} ttl_cmsg_t;
+
+static void set_msg(struct mmsghdr *msg, struct iovec *iov, ttl_cmsg_t *ctl)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_hdr.msg_iov    = iov;
+    msg->msg_hdr.msg_iovlen = 1;
+    if (ctl) {
+        msg->msg_hdr.msg_control    = ctl->buf;
+        msg->msg_hdr.msg_controllen = sizeof(ctl->buf);
+    }
+}
+
+/*
+ * Send fake_repeats fakes at the fake TTL, then dgrams at the socket's
+ * own TTL, in one sendmmsg. The fake TTL rides on each fake as a control
+ * message, so the socket is never reconfigured. Kernels that reject IP_TTL
+ * in sendmsg (before 3.13) are detected on the first fake and get the
+ * fakes between two setsockopt calls instead.
+ */
 static void send_with_fakes(udp_relay_t *relay, udp_session_t *session,
-                            const uint8_t *payload, int payload_len)
+                            struct iovec *dgrams, int count)
+{
+    struct mmsghdr msgs[UDP_TX_BATCH];
+    struct iovec fake = { (void *)relay->fake_payload, (size_t)relay->fake_len };
+    ttl_cmsg_t ctl;
+    int fakes = relay->fake_repeats;
+    int m = 0;
+
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.hdr.cmsg_len = CMSG_LEN(sizeof(int));
+    if (dpi_addr_is_ipv4(&session->dst_addr)) {
+        ctl.hdr.cmsg_level = IPPROTO_IP;
+        ctl.hdr.cmsg_type  = IP_TTL;
+    } else {
+        ctl.hdr.cmsg_level = IPPROTO_IPV6;
+        ctl.hdr.cmsg_type  = IPV6_HOPLIMIT;
+    }
+    memcpy(CMSG_DATA(&ctl.hdr), &relay->fake_ttl, sizeof(int));
+
+    if (relay->ttl_cmsg < 0 && fakes > 0) {
+        set_msg(&msgs[0], &fake, &ctl);
+        int ret = sendmsg(session->fd, &msgs[0].msg_hdr, MSG_DONTWAIT);
+        relay->tx_calls++;
+        if (ret < 0 && errno == EINVAL) {
+            LOGD("Kernel rejects per-datagram TTL, setting it on the socket instead");
+            relay->ttl_cmsg = 0;
+        } else {
+            relay->ttl_cmsg = 1;
+            relay->tx_datagrams += ret >= 0;
+            fakes--;
+        }
+    }
+    if (relay->ttl_cmsg == 0) {
+        set_socket_ttl(session, relay->fake_ttl);
+        for (; fakes > 0; fakes--)
+            send(session->fd, relay->fake_payload, relay->fake_len, 0);
+        set_socket_ttl(session, 64);
+    }
+
+    for (int i = 0; i < fakes + count; i++) {
+        if (m == UDP_TX_BATCH) {
+            send_batch(relay, session->fd, msgs, m);
+            m = 0;
+        }
+        if (i < fakes)
+            set_msg(&msgs[m++], &fake, &ctl);
+        else
+            set_msg(&msgs[m++], &dgrams[i - fakes], NULL);
+    }
+    send_batch(relay, session->fd, msgs, m);
+}
+
+static void free_quic_pending(udp_session_t *session)
+{
+    struct udp_quic_pending *p = session->quic_pending;
+    if (!p)
+        return;
+    for (int i = 0; i < p->held_count; i++)
+        free(p->held[i]);
+    free(p);
+    session->quic_pending = NULL;
+}
+
+/* Unindex the session and return its slot to the table */
+static void close_session(udp_relay_t *relay, udp_session_t *session)
+{
+    /* Queued datagrams point at this session */
+    udp_relay_flush(relay);
+
+    session_key_t key = { .dst_addr = session->dst_addr,
+                          .src_port = session->src_port,
+                          .dst_port = session->dst_port };
+    session_table_remove(&relay->table, &key);
+    session_pool_release(&relay->pool, session->pool_index);
+
+    free_quic_pending(session);
+    timer_cancel(&relay->timers, &session->timer);
+    epoll_ctl(relay->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    session->active = false;
+}
+
+/* Whether the attempt gets (another) fake burst: up to fake_bursts, never once it moved on */
+static bool quic_take_burst(udp_relay_t *relay, udp_session_t *session)
+{
+    if (session->quic_moved_on || session->quic_bursts >= relay->fake_bursts) {
+        relay->quic_passed++;
+        return false;
+    }
+    session->quic_bursts++;
+    relay->quic_faked++;
+    return true;
+}
+
+/*
+ * Send the held Initials (and payload, if any) preceded by fakes when
+ * the session was judged eligible and its attempt has a burst left,
+ * then drop the reassembly state.
+ */
+static void release_quic_pending(udp_relay_t *relay, udp_session_t *session,
+                                 const uint8_t *payload, int payload_len)
+{
+    struct udp_quic_pending *p = session->quic_pending;
+    struct iovec iov[UDP_QUIC_MAX_HELD + 1];
+    int count = 0;
+
+    if (p) {
+        for (int i = 0; i < p->held_count; i++)
+            iov[count++] = (struct iovec){ p->held[i], (size_t)p->held_len[i] };
+    }
+    if (payload)
+        iov[count++] = (struct iovec){ (void *)payload, (size_t)payload_len };
+
+    if (session->quic_desync == 1 && quic_take_burst(relay, session)) {
+        send_with_fakes(relay, session, iov, count);
+    } else {
+        struct mmsghdr msgs[UDP_QUIC_MAX_HELD + 1];
+        for (int i = 0; i < count; i++)
+            set_msg(&msgs[i], &iov[i], NULL);
+        send_batch(relay, session->fd, msgs, count);
+    }
+
+    free_quic_pending(session);
+}
+
+/* Decide on fakes once the ClientHello SNI is known (or unobtainable) */
+static void handle_quic_initial(udp_relay_t *relay, udp_session_t *session,
+                                const uint8_t *payload, int payload_len)
+{
+    if (session->quic_desync >= 0) {
+        /* Retransmitted Initial: same verdict as before */
+        release_quic_pending(relay, session, payload, payload_len);
+        return;
+    }
+
+    struct udp_quic_pending *p = session->quic_pending;
+    if (!p) {
+        p = calloc(1, sizeof(*p));
+        if (!p) {
+            session->quic_desync = dpi_hostlist_allows(relay->hostlist,
+                                                       relay->hostlist_exclude, NULL, 0);
+            release_quic_pending(relay, session, payload, payload_len);
+            return;
+        }
+        dpi_quic_crypto_init(&p->crypto);
+        p->deadline_ms = monotonic_ms() + UDP_QUIC_HOLD_MS;
+        session->quic_pending = p;
+        timer_arm(&relay->timers, &session->timer, session_deadline_ms(session));
+    }
+
+    dpi_tls_hello_t hello;
+    int ret = DPI_TLS_INVALID;
+    if (dpi_quic_crypto_add(&p->crypto, payload, payload_len) == 0)
+        ret = dpi_quic_crypto_hello(&p->crypto, &hello);
+
+    if (ret == DPI_TLS_INCOMPLETE && p->held_count < UDP_QUIC_MAX_HELD) {
+        uint8_t *copy = malloc(payload_len);
+        if (copy) {
+            memcpy(copy, payload, payload_len);
+            p->held[p->held_count] = copy;
+            p->held_len[p->held_count] = payload_len;
+            p->held_count++;
+            return;
+        }
+    }
+
+    if (ret == DPI_TLS_OK && hello.host_off >= 0) {
+        const char *host = (const char *)p->crypto.data + hello.host_off;
+        session->quic_desync = dpi_hostlist_allows(relay->hostlist, relay->hostlist_exclude,
+                                                   host, hello.host_len);
+        LOGD("QUIC Initial SNI %.*s: %s", hello.host_len, host,
+             session->quic_desync ? "injecting fakes" : "passing through");
+    } else {
+        session->quic_desync = dpi_hostlist_allows(relay->hostlist,
+                                                   relay->hostlist_exclude, NULL, 0);
+    }
+
+    release_quic_pending(relay, session, payload, payload_len);
+}
+
+/*
+ * Follow the session's QUIC connection attempt from a client Initial.
+ * A new DCID starts a new attempt unless the server has answered, since
+ * the client's later Initials carry the DCID the server chose. An
+ * Initial coalesced with a Handshake or 1-RTT packet has moved on.
+ */
+static void quic_track_initial(udp_relay_t *relay, udp_session_t *session,
+                               const uint8_t *payload, int payload_len)
 {
-    /* Set low TTL for fakes */
-    int ttl = relay->fake_ttl;
-    setsockopt(session->fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+    const uint8_t *dcid;
+    int dcid_len;
+    if (!dpi_quic_initial_dcid(payload, payload_len, &dcid, &dcid_len))
+        return;
+
+    bool same = dcid_len == session->quic_dcid_len &&
+                memcmp(dcid, session->quic_dcid, dcid_len) == 0;
+    if (!same && !(session->quic_dcid_len && session->quic_moved_on)) {
+        if (session->quic_pending) {
+            /* The previous attempt was abandoned before its SNI completed */
+            session->quic_desync = dpi_hostlist_allows(relay->hostlist,
+                                                       relay->hostlist_exclude, NULL, 0);
+            release_quic_pending(relay, session, NULL, 0);
+        }
+        memcpy(session->quic_dcid, dcid, dcid_len);
+        session->quic_dcid_len = (uint8_t)dcid_len;
+        session->quic_bursts   = 0;
+        session->quic_moved_on = false;
+        session->quic_desync   = -1;
+    }
+
+    int end = dpi_quic_initial_len(payload, payload_len);
+    if (end > 0 && end < payload_len &&
+        dpi_quic_past_initial(payload + end, payload_len - end))
+        session->quic_moved_on = true;
+}
+
+/* ------------------------------------------------------------------ */
+/*  DNS fast path                                                      */
+/* ------------------------------------------------------------------ */
 
-    /* Send N fake packets */
-    for (int i = 0; i < relay->fake_repeats; i++) {
-        send(session->fd, relay->fake_payload, relay->fake_len, 0);
+/* An upstream transaction id no flight is using (xorshift32) */
+static uint16_t dns_upstream_id(udp_relay_t *relay)
+{
+    for (;;) {
+        uint32_t x = relay->dns_rand;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        relay->dns_rand = x;
+
+        uint16_t id = (uint16_t)(x >> 16);
+        bool taken = false;
+        for (int i = 0; i < UDP_DNS_FLIGHTS && !taken; i++)
+            taken = relay->dns_flights[i].active && relay->dns_flights[i].upstream_id == id;
+        if (!taken)
+            return id;
     }
+}
+
+/* The next shared upstream socket for the family, opened on first use */
+static udp_dns_socket_t *dns_upstream(udp_relay_t *relay, bool ipv4)
+{
+    udp_dns_socket_t *sock = &relay->dns_up[ipv4 ? 0 : 1][relay->dns_next_up];
+    relay->dns_next_up = (relay->dns_next_up + 1) % UDP_DNS_UPSTREAMS;
+    if (sock->fd >= 0)
+        return sock;
+
+    socket_kind_t kind = socket_pool_kind(false, ipv4);
+    int fd = relay->sockets ? socket_pool_take(relay->sockets, kind) : -1;
+    if (fd < 0)
+        fd = socket_pool_create(relay->env, relay->vpn_service, relay->protect_method, kind);
+    if (fd < 0)
+        return NULL;
 
-    /* Restore normal TTL and send original */
-    ttl = 64;
-    setsockopt(session->fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
-    send(session->fd, payload, payload_len, 0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = sock };
+    if (epoll_ctl(relay->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOGE("epoll_ctl(ADD, dns fd=%d): %s", fd, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    sock->fd = fd;
+    return sock;
 }
 
-void udp_relay_init(udp_relay_t *relay, int tun_fd,
-                    const uint8_t *fake_payload, int fake_len,
-                    int fake_ttl, int fake_repeats,
-                    JNIEnv *env, jobject vpn_service)
+/* Write a DNS message from server:53 to the app in a TUN packet built at pkt */
+static void dns_emit(udp_relay_t *relay, const dpi_addr_t *server,
+                     const dpi_addr_t *app_addr, uint16_t app_port,
+                     uint8_t *payload, int len)
+{
+    dpi_hdr_template_t hdr;
+    dpi_template_init_udp(&hdr, server, app_addr, DNS_PORT, app_port);
+
+    uint8_t *pkt = payload - hdr.hdr_len;
+    int pkt_len = dpi_template_build_udp(&hdr, pkt, hdr.hdr_len + len, payload, len);
+    if (pkt_len > 0)
+        tun_out_write(relay->tun_out, pkt, pkt_len);
+}
+
+/*
+ * Handle a query to dst:53 without a session: answer it from the cache,
+ * add it to an identical query already upstream, or send it upstream.
+ * Returns false to leave it to an ordinary session (not a plain query,
+ * too many in flight, no upstream socket).
+ */
+static bool dns_fast_path(udp_relay_t *relay,
+                          const dpi_addr_t *src_addr, const dpi_addr_t *dst_addr,
+                          uint16_t src_port, const uint8_t *payload, int payload_len)
+{
+    dns_query_t q;
+    if (dns_parse_query(payload, payload_len, dst_addr, DNS_PORT, &q) < 0)
+        return false;
+
+    int64_t now = monotonic_ms();
+    uint8_t *buf = pkt_pool_get(&relay->bufs);
+    if (buf) {
+        int len = dns_cache_answer(&relay->dns_cache, &q, payload, pkt_payload(buf),
+                                   (int)relay->bufs.payload_size, now);
+        if (len > 0)
+            dns_emit(relay, dst_addr, src_addr, src_port, pkt_payload(buf), len);
+        pkt_pool_put(&relay->bufs, buf);
+        if (len > 0) {
+            relay->dns_cached++;
+            return true;
+        }
+    }
+
+    /* Same question, same spelling: one upstream answer serves both */
+    const uint8_t *question = payload + DNS_HEADER_LEN;
+    udp_dns_flight_t *free_slot = NULL;
+    for (int i = 0; i < UDP_DNS_FLIGHTS; i++) {
+        udp_dns_flight_t *f = &relay->dns_flights[i];
+        if (!f->active) {
+            if (!free_slot)
+                free_slot = f;
+            continue;
+        }
+        if (f->query.hash != q.hash || f->query.key_len != q.key_len ||
+            memcmp(f->query.key, q.key, q.key_len) != 0 ||
+            memcmp(f->question, question, q.question_len) != 0)
+            continue;
+
+        udp_dns_waiter_t w = { *src_addr, src_port, dns_id(payload) };
+        for (int j = 0; j < f->waiter_count; j++) {
+            if (f->waiters[j].src_port == w.src_port && f->waiters[j].id == w.id &&
+                dpi_addr_equal(&f->waiters[j].app_addr, &w.app_addr))
+                return true;   /* the app retransmitted */
+        }
+        if (f->waiter_count == UDP_DNS_WAITERS)
+            return false;
+        f->waiters[f->waiter_count++] = w;
+        relay->dns_joined++;
+        return true;
+    }
+    if (!free_slot)
+        return false;
+
+    udp_dns_socket_t *sock = dns_upstream(relay, dpi_addr_is_ipv4(dst_addr));
+    if (!sock)
+        return false;
+
+    /* The app's query under an id of ours: answers from the shared socket
+     * are told apart by id and source */
+    uint8_t msg[DNS_MAX_MSG];
+    uint16_t id = dns_upstream_id(relay);
+    memcpy(msg, payload, payload_len);
+    dns_set_id(msg, id);
+
+    struct sockaddr_storage dst;
+    socklen_t dst_len = fill_sockaddr(&dst, dst_addr, DNS_PORT);
+    if (sendto(sock->fd, msg, payload_len, MSG_DONTWAIT, (struct sockaddr *)&dst, dst_len) < 0)
+        return false;
+    relay->tx_calls++;
+    relay->tx_datagrams++;
+
+    udp_dns_flight_t *f = free_slot;
+    f->active       = true;
+    f->query        = q;
+    memcpy(f->question, question, q.question_len);
+    f->server       = *dst_addr;
+    f->upstream_id  = id;
+    f->deadline_ms  = now + UDP_DNS_QUERY_MS;
+    f->waiters[0]   = (udp_dns_waiter_t){ *src_addr, src_port, dns_id(payload) };
+    f->waiter_count = 1;
+    relay->dns_sent++;
+    if (!timer_armed(&relay->dns_timer))
+        timer_arm(&relay->timers, &relay->dns_timer, f->deadline_ms);
+    return true;
+}
+
+/* The flight an answer from server belongs to, or NULL */
+static udp_dns_flight_t *dns_find_flight(udp_relay_t *relay, const dpi_addr_t *server,
+                                         const uint8_t *msg, int len)
+{
+    uint16_t id = dns_id(msg);
+
+    for (int i = 0; i < UDP_DNS_FLIGHTS; i++) {
+        udp_dns_flight_t *f = &relay->dns_flights[i];
+        if (f->active && f->upstream_id == id && dpi_addr_equal(&f->server, server) &&
+            dns_response_matches(msg, len, f->question, f->query.question_len))
+            return f;
+    }
+    return NULL;
+}
+
+int udp_relay_init(udp_relay_t *relay, tun_out_t *tun_out, int epoll_fd,
+                   const uint8_t *fake_payload, int fake_len,
+                   int fake_ttl, int fake_repeats, int fake_bursts,
+                   const dpi_hostlist_t *hostlist,
+                   const dpi_hostlist_t *hostlist_exclude,
+                   int max_sessions,
+                   JNIEnv *env, jobject vpn_service)
 {
     memset(relay, 0, sizeof(*relay));
-    relay->tun_fd       = tun_fd;
-    relay->fake_payload = fake_payload;
-    relay->fake_len     = fake_len;
-    relay->fake_ttl     = fake_ttl;
-    relay->fake_repeats = fake_repeats;
-    relay->env          = env;
-    relay->vpn_service  = vpn_service;
+    if (session_pool_init(&relay->pool, sizeof(udp_session_t),
+                          max_sessions > 0 ? max_sessions : UDP_MAX_SESSIONS) < 0 ||
+        session_table_init(&relay->table, SESSION_POOL_CHUNK) < 0 ||
+        pkt_pool_init(&relay->bufs, UDP_BUF_PAYLOAD, UDP_BUF_POOL, UDP_RX_BATCH) < 0) {
+        LOGE("Cannot allocate the UDP session table");
+        session_pool_free(&relay->pool);
+        session_table_free(&relay->table);
+        return -1;
+    }
+
+    relay->tun_out          = tun_out;
+    relay->epoll_fd         = epoll_fd;
+    timer_wheel_init(&relay->timers, monotonic_ms(), UDP_TIMER_TICK_MS);
+    relay->fake_payload     = fake_payload;
+    relay->fake_len         = fake_len;
+    relay->fake_ttl         = fake_ttl;
+    relay->fake_repeats     = fake_repeats;
+    relay->fake_bursts      = fake_bursts > 0 ? fake_bursts : UDP_QUIC_FAKE_BURSTS;
+    relay->ttl_cmsg         = -1;
+    relay->hostlist         = hostlist;
+    relay->hostlist_exclude = hostlist_exclude;
+    relay->env              = env;
+    relay->vpn_service      = vpn_service;
 
     jclass cls = (*env)->GetObjectClass(env, vpn_service);
     relay->protect_method = (*env)->GetMethodID(env, cls, "protect", "(I)Z");
+
+    dns_cache_init(&relay->dns_cache, UDP_DNS_CACHE);
+    for (int f = 0; f < 2; f++) {
+        for (int i = 0; i < UDP_DNS_UPSTREAMS; i++)
+            relay->dns_up[f][i] = (udp_dns_socket_t){ SESSION_KIND_DNS, -1 };
+    }
+    timer_init(&relay->dns_timer, on_dns_timer);
+    relay->dns_rand = (uint32_t)monotonic_ms() ^ (uint32_t)(uintptr_t)relay;
+    if (relay->dns_rand == 0)
+        relay->dns_rand = 1;
+    return 0;
 }
 
 void udp_relay_process(udp_relay_t *relay,
-                       uint32_t src_addr, uint32_t dst_addr,
+                       const dpi_addr_t *src_addr, const dpi_addr_t *dst_addr,
                        uint16_t src_port, uint16_t dst_port,
                        const uint8_t *payload, int payload_len)
 {
-    udp_session_t *session = get_or_create_session(relay, src_port, dst_addr, dst_port);
+    if (dst_port == DNS_PORT &&
+        dns_fast_path(relay, src_addr, dst_addr, src_port, payload, payload_len))
+        return;
+
+    udp_session_t *session = get_or_create_session(relay, src_addr, src_port,
+                                                   dst_addr, dst_port);
     if (!session)
         return;
 
     /* Check if this is a QUIC Initial and we have fake payload */
     if (relay->fake_payload && relay->fake_len > 0 &&
         dpi_is_quic_initial(payload, payload_len)) {
-        LOGD("QUIC Initial detected, injecting %d fakes (TTL=%d)",
-             relay->fake_repeats, relay->fake_ttl);
-        send_with_fakes(relay, session, payload, payload_len);
+        /* Fakes and held Initials are sent at once: queued datagrams go first */
+        udp_relay_flush(relay);
+        quic_track_initial(relay, session, payload, payload_len);
+        if (relay->hostlist || relay->hostlist_exclude) {
+            handle_quic_initial(relay, session, payload, payload_len);
+            return;
+        }
+        if (quic_take_burst(relay, session)) {
+            LOGD("QUIC Initial detected, injecting %d fakes (TTL=%d)",
+                 relay->fake_repeats, relay->fake_ttl);
+            struct iovec iov = { (void *)payload, (size_t)payload_len };
+            send_with_fakes(relay, session, &iov, 1);
+            return;
+        }
+        /* A later Initial of an attempt already faked: forwarded as-is */
     } else {
-        /* Forward as-is */
-        send(session->fd, payload, payload_len, 0);
+        if (session->quic_dcid_len && dpi_quic_past_initial(payload, payload_len))
+            session->quic_moved_on = true;
+        if (session->quic_pending) {
+            /* Connection moved on before the SNI completed */
+            udp_relay_flush(relay);
+            session->quic_desync = dpi_hostlist_allows(relay->hostlist,
+                                                       relay->hostlist_exclude, NULL, 0);
+            release_quic_pending(relay, session, payload, payload_len);
+            return;
+        }
     }
+
+    /* Forward as-is, batched with the rest of the TUN burst */
+    if (relay->tx_count == UDP_TX_BATCH)
+        udp_relay_flush(relay);
+    relay->tx[relay->tx_count++] = (udp_tx_t){ session, payload, payload_len };
 }
 
-int udp_relay_handle_response(udp_relay_t *relay, int fd)
+void udp_relay_flush(udp_relay_t *relay)
 {
-    udp_session_t *session = find_session_by_fd(relay, fd);
-    if (!session)
+    struct mmsghdr msgs[UDP_TX_BATCH];
+    struct iovec iov[UDP_TX_BATCH];
+    int count = relay->tx_count;
+
+    relay->tx_count = 0;
+
+    /* Gather each session's datagrams, in TUN order, into one sendmmsg */
+    for (int i = 0; i < count; i++) {
+        udp_session_t *session = relay->tx[i].session;
+        if (!session)
+            continue;
+
+        int m = 0;
+        for (int j = i; j < count; j++) {
+            if (relay->tx[j].session != session)
+                continue;
+            iov[m].iov_base = (void *)relay->tx[j].data;
+            iov[m].iov_len  = (size_t)relay->tx[j].len;
+            set_msg(&msgs[m], &iov[m], NULL);
+            relay->tx[j].session = NULL;
+            m++;
+        }
+        send_batch(relay, session->fd, msgs, m);
+    }
+}
+
+/* Build one received datagram into a TUN packet and write it */
+static int emit_datagram(udp_relay_t *relay, udp_session_t *session,
+                         uint8_t *buf, uint8_t *spill, int n)
+{
+    int room = (int)relay->bufs.payload_size;
+
+    if (n <= room) {
+        /* Header written in place in front of the payload: one contiguous packet */
+        uint8_t *pkt = pkt_payload(buf) - session->tun_hdr.hdr_len;
+        int pkt_len = dpi_template_build_udp(&session->tun_hdr, pkt,
+                                             session->tun_hdr.hdr_len + n,
+                                             pkt_payload(buf), n);
+        if (pkt_len < 0)
+            return -1;
+        tun_out_write(relay->tun_out, pkt, pkt_len);
         return 0;
+    }
 
-    uint8_t recv_buf[MAX_PKT_SIZE];
-    ssize_t n = recv(fd, recv_buf, sizeof(recv_buf), 0);
-    if (n <= 0)
+    /* Oversized (EDNS, fragmented): join the head onto the rest in spill */
+    memcpy(spill, pkt_payload(buf), room);
+    uint8_t hdr[DPI_TEMPLATE_MAX_HDR];
+    struct iovec iov[2];
+    if (dpi_template_iov_udp(&session->tun_hdr, hdr, spill, n, iov) < 0)
         return -1;
+    tun_out_writev(relay->tun_out, iov, 2);
+    return 0;
+}
 
-    session->last_activity = monotonic_seconds();
-
-    /* Build IP+UDP response packet for TUN */
-    uint8_t pkt[MAX_PKT_SIZE];
-    int pkt_len = dpi_build_ipv4_udp(pkt, sizeof(pkt),
-                                      session->dst_addr,  /* response: dst→src */
-                                      0x0A780001,          /* 10.120.0.1 (TUN addr) */
-                                      session->dst_port,
-                                      session->src_port,
-                                      recv_buf, (int)n);
-    if (pkt_len < 0)
-        return -1;
+int udp_relay_handle_response(udp_relay_t *relay, udp_session_t *session)
+{
+    /* Closed earlier in the same epoll_wait batch, or the slot was
+     * reused since: never block on a socket that may not be readable */
+    if (!session->active)
+        return 0;
+
+    struct mmsghdr msgs[UDP_RX_BATCH];
+    struct iovec rx[UDP_RX_BATCH][2];
+    uint8_t *bufs[UDP_RX_BATCH];
+    uint8_t *spill[UDP_RX_BATCH];
+    uint32_t room = relay->bufs.payload_size;
+    int count = 0;
+
+    /* Each datagram: a pool buffer's payload area, then its spill room */
+    for (; count < UDP_RX_BATCH; count++) {
+        bufs[count] = pkt_pool_get(&relay->bufs);
+        if (!bufs[count])
+            break;
+        spill[count] = count ? relay->rx_spill[count - 1] : relay->rx_buf;
+        size_t spill_size = count ? sizeof(relay->rx_spill[0]) : sizeof(relay->rx_buf);
+
+        rx[count][0].iov_base = pkt_payload(bufs[count]);
+        rx[count][0].iov_len  = room;
+        rx[count][1].iov_base = spill[count] + room;
+        rx[count][1].iov_len  = spill_size - room;
+        memset(&msgs[count], 0, sizeof(msgs[count]));
+        msgs[count].msg_hdr.msg_iov    = rx[count];
+        msgs[count].msg_hdr.msg_iovlen = 2;
+    }
 
-    write(relay->tun_fd, pkt, pkt_len);
-    return 1;
+    int n = count ? recvmmsg(session->fd, msgs, count, MSG_DONTWAIT, NULL) : -1;
+    int ret = 1;
+    if (n < 0) {
+        ret = (count && (errno == EAGAIN || errno == EWOULDBLOCK)) ? 1 : -1;
+    } else {
+        relay->rx_calls++;
+        relay->rx_datagrams += n;
+        session->last_activity_ms = monotonic_ms();
+        if (n > 0)
+            session->quic_moved_on = true;   /* the server answered the attempt */
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            relay->rx_truncated++;
+            continue;
+        }
+        if (emit_datagram(relay, session, bufs[i], spill[i], (int)msgs[i].msg_len) < 0)
+            ret = -1;
+    }
+
+    for (int i = 0; i < count; i++)
+        pkt_pool_put(&relay->bufs, bufs[i]);
+    return ret;
 }
 
-int udp_relay_get_fds(udp_relay_t *relay, int *out_fds, int max_fds)
+void udp_relay_handle_dns(udp_relay_t *relay, udp_dns_socket_t *sock)
 {
-    int count = 0;
-    for (int i = 0; i < relay->session_count && count < max_fds; i++) {
-        if (relay->sessions[i].active)
-            out_fds[count++] = relay->sessions[i].fd;
+    /* Built in place: the header goes into the room in front */
+    uint8_t *msg = relay->rx_buf + DPI_TEMPLATE_MAX_HDR;
+    int cap = (int)sizeof(relay->rx_buf) - DPI_TEMPLATE_MAX_HDR;
+
+    for (;;) {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        int n = recvfrom(sock->fd, msg, cap, MSG_DONTWAIT,
+                         (struct sockaddr *)&from, &from_len);
+        if (n < 0)
+            return;
+        relay->rx_calls++;
+        relay->rx_datagrams++;
+
+        dpi_addr_t server;
+        uint16_t port;
+        if (from.ss_family == AF_INET) {
+            const struct sockaddr_in *sin = (const struct sockaddr_in *)&from;
+            dpi_addr_from_ipv4(&server, ntohl(sin->sin_addr.s_addr));
+            port   = ntohs(sin->sin_port);
+        } else {
+            const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)&from;
+            memcpy(server.b, &sin6->sin6_addr, 16);
+            port   = ntohs(sin6->sin6_port);
+        }
+
+        /* Late, duplicated or not ours at all */
+        udp_dns_flight_t *f;
+        if (n < DNS_HEADER_LEN || port != DNS_PORT ||
+            !(f = dns_find_flight(relay, &server, msg, n)))
+            continue;
+
+        uint32_t ttl = dns_response_ttl(msg, n);
+        if (ttl > 0)
+            dns_cache_put(&relay->dns_cache, &f->query, msg, n, ttl, monotonic_ms());
+
+        /* In the spelling the apps asked with, under each one's id */
+        memcpy(msg + DNS_HEADER_LEN, f->question, f->query.question_len);
+        for (int i = 0; i < f->waiter_count; i++) {
+            udp_dns_waiter_t *w = &f->waiters[i];
+            dns_set_id(msg, w->id);
+            dns_emit(relay, &f->server, &w->app_addr, w->src_port, msg, n);
+        }
+        f->active = false;
     }
-    return count;
 }
 
-void udp_relay_cleanup(udp_relay_t *relay)
+/* Drop upstream queries never answered; the apps retry on their own */
+static void on_dns_timer(timer_node_t *t, void *ctx, int64_t now_ms)
 {
-    int64_t now = monotonic_seconds();
-    for (int i = 0; i < relay->session_count; i++) {
-        udp_session_t *s = &relay->sessions[i];
-        if (s->active && (now - s->last_activity) > UDP_SESSION_TIMEOUT) {
-            close(s->fd);
-            s->active = false;
+    udp_relay_t *relay = ctx;
+    int64_t next = INT64_MAX;
+
+    for (int i = 0; i < UDP_DNS_FLIGHTS; i++) {
+        udp_dns_flight_t *f = &relay->dns_flights[i];
+        if (!f->active)
+            continue;
+        if (now_ms >= f->deadline_ms) {
+            f->active = false;
+            relay->dns_expired++;
+        } else if (f->deadline_ms < next) {
+            next = f->deadline_ms;
         }
     }
+    if (next != INT64_MAX)
+        timer_arm(&relay->timers, t, next);
+}
+
+/* Release a hold that timed out, close an idle session, or re-arm */
+static void on_timer(timer_node_t *t, void *ctx, int64_t now_ms)
+{
+    udp_relay_t *relay = ctx;
+    udp_session_t *session = timer_entry(t, udp_session_t, timer);
+
+    if (session->quic_pending && now_ms >= session->quic_pending->deadline_ms) {
+        /* The rest of the ClientHello never came */
+        session->quic_desync = dpi_hostlist_allows(relay->hostlist,
+                                                   relay->hostlist_exclude, NULL, 0);
+        release_quic_pending(relay, session, NULL, 0);
+    }
+
+    int64_t deadline = session_deadline_ms(session);
+    if (now_ms < deadline) {
+        timer_arm(&relay->timers, t, deadline);
+        return;
+    }
+    close_session(relay, session);
+}
+
+void udp_relay_timers(udp_relay_t *relay)
+{
+    timer_wheel_advance(&relay->timers, monotonic_ms(), relay);
+    session_pool_trim(&relay->pool);
+}
+
+int udp_relay_poll_timeout(const udp_relay_t *relay, int idle_ms)
+{
+    return timer_wheel_timeout(&relay->timers, monotonic_ms(), idle_ms);
 }
 
 void udp_relay_destroy(udp_relay_t *relay)
 {
-    for (int i = 0; i < relay->session_count; i++) {
-        if (relay->sessions[i].active) {
-            close(relay->sessions[i].fd);
-            relay->sessions[i].active = false;
+    for (int i = session_pool_next(&relay->pool, 0); i >= 0;
+         i = session_pool_next(&relay->pool, i + 1))
+        close_session(relay, session_pool_get(&relay->pool, i));
+
+    if (relay->pool.peak)
+        LOGD("UDP sessions: peak %d of %d", relay->pool.peak, relay->pool.capacity);
+    if (relay->rx_calls || relay->tx_calls)
+        LOGD("UDP: %llu datagrams in over %llu recvmmsg, %llu out over %llu sendmmsg, "
+             "%u truncated",
+             (unsigned long long)relay->rx_datagrams, (unsigned long long)relay->rx_calls,
+             (unsigned long long)relay->tx_datagrams, (unsigned long long)relay->tx_calls,
+             relay->rx_truncated);
+    if (relay->quic_faked || relay->quic_passed)
+        LOGD("QUIC: %u Initials behind fakes, %u passed through (attempt already faked)",
+             relay->quic_faked, relay->quic_passed);
+    if (relay->dns_cached || relay->dns_joined || relay->dns_sent)
+        LOGD("DNS: %u answered from cache, %u joined a query in flight, %u sent upstream "
+             "(%u unanswered), %d cached",
+             relay->dns_cached, relay->dns_joined, relay->dns_sent, relay->dns_expired,
+             relay->dns_cache.count);
+    for (int f = 0; f < 2; f++) {
+        for (int i = 0; i < UDP_DNS_UPSTREAMS; i++) {
+            int fd = relay->dns_up[f][i].fd;
+            if (fd >= 0) {
+                epoll_ctl(relay->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                close(fd);
+            }
         }
     }
-    relay->session_count = 0;
+    timer_cancel(&relay->timers, &relay->dns_timer);
+    dns_cache_free(&relay->dns_cache);
+    if (relay->bufs.hits || relay->bufs.misses)
+        LOGD("UDP buffers: %llu pool hits, %llu misses",
+             (unsigned long long)relay->bufs.hits, (unsigned long long)relay->bufs.misses);
+    session_pool_free(&relay->pool);
+    session_table_free(&relay->table);
+    pkt_pool_free(&relay->bufs);
 }
@@ -3,6 +3,18 @@
  *
  * Manages UDP sessions: (src_port, dst_ip, dst_port) → protected socket.
  * Detects QUIC Initial packets and injects fake packets with low TTL.
+ * With a hostlist, Initials are decrypted first and only hosts that pass
+ * the list get fakes; datagrams are held until the SNI is known.
+ *
+ * Fakes go out once per QUIC connection attempt (keyed by the DCID of
+ * the client's first Initial), not once per Initial: retransmissions and
+ * the later Initials of a multi-datagram ClientHello are forwarded as-is,
+ * and nothing is faked once the server has answered or the client has
+ * sent a Handshake or 1-RTT packet.
+ *
+ * Plain DNS queries (to port 53) skip the sessions: they are answered
+ * from a cache when possible, joined to an identical query already in
+ * flight, or sent on a few shared upstream sockets.
  */
 
 #ifndef UDP_RELAY_H
@@ -12,30 +24,137 @@
 #include <stdbool.h>
 #include <jni.h>
 
-#define UDP_MAX_SESSIONS     4096
-#define UDP_SESSION_TIMEOUT  120  /* seconds */
+#include "dns_cache.h"
+#include "dpi_bypass.h"
+#include "pkt_pool.h"
+#include "session_pool.h"
+#include "session_table.h"
+#include "socket_pool.h"
+#include "timer_wheel.h"
+#include "tun_out.h"
+
+#define UDP_MAX_SESSIONS     4096 /* default session limit per relay */
+#define UDP_IDLE_TIMEOUT     120  /* seconds */
+#define UDP_DNS_TIMEOUT      10   /* seconds; sessions to port 53 are one query each */
+#define UDP_QUIC_MAX_HELD    4    /* Initial datagrams held while the SNI is incomplete */
+#define UDP_QUIC_HOLD_MS     300  /* release held Initials if the SNI is still incomplete (as udp-bypass) */
+#define UDP_QUIC_FAKE_BURSTS 1    /* default fake bursts per connection attempt */
+#define UDP_TIMER_TICK_MS    100  /* timer wheel granularity */
+#define UDP_RX_BUF_SIZE      65536 /* one datagram from a server socket */
+#define UDP_BUF_PAYLOAD      1920 /* pool buffer payload; larger datagrams spill into rx_buf */
+#define UDP_RX_BATCH         16   /* datagrams per recvmmsg */
+#define UDP_RX_SPILL         4096 /* spill room of the batch's later datagrams (the first gets rx_buf) */
+#define UDP_TX_BATCH         32   /* datagrams queued for sendmmsg; one TUN burst */
+#define UDP_BUF_POOL         (2 * UDP_RX_BATCH) /* pool buffers kept per relay */
+#define UDP_DNS_UPSTREAMS    2    /* shared upstream DNS sockets per address family */
+#define UDP_DNS_FLIGHTS      64   /* distinct DNS questions awaiting an answer */
+#define UDP_DNS_WAITERS      8    /* app queries answered by one upstream answer */
+#define UDP_DNS_QUERY_MS     5000 /* unanswered upstream queries are dropped after this */
+#define UDP_DNS_CACHE        512  /* cached DNS answers */
+
+struct udp_quic_pending;
 
 typedef struct {
-    uint16_t src_port;   /* app-side source port (network byte order) */
-    uint32_t dst_addr;   /* destination IP (network byte order) */
-    uint16_t dst_port;   /* destination port (network byte order) */
+    session_kind_t kind; /* SESSION_KIND_UDP; epoll data.ptr points here */
+    int      pool_index; /* slot in the relay's session pool */
+    uint16_t src_port;   /* app-side source port (host byte order) */
+    dpi_addr_t dst_addr; /* destination IP (IPv4-mapped for IPv4) */
+    uint16_t dst_port;   /* destination port (host byte order) */
+    dpi_addr_t app_addr; /* app-side source IP (destination of TUN responses) */
+    dpi_hdr_template_t tun_hdr; /* prebuilt server→app IP+UDP header */
     int      fd;         /* protected UDP socket */
-    int64_t  last_activity; /* monotonic timestamp (seconds) */
+    int64_t  last_activity_ms; /* monotonic timestamp */
+    timer_node_t timer;  /* idle expiry, or the QUIC hold while one is pending */
     bool     active;
+    int8_t   quic_desync;   /* -1 = undecided, 0 = no fakes, 1 = fakes */
+    struct udp_quic_pending *quic_pending; /* Initial reassembly (malloc'd) */
+    uint8_t  quic_dcid[DPI_QUIC_MAX_CID];  /* DCID of the attempt's first Initial */
+    uint8_t  quic_dcid_len; /* 0 = no Initial seen yet */
+    uint8_t  quic_bursts;   /* fake bursts sent for this attempt */
+    bool     quic_moved_on; /* server answered, or the client is past its first flight */
 } udp_session_t;
 
+/* A shared upstream DNS socket; epoll data.ptr points here */
+typedef struct {
+    session_kind_t kind;      /* SESSION_KIND_DNS */
+    int      fd;              /* protected, unconnected; -1 until first needed */
+} udp_dns_socket_t;
+
+/* An app query waiting for the answer to an upstream query */
+typedef struct {
+    dpi_addr_t app_addr;
+    uint16_t src_port;
+    uint16_t id;              /* the app's transaction id */
+} udp_dns_waiter_t;
+
+/* One question sent upstream and the app queries that asked it */
+typedef struct {
+    bool     active;
+    dns_query_t query;
+    uint8_t  question[DNS_MAX_QUESTION]; /* as the apps spelled it */
+    dpi_addr_t server;
+    uint16_t upstream_id;     /* transaction id used upstream */
+    int64_t  deadline_ms;
+    int      waiter_count;
+    udp_dns_waiter_t waiters[UDP_DNS_WAITERS];
+} udp_dns_flight_t;
+
+/* A datagram from the TUN waiting for udp_relay_flush */
 typedef struct {
-    udp_session_t sessions[UDP_MAX_SESSIONS];
-    int session_count;
+    udp_session_t *session;
+    const uint8_t *data;      /* in the TUN burst's packet buffer */
+    int len;
+} udp_tx_t;
+
+typedef struct {
+    session_pool_t pool;      /* udp_session_t storage, grown up to the session limit */
+    session_table_t table;    /* key index into the pool */
+    timer_wheel_t timers;     /* one timer per session */
 
     /* Fake injection config */
     const uint8_t *fake_payload;
     int fake_len;
     int fake_ttl;
     int fake_repeats;
+    int fake_bursts;          /* per QUIC connection attempt */
+    int8_t ttl_cmsg;          /* kernel takes IP_TTL per datagram: -1 = not yet known */
+    const dpi_hostlist_t *hostlist;         /* fakes only for these hosts (NULL = all) */
+    const dpi_hostlist_t *hostlist_exclude; /* never fake these hosts */
+
+    /* Responses back to the app: the TUN fd or a shard's outbound ring */
+    tun_out_t *tun_out;
+    int epoll_fd;             /* session sockets are registered here */
+    pkt_pool_t bufs;          /* server datagrams are received and sent to the TUN in place */
+    uint8_t rx_buf[UDP_RX_BUF_SIZE];  /* the rest of a datagram larger than a pool buffer */
+    uint8_t rx_spill[UDP_RX_BATCH - 1][UDP_BUF_PAYLOAD + UDP_RX_SPILL]; /* same, later in a batch */
+
+    /* Datagrams to the servers, sent per session with sendmmsg */
+    udp_tx_t tx[UDP_TX_BATCH];
+    int tx_count;
+
+    /* DNS fast path */
+    dns_cache_t dns_cache;
+    udp_dns_socket_t dns_up[2][UDP_DNS_UPSTREAMS]; /* [0] IPv4, [1] IPv6 */
+    int dns_next_up;          /* round-robin over dns_up */
+    udp_dns_flight_t dns_flights[UDP_DNS_FLIGHTS];
+    timer_node_t dns_timer;   /* drops flights past their deadline */
+    uint32_t dns_rand;        /* upstream transaction ids */
+    uint32_t dns_cached;      /* queries answered from the cache */
+    uint32_t dns_joined;      /* queries joined to one in flight */
+    uint32_t dns_sent;        /* queries sent upstream */
+    uint32_t dns_expired;     /* upstream queries never answered */
 
-    /* TUN fd for sending responses back to app */
-    int tun_fd;
+    /* Syscall statistics, logged on destroy */
+    uint64_t rx_calls;
+    uint64_t rx_datagrams;
+    uint64_t tx_calls;
+    uint64_t tx_datagrams;
+    uint32_t rx_truncated;    /* too large for their spill room, dropped */
+    uint32_t quic_faked;      /* Initials sent behind a fake burst */
+    uint32_t quic_passed;     /* Initials of an attempt already faked or moved on */
+
+    /* Protected sockets made ahead by the pool thread (NULL = always inline) */
+    socket_pool_shard_t *sockets;
 
     /* JNI references for socket protection */
     JNIEnv *env;
@@ -45,40 +164,70 @@ typedef struct {
 
 /*
  * Initialize the UDP relay.
+ * fake_bursts caps fake bursts per QUIC connection attempt (<= 0 =
+ * UDP_QUIC_FAKE_BURSTS).
+ * Hostlists are borrowed and must outlive the relay; either may be NULL.
+ * Session sockets are added to epoll_fd with data.ptr = the session;
+ * packets for the app go through tun_out, which must outlive the relay.
+ * max_sessions caps concurrent sessions (<= 0 = UDP_MAX_SESSIONS); their
+ * memory is allocated as they open.
+ * Returns 0, or -1 if the session table cannot be allocated.
  */
-void udp_relay_init(udp_relay_t *relay, int tun_fd,
-                    const uint8_t *fake_payload, int fake_len,
-                    int fake_ttl, int fake_repeats,
-                    JNIEnv *env, jobject vpn_service);
+int udp_relay_init(udp_relay_t *relay, tun_out_t *tun_out, int epoll_fd,
+                   const uint8_t *fake_payload, int fake_len,
+                   int fake_ttl, int fake_repeats, int fake_bursts,
+                   const dpi_hostlist_t *hostlist,
+                   const dpi_hostlist_t *hostlist_exclude,
+                   int max_sessions,
+                   JNIEnv *env, jobject vpn_service);
 
 /*
  * Process an outgoing UDP packet from the TUN (app → internet).
  * Creates/reuses session, detects QUIC, injects fakes, forwards.
+ * Plain datagrams are only queued: payload must stay valid until the
+ * next udp_relay_flush.
  *
- * src_addr/dst_addr in network byte order (as parsed by dpi_parse_ipv4).
+ * src_addr/dst_addr as parsed by dpi_parse_ip (IPv4 or IPv6).
  */
 void udp_relay_process(udp_relay_t *relay,
-                       uint32_t src_addr, uint32_t dst_addr,
+                       const dpi_addr_t *src_addr, const dpi_addr_t *dst_addr,
                        uint16_t src_port, uint16_t dst_port,
                        const uint8_t *payload, int payload_len);
 
 /*
- * Check a relay socket fd for incoming response data.
- * Constructs IP+UDP response and writes to TUN.
- * Returns: 1 if data was processed, 0 if fd doesn't belong to relay, -1 on error.
+ * Send the queued datagrams, one sendmmsg per session. Call at the end
+ * of every TUN burst, before its packet buffers are reused.
  */
-int udp_relay_handle_response(udp_relay_t *relay, int fd);
+void udp_relay_flush(udp_relay_t *relay);
 
 /*
- * Get all active session fds for epoll registration.
- * Returns number of fds written to out_fds (up to max_fds).
+ * Handle a readiness event on a session socket (the epoll data.ptr).
+ * Receives up to UDP_RX_BATCH datagrams with one recvmmsg, each into a
+ * pool buffer behind the headroom, writes the IP+UDP header in front of
+ * each and sends them to the TUN one contiguous write apiece.
+ * Returns: 1 if data was processed, 0 if the session is already closed,
+ * -1 on error.
  */
-int udp_relay_get_fds(udp_relay_t *relay, int *out_fds, int max_fds);
+int udp_relay_handle_response(udp_relay_t *relay, udp_session_t *session);
 
 /*
- * Clean up expired sessions (older than UDP_SESSION_TIMEOUT).
+ * Handle a readiness event on a shared upstream DNS socket (the epoll
+ * data.ptr): hand each answer to the app queries waiting for it, and
+ * cache it.
  */
-void udp_relay_cleanup(udp_relay_t *relay);
+void udp_relay_handle_dns(udp_relay_t *relay, udp_dns_socket_t *sock);
+
+/*
+ * Run due timers: close sessions idle past their timeout (UDP_DNS_TIMEOUT
+ * for port 53, UDP_IDLE_TIMEOUT otherwise) and release Initials held
+ * longer than UDP_QUIC_HOLD_MS waiting for the rest of their ClientHello,
+ * then free the slots of closed sessions for reuse and return idle session
+ * memory. Call once the epoll events are handled.
+ */
+void udp_relay_timers(udp_relay_t *relay);
+
+/* Milliseconds until udp_relay_timers has work, at most idle_ms */
+int udp_relay_poll_timeout(const udp_relay_t *relay, int idle_ms);
 
 /*
  * Destroy all sessions and free resources.
@@ -1,22 +1,45 @@
 /*
  * vpn_processor.c — Android VPN packet processor (JNI)
  *
- * Main loop: reads packets from TUN fd, dispatches TCP/UDP,
- * multiplexes relay sockets via epoll.
+ * Flows are spread over worker shards. Each shard owns a TCP and a UDP
+ * relay, their session tables and an epoll set; it classifies its
+ * packets with dpi_classify_batch and dispatches TCP/UDP as before.
+ *
+ * The VPN thread owns the TUN fd. It reads bursts, hashes every packet
+ * on its session key (src_port, dst_addr, dst_port) to pick a shard and
+ * copies it into that shard's inbound SPSC ring. Shards write packets
+ * for the app into their own outbound ring; the VPN thread merges those
+ * rings round-robin and writes them to the TUN. No locks are taken on
+ * the packet path.
+ *
+ * With a single shard (one or two cores) the shard runs on the VPN
+ * thread and uses the TUN fd directly, as the unsharded loop did.
+ *
+ * A socket pool thread keeps protected sockets ready for every shard,
+ * so opening a session skips socket() and the protect() JNI call.
+ *
+ * UDP to port 53 all goes to shard 0, whose relay answers DNS from one
+ * cache for every app instead of opening a session per query.
  *
  * Called from Java ZapretVpnService via JNI.
  */
 
 #include "dpi_bypass.h"
+#include "socket_pool.h"
+#include "spsc_ring.h"
 #include "tcp_relay.h"
+#include "tun_out.h"
 #include "udp_relay.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <jni.h>
 #include <android/log.h>
 
@@ -25,50 +48,355 @@
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
 
-#define MAX_PKT_SIZE    65536
+#define TUN_BURST       32    /* packets drained per TUN wakeup */
+#define TUN_SLOT_SIZE   4096  /* per-packet read buffer (TUN MTU is 1500) */
 #define MAX_EPOLL_EVENTS 128
-#define CLEANUP_INTERVAL 10  /* seconds between session cleanup */
+
+#define VPN_MAX_SHARDS   8
+#define SHARD_RING_SLOTS 256  /* packets per direction per shard */
 
 #define IPPROTO_TCP_VAL  6
 #define IPPROTO_UDP_VAL 17
 
-static volatile int g_running = 0;
+static atomic_int g_running = 0;  /* read by every shard */
 static pthread_t g_thread;
 
-/* Global relay state (single instance — only one VPN active at a time) */
-static tcp_relay_t g_tcp_relay;
-static udp_relay_t g_udp_relay;
+typedef struct {
+    tcp_relay_t tcp;
+    udp_relay_t udp;
+    tun_out_t   out;          /* the TUN fd, or out_ring */
+    int         epoll_fd;     /* relay sockets + the inbound wakeup */
+    int         tun_fd;       /* read directly when unsharded, else -1 */
+    int         wake_fd;      /* eventfd: in_ring has packets */
+    spsc_ring_t in_ring;      /* VPN thread → shard */
+    spsc_ring_t out_ring;     /* shard → VPN thread */
+    uint32_t    in_drops;     /* packets lost to a full in_ring (VPN thread) */
+    uint32_t    out_errors;   /* out_ring packets the TUN refused (VPN thread) */
+    uint32_t    wake_errors;  /* failed in_ring wakeups (VPN thread) */
+    dpi_batch_t batch;
+    JavaVM     *jvm;
+    pthread_t   thread;
+    bool        started;
+    int         index;
+} vpn_shard_t;
+
+/* Global state (single instance — only one VPN active at a time) */
+static vpn_shard_t *g_shards[VPN_MAX_SHARDS];
+static int g_shard_count;
+static dpi_hostlist_t g_hostlist;
+static dpi_hostlist_t g_hostlist_exclude;
+static dpi_hostlist_t g_quic_hostlist;
+static dpi_hostlist_t g_quic_hostlist_exclude;
+static socket_pool_t g_sockets;
+static bool g_sockets_ready;
+
+/* Tag for packet input (TUN fd or inbound ring) in epoll data.ptr */
+static const session_kind_t g_tun_kind = SESSION_KIND_TUN;
+
+/* ------------------------------------------------------------------ */
+/*  TUN burst processing                                               */
+/* ------------------------------------------------------------------ */
+
+/* Only the thread that owns the TUN fd reads into these */
+static uint8_t g_tun_slots[TUN_BURST][TUN_SLOT_SIZE];
+
+/*
+ * Read up to TUN_BURST packets after an epoll wakeup. The TUN fd is
+ * non-blocking, so the burst ends at the first EAGAIN: one read() per
+ * packet and one more per burst.
+ */
+static int read_tun_burst(int tun_fd, const uint8_t **pkts, int *lens)
+{
+    int n = 0;
+
+    while (n < TUN_BURST) {
+        ssize_t r = read(tun_fd, g_tun_slots[n], TUN_SLOT_SIZE);
+        if (r <= 0)
+            break;
+        pkts[n] = g_tun_slots[n];
+        lens[n] = (int)r;
+        n++;
+    }
+    return n;
+}
+
+/* Classify a burst in one pass, then hand each packet to its relay */
+static void process_burst(vpn_shard_t *shard, const uint8_t **pkts, int *lens, int n)
+{
+    dpi_batch_t *batch = &shard->batch;
+
+    n = dpi_classify_batch(pkts, lens, n, batch);
+
+    for (int i = 0; i < n; i++) {
+        const uint8_t *payload = pkts[i] + batch->payload_off[i];
+
+        if (batch->protocol[i] == IPPROTO_TCP_VAL) {
+            /* Options are rare outside SYNs and SACKs — parse on demand */
+            dpi_tcp_opts_t opts;
+            const dpi_tcp_opts_t *popts = NULL;
+            int opt_len = batch->tcp_opt_len[i];
+            if (opt_len > 0) {
+                dpi_parse_tcp_options(payload - opt_len, opt_len, &opts);
+                popts = &opts;
+            }
+
+            tcp_relay_process(&shard->tcp,
+                              &batch->src_ip[i], &batch->dst_ip[i],
+                              batch->src_port[i], batch->dst_port[i],
+                              batch->seq[i], batch->ack[i],
+                              batch->tcp_flags[i], batch->window[i], popts,
+                              payload, batch->payload_len[i]);
+        } else if (batch->protocol[i] == IPPROTO_UDP_VAL) {
+            udp_relay_process(&shard->udp,
+                              &batch->src_ip[i], &batch->dst_ip[i],
+                              batch->src_port[i], batch->dst_port[i],
+                              payload, batch->payload_len[i]);
+        }
+    }
+
+    /* Queued UDP payloads point into the burst's slots */
+    udp_relay_flush(&shard->udp);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Shards                                                             */
+/* ------------------------------------------------------------------ */
+
+/* Drain the inbound ring in place, a burst at a time */
+static void shard_drain_input(vpn_shard_t *shard)
+{
+    const uint8_t *pkts[TUN_BURST];
+    int lens[TUN_BURST];
+    uint64_t count;
+
+    /* Reset the wakeup first: packets committed after this re-arm it */
+    if (read(shard->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        LOGE("shard %d: eventfd read: %s", shard->index, strerror(errno));
+
+    uint32_t avail;
+    while ((avail = spsc_ring_available(&shard->in_ring)) > 0) {
+        int n = avail < TUN_BURST ? (int)avail : TUN_BURST;
+        for (int i = 0; i < n; i++) {
+            uint32_t len;
+            pkts[i] = spsc_ring_slot(&shard->in_ring, i, &len);
+            lens[i] = (int)len;
+        }
+        process_burst(shard, pkts, lens, n);
+        spsc_ring_release(&shard->in_ring, n);
+    }
+}
+
+static void shard_input(vpn_shard_t *shard)
+{
+    if (shard->tun_fd < 0) {
+        shard_drain_input(shard);
+        return;
+    }
+
+    const uint8_t *pkts[TUN_BURST];
+    int lens[TUN_BURST];
+    int n = read_tun_burst(shard->tun_fd, pkts, lens);
+    if (n > 0)
+        process_burst(shard, pkts, lens, n);
+}
+
+static void shard_loop(vpn_shard_t *shard)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    while (g_running) {
+        /* Sleep until the next session timer; the 1 s cap rechecks g_running */
+        int timeout = tcp_relay_poll_timeout(&shard->tcp,
+                                             udp_relay_poll_timeout(&shard->udp, 1000));
+        int nfds = epoll_wait(shard->epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+        if (nfds < 0) {
+            if (errno == EINTR) continue;
+            LOGE("shard %d: epoll_wait: %s", shard->index, strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            const session_kind_t *kind = events[i].data.ptr;
+
+            switch (*kind) {
+            case SESSION_KIND_TUN:
+                shard_input(shard);
+                break;
+            case SESSION_KIND_TCP:
+                tcp_relay_handle_response(&shard->tcp, (tcp_session_t *)kind,
+                                          events[i].events);
+                break;
+            case SESSION_KIND_UDP:
+                udp_relay_handle_response(&shard->udp, (udp_session_t *)kind);
+                break;
+            case SESSION_KIND_DNS:
+                udp_relay_handle_dns(&shard->udp, (udp_dns_socket_t *)kind);
+                break;
+            }
+        }
+
+        /* Retransmissions and session expiry */
+        tcp_relay_timers(&shard->tcp);
+        udp_relay_timers(&shard->udp);
+
+        /* One writer wakeup for everything queued this iteration */
+        tun_out_flush(&shard->out);
+    }
+}
+
+static void *shard_thread_func(void *arg)
+{
+    vpn_shard_t *shard = (vpn_shard_t *)arg;
+
+    /* JNIEnv is per thread: protect() must go through this one */
+    JNIEnv *env;
+    JavaVM *jvm = shard->jvm;
+    if ((*jvm)->AttachCurrentThread(jvm, &env, NULL) != 0) {
+        LOGE("shard %d: failed to attach thread to JVM", shard->index);
+        return NULL;
+    }
+    shard->tcp.env = env;
+    shard->udp.env = env;
+
+    shard_loop(shard);
+
+    (*jvm)->DetachCurrentThread(jvm);
+    return NULL;
+}
 
 /* ------------------------------------------------------------------ */
-/*  Epoll helpers                                                      */
+/*  TUN reader / writer                                                */
 /* ------------------------------------------------------------------ */
 
-static int g_epoll_fd = -1;
+/*
+ * Shard for a packet from the app, from the same key the relays index
+ * sessions by, so every packet of a flow lands on the shard that owns
+ * its session. DNS goes to shard 0, which keeps the one DNS cache.
+ * Returns -1 for anything the relays would drop anyway.
+ */
+static int flow_shard(const uint8_t *pkt, int len)
+{
+    dpi_ip_info_t ip;
+    if (dpi_parse_ip(pkt, len, &ip) < 0 || ip.l4_len < 4 ||
+        (ip.protocol != IPPROTO_TCP_VAL && ip.protocol != IPPROTO_UDP_VAL))
+        return -1;
+
+    session_key_t key;
+    key.dst_addr = ip.dst_ip;
+    key.src_port = (uint16_t)(ip.l4_data[0] << 8 | ip.l4_data[1]);
+    key.dst_port = (uint16_t)(ip.l4_data[2] << 8 | ip.l4_data[3]);
+    if (ip.protocol == IPPROTO_UDP_VAL && key.dst_port == DNS_PORT)
+        return 0;
+
+    /* High bits: the shard's session table indexes by the low ones */
+    return (int)(((uint64_t)session_key_hash(&key) * (uint32_t)g_shard_count) >> 32);
+}
 
-static void epoll_add_fd(int fd)
+/* Read a TUN burst and copy each packet into its shard's inbound ring */
+static void dispatch_tun_burst(int tun_fd)
 {
-    struct epoll_event ev;
-    ev.events = EPOLLIN;
-    ev.data.fd = fd;
-    epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    const uint8_t *pkts[TUN_BURST];
+    int lens[TUN_BURST];
+    uint32_t wake = 0;
+
+    int n = read_tun_burst(tun_fd, pkts, lens);
+
+    for (int i = 0; i < n; i++) {
+        int s = flow_shard(pkts[i], lens[i]);
+        if (s < 0)
+            continue;
+
+        vpn_shard_t *shard = g_shards[s];
+        uint8_t *slot = spsc_ring_reserve(&shard->in_ring);
+        if (!slot) {
+            /* Shard is behind; the app retransmits */
+            shard->in_drops++;
+            continue;
+        }
+        memcpy(slot, pkts[i], lens[i]);
+        spsc_ring_commit(&shard->in_ring, (uint32_t)lens[i]);
+        wake |= 1u << s;
+    }
+
+    /* One wakeup per shard per burst */
+    for (int s = 0; s < g_shard_count; s++) {
+        if (wake & (1u << s)) {
+            uint64_t one = 1;
+            if (write(g_shards[s]->wake_fd, &one, sizeof(one)) < 0)
+                g_shards[s]->wake_errors++;
+        }
+    }
 }
 
-/* Re-register all relay fds in epoll (called periodically) */
-static void epoll_refresh_relay_fds(void)
+/*
+ * Merge the shards' outbound rings onto the TUN, up to a burst from each
+ * in turn so one busy shard cannot starve the others. A packet the
+ * non-blocking TUN refuses is dropped and counted.
+ */
+static void drain_shard_output(int tun_fd)
 {
-    int fds[TCP_MAX_SESSIONS + UDP_MAX_SESSIONS];
-    int count = 0;
-
-    count += tcp_relay_get_fds(&g_tcp_relay, fds + count, TCP_MAX_SESSIONS);
-    count += udp_relay_get_fds(&g_udp_relay, fds + count, UDP_MAX_SESSIONS);
-
-    for (int i = 0; i < count; i++) {
-        struct epoll_event ev;
-        ev.events = EPOLLIN;
-        ev.data.fd = fds[i];
-        /* EPOLL_CTL_ADD may fail with EEXIST for already-added fds — that's fine */
-        epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fds[i], &ev);
+    uint32_t moved;
+
+    do {
+        moved = 0;
+        for (int s = 0; s < g_shard_count; s++) {
+            spsc_ring_t *ring = &g_shards[s]->out_ring;
+            uint32_t n = spsc_ring_available(ring);
+            if (n > TUN_BURST)
+                n = TUN_BURST;
+
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t len;
+                const uint8_t *pkt = spsc_ring_slot(ring, i, &len);
+                if (write(tun_fd, pkt, len) < 0 && g_shards[s]->out_errors++ == 0)
+                    LOGE("shard %d: TUN write: %s", s, strerror(errno));
+            }
+            spsc_ring_release(ring, n);
+            moved += n;
+        }
+    } while (moved > 0);
+}
+
+static void tun_loop(int tun_fd, int out_wake_fd)
+{
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        LOGE("epoll_create1: %s", strerror(errno));
+        return;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = tun_fd };
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.fd = out_wake_fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tun_fd, &ev) < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, out_wake_fd, &wake_ev) < 0) {
+        LOGE("epoll_ctl(ADD): %s", strerror(errno));
+        close(epoll_fd);
+        return;
     }
+
+    struct epoll_event events[2];
+
+    while (g_running) {
+        int nfds = epoll_wait(epoll_fd, events, 2, 1000);
+        if (nfds < 0) {
+            if (errno == EINTR) continue;
+            LOGE("epoll_wait: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.fd == tun_fd) {
+                dispatch_tun_burst(tun_fd);
+            } else {
+                uint64_t count;
+                read(out_wake_fd, &count, sizeof(count));
+            }
+        }
+
+        drain_shard_output(tun_fd);
+    }
+
+    close(epoll_fd);
 }
 
 /* ------------------------------------------------------------------ */
@@ -81,12 +409,175 @@ typedef struct {
     int fake_len;
     int fake_ttl;
     int fake_repeats;
+    int fake_bursts;            /* per QUIC connection attempt, 0 = relay default */
     int split_pos;
+    char *split_markers;        /* e.g. "1,midsld", NULL = split_pos only */
     bool use_disorder;
+    bool defer_syn_ack;         /* SYN-ACK the app only after the server connect */
+    char *hostlist_path;        /* NULL = desync every host */
+    char *hostlist_exclude_path;
+    char *quic_hostlist_path;   /* NULL = fakes for every QUIC Initial */
+    char *quic_hostlist_exclude_path;
+    int max_tcp_sessions;       /* across all shards, 0 = relay defaults */
+    int max_udp_sessions;
     JavaVM *jvm;
     jobject vpn_service_global;
 } vpn_thread_args_t;
 
+static void free_thread_args(vpn_thread_args_t *args)
+{
+    free(args->fake_payload);
+    free(args->split_markers);
+    free(args->hostlist_path);
+    free(args->hostlist_exclude_path);
+    free(args->quic_hostlist_path);
+    free(args->quic_hostlist_exclude_path);
+    free(args);
+}
+
+/* Load a hostlist file; returns hl on success, NULL if unset or unreadable */
+static const dpi_hostlist_t *load_hostlist(dpi_hostlist_t *hl, const char *path)
+{
+    dpi_hostlist_init(hl);
+    if (!path)
+        return NULL;
+
+    int n = dpi_hostlist_load_file(hl, path);
+    if (n < 0) {
+        LOGE("Failed to load hostlist %s", path);
+        return NULL;
+    }
+    LOGI("Loaded %d domains from %s", n, path);
+    return hl;
+}
+
+/* One core is left for the TUN thread */
+static int shard_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (n < 1)
+        n = 1;
+    if (n > VPN_MAX_SHARDS)
+        n = VPN_MAX_SHARDS;
+    return (int)n;
+}
+
+/* One shard's part of a session limit (0 stays 0: the relay default) */
+static int shard_limit(int total, int shards)
+{
+    return total > 0 ? (total + shards - 1) / shards : 0;
+}
+
+/*
+ * Allocate a shard and its relays. The only shard reads and writes the
+ * TUN itself; otherwise the shard is fed through rings and wakes the TUN
+ * thread via out_wake_fd, writing to tun_fd only packets too large for
+ * an out_ring slot.
+ */
+static vpn_shard_t *shard_create(int index, int shards, int tun_fd, int out_wake_fd,
+                                 const vpn_thread_args_t *args,
+                                 const dpi_hostlist_t *hostlist,
+                                 const dpi_hostlist_t *hostlist_exclude,
+                                 const dpi_hostlist_t *quic_hostlist,
+                                 const dpi_hostlist_t *quic_hostlist_exclude,
+                                 JNIEnv *env)
+{
+    vpn_shard_t *shard = calloc(1, sizeof(*shard));
+    if (!shard) {
+        LOGE("calloc failed");
+        return NULL;
+    }
+    shard->index   = index;
+    shard->tun_fd  = shards > 1 ? -1 : tun_fd;
+    shard->wake_fd = -1;
+    shard->jvm     = args->jvm;
+
+    shard->epoll_fd = epoll_create1(0);
+    if (shard->epoll_fd < 0) {
+        LOGE("epoll_create1: %s", strerror(errno));
+        goto fail;
+    }
+
+    int input_fd = shard->tun_fd;
+    if (shards == 1) {
+        tun_out_init_direct(&shard->out, tun_fd);
+    } else {
+        if (spsc_ring_init(&shard->in_ring, SHARD_RING_SLOTS, TUN_SLOT_SIZE) < 0 ||
+            spsc_ring_init(&shard->out_ring, SHARD_RING_SLOTS, TUN_SLOT_SIZE) < 0) {
+            LOGE("Cannot allocate shard %d rings", index);
+            goto fail;
+        }
+        shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->wake_fd < 0) {
+            LOGE("eventfd: %s", strerror(errno));
+            goto fail;
+        }
+        tun_out_init_ring(&shard->out, &shard->out_ring, out_wake_fd, tun_fd);
+        input_fd = shard->wake_fd;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = (void *)&g_tun_kind };
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, input_fd, &ev) < 0) {
+        LOGE("epoll_ctl(ADD, input): %s", strerror(errno));
+        goto fail;
+    }
+
+    if (tcp_relay_init(&shard->tcp, &shard->out, shard->epoll_fd,
+                       args->split_pos, args->split_markers,
+                       args->use_disorder, args->defer_syn_ack,
+                       hostlist, hostlist_exclude,
+                       shard_limit(args->max_tcp_sessions, shards),
+                       env, args->vpn_service_global) < 0)
+        goto fail;
+    if (udp_relay_init(&shard->udp, &shard->out, shard->epoll_fd,
+                       args->fake_payload, args->fake_len,
+                       args->fake_ttl, args->fake_repeats, args->fake_bursts,
+                       quic_hostlist, quic_hostlist_exclude,
+                       shard_limit(args->max_udp_sessions, shards),
+                       env, args->vpn_service_global) < 0) {
+        tcp_relay_destroy(&shard->tcp);
+        goto fail;
+    }
+    if (g_sockets_ready) {
+        shard->tcp.sockets = &g_sockets.shards[index];
+        shard->udp.sockets = &g_sockets.shards[index];
+    }
+    return shard;
+
+fail:
+    if (shard->epoll_fd >= 0)
+        close(shard->epoll_fd);
+    if (shard->wake_fd >= 0)
+        close(shard->wake_fd);
+    spsc_ring_free(&shard->in_ring);
+    spsc_ring_free(&shard->out_ring);
+    free(shard);
+    return NULL;
+}
+
+static void shard_destroy(vpn_shard_t *shard)
+{
+    if (shard->started)
+        pthread_join(shard->thread, NULL);
+
+    if (shard->in_drops || shard->out.drops)
+        LOGI("shard %d: dropped %u inbound, %u outbound packets",
+             shard->index, shard->in_drops, shard->out.drops);
+    if (shard->out_errors || shard->out.write_errors || shard->wake_errors)
+        LOGI("shard %d: %u TUN writes failed (%u from the ring), %u wakeups failed",
+             shard->index, shard->out_errors + shard->out.write_errors,
+             shard->out_errors, shard->wake_errors);
+
+    tcp_relay_destroy(&shard->tcp);
+    udp_relay_destroy(&shard->udp);
+    close(shard->epoll_fd);
+    if (shard->wake_fd >= 0)
+        close(shard->wake_fd);
+    spsc_ring_free(&shard->in_ring);
+    spsc_ring_free(&shard->out_ring);
+    free(shard);
+}
+
 static void *vpn_thread_func(void *arg)
 {
     vpn_thread_args_t *args = (vpn_thread_args_t *)arg;
@@ -96,128 +587,107 @@ static void *vpn_thread_func(void *arg)
     JavaVM *jvm = args->jvm;
     if ((*jvm)->AttachCurrentThread(jvm, &env, NULL) != 0) {
         LOGE("Failed to attach thread to JVM");
-        free(args->fake_payload);
-        free(args);
+        free_thread_args(args);
         return NULL;
     }
 
     int tun_fd = args->tun_fd;
-
-    LOGI("VPN processor starting: tun_fd=%d, split_pos=%d, disorder=%d, "
-         "fake_ttl=%d, fake_repeats=%d, fake_len=%d",
-         tun_fd, args->split_pos, args->use_disorder,
-         args->fake_ttl, args->fake_repeats, args->fake_len);
-
-    /* Initialize relays */
-    tcp_relay_init(&g_tcp_relay, tun_fd,
-                   args->split_pos, args->use_disorder,
-                   env, args->vpn_service_global);
-    udp_relay_init(&g_udp_relay, tun_fd,
-                   args->fake_payload, args->fake_len,
-                   args->fake_ttl, args->fake_repeats,
-                   env, args->vpn_service_global);
-
-    /* Create epoll */
-    g_epoll_fd = epoll_create1(0);
-    if (g_epoll_fd < 0) {
-        LOGE("epoll_create1: %s", strerror(errno));
+    int shards = shard_count();
+    int out_wake_fd = -1;
+
+    LOGI("VPN processor starting: tun_fd=%d, shards=%d, split_pos=%d, split_markers=%s, "
+         "disorder=%d, defer_syn_ack=%d, fake_ttl=%d, fake_repeats=%d, fake_bursts=%d, fake_len=%d, "
+         "max_sessions=%d/%d",
+         tun_fd, shards, args->split_pos,
+         args->split_markers ? args->split_markers : "-",
+         args->use_disorder, args->defer_syn_ack,
+         args->fake_ttl, args->fake_repeats, args->fake_bursts, args->fake_len,
+         args->max_tcp_sessions, args->max_udp_sessions);
+
+    const dpi_hostlist_t *hostlist =
+        load_hostlist(&g_hostlist, args->hostlist_path);
+    const dpi_hostlist_t *hostlist_exclude =
+        load_hostlist(&g_hostlist_exclude, args->hostlist_exclude_path);
+    const dpi_hostlist_t *quic_hostlist =
+        load_hostlist(&g_quic_hostlist, args->quic_hostlist_path);
+    const dpi_hostlist_t *quic_hostlist_exclude =
+        load_hostlist(&g_quic_hostlist_exclude, args->quic_hostlist_exclude_path);
+
+    /* Bursts read until EAGAIN */
+    int fl = fcntl(tun_fd, F_GETFL);
+    if (fl < 0 || fcntl(tun_fd, F_SETFL, fl | O_NONBLOCK) < 0) {
+        LOGE("fcntl(tun, O_NONBLOCK): %s", strerror(errno));
         goto cleanup;
     }
 
-    /* Add TUN fd to epoll */
-    epoll_add_fd(tun_fd);
+    /* Pick the checksum kernel before the shards race to do it lazily */
+    dpi_checksum_select(DPI_CSUM_AUTO);
 
-    uint8_t buf[MAX_PKT_SIZE];
-    struct epoll_event events[MAX_EPOLL_EVENTS];
-    int64_t last_cleanup = 0;
-
-    while (g_running) {
-        int nfds = epoll_wait(g_epoll_fd, events, MAX_EPOLL_EVENTS, 1000);
-        if (nfds < 0) {
-            if (errno == EINTR) continue;
-            LOGE("epoll_wait: %s", strerror(errno));
-            break;
+    if (shards > 1) {
+        out_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (out_wake_fd < 0) {
+            LOGE("eventfd: %s", strerror(errno));
+            goto cleanup;
         }
+    }
 
-        for (int i = 0; i < nfds; i++) {
-            int fd = events[i].data.fd;
-
-            if (fd == tun_fd) {
-                /* Read packet from TUN */
-                ssize_t n = read(tun_fd, buf, sizeof(buf));
-                if (n <= 0) continue;
-
-                /* Parse IPv4 */
-                dpi_ip_info_t ip;
-                if (dpi_parse_ipv4(buf, (int)n, &ip) < 0)
-                    continue;
-
-                if (ip.protocol == IPPROTO_TCP_VAL) {
-                    dpi_tcp_info_t tcp;
-                    if (dpi_parse_tcp(ip.l4_data, ip.l4_len, &tcp) < 0)
-                        continue;
-
-                    tcp_relay_process(&g_tcp_relay,
-                                     ip.src_addr, ip.dst_addr,
-                                     tcp.src_port, tcp.dst_port,
-                                     tcp.seq, tcp.ack,
-                                     tcp.flags,
-                                     tcp.payload, tcp.payload_len);
-
-                    /* New session may have been created — refresh epoll */
-                    epoll_refresh_relay_fds();
-
-                } else if (ip.protocol == IPPROTO_UDP_VAL) {
-                    dpi_udp_info_t udp;
-                    if (dpi_parse_udp(ip.l4_data, ip.l4_len, &udp) < 0)
-                        continue;
-
-                    udp_relay_process(&g_udp_relay,
-                                     ip.src_addr, ip.dst_addr,
-                                     udp.src_port, udp.dst_port,
-                                     udp.payload, udp.payload_len);
-
-                    epoll_refresh_relay_fds();
-                }
-            } else {
-                /* Response from a relay socket */
-                int handled = tcp_relay_handle_response(&g_tcp_relay, fd);
-                if (handled == 0)
-                    handled = udp_relay_handle_response(&g_udp_relay, fd);
-
-                if (handled < 0) {
-                    /* Socket closed/error — remove from epoll */
-                    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-                }
-            }
-        }
+    /* Without the pool thread every session opens its socket inline */
+    g_sockets_ready = socket_pool_init(&g_sockets, shards, env, args->vpn_service_global) == 0;
+
+    /* Relays are set up here so a failure stops the VPN before any thread runs */
+    for (int s = 0; s < shards; s++) {
+        g_shards[s] = shard_create(s, shards, tun_fd, out_wake_fd, args,
+                                   hostlist, hostlist_exclude,
+                                   quic_hostlist, quic_hostlist_exclude, env);
+        if (!g_shards[s])
+            goto cleanup;
+        g_shard_count = s + 1;
+    }
+
+    if (shards == 1) {
+        shard_loop(g_shards[0]);
+        goto cleanup;
+    }
 
-        /* Periodic cleanup */
-        struct timespec ts;
-        clock_gettime(CLOCK_MONOTONIC, &ts);
-        if (ts.tv_sec - last_cleanup >= CLEANUP_INTERVAL) {
-            tcp_relay_cleanup(&g_tcp_relay);
-            udp_relay_cleanup(&g_udp_relay);
-            last_cleanup = ts.tv_sec;
+    for (int s = 0; s < shards; s++) {
+        if (pthread_create(&g_shards[s]->thread, NULL, shard_thread_func, g_shards[s]) != 0) {
+            LOGE("pthread_create(shard %d) failed", s);
+            g_running = 0;
+            goto cleanup;
         }
+        g_shards[s]->started = true;
     }
 
+    tun_loop(tun_fd, out_wake_fd);
+
 cleanup:
     LOGI("VPN processor stopping");
 
-    tcp_relay_destroy(&g_tcp_relay);
-    udp_relay_destroy(&g_udp_relay);
-
-    if (g_epoll_fd >= 0) {
-        close(g_epoll_fd);
-        g_epoll_fd = -1;
+    /* Shards see g_running drop within one poll timeout */
+    g_running = 0;
+    for (int s = 0; s < g_shard_count; s++) {
+        shard_destroy(g_shards[s]);
+        g_shards[s] = NULL;
     }
+    g_shard_count = 0;
+
+    /* Its rings are the shards' to read: only once they have stopped */
+    if (g_sockets_ready)
+        socket_pool_destroy(&g_sockets);
+    g_sockets_ready = false;
+
+    dpi_hostlist_free(&g_hostlist);
+    dpi_hostlist_free(&g_hostlist_exclude);
+    dpi_hostlist_free(&g_quic_hostlist);
+    dpi_hostlist_free(&g_quic_hostlist_exclude);
+
+    if (out_wake_fd >= 0)
+        close(out_wake_fd);
 
     /* Delete global ref */
     (*env)->DeleteGlobalRef(env, args->vpn_service_global);
 
-    free(args->fake_payload);
-    free(args);
+    free_thread_args(args);
 
     (*jvm)->DetachCurrentThread(jvm);
     return NULL;
@@ -227,12 +697,36 @@ cleanup:
 /*  JNI entry points                                                   */
 /* ------------------------------------------------------------------ */
 
+/* Copy a Java string; NULL for null or empty strings */
+static char *dup_jstring(JNIEnv *env, jstring str)
+{
+    if (str == NULL)
+        return NULL;
+
+    const char *utf = (*env)->GetStringUTFChars(env, str, NULL);
+    if (!utf)
+        return NULL;
+
+    char *copy = utf[0] ? strdup(utf) : NULL;
+    (*env)->ReleaseStringUTFChars(env, str, utf);
+    return copy;
+}
+
 JNIEXPORT void JNICALL
 Java_com_zapretgui_ZapretVpnService_nativeStart(JNIEnv *env, jobject thiz,
                                                   int tun_fd,
                                                   jbyteArray fake_payload_arr,
                                                   int fake_ttl, int fake_repeats,
-                                                  int split_pos, jboolean use_disorder)
+                                                  int fake_bursts,
+                                                  jstring quic_hostlist_path,
+                                                  jstring quic_hostlist_exclude_path,
+                                                  int split_pos, jstring split_markers,
+                                                  jboolean use_disorder,
+                                                  jboolean defer_syn_ack,
+                                                  jstring hostlist_path,
+                                                  jstring hostlist_exclude_path,
+                                                  int max_tcp_sessions,
+                                                  int max_udp_sessions)
 {
     if (g_running) {
         LOGE("VPN processor already running");
@@ -248,8 +742,17 @@ Java_com_zapretgui_ZapretVpnService_nativeStart(JNIEnv *env, jobject thiz,
     args->tun_fd      = tun_fd;
     args->fake_ttl    = fake_ttl;
     args->fake_repeats = fake_repeats;
+    args->fake_bursts = fake_bursts;
     args->split_pos   = split_pos;
     args->use_disorder = use_disorder;
+    args->defer_syn_ack = defer_syn_ack;
+    args->max_tcp_sessions = max_tcp_sessions;
+    args->max_udp_sessions = max_udp_sessions;
+    args->split_markers = dup_jstring(env, split_markers);
+    args->hostlist_path = dup_jstring(env, hostlist_path);
+    args->hostlist_exclude_path = dup_jstring(env, hostlist_exclude_path);
+    args->quic_hostlist_path = dup_jstring(env, quic_hostlist_path);
+    args->quic_hostlist_exclude_path = dup_jstring(env, quic_hostlist_exclude_path);
 
     /* Copy fake payload from Java byte[] */
     if (fake_payload_arr != NULL) {
@@ -276,8 +779,7 @@ Java_com_zapretgui_ZapretVpnService_nativeStart(JNIEnv *env, jobject thiz,
         LOGE("pthread_create failed: %s", strerror(errno));
         g_running = 0;
         (*env)->DeleteGlobalRef(env, args->vpn_service_global);
-        free(args->fake_payload);
-        free(args);
+        free_thread_args(args);
     }
 }
 
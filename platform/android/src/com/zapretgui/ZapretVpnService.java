@@ -6,6 +6,10 @@ import android.app.NotificationManager;
 import android.app.PendingIntent;
 import android.content.Context;
 import android.content.Intent;
+import android.net.ConnectivityManager;
+import android.net.LinkAddress;
+import android.net.LinkProperties;
+import android.net.Network;
 import android.net.VpnService;
 import android.os.Build;
 import android.os.ParcelFileDescriptor;
@@ -14,6 +18,8 @@ import android.util.Log;
 import java.io.File;
 import java.io.FileInputStream;
 import java.io.IOException;
+import java.net.Inet6Address;
+import java.net.InetAddress;
 
 public class ZapretVpnService extends VpnService {
     private static final String TAG = "ZapretVpnService";
@@ -23,9 +29,18 @@ public class ZapretVpnService extends VpnService {
     /* Intent extras for strategy configuration */
     public static final String EXTRA_FAKE_TTL = "fake_ttl";
     public static final String EXTRA_FAKE_REPEATS = "fake_repeats";
+    public static final String EXTRA_FAKE_BURSTS = "fake_bursts";
     public static final String EXTRA_FAKE_QUIC_PATH = "fake_quic_path";
+    public static final String EXTRA_QUIC_HOSTLIST = "quic_hostlist";
+    public static final String EXTRA_QUIC_HOSTLIST_EXCLUDE = "quic_hostlist_exclude";
     public static final String EXTRA_SPLIT_POS = "split_pos";
+    public static final String EXTRA_SPLIT_MARKERS = "split_markers";
     public static final String EXTRA_USE_DISORDER = "use_disorder";
+    public static final String EXTRA_DEFER_SYN_ACK = "defer_syn_ack";
+    public static final String EXTRA_HOSTLIST = "hostlist";
+    public static final String EXTRA_HOSTLIST_EXCLUDE = "hostlist_exclude";
+    public static final String EXTRA_MAX_TCP_SESSIONS = "max_tcp_sessions";
+    public static final String EXTRA_MAX_UDP_SESSIONS = "max_udp_sessions";
 
     private ParcelFileDescriptor mTunFd;
     private static ZapretVpnService sInstance;
@@ -36,8 +51,12 @@ public class ZapretVpnService extends VpnService {
 
     /* Native methods implemented in vpn_processor.c */
     private native void nativeStart(int tunFd, byte[] fakePayload,
-                                    int fakeTtl, int fakeRepeats,
-                                    int splitPos, boolean useDisorder);
+                                    int fakeTtl, int fakeRepeats, int fakeBursts,
+                                    String quicHostlistPath, String quicHostlistExcludePath,
+                                    int splitPos, String splitMarkers,
+                                    boolean useDisorder, boolean deferSynAck,
+                                    String hostlistPath, String hostlistExcludePath,
+                                    int maxTcpSessions, int maxUdpSessions);
     private native void nativeStop();
 
     @Override
@@ -60,19 +79,40 @@ public class ZapretVpnService extends VpnService {
         /* Extract strategy parameters from intent */
         int fakeTtl = 3;
         int fakeRepeats = 6;
+        int fakeBursts = 0;      /* per QUIC connection attempt, 0 = native default */
         String fakeQuicPath = null;
+        String quicHostlistPath = null;
+        String quicHostlistExcludePath = null;
         int splitPos = 1;
+        String splitMarkers = null;
         boolean useDisorder = false;
+        boolean deferSynAck = true;
+        String hostlistPath = null;
+        String hostlistExcludePath = null;
+        int maxTcpSessions = 0;  /* 0 = native defaults */
+        int maxUdpSessions = 0;
 
         if (intent != null) {
             fakeTtl = intent.getIntExtra(EXTRA_FAKE_TTL, 3);
             fakeRepeats = intent.getIntExtra(EXTRA_FAKE_REPEATS, 6);
+            fakeBursts = intent.getIntExtra(EXTRA_FAKE_BURSTS, 0);
             fakeQuicPath = intent.getStringExtra(EXTRA_FAKE_QUIC_PATH);
+            quicHostlistPath = intent.getStringExtra(EXTRA_QUIC_HOSTLIST);
+            quicHostlistExcludePath = intent.getStringExtra(EXTRA_QUIC_HOSTLIST_EXCLUDE);
             splitPos = intent.getIntExtra(EXTRA_SPLIT_POS, 1);
+            splitMarkers = intent.getStringExtra(EXTRA_SPLIT_MARKERS);
             useDisorder = intent.getBooleanExtra(EXTRA_USE_DISORDER, false);
+            deferSynAck = intent.getBooleanExtra(EXTRA_DEFER_SYN_ACK, true);
+            hostlistPath = intent.getStringExtra(EXTRA_HOSTLIST);
+            hostlistExcludePath = intent.getStringExtra(EXTRA_HOSTLIST_EXCLUDE);
+            maxTcpSessions = intent.getIntExtra(EXTRA_MAX_TCP_SESSIONS, 0);
+            maxUdpSessions = intent.getIntExtra(EXTRA_MAX_UDP_SESSIONS, 0);
         }
 
-        startVpn(fakeTtl, fakeRepeats, fakeQuicPath, splitPos, useDisorder);
+        startVpn(fakeTtl, fakeRepeats, fakeBursts, fakeQuicPath,
+                 quicHostlistPath, quicHostlistExcludePath,
+                 splitPos, splitMarkers, useDisorder, deferSynAck,
+                 hostlistPath, hostlistExcludePath, maxTcpSessions, maxUdpSessions);
         return START_STICKY;
     }
 
@@ -83,8 +123,12 @@ public class ZapretVpnService extends VpnService {
         super.onDestroy();
     }
 
-    private void startVpn(int fakeTtl, int fakeRepeats, String fakeQuicPath,
-                          int splitPos, boolean useDisorder) {
+    private void startVpn(int fakeTtl, int fakeRepeats, int fakeBursts, String fakeQuicPath,
+                          String quicHostlistPath, String quicHostlistExcludePath,
+                          int splitPos, String splitMarkers, boolean useDisorder,
+                          boolean deferSynAck,
+                          String hostlistPath, String hostlistExcludePath,
+                          int maxTcpSessions, int maxUdpSessions) {
         try {
             /* Create TUN interface */
             Builder builder = new Builder();
@@ -95,6 +139,13 @@ public class ZapretVpnService extends VpnService {
             builder.addDnsServer("8.8.8.8");
             builder.setMtu(1500);
 
+            /* Relay IPv6 natively only when the real network has it —
+             * otherwise apps would prefer an IPv6 path we cannot reach */
+            if (underlyingNetworkHasIpv6()) {
+                builder.addAddress("fd00:a78::1", 64);
+                builder.addRoute("::", 0);
+            }
+
             /* Exclude our own app from VPN to avoid loops */
             try {
                 builder.addDisallowedApplication(getPackageName());
@@ -116,16 +167,41 @@ public class ZapretVpnService extends VpnService {
 
             /* Start native packet processor in background thread */
             nativeStart(mTunFd.getFd(), fakePayload,
-                       fakeTtl, fakeRepeats, splitPos, useDisorder);
-
-            Log.i(TAG, "VPN started: split=" + splitPos + " disorder=" + useDisorder
-                    + " fakeTtl=" + fakeTtl + " fakeRepeats=" + fakeRepeats);
+                       fakeTtl, fakeRepeats, fakeBursts, quicHostlistPath, quicHostlistExcludePath,
+                       splitPos, splitMarkers, useDisorder, deferSynAck,
+                       hostlistPath, hostlistExcludePath, maxTcpSessions, maxUdpSessions);
+
+            Log.i(TAG, "VPN started: split=" + (splitMarkers != null && !splitMarkers.isEmpty()
+                    ? splitMarkers : String.valueOf(splitPos)) + " disorder=" + useDisorder
+                    + " deferSynAck=" + deferSynAck
+                    + " fakeTtl=" + fakeTtl + " fakeRepeats=" + fakeRepeats
+                    + " fakeBursts=" + fakeBursts);
         } catch (Exception e) {
             Log.e(TAG, "Failed to start VPN", e);
             stopVpn();
         }
     }
 
+    private boolean underlyingNetworkHasIpv6() {
+        ConnectivityManager cm = getSystemService(ConnectivityManager.class);
+        if (cm == null) {
+            return false;
+        }
+        Network network = cm.getActiveNetwork();
+        LinkProperties lp = network != null ? cm.getLinkProperties(network) : null;
+        if (lp == null) {
+            return false;
+        }
+        for (LinkAddress la : lp.getLinkAddresses()) {
+            InetAddress addr = la.getAddress();
+            if (addr instanceof Inet6Address && !addr.isLinkLocalAddress()
+                    && !addr.isLoopbackAddress() && !addr.isSiteLocalAddress()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     private byte[] loadFakePayload(String path) {
         try {
             File file = new File(path);
@@ -212,14 +288,28 @@ public class ZapretVpnService extends VpnService {
         }
     }
 
-    public static void start(Context context, int fakeTtl, int fakeRepeats,
-                             String fakeQuicPath, int splitPos, boolean useDisorder) {
+    public static void start(Context context, int fakeTtl, int fakeRepeats, int fakeBursts,
+                             String fakeQuicPath,
+                             String quicHostlistPath, String quicHostlistExcludePath,
+                             int splitPos, String splitMarkers,
+                             boolean useDisorder, boolean deferSynAck,
+                             String hostlistPath, String hostlistExcludePath,
+                             int maxTcpSessions, int maxUdpSessions) {
         Intent intent = new Intent(context, ZapretVpnService.class);
         intent.putExtra(EXTRA_FAKE_TTL, fakeTtl);
         intent.putExtra(EXTRA_FAKE_REPEATS, fakeRepeats);
+        intent.putExtra(EXTRA_FAKE_BURSTS, fakeBursts);
         intent.putExtra(EXTRA_FAKE_QUIC_PATH, fakeQuicPath);
+        intent.putExtra(EXTRA_QUIC_HOSTLIST, quicHostlistPath);
+        intent.putExtra(EXTRA_QUIC_HOSTLIST_EXCLUDE, quicHostlistExcludePath);
         intent.putExtra(EXTRA_SPLIT_POS, splitPos);
+        intent.putExtra(EXTRA_SPLIT_MARKERS, splitMarkers);
         intent.putExtra(EXTRA_USE_DISORDER, useDisorder);
+        intent.putExtra(EXTRA_DEFER_SYN_ACK, deferSynAck);
+        intent.putExtra(EXTRA_HOSTLIST, hostlistPath);
+        intent.putExtra(EXTRA_HOSTLIST_EXCLUDE, hostlistExcludePath);
+        intent.putExtra(EXTRA_MAX_TCP_SESSIONS, maxTcpSessions);
+        intent.putExtra(EXTRA_MAX_UDP_SESSIONS, maxUdpSessions);
 
         if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.O) {
             context.startForegroundService(intent);
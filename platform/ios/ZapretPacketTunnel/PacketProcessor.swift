@@ -79,10 +79,10 @@ class PacketProcessor {
             guard let self = self else { return }
 
             for (i, packet) in packets.enumerated() {
-                // protocols[i] should be AF_INET (2) for IPv4
-                let proto = protocols[i].intValue
-                if proto == AF_INET {
-                    self.processIPv4Packet(packet)
+                // protocols[i] is AF_INET or AF_INET6
+                let proto = protocols[i].int32Value
+                if proto == AF_INET || proto == AF_INET6 {
+                    self.processIPPacket(packet)
                 }
             }
 
@@ -91,13 +91,13 @@ class PacketProcessor {
         }
     }
 
-    private func processIPv4Packet(_ packet: Data) {
+    private func processIPPacket(_ packet: Data) {
         packet.withUnsafeBytes { ptr in
             guard let base = ptr.baseAddress?.assumingMemoryBound(to: UInt8.self) else { return }
             let len = Int32(packet.count)
 
             var ip = dpi_ip_info_t()
-            guard dpi_parse_ipv4(base, len, &ip) == 0 else { return }
+            guard dpi_parse_ip(base, len, &ip) == 0 else { return }
 
             if ip.protocol == 6 { // TCP
                 var tcp = dpi_tcp_info_t()
@@ -111,7 +111,7 @@ class PacketProcessor {
                 }
 
                 tcpRelay?.processPacket(
-                    srcAddr: ip.src_addr, dstAddr: ip.dst_addr,
+                    srcAddr: ip.src_ip, dstAddr: ip.dst_ip,
                     srcPort: tcp.src_port, dstPort: tcp.dst_port,
                     seq: tcp.seq, ack: tcp.ack, flags: tcp.flags,
                     payload: payload
@@ -128,7 +128,7 @@ class PacketProcessor {
                 }
 
                 udpRelay?.processPacket(
-                    srcAddr: ip.src_addr, dstAddr: ip.dst_addr,
+                    srcAddr: ip.src_ip, dstAddr: ip.dst_ip,
                     srcPort: udp.src_port, dstPort: udp.dst_port,
                     payload: payload
                 )
@@ -137,7 +137,26 @@ class PacketProcessor {
     }
 
     private func writeToTun(_ packet: Data) {
-        // Protocol number 2 = AF_INET (IPv4)
-        packetFlow?.writePackets([packet], withProtocols: [NSNumber(value: AF_INET)])
+        // Protocol family from the IP version nibble
+        let family = (packet.first ?? 0) >> 4 == 6 ? AF_INET6 : AF_INET
+        packetFlow?.writePackets([packet], withProtocols: [NSNumber(value: family)])
+    }
+}
+
+// MARK: - dpi_addr_t helpers
+
+extension dpi_addr_t {
+    /// 16 address bytes in wire order (IPv4 is IPv4-mapped)
+    var bytes: [UInt8] {
+        withUnsafeBytes(of: b) { Array($0) }
+    }
+
+    var isIPv4: Bool {
+        withUnsafePointer(to: self) { dpi_addr_is_ipv4($0) }
+    }
+
+    /// Hex string usable as a dictionary key
+    var key: String {
+        bytes.map { String(format: "%02x", $0) }.joined()
     }
 }
@@ -1,3 +1,4 @@
+import Network
 import NetworkExtension
 import os.log
 
@@ -16,6 +17,16 @@ class PacketTunnelProvider: NEPacketTunnelProvider {
         ipv4Settings.includedRoutes = [NEIPv4Route.default()]
         settings.ipv4Settings = ipv4Settings
 
+        // Route ::/0 only when the real network has IPv6, as on Android:
+        // otherwise IPv6 flows are captured with nowhere to relay them
+        if await underlyingPathSupportsIPv6() {
+            let ipv6Settings = NEIPv6Settings(addresses: ["fd00:a78::1"], networkPrefixLengths: [64])
+            ipv6Settings.includedRoutes = [NEIPv6Route.default()]
+            settings.ipv6Settings = ipv6Settings
+        } else {
+            logger.info("Underlying network has no IPv6, tunnelling IPv4 only")
+        }
+
         settings.dnsSettings = NEDNSSettings(servers: ["1.1.1.1", "8.8.8.8"])
         settings.mtu = 1500
 
@@ -53,6 +64,21 @@ class PacketTunnelProvider: NEPacketTunnelProvider {
         return nil
     }
 
+    /// First path update of the network the tunnel runs over: whether it can reach IPv6.
+    private func underlyingPathSupportsIPv6() async -> Bool {
+        await withCheckedContinuation { continuation in
+            let monitor = NWPathMonitor()
+            var resumed = false
+            monitor.pathUpdateHandler = { path in
+                guard !resumed else { return }
+                resumed = true
+                monitor.cancel()
+                continuation.resume(returning: path.status == .satisfied && path.supportsIPv6)
+            }
+            monitor.start(queue: DispatchQueue(label: "com.zapretgui.tunnel.path"))
+        }
+    }
+
     private func loadConfig() -> PacketProcessor.DPIConfig {
         var config = PacketProcessor.DPIConfig()
 
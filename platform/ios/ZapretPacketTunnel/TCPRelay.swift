@@ -18,8 +18,9 @@ class TCPRelay {
 
     class Session {
         let srcPort: UInt16
-        let dstAddr: UInt32
+        let dstAddr: dpi_addr_t
         let dstPort: UInt16
+        let appAddr: dpi_addr_t
 
         var connection: NWConnection?
         var tunSeq: UInt32 = 0
@@ -28,16 +29,18 @@ class TCPRelay {
         var lastActivity: Date = Date()
         var active: Bool = true
 
-        init(srcPort: UInt16, dstAddr: UInt32, dstPort: UInt16) {
+        init(srcPort: UInt16, dstAddr: dpi_addr_t, dstPort: UInt16, appAddr: dpi_addr_t) {
             self.srcPort = srcPort
             self.dstAddr = dstAddr
             self.dstPort = dstPort
+            self.appAddr = appAddr
         }
     }
 
     private var sessions: [String: Session] = [:]
     private let config: Config
     private let sessionTimeout: TimeInterval = 300
+    private let tunMTU = 1500  // NEPacketTunnelNetworkSettings.mtu in PacketTunnelProvider
     private let queue = DispatchQueue(label: "com.zapretgui.tcp-relay")
 
     /// Callback to write a constructed IP packet back to the TUN
@@ -48,7 +51,7 @@ class TCPRelay {
     }
 
     /// Process an outgoing TCP packet (app → internet)
-    func processPacket(srcAddr: UInt32, dstAddr: UInt32,
+    func processPacket(srcAddr: dpi_addr_t, dstAddr: dpi_addr_t,
                        srcPort: UInt16, dstPort: UInt16,
                        seq: UInt32, ack: UInt32, flags: UInt8,
                        payload: Data) {
@@ -65,8 +68,8 @@ class TCPRelay {
 
             // SYN
             if flags & UInt8(DPI_TCP_SYN) != 0 {
-                handleSyn(key: key, srcPort: srcPort, dstAddr: dstAddr,
-                         dstPort: dstPort, seq: seq)
+                handleSyn(key: key, srcAddr: srcAddr, srcPort: srcPort,
+                          dstAddr: dstAddr, dstPort: dstPort, seq: seq)
                 return
             }
 
@@ -108,18 +111,19 @@ class TCPRelay {
 
     // MARK: - Private
 
-    private func sessionKey(srcPort: UInt16, dstAddr: UInt32, dstPort: UInt16) -> String {
-        "\(srcPort)-\(dstAddr)-\(dstPort)"
+    private func sessionKey(srcPort: UInt16, dstAddr: dpi_addr_t, dstPort: UInt16) -> String {
+        "\(srcPort)-\(dstAddr.key)-\(dstPort)"
     }
 
-    private func handleSyn(key: String, srcPort: UInt16,
-                           dstAddr: UInt32, dstPort: UInt16, seq: UInt32) {
+    private func handleSyn(key: String, srcAddr: dpi_addr_t, srcPort: UInt16,
+                           dstAddr: dpi_addr_t, dstPort: UInt16, seq: UInt32) {
         // Close existing session if re-SYN
         if let existing = sessions[key] {
             closeSession(key: key, session: existing)
         }
 
-        let session = Session(srcPort: srcPort, dstAddr: dstAddr, dstPort: dstPort)
+        let session = Session(srcPort: srcPort, dstAddr: dstAddr, dstPort: dstPort,
+                              appAddr: srcAddr)
 
         // Generate our ISN
         let now = DispatchTime.now().uptimeNanoseconds
@@ -127,9 +131,8 @@ class TCPRelay {
         session.tunAck = seq &+ 1  // ACK the SYN
 
         // Create NWConnection (automatically bypasses tunnel)
-        let addrBytes = withUnsafeBytes(of: dstAddr.bigEndian) { Array($0) }
-        let addrString = "\(addrBytes[0]).\(addrBytes[1]).\(addrBytes[2]).\(addrBytes[3])"
-        let host = NWEndpoint.Host(addrString)
+        let host = dstAddr.nwHost
+        let addrString = "\(host)"
         let port = NWEndpoint.Port(rawValue: dstPort)!
 
         let params = NWParameters.tcp
@@ -143,7 +146,8 @@ class TCPRelay {
         // Send SYN-ACK to app immediately (optimistic — we'll RST if connect fails)
         sendToTun(session: session,
                   flags: UInt8(DPI_TCP_SYN) | UInt8(DPI_TCP_ACK),
-                  payload: Data())
+                  payload: Data(),
+                  options: synAckOptions(for: session))
 
         // Set up connection
         connection.stateUpdateHandler = { [weak self, weak session] state in
@@ -252,23 +256,41 @@ class TCPRelay {
         }
     }
 
-    private func sendToTun(session: Session, flags: UInt8, payload: Data) {
+    /// MSS option for the SYN-ACK so the app sends full-size segments
+    /// instead of falling back to the 536-byte default
+    private func synAckOptions(for session: Session) -> [UInt8] {
+        var opts = dpi_tcp_opts_t()
+        opts.mss = UInt16(tunMTU - (session.appAddr.isIPv4 ? 20 : 40) - 20)
+        opts.wscale = -1
+
+        var buf = [UInt8](repeating: 0, count: Int(DPI_TCP_MAX_OPTIONS))
+        let len = dpi_tcp_write_options(&buf, Int32(buf.count), &opts)
+        return len > 0 ? Array(buf.prefix(Int(len))) : []
+    }
+
+    private func sendToTun(session: Session, flags: UInt8, payload: Data,
+                           options: [UInt8] = []) {
         var pkt = [UInt8](repeating: 0, count: 65536)
 
+        var src = session.dstAddr      // response: server → app
+        var dst = session.appAddr
+
         let pktLen: Int32 = payload.withUnsafeBytes { payloadPtr -> Int32 in
             let payloadBase = payloadPtr.baseAddress?.assumingMemoryBound(to: UInt8.self)
-            return dpi_build_ipv4_tcp(
-                &pkt, Int32(pkt.count),
-                session.dstAddr,        // response: server → app
-                0x0A78_0001,            // 10.120.0.1 (TUN address)
-                session.dstPort,
-                session.srcPort,
-                session.tunSeq,
-                session.tunAck,
-                flags,
-                32768,                  // window
-                payloadBase, Int32(payload.count)
-            )
+            return options.withUnsafeBufferPointer { optPtr -> Int32 in
+                dpi_build_ip_tcp_opts(
+                    &pkt, Int32(pkt.count),
+                    &src, &dst,
+                    session.dstPort,
+                    session.srcPort,
+                    session.tunSeq,
+                    session.tunAck,
+                    flags,
+                    32768,              // window
+                    optPtr.baseAddress, Int32(options.count),
+                    payloadBase, Int32(payload.count)
+                )
+            }
         }
 
         if pktLen > 0 {
@@ -292,3 +314,15 @@ class TCPRelay {
         sessions.removeValue(forKey: key)
     }
 }
+
+// MARK: - dpi_addr_t → NWEndpoint
+
+extension dpi_addr_t {
+    var nwHost: NWEndpoint.Host {
+        let raw = bytes
+        if isIPv4, let v4 = IPv4Address(Data(raw[12..<16])) {
+            return .ipv4(v4)
+        }
+        return .ipv6(IPv6Address(Data(raw))!)
+    }
+}
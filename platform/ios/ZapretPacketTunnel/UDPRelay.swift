@@ -18,9 +18,10 @@ class UDPRelay {
     }
 
     struct Session {
-        let srcPort: UInt16   // app-side source port
-        let dstAddr: UInt32   // destination IP (network byte order)
-        let dstPort: UInt16   // destination port
+        let srcPort: UInt16      // app-side source port
+        let dstAddr: dpi_addr_t  // destination IP (IPv4-mapped for IPv4)
+        let dstPort: UInt16      // destination port
+        let appAddr: dpi_addr_t  // app-side source IP
         let fd: Int32         // BSD socket
         var lastActivity: Date
     }
@@ -39,12 +40,12 @@ class UDPRelay {
     }
 
     /// Process an outgoing UDP packet (app → internet)
-    func processPacket(srcAddr: UInt32, dstAddr: UInt32,
+    func processPacket(srcAddr: dpi_addr_t, dstAddr: dpi_addr_t,
                        srcPort: UInt16, dstPort: UInt16,
                        payload: Data) {
         queue.async { [self] in
             let key = sessionKey(srcPort: srcPort, dstAddr: dstAddr, dstPort: dstPort)
-            let session = getOrCreateSession(key: key, srcPort: srcPort,
+            let session = getOrCreateSession(key: key, srcAddr: srcAddr, srcPort: srcPort,
                                              dstAddr: dstAddr, dstPort: dstPort)
             guard let session = session else { return }
 
@@ -95,12 +96,12 @@ class UDPRelay {
 
     // MARK: - Private
 
-    private func sessionKey(srcPort: UInt16, dstAddr: UInt32, dstPort: UInt16) -> String {
-        "\(srcPort)-\(dstAddr)-\(dstPort)"
+    private func sessionKey(srcPort: UInt16, dstAddr: dpi_addr_t, dstPort: UInt16) -> String {
+        "\(srcPort)-\(dstAddr.key)-\(dstPort)"
     }
 
-    private func getOrCreateSession(key: String, srcPort: UInt16,
-                                    dstAddr: UInt32, dstPort: UInt16) -> Session? {
+    private func getOrCreateSession(key: String, srcAddr: dpi_addr_t, srcPort: UInt16,
+                                    dstAddr: dpi_addr_t, dstPort: UInt16) -> Session? {
         if var existing = sessions[key] {
             existing.lastActivity = Date()
             sessions[key] = existing
@@ -108,22 +109,38 @@ class UDPRelay {
         }
 
         // Create BSD UDP socket (auto-bypasses tunnel in Network Extension)
-        let fd = Darwin.socket(AF_INET, SOCK_DGRAM, 0)
+        let fd = Darwin.socket(dstAddr.isIPv4 ? AF_INET : AF_INET6, SOCK_DGRAM, 0)
         if fd < 0 {
             logger.error("socket(SOCK_DGRAM) failed: \(String(cString: strerror(errno)))")
             return nil
         }
 
         // Connect to destination
-        var dst = sockaddr_in()
-        dst.sin_len = UInt8(MemoryLayout<sockaddr_in>.size)
-        dst.sin_family = sa_family_t(AF_INET)
-        dst.sin_port = dstPort.bigEndian
-        dst.sin_addr.s_addr = dstAddr.bigEndian
-
-        let connectResult = withUnsafePointer(to: &dst) { ptr in
-            ptr.withMemoryRebound(to: sockaddr.self, capacity: 1) { sa in
-                Darwin.connect(fd, sa, socklen_t(MemoryLayout<sockaddr_in>.size))
+        let raw = dstAddr.bytes
+        let connectResult: Int32
+        if dstAddr.isIPv4 {
+            var dst = sockaddr_in()
+            dst.sin_len = UInt8(MemoryLayout<sockaddr_in>.size)
+            dst.sin_family = sa_family_t(AF_INET)
+            dst.sin_port = dstPort.bigEndian
+            withUnsafeMutableBytes(of: &dst.sin_addr) { $0.copyBytes(from: raw[12..<16]) }
+
+            connectResult = withUnsafePointer(to: &dst) { ptr in
+                ptr.withMemoryRebound(to: sockaddr.self, capacity: 1) { sa in
+                    Darwin.connect(fd, sa, socklen_t(MemoryLayout<sockaddr_in>.size))
+                }
+            }
+        } else {
+            var dst = sockaddr_in6()
+            dst.sin6_len = UInt8(MemoryLayout<sockaddr_in6>.size)
+            dst.sin6_family = sa_family_t(AF_INET6)
+            dst.sin6_port = dstPort.bigEndian
+            withUnsafeMutableBytes(of: &dst.sin6_addr) { $0.copyBytes(from: raw) }
+
+            connectResult = withUnsafePointer(to: &dst) { ptr in
+                ptr.withMemoryRebound(to: sockaddr.self, capacity: 1) { sa in
+                    Darwin.connect(fd, sa, socklen_t(MemoryLayout<sockaddr_in6>.size))
+                }
             }
         }
 
@@ -134,7 +151,8 @@ class UDPRelay {
         }
 
         let session = Session(srcPort: srcPort, dstAddr: dstAddr,
-                              dstPort: dstPort, fd: fd, lastActivity: Date())
+                              dstPort: dstPort, appAddr: srcAddr,
+                              fd: fd, lastActivity: Date())
         sessions[key] = session
 
         // Set up dispatch source to read responses
@@ -155,10 +173,11 @@ class UDPRelay {
 
             // Build IP+UDP response for TUN
             var pkt = [UInt8](repeating: 0, count: 65536)
-            let pktLen = dpi_build_ipv4_udp(
+            var src = session.dstAddr   // response: server → app
+            var dst = session.appAddr
+            let pktLen = dpi_build_ip_udp(
                 &pkt, Int32(pkt.count),
-                session.dstAddr,    // response: server → app
-                0x0A78_0001,        // 10.120.0.1 (TUN address)
+                &src, &dst,
                 session.dstPort,
                 session.srcPort,
                 buf, Int32(n)
@@ -178,10 +197,19 @@ class UDPRelay {
         readSources[key] = source
     }
 
+    /// TTL (IPv4) or hop limit (IPv6) for subsequent sends
+    private func setTTL(session: Session, _ value: Int32) {
+        var ttl = value
+        if session.dstAddr.isIPv4 {
+            setsockopt(session.fd, IPPROTO_IP, IP_TTL, &ttl, socklen_t(MemoryLayout<Int32>.size))
+        } else {
+            setsockopt(session.fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, socklen_t(MemoryLayout<Int32>.size))
+        }
+    }
+
     private func sendWithFakes(session: Session, payload: Data, fakeData: Data) {
         // Set low TTL for fakes
-        var ttl = config.fakeTTL
-        setsockopt(session.fd, IPPROTO_IP, IP_TTL, &ttl, socklen_t(MemoryLayout<Int32>.size))
+        setTTL(session: session, config.fakeTTL)
 
         // Send N fake packets
         fakeData.withUnsafeBytes { ptr in
@@ -192,8 +220,7 @@ class UDPRelay {
         }
 
         // Restore normal TTL and send original
-        ttl = 64
-        setsockopt(session.fd, IPPROTO_IP, IP_TTL, &ttl, socklen_t(MemoryLayout<Int32>.size))
+        setTTL(session: session, 64)
 
         payload.withUnsafeBytes { ptr in
             guard let base = ptr.baseAddress else { return }
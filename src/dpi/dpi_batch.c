@@ -0,0 +1,193 @@
+/*
+ * dpi_batch.c — Burst classification of TUN packets
+ *
+ * Parses a burst of IPv4/IPv6 + TCP/UDP packets in one loop and stores
+ * the results column-wise (dpi_batch_t) instead of one dpi_ip_info_t +
+ * dpi_tcp_info_t pair per packet. The headers of packet i+1 are
+ * prefetched while packet i is being parsed.
+ */
+
+#include "dpi_bypass.h"
+#include <string.h>
+
+#define IPV4_MIN_HEADER   20
+#define TCP_MIN_HEADER    20
+#define UDP_HEADER_LEN     8
+
+#define IPPROTO_TCP_CONST  6
+#define IPPROTO_UDP_CONST 17
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define DPI_PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#else
+#  define DPI_PREFETCH(p) ((void)(p))
+#endif
+
+static inline uint16_t read_u16_be(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t read_u32_be(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+
+/* ------------------------------------------------------------------ */
+/*  Flow hash                                                          */
+/* ------------------------------------------------------------------ */
+
+static inline uint32_t hash_mix(uint32_t h, uint32_t v)
+{
+    v *= 0xcc9e2d51u;
+    v = (v << 15) | (v >> 17);
+    v *= 0x1b873593u;
+    h ^= v;
+    h = (h << 13) | (h >> 19);
+    return h * 5 + 0xe6546b64u;
+}
+
+uint32_t dpi_flow_hash(const dpi_addr_t *src, const dpi_addr_t *dst,
+                       uint16_t src_port, uint16_t dst_port, uint8_t protocol)
+{
+    uint32_t h = protocol;
+    uint32_t w;
+
+    for (int i = 0; i < 16; i += 4) {
+        memcpy(&w, src->b + i, 4);
+        h = hash_mix(h, w);
+        memcpy(&w, dst->b + i, 4);
+        h = hash_mix(h, w);
+    }
+    h = hash_mix(h, ((uint32_t)src_port << 16) | dst_port);
+
+    /* murmur3 finalizer: spread entropy into the low bits used as index */
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Batch classification                                               */
+/* ------------------------------------------------------------------ */
+
+/* IP layer of one packet; returns L4 offset or -1. IPv4 is inlined,
+ * IPv6 goes through dpi_parse_ipv6 for its extension header walk. */
+static int classify_ip(const uint8_t *pkt, int len, dpi_batch_t *out, int i,
+                       int *l4_len)
+{
+    if (len < 1)
+        return -1;
+
+    if ((pkt[0] >> 4) == 4) {
+        if (len < IPV4_MIN_HEADER)
+            return -1;
+        int header_len = (pkt[0] & 0x0F) * 4;
+        if (header_len < IPV4_MIN_HEADER || header_len > len)
+            return -1;
+        int total_len = read_u16_be(pkt + 2);
+        if (total_len > len)
+            total_len = len;
+        if (total_len < header_len)
+            return -1;
+
+        out->protocol[i] = pkt[9];
+        dpi_addr_from_ipv4(&out->src_ip[i], read_u32_be(pkt + 12));
+        dpi_addr_from_ipv4(&out->dst_ip[i], read_u32_be(pkt + 16));
+        *l4_len = total_len - header_len;
+        return header_len;
+    }
+
+    dpi_ip_info_t ip;
+    if (dpi_parse_ipv6(pkt, len, &ip) < 0)
+        return -1;
+    out->protocol[i] = ip.protocol;
+    out->src_ip[i] = ip.src_ip;
+    out->dst_ip[i] = ip.dst_ip;
+    *l4_len = ip.l4_len;
+    return ip.header_len;
+}
+
+int dpi_classify_batch(const uint8_t **pkts, const int *lens, int n, dpi_batch_t *out)
+{
+    if (n > DPI_BATCH_MAX)
+        n = DPI_BATCH_MAX;
+    if (n > 0)
+        DPI_PREFETCH(pkts[0]);
+
+    for (int i = 0; i < n; i++) {
+        const uint8_t *pkt = pkts[i];
+
+        /* IP + TCP headers of the next packet fit in its first 64 bytes
+         * (the IPv6 + TCP case spills into the second line) */
+        if (i + 1 < n) {
+            DPI_PREFETCH(pkts[i + 1]);
+            DPI_PREFETCH(pkts[i + 1] + 64);
+        }
+
+        out->protocol[i] = 0;
+        out->tcp_flags[i] = 0;
+        out->tcp_opt_len[i] = 0;
+        out->hint[i] = DPI_HINT_NONE;
+        out->payload_off[i] = 0;
+        out->payload_len[i] = 0;
+
+        int l4_len;
+        int l4_off = classify_ip(pkt, lens[i], out, i, &l4_len);
+        if (l4_off < 0)
+            continue;
+        const uint8_t *l4 = pkt + l4_off;
+        int header_len;
+
+        if (out->protocol[i] == IPPROTO_TCP_CONST) {
+            if (l4_len < TCP_MIN_HEADER) {
+                out->protocol[i] = 0;
+                continue;
+            }
+            header_len = (l4[12] >> 4) * 4;
+            if (header_len < TCP_MIN_HEADER || header_len > l4_len) {
+                out->protocol[i] = 0;
+                continue;
+            }
+            out->seq[i] = read_u32_be(l4 + 4);
+            out->ack[i] = read_u32_be(l4 + 8);
+            out->tcp_flags[i] = l4[13] & 0x3F;
+            out->tcp_opt_len[i] = (uint8_t)(header_len - TCP_MIN_HEADER);
+            out->window[i] = read_u16_be(l4 + 14);
+        } else if (out->protocol[i] == IPPROTO_UDP_CONST) {
+            if (l4_len < UDP_HEADER_LEN) {
+                out->protocol[i] = 0;
+                continue;
+            }
+            header_len = UDP_HEADER_LEN;
+        } else {
+            out->protocol[i] = 0;   /* relays only handle TCP/UDP */
+            continue;
+        }
+
+        out->src_port[i] = read_u16_be(l4 + 0);
+        out->dst_port[i] = read_u16_be(l4 + 2);
+        out->payload_off[i] = l4_off + header_len;
+        out->payload_len[i] = l4_len - header_len;
+
+        const uint8_t *payload = pkt + out->payload_off[i];
+        int payload_len = out->payload_len[i];
+        if (out->protocol[i] == IPPROTO_TCP_CONST) {
+            if (dpi_is_tls_client_hello(payload, payload_len))
+                out->hint[i] = DPI_HINT_TLS_HELLO;
+        } else if (dpi_is_quic_initial(payload, payload_len)) {
+            out->hint[i] = DPI_HINT_QUIC_INITIAL;
+        }
+
+        out->flow_hash[i] = dpi_flow_hash(&out->src_ip[i], &out->dst_ip[i],
+                                          out->src_port[i], out->dst_port[i],
+                                          out->protocol[i]);
+    }
+
+    out->count = n < 0 ? 0 : n;
+    return out->count;
+}
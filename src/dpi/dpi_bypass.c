@@ -13,12 +13,30 @@
 /* ------------------------------------------------------------------ */
 
 #define IPV4_MIN_HEADER   20
+#define IPV6_HEADER       40
 #define TCP_MIN_HEADER    20
 #define UDP_HEADER_LEN     8
 
 #define IPPROTO_TCP_CONST  6
 #define IPPROTO_UDP_CONST 17
 
+/* IPv6 extension headers */
+#define IPV6_EXT_HOPOPTS   0
+#define IPV6_EXT_ROUTING  43
+#define IPV6_EXT_FRAGMENT 44
+#define IPV6_EXT_AH       51
+#define IPV6_EXT_DSTOPTS  60
+
+/* TCP option kinds */
+#define TCPOPT_EOL         0
+#define TCPOPT_NOP         1
+#define TCPOPT_MSS         2
+#define TCPOPT_WSCALE      3
+#define TCPOPT_SACK_PERM   4
+#define TCPOPT_SACK        5
+#define TCPOPT_TIMESTAMP   8
+#define TCP_MAX_WSCALE    14
+
 /* ------------------------------------------------------------------ */
 /*  Byte-order helpers (portable, no htons/ntohs needed)               */
 /* ------------------------------------------------------------------ */
@@ -48,59 +66,6 @@ static inline void write_u32_be(uint8_t *p, uint32_t val)
     p[3] = (uint8_t)(val & 0xFF);
 }
 
-/* ------------------------------------------------------------------ */
-/*  Checksum (RFC 1071)                                                */
-/* ------------------------------------------------------------------ */
-
-uint16_t dpi_checksum(const uint8_t *data, int len)
-{
-    uint32_t sum = 0;
-    int i;
-
-    for (i = 0; i + 1 < len; i += 2)
-        sum += read_u16_be(data + i);
-
-    if (len & 1)
-        sum += (uint32_t)data[len - 1] << 8;
-
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
-
-    return (uint16_t)(~sum & 0xFFFF);
-}
-
-uint16_t dpi_transport_checksum(uint32_t src_addr, uint32_t dst_addr,
-                                uint8_t proto,
-                                const uint8_t *transport_hdr, int transport_len)
-{
-    /* Pseudo-header: src_ip(4) + dst_ip(4) + zero(1) + proto(1) + length(2) = 12 bytes */
-    uint8_t pseudo[12];
-    write_u32_be(pseudo + 0, src_addr);
-    write_u32_be(pseudo + 4, dst_addr);
-    pseudo[8] = 0;
-    pseudo[9] = proto;
-    write_u16_be(pseudo + 10, (uint16_t)transport_len);
-
-    uint32_t sum = 0;
-    int i;
-
-    /* Sum pseudo-header */
-    for (i = 0; i < 12; i += 2)
-        sum += read_u16_be(pseudo + i);
-
-    /* Sum transport data */
-    for (i = 0; i + 1 < transport_len; i += 2)
-        sum += read_u16_be(transport_hdr + i);
-
-    if (transport_len & 1)
-        sum += (uint32_t)transport_hdr[transport_len - 1] << 8;
-
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
-
-    return (uint16_t)(~sum & 0xFFFF);
-}
-
 /* ------------------------------------------------------------------ */
 /*  IPv4 parsing                                                       */
 /* ------------------------------------------------------------------ */
@@ -123,6 +88,8 @@ int dpi_parse_ipv4(const uint8_t *pkt, int len, dpi_ip_info_t *info)
     int total_len = read_u16_be(pkt + 2);
     if (total_len > len)
         total_len = len; /* truncated packet — use what we have */
+    if (total_len < header_len)
+        return -1;
 
     info->version    = 4;
     info->ihl        = (uint8_t)ihl;
@@ -135,9 +102,94 @@ int dpi_parse_ipv4(const uint8_t *pkt, int len, dpi_ip_info_t *info)
     info->l4_data    = pkt + header_len;
     info->l4_len     = total_len - header_len;
 
+    dpi_addr_from_ipv4(&info->src_ip, info->src_addr);
+    dpi_addr_from_ipv4(&info->dst_ip, info->dst_addr);
+
     return 0;
 }
 
+/* ------------------------------------------------------------------ */
+/*  IPv6 parsing                                                       */
+/* ------------------------------------------------------------------ */
+
+int dpi_parse_ipv6(const uint8_t *pkt, int len, dpi_ip_info_t *info)
+{
+    if (len < IPV6_HEADER)
+        return -1;
+
+    if ((pkt[0] >> 4) != 6)
+        return -1;
+
+    int total_len = IPV6_HEADER + read_u16_be(pkt + 4);
+    if (total_len > len)
+        total_len = len; /* truncated packet — use what we have */
+
+    /* Walk the extension header chain (bounded) */
+    uint8_t next = pkt[6];
+    int off = IPV6_HEADER;
+
+    for (int hops = 0; ; hops++) {
+        int ext_len;
+
+        switch (next) {
+        case IPV6_EXT_HOPOPTS:
+        case IPV6_EXT_ROUTING:
+        case IPV6_EXT_DSTOPTS:
+            if (off + 8 > total_len)
+                return -1;
+            ext_len = (pkt[off + 1] + 1) * 8;
+            break;
+        case IPV6_EXT_AH:
+            if (off + 8 > total_len)
+                return -1;
+            ext_len = (pkt[off + 1] + 2) * 4;
+            break;
+        case IPV6_EXT_FRAGMENT:
+            return -1; /* relays cannot reassemble — drop */
+        default:
+            ext_len = 0;
+            break;
+        }
+
+        if (ext_len == 0)
+            break;
+        if (hops == DPI_IPV6_MAX_EXT_HEADERS)
+            return -1; /* one extension header too many */
+        if (off + ext_len > total_len)
+            return -1;
+
+        next = pkt[off];
+        off += ext_len;
+    }
+
+    info->version    = 6;
+    info->ihl        = 0;
+    info->ttl        = pkt[7];
+    info->protocol   = next;
+    info->src_addr   = 0;
+    info->dst_addr   = 0;
+    memcpy(info->src_ip.b, pkt + 8, 16);
+    memcpy(info->dst_ip.b, pkt + 24, 16);
+    info->header_len = off;
+    info->total_len  = total_len;
+    info->l4_data    = pkt + off;
+    info->l4_len     = total_len - off;
+
+    return 0;
+}
+
+int dpi_parse_ip(const uint8_t *pkt, int len, dpi_ip_info_t *info)
+{
+    if (len < 1)
+        return -1;
+
+    switch (pkt[0] >> 4) {
+    case 4:  return dpi_parse_ipv4(pkt, len, info);
+    case 6:  return dpi_parse_ipv6(pkt, len, info);
+    default: return -1;
+    }
+}
+
 /* ------------------------------------------------------------------ */
 /*  UDP parsing                                                        */
 /* ------------------------------------------------------------------ */
@@ -179,9 +231,136 @@ int dpi_parse_tcp(const uint8_t *l4, int l4_len, dpi_tcp_info_t *info)
     info->payload     = l4 + data_offset;
     info->payload_len = l4_len - data_offset;
 
+    dpi_parse_tcp_options(l4 + TCP_MIN_HEADER, data_offset - TCP_MIN_HEADER, &info->opts);
     return 0;
 }
 
+/* ------------------------------------------------------------------ */
+/*  TCP options                                                        */
+/* ------------------------------------------------------------------ */
+
+int dpi_parse_tcp_options(const uint8_t *opt, int len, dpi_tcp_opts_t *out)
+{
+    out->mss        = 0;
+    out->wscale     = -1;
+    out->sack_ok    = false;
+    out->has_ts     = false;
+    out->ts_val     = 0;
+    out->ts_ecr     = 0;
+    out->sack_count = 0;
+
+    int pos = 0;
+    while (pos < len) {
+        uint8_t kind = opt[pos];
+        if (kind == TCPOPT_EOL)
+            break;
+        if (kind == TCPOPT_NOP) {
+            pos++;
+            continue;
+        }
+
+        if (pos + 2 > len)
+            return -1;
+        int olen = opt[pos + 1];
+        if (olen < 2 || pos + olen > len)
+            return -1;
+        const uint8_t *v = opt + pos + 2;
+
+        switch (kind) {
+        case TCPOPT_MSS:
+            if (olen == 4)
+                out->mss = read_u16_be(v);
+            break;
+        case TCPOPT_WSCALE:
+            if (olen == 3)
+                out->wscale = (int8_t)(v[0] > TCP_MAX_WSCALE ? TCP_MAX_WSCALE : v[0]);
+            break;
+        case TCPOPT_SACK_PERM:
+            if (olen == 2)
+                out->sack_ok = true;
+            break;
+        case TCPOPT_TIMESTAMP:
+            if (olen == 10) {
+                out->has_ts = true;
+                out->ts_val = read_u32_be(v);
+                out->ts_ecr = read_u32_be(v + 4);
+            }
+            break;
+        case TCPOPT_SACK:
+            for (int off = 0; off + 8 <= olen - 2 &&
+                 out->sack_count < DPI_TCP_MAX_SACK; off += 8) {
+                out->sack_left[out->sack_count]  = read_u32_be(v + off);
+                out->sack_right[out->sack_count] = read_u32_be(v + off + 4);
+                out->sack_count++;
+            }
+            break;
+        default:
+            break;
+        }
+        pos += olen;
+    }
+    return 0;
+}
+
+int dpi_tcp_write_options(uint8_t *out, int out_size, const dpi_tcp_opts_t *opts)
+{
+    uint8_t buf[DPI_TCP_MAX_OPTIONS];
+    int n = 0;
+
+    /* Same layout as Linux: MSS, SACK-permitted + timestamps, NOP + window scale */
+    if (opts->mss) {
+        buf[n++] = TCPOPT_MSS;
+        buf[n++] = 4;
+        write_u16_be(buf + n, opts->mss);
+        n += 2;
+    }
+    if (opts->has_ts) {
+        if (opts->sack_ok) {
+            buf[n++] = TCPOPT_SACK_PERM;
+            buf[n++] = 2;
+        } else {
+            buf[n++] = TCPOPT_NOP;
+            buf[n++] = TCPOPT_NOP;
+        }
+        buf[n++] = TCPOPT_TIMESTAMP;
+        buf[n++] = 10;
+        write_u32_be(buf + n, opts->ts_val);
+        write_u32_be(buf + n + 4, opts->ts_ecr);
+        n += 8;
+    } else if (opts->sack_ok) {
+        buf[n++] = TCPOPT_NOP;
+        buf[n++] = TCPOPT_NOP;
+        buf[n++] = TCPOPT_SACK_PERM;
+        buf[n++] = 2;
+    }
+    if (opts->wscale >= 0) {
+        buf[n++] = TCPOPT_NOP;
+        buf[n++] = TCPOPT_WSCALE;
+        buf[n++] = 3;
+        buf[n++] = (uint8_t)(opts->wscale > TCP_MAX_WSCALE ? TCP_MAX_WSCALE : opts->wscale);
+    }
+
+    int blocks = (DPI_TCP_MAX_OPTIONS - n - 4) / 8;
+    if (blocks > opts->sack_count)
+        blocks = opts->sack_count;
+    if (blocks > 0) {
+        buf[n++] = TCPOPT_NOP;
+        buf[n++] = TCPOPT_NOP;
+        buf[n++] = TCPOPT_SACK;
+        buf[n++] = (uint8_t)(2 + 8 * blocks);
+        for (int i = 0; i < blocks; i++) {
+            write_u32_be(buf + n, opts->sack_left[i]);
+            write_u32_be(buf + n + 4, opts->sack_right[i]);
+            n += 8;
+        }
+    }
+
+    if (n > out_size)
+        return -1;
+    memcpy(out, buf, n);
+    return n;
+}
+
 /* ------------------------------------------------------------------ */
 /*  QUIC Initial detection                                             */
 /* ------------------------------------------------------------------ */
@@ -198,8 +377,12 @@ bool dpi_is_quic_initial(const uint8_t *payload, int len)
     /* Version field at bytes 1-4 */
     uint32_t version = read_u32_be(payload + 1);
 
+    /* Long packet type: Initial is 0b00 in v1 and 0b01 in v2 */
+    int type = (payload[0] >> 4) & 0x03;
+
     /* QUIC v1 or QUIC v2 */
-    return version == 0x00000001 || version == 0x6b3343cf;
+    return (version == 0x00000001 && type == 0x00) ||
+           (version == 0x6b3343cf && type == 0x01);
 }
 
 /* ------------------------------------------------------------------ */
@@ -301,16 +484,23 @@ int dpi_build_ipv4_udp(uint8_t *out, int out_size,
 /*  Build IPv4 + TCP packet                                            */
 /* ------------------------------------------------------------------ */
 
-int dpi_build_ipv4_tcp(uint8_t *out, int out_size,
-                       uint32_t src_addr, uint32_t dst_addr,
-                       uint16_t src_port, uint16_t dst_port,
-                       uint32_t seq, uint32_t ack,
-                       uint8_t flags, uint16_t window,
-                       const uint8_t *payload, int payload_len)
+static bool tcp_opts_len_ok(int opts_len)
+{
+    return opts_len >= 0 && opts_len <= DPI_TCP_MAX_OPTIONS && (opts_len & 3) == 0;
+}
+
+static int build_ipv4_tcp(uint8_t *out, int out_size,
+                          uint32_t src_addr, uint32_t dst_addr,
+                          uint16_t src_port, uint16_t dst_port,
+                          uint32_t seq, uint32_t ack,
+                          uint8_t flags, uint16_t window,
+                          const uint8_t *opts, int opts_len,
+                          const uint8_t *payload, int payload_len)
 {
-    int tcp_len = TCP_MIN_HEADER + payload_len;
+    int tcp_hdr = TCP_MIN_HEADER + opts_len;
+    int tcp_len = tcp_hdr + payload_len;
     int total   = IPV4_MIN_HEADER + tcp_len;
-    if (out_size < total)
+    if (out_size < total || !tcp_opts_len_ok(opts_len))
         return -1;
 
     memset(out, 0, IPV4_MIN_HEADER + TCP_MIN_HEADER);
@@ -333,14 +523,17 @@ int dpi_build_ipv4_tcp(uint8_t *out, int out_size,
     write_u16_be(tcp + 2, dst_port);
     write_u32_be(tcp + 4, seq);
     write_u32_be(tcp + 8, ack);
-    tcp[12] = (TCP_MIN_HEADER / 4) << 4;   /* data offset */
+    tcp[12] = (uint8_t)((tcp_hdr / 4) << 4);   /* data offset */
     tcp[13] = flags;
     write_u16_be(tcp + 14, window);
     /* checksum at tcp+16, urgent at tcp+18 — both 0 initially */
 
+    if (opts_len > 0)
+        memcpy(tcp + TCP_MIN_HEADER, opts, opts_len);
+
     /* TCP payload */
     if (payload_len > 0)
-        memcpy(tcp + TCP_MIN_HEADER, payload, payload_len);
+        memcpy(tcp + tcp_hdr, payload, payload_len);
 
     /* TCP checksum */
     uint16_t tcp_cksum = dpi_transport_checksum(src_addr, dst_addr,
@@ -350,3 +543,353 @@ int dpi_build_ipv4_tcp(uint8_t *out, int out_size,
 
     return total;
 }
+
+int dpi_build_ipv4_tcp(uint8_t *out, int out_size,
+                       uint32_t src_addr, uint32_t dst_addr,
+                       uint16_t src_port, uint16_t dst_port,
+                       uint32_t seq, uint32_t ack,
+                       uint8_t flags, uint16_t window,
+                       const uint8_t *payload, int payload_len)
+{
+    return build_ipv4_tcp(out, out_size, src_addr, dst_addr, src_port, dst_port,
+                          seq, ack, flags, window, NULL, 0, payload, payload_len);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Build IPv6 + UDP / TCP packets                                     */
+/* ------------------------------------------------------------------ */
+
+static void write_ipv6_header(uint8_t *out, int payload_len, uint8_t next_header,
+                              const uint8_t *src_addr, const uint8_t *dst_addr)
+{
+    write_u32_be(out + 0, 0x60000000);      /* version=6, TC=0, flow label=0 */
+    write_u16_be(out + 4, (uint16_t)payload_len);
+    out[6] = next_header;
+    out[7] = 64;                            /* hop limit */
+    memcpy(out + 8,  src_addr, 16);
+    memcpy(out + 24, dst_addr, 16);
+}
+
+int dpi_build_ipv6_udp(uint8_t *out, int out_size,
+                       const uint8_t *src_addr, const uint8_t *dst_addr,
+                       uint16_t src_port, uint16_t dst_port,
+                       const uint8_t *payload, int payload_len)
+{
+    int udp_len = UDP_HEADER_LEN + payload_len;
+    int total   = IPV6_HEADER + udp_len;
+    if (out_size < total || udp_len > 0xFFFF)
+        return -1;
+
+    write_ipv6_header(out, udp_len, IPPROTO_UDP_CONST, src_addr, dst_addr);
+
+    uint8_t *udp = out + IPV6_HEADER;
+    write_u16_be(udp + 0, src_port);
+    write_u16_be(udp + 2, dst_port);
+    write_u16_be(udp + 4, (uint16_t)udp_len);
+    write_u16_be(udp + 6, 0);
+
+    if (payload_len > 0)
+        memcpy(udp + UDP_HEADER_LEN, payload, payload_len);
+
+    /* UDP checksum is mandatory over IPv6 */
+    uint16_t udp_cksum = dpi_transport_checksum6(src_addr, dst_addr,
+                                                  IPPROTO_UDP_CONST,
+                                                  udp, udp_len);
+    if (udp_cksum == 0)
+        udp_cksum = 0xFFFF;
+    write_u16_be(udp + 6, udp_cksum);
+
+    return total;
+}
+
+static int build_ipv6_tcp(uint8_t *out, int out_size,
+                          const uint8_t *src_addr, const uint8_t *dst_addr,
+                          uint16_t src_port, uint16_t dst_port,
+                          uint32_t seq, uint32_t ack,
+                          uint8_t flags, uint16_t window,
+                          const uint8_t *opts, int opts_len,
+                          const uint8_t *payload, int payload_len)
+{
+    int tcp_hdr = TCP_MIN_HEADER + opts_len;
+    int tcp_len = tcp_hdr + payload_len;
+    int total   = IPV6_HEADER + tcp_len;
+    if (out_size < total || tcp_len > 0xFFFF || !tcp_opts_len_ok(opts_len))
+        return -1;
+
+    write_ipv6_header(out, tcp_len, IPPROTO_TCP_CONST, src_addr, dst_addr);
+
+    uint8_t *tcp = out + IPV6_HEADER;
+    memset(tcp, 0, TCP_MIN_HEADER);
+    write_u16_be(tcp + 0, src_port);
+    write_u16_be(tcp + 2, dst_port);
+    write_u32_be(tcp + 4, seq);
+    write_u32_be(tcp + 8, ack);
+    tcp[12] = (uint8_t)((tcp_hdr / 4) << 4);   /* data offset */
+    tcp[13] = flags;
+    write_u16_be(tcp + 14, window);
+
+    if (opts_len > 0)
+        memcpy(tcp + TCP_MIN_HEADER, opts, opts_len);
+    if (payload_len > 0)
+        memcpy(tcp + tcp_hdr, payload, payload_len);
+
+    uint16_t tcp_cksum = dpi_transport_checksum6(src_addr, dst_addr,
+                                                  IPPROTO_TCP_CONST,
+                                                  tcp, tcp_len);
+    write_u16_be(tcp + 16, tcp_cksum);
+
+    return total;
+}
+
+int dpi_build_ipv6_tcp(uint8_t *out, int out_size,
+                       const uint8_t *src_addr, const uint8_t *dst_addr,
+                       uint16_t src_port, uint16_t dst_port,
+                       uint32_t seq, uint32_t ack,
+                       uint8_t flags, uint16_t window,
+                       const uint8_t *payload, int payload_len)
+{
+    return build_ipv6_tcp(out, out_size, src_addr, dst_addr, src_port, dst_port,
+                          seq, ack, flags, window, NULL, 0, payload, payload_len);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Family-agnostic builders                                           */
+/* ------------------------------------------------------------------ */
+
+int dpi_build_ip_udp(uint8_t *out, int out_size,
+                     const dpi_addr_t *src, const dpi_addr_t *dst,
+                     uint16_t src_port, uint16_t dst_port,
+                     const uint8_t *payload, int payload_len)
+{
+    if (dpi_addr_is_ipv4(src))
+        return dpi_build_ipv4_udp(out, out_size,
+                                  dpi_addr_to_ipv4(src), dpi_addr_to_ipv4(dst),
+                                  src_port, dst_port, payload, payload_len);
+
+    return dpi_build_ipv6_udp(out, out_size, src->b, dst->b,
+                              src_port, dst_port, payload, payload_len);
+}
+
+int dpi_build_ip_tcp(uint8_t *out, int out_size,
+                     const dpi_addr_t *src, const dpi_addr_t *dst,
+                     uint16_t src_port, uint16_t dst_port,
+                     uint32_t seq, uint32_t ack,
+                     uint8_t flags, uint16_t window,
+                     const uint8_t *payload, int payload_len)
+{
+    return dpi_build_ip_tcp_opts(out, out_size, src, dst, src_port, dst_port,
+                                 seq, ack, flags, window, NULL, 0,
+                                 payload, payload_len);
+}
+
+int dpi_build_ip_tcp_opts(uint8_t *out, int out_size,
+                          const dpi_addr_t *src, const dpi_addr_t *dst,
+                          uint16_t src_port, uint16_t dst_port,
+                          uint32_t seq, uint32_t ack,
+                          uint8_t flags, uint16_t window,
+                          const uint8_t *opts, int opts_len,
+                          const uint8_t *payload, int payload_len)
+{
+    if (dpi_addr_is_ipv4(src))
+        return build_ipv4_tcp(out, out_size,
+                              dpi_addr_to_ipv4(src), dpi_addr_to_ipv4(dst),
+                              src_port, dst_port, seq, ack, flags, window,
+                              opts, opts_len, payload, payload_len);
+
+    return build_ipv6_tcp(out, out_size, src->b, dst->b,
+                          src_port, dst_port, seq, ack, flags, window,
+                          opts, opts_len, payload, payload_len);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Address helpers                                                    */
+/* ------------------------------------------------------------------ */
+
+static const uint8_t ipv4_mapped_prefix[12] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF
+};
+
+void dpi_addr_from_ipv4(dpi_addr_t *addr, uint32_t ipv4)
+{
+    memcpy(addr->b, ipv4_mapped_prefix, sizeof(ipv4_mapped_prefix));
+    write_u32_be(addr->b + 12, ipv4);
+}
+
+bool dpi_addr_is_ipv4(const dpi_addr_t *addr)
+{
+    return memcmp(addr->b, ipv4_mapped_prefix, sizeof(ipv4_mapped_prefix)) == 0;
+}
+
+uint32_t dpi_addr_to_ipv4(const dpi_addr_t *addr)
+{
+    return read_u32_be(addr->b + 12);
+}
+
+bool dpi_addr_equal(const dpi_addr_t *a, const dpi_addr_t *b)
+{
+    return memcmp(a->b, b->b, sizeof(a->b)) == 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  In-place header patching                                           */
+/* ------------------------------------------------------------------ */
+
+/* Locate the L4 header of a built IPv4 TCP/UDP packet */
+static uint8_t *patch_locate_l4(uint8_t *pkt, int len, uint8_t *proto, int *l4_len)
+{
+    if (len < IPV4_MIN_HEADER || (pkt[0] >> 4) != 4)
+        return NULL;
+
+    int header_len = (pkt[0] & 0x0F) * 4;
+    int total_len  = read_u16_be(pkt + 2);
+    if (header_len < IPV4_MIN_HEADER || total_len > len || total_len < header_len)
+        return NULL;
+
+    *proto  = pkt[9];
+    *l4_len = total_len - header_len;
+
+    if (*proto == IPPROTO_TCP_CONST && *l4_len >= TCP_MIN_HEADER)
+        return pkt + header_len;
+    if (*proto == IPPROTO_UDP_CONST && *l4_len >= UDP_HEADER_LEN)
+        return pkt + header_len;
+    return NULL;
+}
+
+static inline int l4_checksum_offset(uint8_t proto)
+{
+    return proto == IPPROTO_TCP_CONST ? 16 : 6;
+}
+
+/* Fold a raw 16-bit sum into the L4 checksum: sign < 0 subtracts it */
+static void l4_checksum_apply(uint8_t *l4, uint8_t proto, uint16_t part, int sign)
+{
+    uint8_t *field = l4 + l4_checksum_offset(proto);
+    uint16_t cksum = read_u16_be(field);
+
+    if (proto == IPPROTO_UDP_CONST && cksum == 0)
+        return; /* checksum not in use */
+
+    cksum = sign < 0 ? dpi_checksum_adjust16(cksum, part, 0)
+                     : dpi_checksum_adjust16(cksum, 0, part);
+
+    if (proto == IPPROTO_UDP_CONST && cksum == 0)
+        cksum = 0xFFFF;
+    write_u16_be(field, cksum);
+}
+
+static void l4_checksum_adjust16(uint8_t *l4, uint8_t proto, uint16_t old_val, uint16_t new_val)
+{
+    uint8_t *field = l4 + l4_checksum_offset(proto);
+    uint16_t cksum = read_u16_be(field);
+
+    if (proto == IPPROTO_UDP_CONST && cksum == 0)
+        return;
+
+    cksum = dpi_checksum_adjust16(cksum, old_val, new_val);
+    if (proto == IPPROTO_UDP_CONST && cksum == 0)
+        cksum = 0xFFFF;
+    write_u16_be(field, cksum);
+}
+
+int dpi_patch_ipv4_ttl(uint8_t *pkt, int len, uint8_t ttl)
+{
+    if (len < IPV4_MIN_HEADER || (pkt[0] >> 4) != 4)
+        return -1;
+
+    /* TTL shares a 16-bit word with protocol; not in the pseudo-header */
+    uint16_t old_word = read_u16_be(pkt + 8);
+    pkt[8] = ttl;
+    uint16_t new_word = read_u16_be(pkt + 8);
+
+    write_u16_be(pkt + 10, dpi_checksum_adjust16(read_u16_be(pkt + 10),
+                                                 old_word, new_word));
+    return 0;
+}
+
+int dpi_patch_ports(uint8_t *pkt, int len, uint16_t src_port, uint16_t dst_port)
+{
+    uint8_t proto;
+    int l4_len;
+    uint8_t *l4 = patch_locate_l4(pkt, len, &proto, &l4_len);
+    if (!l4)
+        return -1;
+
+    uint32_t old_ports = read_u32_be(l4);
+    uint32_t new_ports = ((uint32_t)src_port << 16) | dst_port;
+    write_u32_be(l4, new_ports);
+
+    l4_checksum_adjust16(l4, proto, (uint16_t)(old_ports >> 16), src_port);
+    l4_checksum_adjust16(l4, proto, (uint16_t)old_ports, dst_port);
+    return 0;
+}
+
+static int patch_tcp_u32(uint8_t *pkt, int len, int offset, uint32_t val)
+{
+    uint8_t proto;
+    int l4_len;
+    uint8_t *l4 = patch_locate_l4(pkt, len, &proto, &l4_len);
+    if (!l4 || proto != IPPROTO_TCP_CONST)
+        return -1;
+
+    uint32_t old_val = read_u32_be(l4 + offset);
+    write_u32_be(l4 + offset, val);
+    write_u16_be(l4 + 16, dpi_checksum_adjust32(read_u16_be(l4 + 16), old_val, val));
+    return 0;
+}
+
+int dpi_patch_tcp_seq(uint8_t *pkt, int len, uint32_t seq)
+{
+    return patch_tcp_u32(pkt, len, 4, seq);
+}
+
+int dpi_patch_tcp_ack(uint8_t *pkt, int len, uint32_t ack)
+{
+    return patch_tcp_u32(pkt, len, 8, ack);
+}
+
+/* Sum of l4[from..to) as if it sat at its offset inside the L4 segment */
+static uint16_t l4_range_sum(const uint8_t *l4, int from, int to)
+{
+    uint16_t part = (uint16_t)dpi_checksum_add(0, l4 + from, to - from);
+    if (from & 1)
+        part = (uint16_t)((part << 8) | (part >> 8));
+    return part;
+}
+
+int dpi_patch_ipv4_length(uint8_t *pkt, int buf_size, int new_total)
+{
+    uint8_t proto;
+    int old_l4;
+    uint8_t *l4 = patch_locate_l4(pkt, buf_size, &proto, &old_l4);
+    if (!l4)
+        return -1;
+
+    int header_len = (int)(l4 - pkt);
+    int new_l4 = new_total - header_len;
+    int min_l4 = proto == IPPROTO_TCP_CONST ? (l4[12] >> 4) * 4 : UDP_HEADER_LEN;
+    if (new_total > buf_size || new_total > 0xFFFF || new_l4 < min_l4)
+        return -1;
+    if (new_l4 == old_l4)
+        return 0;
+
+    /* IP header: total length */
+    write_u16_be(pkt + 10, dpi_checksum_adjust16(read_u16_be(pkt + 10),
+                                                 (uint16_t)(old_l4 + header_len),
+                                                 (uint16_t)new_total));
+    write_u16_be(pkt + 2, (uint16_t)new_total);
+
+    /* Pseudo-header length, plus the UDP length field itself */
+    l4_checksum_adjust16(l4, proto, (uint16_t)old_l4, (uint16_t)new_l4);
+    if (proto == IPPROTO_UDP_CONST) {
+        write_u16_be(l4 + 4, (uint16_t)new_l4);
+        l4_checksum_adjust16(l4, proto, (uint16_t)old_l4, (uint16_t)new_l4);
+    }
+
+    /* Payload bytes entering or leaving the segment */
+    if (new_l4 > old_l4)
+        l4_checksum_apply(l4, proto, l4_range_sum(l4, old_l4, new_l4), +1);
+    else
+        l4_checksum_apply(l4, proto, l4_range_sum(l4, new_l4, old_l4), -1);
+
+    return 0;
+}
@@ -3,7 +3,7 @@
  *
  * Provides IP/TCP/UDP parsing, QUIC/TLS detection, and packet construction.
  * Used by Android (JNI) and iOS (Swift bridge) VPN packet processors.
- * No platform-specific dependencies.
+ * No platform-specific dependencies beyond POSIX struct iovec.
  */
 
 #ifndef DPI_BYPASS_H
@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/uio.h>    /* struct iovec (POSIX) */
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,14 +21,24 @@ extern "C" {
 /*  Parsed packet info structures                                      */
 /* ------------------------------------------------------------------ */
 
+/*
+ * IPv4 or IPv6 address in wire order. IPv4 is stored IPv4-mapped
+ * (::ffff:a.b.c.d) so both families share one 16-byte session key.
+ */
+typedef struct {
+    uint8_t b[16];
+} dpi_addr_t;
+
 typedef struct {
-    uint8_t  version;       /* 4 for IPv4 */
-    uint8_t  ihl;           /* header length in 32-bit words */
-    uint8_t  protocol;      /* IPPROTO_TCP (6) or IPPROTO_UDP (17) */
-    uint8_t  ttl;
-    uint32_t src_addr;      /* network byte order */
-    uint32_t dst_addr;      /* network byte order */
-    int      header_len;    /* IP header length in bytes */
+    uint8_t  version;       /* 4 or 6 */
+    uint8_t  ihl;           /* header length in 32-bit words (IPv4 only) */
+    uint8_t  protocol;      /* IPPROTO_TCP (6) or IPPROTO_UDP (17); IPv6: after extension headers */
+    uint8_t  ttl;           /* TTL / IPv6 hop limit */
+    uint32_t src_addr;      /* network byte order (IPv4 only) */
+    uint32_t dst_addr;      /* network byte order (IPv4 only) */
+    dpi_addr_t src_ip;      /* both families */
+    dpi_addr_t dst_ip;      /* both families */
+    int      header_len;    /* IP header length in bytes (IPv6: including extension headers) */
     int      total_len;     /* total IP packet length */
     const uint8_t *l4_data; /* pointer to L4 header (TCP/UDP) */
     int      l4_len;        /* length of L4 data (header + payload) */
@@ -41,6 +52,25 @@ typedef struct {
     int      payload_len;
 } dpi_udp_info_t;
 
+/*
+ * TCP options (RFC 9293 MSS, RFC 7323 window scale / timestamps,
+ * RFC 2018 SACK). Absent options: mss 0, wscale -1, flags false.
+ */
+#define DPI_TCP_MAX_OPTIONS 40
+#define DPI_TCP_MAX_SACK    4
+
+typedef struct {
+    uint16_t mss;
+    int8_t   wscale;        /* window shift count (clamped to 14) */
+    bool     sack_ok;       /* SACK-permitted (SYN only) */
+    bool     has_ts;
+    uint32_t ts_val;
+    uint32_t ts_ecr;
+    int      sack_count;    /* SACK blocks: [left, right) in host order */
+    uint32_t sack_left[DPI_TCP_MAX_SACK];
+    uint32_t sack_right[DPI_TCP_MAX_SACK];
+} dpi_tcp_opts_t;
+
 typedef struct {
     uint16_t src_port;      /* network byte order */
     uint16_t dst_port;      /* network byte order */
@@ -49,6 +79,7 @@ typedef struct {
     uint8_t  flags;         /* TCP flags (SYN=0x02, ACK=0x10, FIN=0x01, RST=0x04, PSH=0x08) */
     uint16_t window;        /* network byte order */
     int      header_len;    /* TCP header length in bytes (data offset * 4) */
+    dpi_tcp_opts_t opts;    /* options between the fixed header and payload */
     const uint8_t *payload;
     int      payload_len;
 } dpi_tcp_info_t;
@@ -70,6 +101,22 @@ typedef struct {
  */
 int dpi_parse_ipv4(const uint8_t *pkt, int len, dpi_ip_info_t *info);
 
+/*
+ * Parse an IPv6 packet, skipping up to DPI_IPV6_MAX_EXT_HEADERS extension
+ * headers (hop-by-hop, routing, destination options, AH).
+ * Fragments are rejected. protocol / l4_data refer to the upper layer.
+ * Returns 0 on success, -1 on error.
+ */
+#define DPI_IPV6_MAX_EXT_HEADERS 8
+
+int dpi_parse_ipv6(const uint8_t *pkt, int len, dpi_ip_info_t *info);
+
+/*
+ * Parse an IPv4 or IPv6 packet based on the version nibble.
+ * Returns 0 on success, -1 on error.
+ */
+int dpi_parse_ip(const uint8_t *pkt, int len, dpi_ip_info_t *info);
+
 /*
  * Parse a UDP header from L4 data.
  * l4 / l4_len come from dpi_ip_info_t.l4_data / l4_len.
@@ -78,18 +125,33 @@ int dpi_parse_ipv4(const uint8_t *pkt, int len, dpi_ip_info_t *info);
 int dpi_parse_udp(const uint8_t *l4, int l4_len, dpi_udp_info_t *info);
 
 /*
- * Parse a TCP header from L4 data.
- * Returns 0 on success, -1 on error.
+ * Parse a TCP header from L4 data, including its options.
+ * Returns 0 on success, -1 on error. Malformed options are not an error;
+ * parsing stops at the bad option.
  */
 int dpi_parse_tcp(const uint8_t *l4, int l4_len, dpi_tcp_info_t *info);
 
+/*
+ * Parse the option bytes of a TCP header (after the 20 fixed bytes).
+ * Returns 0, or -1 if an option is malformed (options before it are kept).
+ */
+int dpi_parse_tcp_options(const uint8_t *opt, int len, dpi_tcp_opts_t *out);
+
+/*
+ * Encode the present fields of opts (NOP-padded to a multiple of 4,
+ * at most DPI_TCP_MAX_OPTIONS bytes). SACK blocks that do not fit are
+ * dropped. Returns the number of bytes written, or -1 if out_size is too small.
+ */
+int dpi_tcp_write_options(uint8_t *out, int out_size, const dpi_tcp_opts_t *opts);
+
 /* ------------------------------------------------------------------ */
 /*  Protocol detection                                                 */
 /* ------------------------------------------------------------------ */
 
 /*
  * Check if UDP payload is a QUIC Initial packet.
- * Checks for long header bit + QUIC v1 (0x00000001) or v2 (0x6b3343cf).
+ * Checks for long header bit + QUIC v1 (0x00000001) or v2 (0x6b3343cf)
+ * and the version's Initial packet type.
  */
 bool dpi_is_quic_initial(const uint8_t *payload, int len);
 
@@ -99,6 +161,227 @@ bool dpi_is_quic_initial(const uint8_t *payload, int len);
  */
 bool dpi_is_tls_client_hello(const uint8_t *payload, int len);
 
+/* ------------------------------------------------------------------ */
+/*  TLS ClientHello locator — see dpi_tls.c                            */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Offsets into the parsed buffer; nothing is copied. Fields that were
+ * not found are -1 (offsets) / 0 (lengths).
+ */
+typedef struct {
+    int record_len;     /* first TLS record incl. 5-byte header (0 for bare handshake) */
+    int hello_len;      /* handshake message incl. 4-byte header */
+    int ext_off;        /* extension block, after its 2-byte length */
+    int ext_len;
+    int sni_ext_off;    /* server_name extension (at its type field) */
+    int host_off;       /* SNI host name */
+    int host_len;
+    int alpn_off;       /* ALPN protocol_name_list, after its 2-byte length */
+    int alpn_len;
+} dpi_tls_hello_t;
+
+#define DPI_TLS_OK          0
+#define DPI_TLS_INCOMPLETE  1   /* need more bytes: record_len when known */
+#define DPI_TLS_INVALID    -1
+
+/*
+ * Locate SNI / ALPN / extensions in a TLS record carrying a ClientHello.
+ * Only the first record is walked; a hello continued in a following
+ * record is reported OK as long as the SNI was found in the first one.
+ */
+int dpi_tls_parse_client_hello(const uint8_t *data, int len, dpi_tls_hello_t *out);
+
+/*
+ * Same for a bare handshake message (no record header), e.g. the
+ * contents of QUIC CRYPTO frames.
+ */
+int dpi_tls_parse_handshake(const uint8_t *data, int len, dpi_tls_hello_t *out);
+
+/*
+ * Split position markers (nfqws syntax): an absolute offset ("2") or a
+ * position relative to the SNI host ("host", "endhost", "sld", "midsld",
+ * "endsld", "sniext") with an optional +N / -N.
+ */
+typedef enum {
+    DPI_SPLIT_ABS = 0,
+    DPI_SPLIT_HOST,
+    DPI_SPLIT_ENDHOST,
+    DPI_SPLIT_SLD,
+    DPI_SPLIT_MIDSLD,
+    DPI_SPLIT_ENDSLD,
+    DPI_SPLIT_SNIEXT
+} dpi_split_base_t;
+
+typedef struct {
+    dpi_split_base_t base;
+    int offset;
+} dpi_split_marker_t;
+
+#define DPI_MAX_SPLIT_MARKERS 4
+
+/*
+ * Parse a comma-separated marker list ("1,midsld").
+ * Returns the number of markers, or -1 on syntax error / overflow.
+ */
+int dpi_split_markers_parse(const char *spec, dpi_split_marker_t *out, int max);
+
+/*
+ * Resolve a marker against a payload. h may be NULL when the payload is
+ * not a ClientHello (only absolute markers resolve then).
+ * Returns a split position in (0, data_len), or -1 if not applicable.
+ */
+int dpi_split_marker_resolve(const dpi_split_marker_t *m, const uint8_t *data,
+                             int data_len, const dpi_tls_hello_t *h);
+
+/* ------------------------------------------------------------------ */
+/*  QUIC Initial decryption — see dpi_quic.c                           */
+/* ------------------------------------------------------------------ */
+
+#define DPI_QUIC_MAX_CID      20
+#define DPI_QUIC_MAX_INITIAL  4096    /* largest Initial packet decrypted */
+#define DPI_QUIC_CRYPTO_MAX   8192    /* CRYPTO stream bytes kept (Kyber hellos ~2 KB) */
+
+/*
+ * Reassembly state for one client connection. Initials may arrive in
+ * several datagrams with CRYPTO frames in any order (Chrome shuffles
+ * them); data[0..contiguous) is the ClientHello prefix received so far.
+ */
+typedef struct {
+    uint32_t version;
+    uint8_t  dcid[DPI_QUIC_MAX_CID];
+    int      dcid_len;
+    uint8_t  key[16];           /* client Initial keys, derived from dcid */
+    uint8_t  iv[12];
+    uint8_t  hp[16];
+    bool     keyed;
+    int      contiguous;
+    uint8_t  data[DPI_QUIC_CRYPTO_MAX];
+    uint8_t  have[DPI_QUIC_CRYPTO_MAX / 8];  /* bitmap of received bytes */
+} dpi_quic_crypto_t;
+
+void dpi_quic_crypto_init(dpi_quic_crypto_t *qc);
+
+/*
+ * Decrypt the client Initial at the start of a UDP payload and collect
+ * its CRYPTO frames. Returns 0 on success, -1 if the payload is not a
+ * client Initial of this connection or fails authentication.
+ */
+int dpi_quic_crypto_add(dpi_quic_crypto_t *qc, const uint8_t *payload, int len);
+
+/*
+ * Locate the ClientHello in the reassembled CRYPTO stream. Offsets in
+ * out are relative to qc->data. Returns DPI_TLS_OK / _INCOMPLETE / _INVALID.
+ */
+int dpi_quic_crypto_hello(const dpi_quic_crypto_t *qc, dpi_tls_hello_t *out);
+
+/*
+ * Destination Connection ID of a client Initial (points into payload).
+ * Returns false if payload is not a QUIC v1/v2 Initial.
+ */
+bool dpi_quic_initial_dcid(const uint8_t *payload, int len,
+                           const uint8_t **dcid, int *dcid_len);
+
+/*
+ * Length of the client Initial at the start of payload, or -1 if it is
+ * not one. Any coalesced packets follow at that offset.
+ */
+int dpi_quic_initial_len(const uint8_t *payload, int len);
+
+/*
+ * Check if payload starts with a QUIC packet from past the client's
+ * first flight: a v1/v2 Handshake long header or a 1-RTT short header.
+ * Only meaningful on a flow already known to carry QUIC.
+ */
+bool dpi_quic_past_initial(const uint8_t *payload, int len);
+
+/* ------------------------------------------------------------------ */
+/*  Hostlist matching — see dpi_hostlist.c                             */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Set of lowercase domains. A host matches if it or any parent domain
+ * is in the set ("www.example.com" matches "example.com").
+ */
+typedef struct {
+    uint32_t *slots;    /* open addressing: (index + 1), 0 = empty */
+    uint32_t  mask;     /* slot count - 1 */
+    uint32_t  count;
+    char     *arena;    /* NUL-terminated names back to back */
+    uint32_t *offsets;  /* name index -> arena offset */
+    uint32_t  arena_used;
+    uint32_t  arena_cap;
+    uint32_t  offsets_cap;
+} dpi_hostlist_t;
+
+void dpi_hostlist_init(dpi_hostlist_t *hl);
+void dpi_hostlist_free(dpi_hostlist_t *hl);
+
+/* Returns 0 on success, -1 on allocation failure or empty name */
+int  dpi_hostlist_add(dpi_hostlist_t *hl, const char *name, int len);
+
+/*
+ * Load a domain-per-line file (blank lines and '#' comments skipped).
+ * Returns the number of domains added, or -1 if the file can't be read.
+ */
+int  dpi_hostlist_load_file(dpi_hostlist_t *hl, const char *path);
+
+/* host need not be NUL-terminated; comparison is case-insensitive */
+bool dpi_hostlist_match(const dpi_hostlist_t *hl, const char *host, int len);
+
+/*
+ * nfqws-style decision: a host is eligible for desync unless it is in
+ * exclude, or include is set and does not contain it. Either list may
+ * be NULL. Without a host (no SNI) only the include list matters.
+ */
+bool dpi_hostlist_allows(const dpi_hostlist_t *include, const dpi_hostlist_t *exclude,
+                         const char *host, int len);
+
+/* ------------------------------------------------------------------ */
+/*  Batch classification — see dpi_batch.c                             */
+/* ------------------------------------------------------------------ */
+
+#define DPI_BATCH_MAX 64
+
+#define DPI_HINT_NONE          0
+#define DPI_HINT_TLS_HELLO     1   /* TCP payload starts a TLS ClientHello */
+#define DPI_HINT_QUIC_INITIAL  2   /* UDP payload is a QUIC v1/v2 Initial */
+
+/*
+ * Struct-of-arrays result of dpi_classify_batch(); entry i describes
+ * pkts[i]. protocol[i] is 0 for packets that are not valid TCP/UDP, and
+ * the remaining columns of such entries are unspecified. Ports, seq and
+ * ack are in the same byte order as dpi_parse_tcp/udp return them.
+ * seq / ack / window are only set for TCP; options are left unparsed.
+ */
+typedef struct {
+    int        count;
+    uint8_t    protocol[DPI_BATCH_MAX];
+    uint8_t    tcp_flags[DPI_BATCH_MAX];
+    uint8_t    tcp_opt_len[DPI_BATCH_MAX];  /* options end at payload_off */
+    uint16_t   window[DPI_BATCH_MAX];       /* TCP window field, unscaled */
+    uint8_t    hint[DPI_BATCH_MAX];
+    uint16_t   src_port[DPI_BATCH_MAX];
+    uint16_t   dst_port[DPI_BATCH_MAX];
+    uint32_t   seq[DPI_BATCH_MAX];
+    uint32_t   ack[DPI_BATCH_MAX];
+    int        payload_off[DPI_BATCH_MAX];  /* from the start of the packet */
+    int        payload_len[DPI_BATCH_MAX];
+    uint32_t   flow_hash[DPI_BATCH_MAX];    /* dpi_flow_hash() of the 5-tuple */
+    dpi_addr_t src_ip[DPI_BATCH_MAX];
+    dpi_addr_t dst_ip[DPI_BATCH_MAX];
+} dpi_batch_t;
+
+/*
+ * Classify up to DPI_BATCH_MAX IP packets in one pass.
+ * Returns the number of entries written (min(n, DPI_BATCH_MAX)).
+ */
+int dpi_classify_batch(const uint8_t **pkts, const int *lens, int n, dpi_batch_t *out);
+
+/* Direction-sensitive hash of a 5-tuple (ports as passed to the relays) */
+uint32_t dpi_flow_hash(const dpi_addr_t *src, const dpi_addr_t *dst,
+                       uint16_t src_port, uint16_t dst_port, uint8_t protocol);
+
 /* ------------------------------------------------------------------ */
 /*  Packet construction (for writing back to TUN fd)                   */
 /* ------------------------------------------------------------------ */
@@ -135,12 +418,174 @@ int dpi_build_ipv4_tcp(uint8_t *out, int out_size,
                        uint8_t flags, uint16_t window,
                        const uint8_t *payload, int payload_len);
 
+/*
+ * IPv6 counterparts of the builders above (RFC 8200 pseudo-header,
+ * hop limit 64). src/dst are 16-byte addresses in wire order.
+ */
+int dpi_build_ipv6_udp(uint8_t *out, int out_size,
+                       const uint8_t *src_addr, const uint8_t *dst_addr,
+                       uint16_t src_port, uint16_t dst_port,
+                       const uint8_t *payload, int payload_len);
+
+int dpi_build_ipv6_tcp(uint8_t *out, int out_size,
+                       const uint8_t *src_addr, const uint8_t *dst_addr,
+                       uint16_t src_port, uint16_t dst_port,
+                       uint32_t seq, uint32_t ack,
+                       uint8_t flags, uint16_t window,
+                       const uint8_t *payload, int payload_len);
+
+/*
+ * Family-agnostic builders: pick IPv4 or IPv6 from the address type.
+ * src and dst must be of the same family.
+ */
+int dpi_build_ip_udp(uint8_t *out, int out_size,
+                     const dpi_addr_t *src, const dpi_addr_t *dst,
+                     uint16_t src_port, uint16_t dst_port,
+                     const uint8_t *payload, int payload_len);
+
+int dpi_build_ip_tcp(uint8_t *out, int out_size,
+                     const dpi_addr_t *src, const dpi_addr_t *dst,
+                     uint16_t src_port, uint16_t dst_port,
+                     uint32_t seq, uint32_t ack,
+                     uint8_t flags, uint16_t window,
+                     const uint8_t *payload, int payload_len);
+
+/*
+ * dpi_build_ip_tcp with TCP options (as encoded by dpi_tcp_write_options;
+ * opts_len must be a multiple of 4, at most DPI_TCP_MAX_OPTIONS).
+ */
+int dpi_build_ip_tcp_opts(uint8_t *out, int out_size,
+                          const dpi_addr_t *src, const dpi_addr_t *dst,
+                          uint16_t src_port, uint16_t dst_port,
+                          uint32_t seq, uint32_t ack,
+                          uint8_t flags, uint16_t window,
+                          const uint8_t *opts, int opts_len,
+                          const uint8_t *payload, int payload_len);
+
+/* ------------------------------------------------------------------ */
+/*  Per-flow header templates — see dpi_template.c                     */
+/* ------------------------------------------------------------------ */
+
+#define DPI_TEMPLATE_MAX_HDR 100    /* IPv6 (40) + TCP with options (60) */
+
+/*
+ * Prebuilt IP + TCP/UDP header of one direction of a flow (no TCP
+ * options). Produces the same packets as dpi_build_ip_tcp/udp.
+ */
+typedef struct {
+    uint8_t  hdr[DPI_TEMPLATE_MAX_HDR];
+    uint8_t  ip_len;        /* 20 (IPv4) or 40 (IPv6) */
+    uint8_t  hdr_len;       /* ip_len + L4 header; payload starts here */
+    uint8_t  protocol;
+    uint32_t ip_sum;        /* partial sum of the IPv4 header without length */
+    uint32_t l4_sum;        /* partial sum of pseudo-header addresses, proto, ports */
+} dpi_hdr_template_t;
+
+void dpi_template_init_tcp(dpi_hdr_template_t *t,
+                           const dpi_addr_t *src, const dpi_addr_t *dst,
+                           uint16_t src_port, uint16_t dst_port);
+void dpi_template_init_udp(dpi_hdr_template_t *t,
+                           const dpi_addr_t *src, const dpi_addr_t *dst,
+                           uint16_t src_port, uint16_t dst_port);
+
+/*
+ * Emit a packet from a template. The payload may already sit at
+ * out + t->hdr_len (e.g. recv() into it), in which case it is not copied.
+ * Returns total length written to out, or -1 on error.
+ */
+int dpi_template_build_tcp(const dpi_hdr_template_t *t, uint8_t *out, int out_size,
+                           uint32_t seq, uint32_t ack,
+                           uint8_t flags, uint16_t window,
+                           const uint8_t *payload, int payload_len);
+int dpi_template_build_udp(const dpi_hdr_template_t *t, uint8_t *out, int out_size,
+                           const uint8_t *payload, int payload_len);
+
+/*
+ * Scatter-gather variants: write only the header (t->hdr_len bytes, at
+ * most DPI_TEMPLATE_MAX_HDR) to hdr and describe the packet as
+ * iov[0] = header, iov[1] = the caller's payload, ready for writev(fd, iov, 2).
+ * The payload is read for the checksum but never copied.
+ * Returns the total packet length, or -1 on error.
+ */
+int dpi_template_iov_tcp(const dpi_hdr_template_t *t, uint8_t *hdr,
+                         uint32_t seq, uint32_t ack,
+                         uint8_t flags, uint16_t window,
+                         const uint8_t *payload, int payload_len,
+                         struct iovec iov[2]);
+int dpi_template_iov_udp(const dpi_hdr_template_t *t, uint8_t *hdr,
+                         const uint8_t *payload, int payload_len,
+                         struct iovec iov[2]);
+
+/* TCP segment with options (e.g. the SYN-ACK); same rules as dpi_build_ip_tcp_opts */
+int dpi_template_iov_tcp_opts(const dpi_hdr_template_t *t, uint8_t *hdr,
+                              uint32_t seq, uint32_t ack,
+                              uint8_t flags, uint16_t window,
+                              const uint8_t *opts, int opts_len,
+                              const uint8_t *payload, int payload_len,
+                              struct iovec iov[2]);
+
+/* ------------------------------------------------------------------ */
+/*  In-place header patching of built IPv4 packets                     */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Rewrite a header field of an IPv4+TCP/UDP packet (e.g. produced by
+ * dpi_build_ipv4_tcp/udp) and fix the affected checksums in O(1).
+ * All return 0 on success, -1 if the packet is malformed or of the
+ * wrong protocol. A zero UDP checksum ("not computed") is left as is.
+ */
+int dpi_patch_ipv4_ttl(uint8_t *pkt, int len, uint8_t ttl);
+int dpi_patch_ports(uint8_t *pkt, int len, uint16_t src_port, uint16_t dst_port);
+int dpi_patch_tcp_seq(uint8_t *pkt, int len, uint32_t seq);
+int dpi_patch_tcp_ack(uint8_t *pkt, int len, uint32_t ack);
+
+/*
+ * Change the IPv4 total length (and UDP length) to new_total after the
+ * payload was trimmed or extended in place. buf_size is the size of the
+ * buffer holding pkt. Cost is proportional to the length difference:
+ * only the bytes entering or leaving the packet are re-summed.
+ */
+int dpi_patch_ipv4_length(uint8_t *pkt, int buf_size, int new_total);
+
+/* ------------------------------------------------------------------ */
+/*  Address helpers                                                    */
+/* ------------------------------------------------------------------ */
+
+void     dpi_addr_from_ipv4(dpi_addr_t *addr, uint32_t ipv4);
+bool     dpi_addr_is_ipv4(const dpi_addr_t *addr);
+uint32_t dpi_addr_to_ipv4(const dpi_addr_t *addr);
+bool     dpi_addr_equal(const dpi_addr_t *a, const dpi_addr_t *b);
+
+/* ------------------------------------------------------------------ */
+/*  Checksum (RFC 1071) — see dpi_checksum.c                           */
+/* ------------------------------------------------------------------ */
+
 /*
  * Compute the Internet checksum (RFC 1071).
  * Used for IP header checksum and TCP/UDP pseudo-header checksum.
  */
 uint16_t dpi_checksum(const uint8_t *data, int len);
 
+/*
+ * IPv6 variant of dpi_transport_checksum (RFC 8200 §8.1 pseudo-header).
+ * src_addr / dst_addr are 16-byte addresses in wire order.
+ */
+uint16_t dpi_transport_checksum6(const uint8_t *src_addr, const uint8_t *dst_addr,
+                                 uint8_t proto,
+                                 const uint8_t *transport_hdr, int transport_len);
+
+/*
+ * Accumulate data into a partial (unfolded, uncomplemented) sum.
+ * Chain calls to checksum non-contiguous buffers; every buffer except
+ * the last must have even length. Finish with dpi_checksum_fold().
+ */
+uint32_t dpi_checksum_add(uint32_t sum, const uint8_t *data, int len);
+
+/*
+ * Fold a partial sum to 16 bits and return its ones' complement.
+ */
+uint16_t dpi_checksum_fold(uint32_t sum);
+
 /*
  * Compute TCP or UDP checksum with pseudo-header.
  * proto: 6 for TCP, 17 for UDP.
@@ -149,6 +594,29 @@ uint16_t dpi_transport_checksum(uint32_t src_addr, uint32_t dst_addr,
                                 uint8_t proto,
                                 const uint8_t *transport_hdr, int transport_len);
 
+/*
+ * Incrementally update a checksum after a 16/32-bit field changed from
+ * old_val to new_val (RFC 1624, eqn. 3). Values in host byte order.
+ */
+uint16_t dpi_checksum_adjust16(uint16_t cksum, uint16_t old_val, uint16_t new_val);
+uint16_t dpi_checksum_adjust32(uint16_t cksum, uint32_t old_val, uint32_t new_val);
+
+/*
+ * Checksum kernel selection. The fastest kernel supported by the CPU
+ * is chosen automatically on first use; all kernels produce identical
+ * results. dpi_checksum_select() returns false if impl is unavailable.
+ */
+typedef enum {
+    DPI_CSUM_AUTO = 0,
+    DPI_CSUM_SCALAR,
+    DPI_CSUM_SSE2,
+    DPI_CSUM_AVX2,
+    DPI_CSUM_NEON
+} dpi_csum_impl_t;
+
+bool dpi_checksum_select(dpi_csum_impl_t impl);
+const char *dpi_checksum_impl_name(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,319 @@
+/*
+ * dpi_checksum.c — Internet checksum (RFC 1071) kernels
+ *
+ * The ones' complement sum is byte-order independent (RFC 1071 §2.B):
+ * kernels add native-endian words into wide accumulators and the result
+ * is folded and swapped into network order once at the end.
+ *
+ * Kernels: scalar (always), SSE2 / AVX2 (x86), NEON (ARM).
+ * The best available one is picked at first use; all give identical results.
+ */
+
+#include "dpi_bypass.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  if defined(__GNUC__) && defined(__SSE2__)
+#    include <immintrin.h>
+#    define DPI_HAVE_SSE2 1
+#    define DPI_HAVE_AVX2 1   /* compiled with target attribute, checked at runtime */
+#  endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define DPI_HAVE_NEON 1
+#endif
+
+/*
+ * 32-bit accumulator lanes receive at most 2 * 0xFFFF per vector step,
+ * so flush them into 64-bit totals before 32768 steps.
+ */
+#define LANE_FLUSH_STEPS 16384
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                            */
+/* ------------------------------------------------------------------ */
+
+static inline bool host_is_little_endian(void)
+{
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+    return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+#else
+    const uint16_t probe = 1;
+    return *(const uint8_t *)&probe == 1;
+#endif
+}
+
+static inline uint32_t fold64(uint64_t sum)
+{
+    sum = (sum & 0xFFFFFFFFu) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFFu) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint32_t)sum;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Kernels: native-endian sum over the even-length prefix of data     */
+/*  (return value is only meaningful after fold64)                     */
+/* ------------------------------------------------------------------ */
+
+typedef uint64_t (*csum_kernel_fn)(const uint8_t *data, size_t len);
+
+static uint64_t csum_scalar(const uint8_t *data, size_t len)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+
+    /* 32-bit words into a 64-bit accumulator: no carry handling needed */
+    for (; i + 16 <= len; i += 16) {
+        uint32_t w[4];
+        memcpy(w, data + i, sizeof(w));
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+    }
+    for (; i + 4 <= len; i += 4) {
+        uint32_t w;
+        memcpy(&w, data + i, sizeof(w));
+        sum += w;
+    }
+    for (; i + 2 <= len; i += 2) {
+        uint16_t w;
+        memcpy(&w, data + i, sizeof(w));
+        sum += w;
+    }
+    return sum;
+}
+
+#ifdef DPI_HAVE_SSE2
+static uint64_t csum_sse2(const uint8_t *data, size_t len)
+{
+    const __m128i mask = _mm_set1_epi32(0xFFFF);
+    uint64_t total = 0;
+    size_t i = 0;
+
+    while (len - i >= 32) {
+        __m128i acc0 = _mm_setzero_si128();
+        __m128i acc1 = _mm_setzero_si128();
+        size_t steps = 0;
+
+        for (; len - i >= 32 && steps < LANE_FLUSH_STEPS; i += 32, steps++) {
+            __m128i v0 = _mm_loadu_si128((const __m128i *)(data + i));
+            __m128i v1 = _mm_loadu_si128((const __m128i *)(data + i + 16));
+            acc0 = _mm_add_epi32(acc0, _mm_add_epi32(_mm_and_si128(v0, mask),
+                                                     _mm_srli_epi32(v0, 16)));
+            acc1 = _mm_add_epi32(acc1, _mm_add_epi32(_mm_and_si128(v1, mask),
+                                                     _mm_srli_epi32(v1, 16)));
+        }
+
+        uint32_t lanes[8];
+        _mm_storeu_si128((__m128i *)lanes, acc0);
+        _mm_storeu_si128((__m128i *)(lanes + 4), acc1);
+        for (int k = 0; k < 8; k++)
+            total += lanes[k];
+    }
+
+    return total + csum_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t csum_avx2(const uint8_t *data, size_t len)
+{
+    const __m256i mask = _mm256_set1_epi32(0xFFFF);
+    uint64_t total = 0;
+    size_t i = 0;
+
+    while (len - i >= 64) {
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        size_t steps = 0;
+
+        for (; len - i >= 64 && steps < LANE_FLUSH_STEPS; i += 64, steps++) {
+            __m256i v0 = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256i v1 = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+            acc0 = _mm256_add_epi32(acc0, _mm256_add_epi32(_mm256_and_si256(v0, mask),
+                                                           _mm256_srli_epi32(v0, 16)));
+            acc1 = _mm256_add_epi32(acc1, _mm256_add_epi32(_mm256_and_si256(v1, mask),
+                                                           _mm256_srli_epi32(v1, 16)));
+        }
+
+        uint32_t lanes[16];
+        _mm256_storeu_si256((__m256i *)lanes, acc0);
+        _mm256_storeu_si256((__m256i *)(lanes + 8), acc1);
+        for (int k = 0; k < 16; k++)
+            total += lanes[k];
+    }
+
+    /* The tail runs legacy-SSE code: clear the upper halves first or
+     * every SSE instruction pays the AVX->SSE transition penalty */
+    _mm256_zeroupper();
+    return total + csum_sse2(data + i, len - i);
+}
+#endif /* DPI_HAVE_SSE2 */
+
+#ifdef DPI_HAVE_NEON
+static uint64_t csum_neon(const uint8_t *data, size_t len)
+{
+    uint64_t total = 0;
+    size_t i = 0;
+
+    while (len - i >= 32) {
+        uint32x4_t acc0 = vdupq_n_u32(0);
+        uint32x4_t acc1 = vdupq_n_u32(0);
+        size_t steps = 0;
+
+        /* vpadalq_u16 adds adjacent 16-bit pairs into each 32-bit lane */
+        for (; len - i >= 32 && steps < LANE_FLUSH_STEPS; i += 32, steps++) {
+            acc0 = vpadalq_u16(acc0, vreinterpretq_u16_u8(vld1q_u8(data + i)));
+            acc1 = vpadalq_u16(acc1, vreinterpretq_u16_u8(vld1q_u8(data + i + 16)));
+        }
+
+        uint64x2_t wide = vaddq_u64(vpaddlq_u32(acc0), vpaddlq_u32(acc1));
+        total += vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1);
+    }
+
+    return total + csum_scalar(data + i, len - i);
+}
+#endif /* DPI_HAVE_NEON */
+
+/* ------------------------------------------------------------------ */
+/*  Kernel selection                                                   */
+/* ------------------------------------------------------------------ */
+
+static csum_kernel_fn g_kernel;
+static const char *g_kernel_name = "scalar";
+
+static bool kernel_supported(dpi_csum_impl_t impl)
+{
+    switch (impl) {
+    case DPI_CSUM_SCALAR:
+        return true;
+#ifdef DPI_HAVE_SSE2
+    case DPI_CSUM_SSE2:
+        return true;
+    case DPI_CSUM_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef DPI_HAVE_NEON
+    case DPI_CSUM_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool dpi_checksum_select(dpi_csum_impl_t impl)
+{
+    if (impl == DPI_CSUM_AUTO) {
+        static const dpi_csum_impl_t order[] = {
+            DPI_CSUM_AVX2, DPI_CSUM_NEON, DPI_CSUM_SSE2, DPI_CSUM_SCALAR
+        };
+        for (size_t k = 0; k < sizeof(order) / sizeof(order[0]); k++) {
+            if (kernel_supported(order[k]))
+                return dpi_checksum_select(order[k]);
+        }
+        return false;
+    }
+
+    if (!kernel_supported(impl))
+        return false;
+
+    switch (impl) {
+#ifdef DPI_HAVE_SSE2
+    case DPI_CSUM_SSE2: g_kernel = csum_sse2; g_kernel_name = "sse2"; break;
+    case DPI_CSUM_AVX2: g_kernel = csum_avx2; g_kernel_name = "avx2"; break;
+#endif
+#ifdef DPI_HAVE_NEON
+    case DPI_CSUM_NEON: g_kernel = csum_neon; g_kernel_name = "neon"; break;
+#endif
+    default:            g_kernel = csum_scalar; g_kernel_name = "scalar"; break;
+    }
+    return true;
+}
+
+const char *dpi_checksum_impl_name(void)
+{
+    if (!g_kernel)
+        dpi_checksum_select(DPI_CSUM_AUTO);
+    return g_kernel_name;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                         */
+/* ------------------------------------------------------------------ */
+
+uint32_t dpi_checksum_add(uint32_t sum, const uint8_t *data, int len)
+{
+    if (len <= 0)
+        return sum;
+
+    if (!g_kernel)
+        dpi_checksum_select(DPI_CSUM_AUTO);
+
+    size_t even = (size_t)len & ~(size_t)1;
+    uint32_t part = fold64(g_kernel(data, even));
+    if (host_is_little_endian())
+        part = ((part & 0xFF) << 8) | (part >> 8);
+
+    uint64_t total = (uint64_t)sum + part;
+    if (len & 1)
+        total += (uint32_t)data[len - 1] << 8;
+
+    return fold64(total);
+}
+
+uint16_t dpi_checksum_fold(uint32_t sum)
+{
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)(~sum & 0xFFFF);
+}
+
+uint16_t dpi_checksum(const uint8_t *data, int len)
+{
+    return dpi_checksum_fold(dpi_checksum_add(0, data, len));
+}
+
+uint16_t dpi_transport_checksum(uint32_t src_addr, uint32_t dst_addr,
+                                uint8_t proto,
+                                const uint8_t *transport_hdr, int transport_len)
+{
+    /* Pseudo-header: src_ip(4) + dst_ip(4) + zero(1) + proto(1) + length(2) */
+    uint32_t sum = (src_addr >> 16) + (src_addr & 0xFFFF) +
+                   (dst_addr >> 16) + (dst_addr & 0xFFFF) +
+                   proto + (uint32_t)(uint16_t)transport_len;
+
+    return dpi_checksum_fold(dpi_checksum_add(sum, transport_hdr, transport_len));
+}
+
+uint16_t dpi_transport_checksum6(const uint8_t *src_addr, const uint8_t *dst_addr,
+                                 uint8_t proto,
+                                 const uint8_t *transport_hdr, int transport_len)
+{
+    /* Pseudo-header: src(16) + dst(16) + length(4) + zero(3) + next header(1) */
+    uint32_t sum = dpi_checksum_add(0, src_addr, 16);
+    sum = dpi_checksum_add(sum, dst_addr, 16);
+    sum += ((uint32_t)transport_len >> 16) + ((uint32_t)transport_len & 0xFFFF) + proto;
+
+    return dpi_checksum_fold(dpi_checksum_add(sum, transport_hdr, transport_len));
+}
+
+/* ------------------------------------------------------------------ */
+/*  Incremental update (RFC 1624)                                      */
+/* ------------------------------------------------------------------ */
+
+/* HC' = ~(~HC + ~m + m')  — eqn. 3, avoids the -0 / +0 ambiguity */
+uint16_t dpi_checksum_adjust16(uint16_t cksum, uint16_t old_val, uint16_t new_val)
+{
+    uint32_t sum = (uint32_t)(uint16_t)~cksum + (uint16_t)~old_val + new_val;
+    return dpi_checksum_fold(sum);
+}
+
+uint16_t dpi_checksum_adjust32(uint16_t cksum, uint32_t old_val, uint32_t new_val)
+{
+    uint32_t sum = (uint32_t)(uint16_t)~cksum +
+                   (uint16_t)~(old_val >> 16) + (uint16_t)~(old_val & 0xFFFF) +
+                   (new_val >> 16) + (new_val & 0xFFFF);
+    return dpi_checksum_fold(sum);
+}
@@ -0,0 +1,468 @@
+/*
+ * dpi_crypto.c — SHA-256, HKDF and AES-128-GCM for QUIC Initials
+ *
+ * Self-contained so the mobile builds need no OpenSSL. Opening one
+ * 1200-byte Initial runs about 75 AES blocks and as many GHASH steps on
+ * the shard thread, so both are table driven (T-table AES, 4-bit GHASH).
+ */
+
+#include "dpi_crypto.h"
+#include <string.h>
+
+/* ------------------------------------------------------------------ */
+/*  SHA-256 (FIPS 180-4)                                               */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t total;
+    uint8_t  block[64];
+    size_t   used;
+} sha256_ctx_t;
+
+static const uint32_t g_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr32(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void sha256_compress(uint32_t h[8], const uint8_t block[64])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = load_be32(block + i * 4);
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = k + s1 + ch + g_sha256_k[i] + w[i];
+        uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void sha256_init(sha256_ctx_t *ctx)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->total = 0;
+    ctx->used = 0;
+}
+
+static void sha256_update(sha256_ctx_t *ctx, const uint8_t *data, size_t len)
+{
+    ctx->total += len;
+
+    if (ctx->used) {
+        size_t take = 64 - ctx->used;
+        if (take > len)
+            take = len;
+        memcpy(ctx->block + ctx->used, data, take);
+        ctx->used += take;
+        data += take;
+        len -= take;
+        if (ctx->used < 64)
+            return;
+        sha256_compress(ctx->h, ctx->block);
+        ctx->used = 0;
+    }
+
+    for (; len >= 64; data += 64, len -= 64)
+        sha256_compress(ctx->h, data);
+
+    memcpy(ctx->block, data, len);
+    ctx->used = len;
+}
+
+static void sha256_final(sha256_ctx_t *ctx, uint8_t out[DPI_SHA256_LEN])
+{
+    uint64_t bits = ctx->total * 8;
+
+    ctx->block[ctx->used++] = 0x80;
+    if (ctx->used > 56) {
+        memset(ctx->block + ctx->used, 0, 64 - ctx->used);
+        sha256_compress(ctx->h, ctx->block);
+        ctx->used = 0;
+    }
+    memset(ctx->block + ctx->used, 0, 56 - ctx->used);
+    store_be32(ctx->block + 56, (uint32_t)(bits >> 32));
+    store_be32(ctx->block + 60, (uint32_t)bits);
+    sha256_compress(ctx->h, ctx->block);
+
+    for (int i = 0; i < 8; i++)
+        store_be32(out + i * 4, ctx->h[i]);
+}
+
+void dpi_sha256(const uint8_t *data, size_t len, uint8_t out[DPI_SHA256_LEN])
+{
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, out);
+}
+
+/* ------------------------------------------------------------------ */
+/*  HMAC / HKDF                                                        */
+/* ------------------------------------------------------------------ */
+
+void dpi_hmac_sha256(const uint8_t *key, size_t key_len,
+                     const uint8_t *data, size_t len,
+                     uint8_t out[DPI_SHA256_LEN])
+{
+    uint8_t k[64] = {0};
+    uint8_t pad[64];
+    uint8_t inner[DPI_SHA256_LEN];
+    sha256_ctx_t ctx;
+
+    if (key_len > 64)
+        dpi_sha256(key, key_len, k);
+    else
+        memcpy(k, key, key_len);
+
+    for (int i = 0; i < 64; i++)
+        pad[i] = k[i] ^ 0x36;
+    sha256_init(&ctx);
+    sha256_update(&ctx, pad, 64);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, inner);
+
+    for (int i = 0; i < 64; i++)
+        pad[i] = k[i] ^ 0x5c;
+    sha256_init(&ctx);
+    sha256_update(&ctx, pad, 64);
+    sha256_update(&ctx, inner, sizeof(inner));
+    sha256_final(&ctx, out);
+}
+
+void dpi_hkdf_extract(const uint8_t *salt, size_t salt_len,
+                      const uint8_t *ikm, size_t ikm_len,
+                      uint8_t prk[DPI_SHA256_LEN])
+{
+    dpi_hmac_sha256(salt, salt_len, ikm, ikm_len, prk);
+}
+
+void dpi_hkdf_expand_label(const uint8_t prk[DPI_SHA256_LEN], const char *label,
+                           uint8_t *out, int out_len)
+{
+    /* HkdfLabel: length(2) | label_len(1) "tls13 " label | context_len(1)=0 */
+    uint8_t info[2 + 1 + 255 + 1 + 1];
+    int label_len = (int)strlen(label);
+    int n = 0;
+
+    info[n++] = (uint8_t)(out_len >> 8);
+    info[n++] = (uint8_t)out_len;
+    info[n++] = (uint8_t)(6 + label_len);
+    memcpy(info + n, "tls13 ", 6);
+    n += 6;
+    memcpy(info + n, label, label_len);
+    n += label_len;
+    info[n++] = 0;
+
+    /* T(i) = HMAC(PRK, T(i-1) | info | i) */
+    uint8_t t[DPI_SHA256_LEN];
+    uint8_t buf[DPI_SHA256_LEN + sizeof(info) + 1];
+    int t_len = 0;
+    int done = 0;
+
+    for (uint8_t i = 1; done < out_len; i++) {
+        memcpy(buf, t, t_len);
+        memcpy(buf + t_len, info, n);
+        buf[t_len + n] = i;
+        dpi_hmac_sha256(prk, DPI_SHA256_LEN, buf, t_len + n + 1, t);
+        t_len = DPI_SHA256_LEN;
+
+        int take = out_len - done < DPI_SHA256_LEN ? out_len - done : DPI_SHA256_LEN;
+        memcpy(out + done, t, take);
+        done += take;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  AES-128 (FIPS 197), encryption only                                */
+/* ------------------------------------------------------------------ */
+
+static const uint8_t g_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+/* Te0[x] = column (2, 1, 1, 3) * S[x]; the other three are rotations */
+static const uint32_t g_te0[256] = {
+    0xc66363a5, 0xf87c7c84, 0xee777799, 0xf67b7b8d, 0xfff2f20d, 0xd66b6bbd, 0xde6f6fb1, 0x91c5c554,
+    0x60303050, 0x02010103, 0xce6767a9, 0x562b2b7d, 0xe7fefe19, 0xb5d7d762, 0x4dababe6, 0xec76769a,
+    0x8fcaca45, 0x1f82829d, 0x89c9c940, 0xfa7d7d87, 0xeffafa15, 0xb25959eb, 0x8e4747c9, 0xfbf0f00b,
+    0x41adadec, 0xb3d4d467, 0x5fa2a2fd, 0x45afafea, 0x239c9cbf, 0x53a4a4f7, 0xe4727296, 0x9bc0c05b,
+    0x75b7b7c2, 0xe1fdfd1c, 0x3d9393ae, 0x4c26266a, 0x6c36365a, 0x7e3f3f41, 0xf5f7f702, 0x83cccc4f,
+    0x6834345c, 0x51a5a5f4, 0xd1e5e534, 0xf9f1f108, 0xe2717193, 0xabd8d873, 0x62313153, 0x2a15153f,
+    0x0804040c, 0x95c7c752, 0x46232365, 0x9dc3c35e, 0x30181828, 0x379696a1, 0x0a05050f, 0x2f9a9ab5,
+    0x0e070709, 0x24121236, 0x1b80809b, 0xdfe2e23d, 0xcdebeb26, 0x4e272769, 0x7fb2b2cd, 0xea75759f,
+    0x1209091b, 0x1d83839e, 0x582c2c74, 0x341a1a2e, 0x361b1b2d, 0xdc6e6eb2, 0xb45a5aee, 0x5ba0a0fb,
+    0xa45252f6, 0x763b3b4d, 0xb7d6d661, 0x7db3b3ce, 0x5229297b, 0xdde3e33e, 0x5e2f2f71, 0x13848497,
+    0xa65353f5, 0xb9d1d168, 0x00000000, 0xc1eded2c, 0x40202060, 0xe3fcfc1f, 0x79b1b1c8, 0xb65b5bed,
+    0xd46a6abe, 0x8dcbcb46, 0x67bebed9, 0x7239394b, 0x944a4ade, 0x984c4cd4, 0xb05858e8, 0x85cfcf4a,
+    0xbbd0d06b, 0xc5efef2a, 0x4faaaae5, 0xedfbfb16, 0x864343c5, 0x9a4d4dd7, 0x66333355, 0x11858594,
+    0x8a4545cf, 0xe9f9f910, 0x04020206, 0xfe7f7f81, 0xa05050f0, 0x783c3c44, 0x259f9fba, 0x4ba8a8e3,
+    0xa25151f3, 0x5da3a3fe, 0x804040c0, 0x058f8f8a, 0x3f9292ad, 0x219d9dbc, 0x70383848, 0xf1f5f504,
+    0x63bcbcdf, 0x77b6b6c1, 0xafdada75, 0x42212163, 0x20101030, 0xe5ffff1a, 0xfdf3f30e, 0xbfd2d26d,
+    0x81cdcd4c, 0x180c0c14, 0x26131335, 0xc3ecec2f, 0xbe5f5fe1, 0x359797a2, 0x884444cc, 0x2e171739,
+    0x93c4c457, 0x55a7a7f2, 0xfc7e7e82, 0x7a3d3d47, 0xc86464ac, 0xba5d5de7, 0x3219192b, 0xe6737395,
+    0xc06060a0, 0x19818198, 0x9e4f4fd1, 0xa3dcdc7f, 0x44222266, 0x542a2a7e, 0x3b9090ab, 0x0b888883,
+    0x8c4646ca, 0xc7eeee29, 0x6bb8b8d3, 0x2814143c, 0xa7dede79, 0xbc5e5ee2, 0x160b0b1d, 0xaddbdb76,
+    0xdbe0e03b, 0x64323256, 0x743a3a4e, 0x140a0a1e, 0x924949db, 0x0c06060a, 0x4824246c, 0xb85c5ce4,
+    0x9fc2c25d, 0xbdd3d36e, 0x43acacef, 0xc46262a6, 0x399191a8, 0x319595a4, 0xd3e4e437, 0xf279798b,
+    0xd5e7e732, 0x8bc8c843, 0x6e373759, 0xda6d6db7, 0x018d8d8c, 0xb1d5d564, 0x9c4e4ed2, 0x49a9a9e0,
+    0xd86c6cb4, 0xac5656fa, 0xf3f4f407, 0xcfeaea25, 0xca6565af, 0xf47a7a8e, 0x47aeaee9, 0x10080818,
+    0x6fbabad5, 0xf0787888, 0x4a25256f, 0x5c2e2e72, 0x381c1c24, 0x57a6a6f1, 0x73b4b4c7, 0x97c6c651,
+    0xcbe8e823, 0xa1dddd7c, 0xe874749c, 0x3e1f1f21, 0x964b4bdd, 0x61bdbddc, 0x0d8b8b86, 0x0f8a8a85,
+    0xe0707090, 0x7c3e3e42, 0x71b5b5c4, 0xcc6666aa, 0x904848d8, 0x06030305, 0xf7f6f601, 0x1c0e0e12,
+    0xc26161a3, 0x6a35355f, 0xae5757f9, 0x69b9b9d0, 0x17868691, 0x99c1c158, 0x3a1d1d27, 0x279e9eb9,
+    0xd9e1e138, 0xebf8f813, 0x2b9898b3, 0x22111133, 0xd26969bb, 0xa9d9d970, 0x078e8e89, 0x339494a7,
+    0x2d9b9bb6, 0x3c1e1e22, 0x15878792, 0xc9e9e920, 0x87cece49, 0xaa5555ff, 0x50282878, 0xa5dfdf7a,
+    0x038c8c8f, 0x59a1a1f8, 0x09898980, 0x1a0d0d17, 0x65bfbfda, 0xd7e6e631, 0x844242c6, 0xd06868b8,
+    0x824141c3, 0x299999b0, 0x5a2d2d77, 0x1e0f0f11, 0x7bb0b0cb, 0xa85454fc, 0x6dbbbbd6, 0x2c16163a
+};
+
+static inline uint32_t sub_word(uint32_t w)
+{
+    return ((uint32_t)g_sbox[w >> 24] << 24) | ((uint32_t)g_sbox[(w >> 16) & 0xFF] << 16) |
+           ((uint32_t)g_sbox[(w >> 8) & 0xFF] << 8) | g_sbox[w & 0xFF];
+}
+
+void dpi_aes128_init(dpi_aes128_t *ctx, const uint8_t key[16])
+{
+    static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+    for (int i = 0; i < 4; i++)
+        ctx->rk[i] = load_be32(key + i * 4);
+    for (int i = 4; i < 44; i++) {
+        uint32_t t = ctx->rk[i - 1];
+        if (i % 4 == 0)
+            t = sub_word((t << 8) | (t >> 24)) ^ ((uint32_t)rcon[i / 4 - 1] << 24);
+        ctx->rk[i] = ctx->rk[i - 4] ^ t;
+    }
+}
+
+static inline uint32_t rotr8(uint32_t x)
+{
+    return (x >> 8) | (x << 24);
+}
+
+void dpi_aes128_encrypt(const dpi_aes128_t *ctx, const uint8_t in[16], uint8_t out[16])
+{
+    const uint32_t *rk = ctx->rk;
+    uint32_t s0 = load_be32(in)      ^ rk[0];
+    uint32_t s1 = load_be32(in + 4)  ^ rk[1];
+    uint32_t s2 = load_be32(in + 8)  ^ rk[2];
+    uint32_t s3 = load_be32(in + 12) ^ rk[3];
+
+    /* SubBytes + ShiftRows + MixColumns as one table lookup per byte */
+    for (int round = 1; round < 10; round++) {
+        rk += 4;
+        uint32_t t0 = g_te0[s0 >> 24] ^ rotr8(g_te0[(s1 >> 16) & 0xFF] ^
+                      rotr8(g_te0[(s2 >> 8) & 0xFF] ^ rotr8(g_te0[s3 & 0xFF]))) ^ rk[0];
+        uint32_t t1 = g_te0[s1 >> 24] ^ rotr8(g_te0[(s2 >> 16) & 0xFF] ^
+                      rotr8(g_te0[(s3 >> 8) & 0xFF] ^ rotr8(g_te0[s0 & 0xFF]))) ^ rk[1];
+        uint32_t t2 = g_te0[s2 >> 24] ^ rotr8(g_te0[(s3 >> 16) & 0xFF] ^
+                      rotr8(g_te0[(s0 >> 8) & 0xFF] ^ rotr8(g_te0[s1 & 0xFF]))) ^ rk[2];
+        uint32_t t3 = g_te0[s3 >> 24] ^ rotr8(g_te0[(s0 >> 16) & 0xFF] ^
+                      rotr8(g_te0[(s1 >> 8) & 0xFF] ^ rotr8(g_te0[s2 & 0xFF]))) ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    /* Last round: no MixColumns */
+    rk += 4;
+    store_be32(out,      sub_word((s0 & 0xFF000000) | (s1 & 0x00FF0000) |
+                                  (s2 & 0x0000FF00) | (s3 & 0x000000FF)) ^ rk[0]);
+    store_be32(out + 4,  sub_word((s1 & 0xFF000000) | (s2 & 0x00FF0000) |
+                                  (s3 & 0x0000FF00) | (s0 & 0x000000FF)) ^ rk[1]);
+    store_be32(out + 8,  sub_word((s2 & 0xFF000000) | (s3 & 0x00FF0000) |
+                                  (s0 & 0x0000FF00) | (s1 & 0x000000FF)) ^ rk[2]);
+    store_be32(out + 12, sub_word((s3 & 0xFF000000) | (s0 & 0x00FF0000) |
+                                  (s1 & 0x0000FF00) | (s2 & 0x000000FF)) ^ rk[3]);
+}
+
+/* ------------------------------------------------------------------ */
+/*  GCM (NIST SP 800-38D), decryption only                             */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    uint64_t hi, lo;
+} gf128_t;
+
+static inline uint64_t load_be64(const uint8_t *p)
+{
+    return ((uint64_t)load_be32(p) << 32) | load_be32(p + 4);
+}
+
+/*
+ * 4-bit table multiplication (Shoup): m[i] = i * H for every nibble i,
+ * so a block costs 32 lookups instead of 128 conditional shifts.
+ */
+typedef struct {
+    gf128_t m[16];
+} ghash_table_t;
+
+static const uint16_t g_ghash_rem4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static void ghash_init(ghash_table_t *t, const gf128_t *h)
+{
+    /* Nibbles are bit-reflected: 8 is H itself, 4, 2 and 1 are H * x^k */
+    gf128_t v = *h;
+    t->m[0].hi = t->m[0].lo = 0;
+    t->m[8] = v;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t carry = v.lo & 1;
+        v.lo = (v.lo >> 1) | (v.hi << 63);
+        v.hi = (v.hi >> 1) ^ (carry ? 0xe100000000000000ULL : 0);
+        t->m[i] = v;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            t->m[i + j].hi = t->m[i].hi ^ t->m[j].hi;
+            t->m[i + j].lo = t->m[i].lo ^ t->m[j].lo;
+        }
+    }
+}
+
+/* x = x * H in GF(2^128), bit-reflected GCM convention */
+static void gf128_mul(gf128_t *x, const ghash_table_t *t)
+{
+    uint64_t zh = 0, zl = 0;
+
+    /* Nibbles from the last (lowest degree) to the first */
+    for (int i = 31; i >= 0; i--) {
+        uint64_t word = i < 16 ? x->hi : x->lo;
+        int nib = (int)(word >> (60 - (i & 15) * 4)) & 0xF;
+        int rem = (int)(zl & 0xF);
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ ((uint64_t)g_ghash_rem4[rem] << 48);
+        zh ^= t->m[nib].hi;
+        zl ^= t->m[nib].lo;
+    }
+    x->hi = zh;
+    x->lo = zl;
+}
+
+static void ghash_update(gf128_t *y, const ghash_table_t *t, const uint8_t *data, int len)
+{
+    while (len > 0) {
+        if (len >= 16) {
+            y->hi ^= load_be64(data);
+            y->lo ^= load_be64(data + 8);
+        } else {
+            uint8_t block[16] = {0};
+            memcpy(block, data, len);
+            y->hi ^= load_be64(block);
+            y->lo ^= load_be64(block + 8);
+        }
+        gf128_mul(y, t);
+        data += 16;
+        len -= 16;
+    }
+}
+
+int dpi_aes128_gcm_decrypt(const dpi_aes128_t *ctx, const uint8_t iv[12],
+                           const uint8_t *aad, int aad_len,
+                           const uint8_t *ct, int ct_len,
+                           const uint8_t tag[16], uint8_t *pt)
+{
+    uint8_t zero[16] = {0};
+    uint8_t hbytes[16];
+    dpi_aes128_encrypt(ctx, zero, hbytes);
+    gf128_t h = { load_be64(hbytes), load_be64(hbytes + 8) };
+    ghash_table_t table;
+    ghash_init(&table, &h);
+
+    /* Authenticate before decrypting (pt may alias ct) */
+    gf128_t y = { 0, 0 };
+    ghash_update(&y, &table, aad, aad_len);
+    ghash_update(&y, &table, ct, ct_len);
+    y.hi ^= (uint64_t)aad_len * 8;
+    y.lo ^= (uint64_t)ct_len * 8;
+    gf128_mul(&y, &table);
+
+    uint8_t counter[16];
+    uint8_t ek[16];
+    memcpy(counter, iv, 12);
+    store_be32(counter + 12, 1);
+    dpi_aes128_encrypt(ctx, counter, ek);
+
+    uint8_t expected[16];
+    store_be32(expected,      (uint32_t)(y.hi >> 32));
+    store_be32(expected + 4,  (uint32_t)y.hi);
+    store_be32(expected + 8,  (uint32_t)(y.lo >> 32));
+    store_be32(expected + 12, (uint32_t)y.lo);
+
+    uint8_t diff = 0;
+    for (int i = 0; i < 16; i++)
+        diff |= (uint8_t)(expected[i] ^ ek[i] ^ tag[i]);
+    if (diff)
+        return -1;
+
+    for (int off = 0; off < ct_len; off += 16) {
+        store_be32(counter + 12, (uint32_t)(off / 16 + 2));
+        dpi_aes128_encrypt(ctx, counter, ek);
+        int take = ct_len - off < 16 ? ct_len - off : 16;
+        for (int i = 0; i < take; i++)
+            pt[off + i] = ct[off + i] ^ ek[i];
+    }
+    return 0;
+}
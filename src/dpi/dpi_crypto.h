@@ -0,0 +1,58 @@
+/*
+ * dpi_crypto.h — Minimal crypto for QUIC Initial packets (internal)
+ *
+ * SHA-256 / HMAC / HKDF (RFC 5869, TLS 1.3 labels) and AES-128 with
+ * GCM decryption — just what RFC 9001 §5 needs to open client Initials.
+ * Not constant-time: Initial keys are public by design.
+ */
+
+#ifndef DPI_CRYPTO_H
+#define DPI_CRYPTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DPI_SHA256_LEN 32
+
+void dpi_sha256(const uint8_t *data, size_t len, uint8_t out[DPI_SHA256_LEN]);
+
+void dpi_hmac_sha256(const uint8_t *key, size_t key_len,
+                     const uint8_t *data, size_t len,
+                     uint8_t out[DPI_SHA256_LEN]);
+
+void dpi_hkdf_extract(const uint8_t *salt, size_t salt_len,
+                      const uint8_t *ikm, size_t ikm_len,
+                      uint8_t prk[DPI_SHA256_LEN]);
+
+/*
+ * HKDF-Expand-Label (RFC 8446 §7.1) with an empty context.
+ * out_len must not exceed 255 bytes.
+ */
+void dpi_hkdf_expand_label(const uint8_t prk[DPI_SHA256_LEN], const char *label,
+                           uint8_t *out, int out_len);
+
+typedef struct {
+    uint32_t rk[44];
+} dpi_aes128_t;
+
+void dpi_aes128_init(dpi_aes128_t *ctx, const uint8_t key[16]);
+void dpi_aes128_encrypt(const dpi_aes128_t *ctx, const uint8_t in[16], uint8_t out[16]);
+
+/*
+ * AES-128-GCM decryption with a 96-bit IV and 128-bit tag.
+ * pt may alias ct. Returns 0 if the tag verifies, -1 otherwise.
+ */
+int dpi_aes128_gcm_decrypt(const dpi_aes128_t *ctx, const uint8_t iv[12],
+                           const uint8_t *aad, int aad_len,
+                           const uint8_t *ct, int ct_len,
+                           const uint8_t tag[16], uint8_t *pt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DPI_CRYPTO_H */
@@ -0,0 +1,218 @@
+/*
+ * dpi_hostlist.c — Domain set for hostlist / hostlist-exclude matching
+ *
+ * Names are stored lowercase in one arena and indexed by an
+ * open-addressing hash table (FNV-1a, linear probing). A lookup walks
+ * the host and its parent domains, one probe sequence per label.
+ */
+
+#include "dpi_bypass.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOSTLIST_MIN_SLOTS 64
+#define HOSTLIST_MAX_NAME  253
+
+static inline char lower_ascii(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+}
+
+static uint32_t hash_name(const char *s, int len)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (uint8_t)lower_ascii(s[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool name_equal(const char *stored, const char *s, int len)
+{
+    for (int i = 0; i < len; i++) {
+        if (stored[i] != lower_ascii(s[i]))
+            return false;
+    }
+    return stored[len] == '\0';
+}
+
+/* Returns the slot holding name, or the empty slot where it would go */
+static uint32_t find_slot(const dpi_hostlist_t *hl, const char *name, int len)
+{
+    uint32_t i = hash_name(name, len) & hl->mask;
+
+    for (;;) {
+        uint32_t idx = hl->slots[i];
+        if (idx == 0 || name_equal(hl->arena + hl->offsets[idx - 1], name, len))
+            return i;
+        i = (i + 1) & hl->mask;
+    }
+}
+
+static int grow_slots(dpi_hostlist_t *hl)
+{
+    uint32_t new_size = hl->slots ? (hl->mask + 1) * 2 : HOSTLIST_MIN_SLOTS;
+    uint32_t *new_slots = calloc(new_size, sizeof(uint32_t));
+    if (!new_slots)
+        return -1;
+
+    uint32_t *old_slots = hl->slots;
+    uint32_t old_size = old_slots ? hl->mask + 1 : 0;
+
+    hl->slots = new_slots;
+    hl->mask = new_size - 1;
+
+    for (uint32_t i = 0; i < old_size; i++) {
+        uint32_t idx = old_slots[i];
+        if (idx == 0)
+            continue;
+        const char *name = hl->arena + hl->offsets[idx - 1];
+        hl->slots[find_slot(hl, name, (int)strlen(name))] = idx;
+    }
+
+    free(old_slots);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                         */
+/* ------------------------------------------------------------------ */
+
+void dpi_hostlist_init(dpi_hostlist_t *hl)
+{
+    memset(hl, 0, sizeof(*hl));
+}
+
+void dpi_hostlist_free(dpi_hostlist_t *hl)
+{
+    free(hl->slots);
+    free(hl->arena);
+    free(hl->offsets);
+    memset(hl, 0, sizeof(*hl));
+}
+
+int dpi_hostlist_add(dpi_hostlist_t *hl, const char *name, int len)
+{
+    /* Tolerate "*.example.com", ".example.com" and a trailing dot */
+    if (len >= 2 && name[0] == '*' && name[1] == '.') {
+        name += 2;
+        len -= 2;
+    }
+    while (len > 0 && name[0] == '.') {
+        name++;
+        len--;
+    }
+    while (len > 0 && name[len - 1] == '.')
+        len--;
+    if (len <= 0 || len > HOSTLIST_MAX_NAME)
+        return -1;
+
+    /* Keep the load factor under 1/2 */
+    if (!hl->slots || (hl->count + 1) * 2 > hl->mask + 1) {
+        if (grow_slots(hl) < 0)
+            return -1;
+    }
+
+    uint32_t slot = find_slot(hl, name, len);
+    if (hl->slots[slot] != 0)
+        return 0; /* duplicate */
+
+    if (hl->arena_used + (uint32_t)len + 1 > hl->arena_cap) {
+        uint32_t cap = hl->arena_cap ? hl->arena_cap * 2 : 4096;
+        while (cap < hl->arena_used + (uint32_t)len + 1)
+            cap *= 2;
+        char *arena = realloc(hl->arena, cap);
+        if (!arena)
+            return -1;
+        hl->arena = arena;
+        hl->arena_cap = cap;
+    }
+    if (hl->count == hl->offsets_cap) {
+        uint32_t cap = hl->offsets_cap ? hl->offsets_cap * 2 : 256;
+        uint32_t *offsets = realloc(hl->offsets, cap * sizeof(uint32_t));
+        if (!offsets)
+            return -1;
+        hl->offsets = offsets;
+        hl->offsets_cap = cap;
+    }
+
+    char *dst = hl->arena + hl->arena_used;
+    for (int i = 0; i < len; i++)
+        dst[i] = lower_ascii(name[i]);
+    dst[len] = '\0';
+
+    hl->offsets[hl->count] = hl->arena_used;
+    hl->arena_used += (uint32_t)len + 1;
+    hl->count++;
+    hl->slots[slot] = hl->count;
+    return 0;
+}
+
+int dpi_hostlist_load_file(dpi_hostlist_t *hl, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    char line[512];
+    int added = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\0')
+            continue;
+
+        int len = 0;
+        while (p[len] && p[len] != '\r' && p[len] != '\n' &&
+               p[len] != ' ' && p[len] != '\t' && p[len] != '#')
+            len++;
+        if (len == 0)
+            continue;
+
+        uint32_t before = hl->count;
+        if (dpi_hostlist_add(hl, p, len) == 0 && hl->count != before)
+            added++;
+    }
+
+    fclose(f);
+    return added;
+}
+
+bool dpi_hostlist_match(const dpi_hostlist_t *hl, const char *host, int len)
+{
+    if (!hl->slots || len <= 0)
+        return false;
+
+    while (len > 0 && host[len - 1] == '.')
+        len--;
+
+    /* host, then each parent domain: a.b.c -> b.c -> c */
+    while (len > 0) {
+        uint32_t slot = find_slot(hl, host, len);
+        if (hl->slots[slot] != 0)
+            return true;
+
+        const char *dot = memchr(host, '.', len);
+        if (!dot)
+            break;
+        len -= (int)(dot + 1 - host);
+        host = dot + 1;
+    }
+    return false;
+}
+
+bool dpi_hostlist_allows(const dpi_hostlist_t *include, const dpi_hostlist_t *exclude,
+                         const char *host, int len)
+{
+    if (!host || len <= 0)
+        return include == NULL;
+    if (exclude && dpi_hostlist_match(exclude, host, len))
+        return false;
+    if (include && !dpi_hostlist_match(include, host, len))
+        return false;
+    return true;
+}
@@ -0,0 +1,343 @@
+/*
+ * dpi_quic.c — QUIC client Initial decryption and CRYPTO reassembly
+ *
+ * Derives the Initial secrets from the client's Destination Connection
+ * ID (RFC 9001 §5.2, QUIC v2: RFC 9369 §3.3), removes header protection,
+ * opens the AES-128-GCM payload and collects CRYPTO frames so the TLS
+ * ClientHello can be located with dpi_tls_parse_handshake().
+ */
+
+#include "dpi_bypass.h"
+#include "dpi_crypto.h"
+#include <string.h>
+
+#define QUIC_VERSION_1 0x00000001
+#define QUIC_VERSION_2 0x6b3343cf
+
+#define QUIC_FRAME_PADDING      0x00
+#define QUIC_FRAME_PING         0x01
+#define QUIC_FRAME_ACK          0x02
+#define QUIC_FRAME_ACK_ECN      0x03
+#define QUIC_FRAME_CRYPTO       0x06
+#define QUIC_FRAME_CLOSE        0x1c
+
+#define QUIC_TAG_LEN     16
+#define QUIC_SAMPLE_LEN  16
+
+static const uint8_t g_salt_v1[20] = {
+    0x38, 0x76, 0x2c, 0xf7, 0xf5, 0x59, 0x34, 0xb3, 0x4d, 0x17,
+    0x9a, 0xe6, 0xa4, 0xc8, 0x0c, 0xad, 0xcc, 0xbb, 0x7f, 0x0a
+};
+
+static const uint8_t g_salt_v2[20] = {
+    0x0d, 0xed, 0xe3, 0xde, 0xf7, 0x00, 0xa6, 0xdb, 0x81, 0x93,
+    0x81, 0xbe, 0x6e, 0x26, 0x9d, 0xcb, 0xf9, 0xbd, 0x2e, 0xd9
+};
+
+static inline uint32_t read_u32_be(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* RFC 9000 §16 variable-length integer; returns bytes consumed or -1 */
+static int read_varint(const uint8_t *p, int len, uint64_t *out)
+{
+    if (len < 1)
+        return -1;
+    int n = 1 << (p[0] >> 6);
+    if (len < n)
+        return -1;
+    uint64_t v = p[0] & 0x3f;
+    for (int i = 1; i < n; i++)
+        v = (v << 8) | p[i];
+    *out = v;
+    return n;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Long header                                                        */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    uint32_t version;
+    const uint8_t *dcid;
+    int dcid_len;
+    int pn_offset;      /* start of the protected packet number */
+    int end;            /* end of this packet (coalesced packets follow) */
+} quic_initial_hdr_t;
+
+static bool is_initial_type(uint8_t first, uint32_t version)
+{
+    int type = (first >> 4) & 0x03;
+    return version == QUIC_VERSION_2 ? type == 0x01 : type == 0x00;
+}
+
+static int parse_initial_header(const uint8_t *p, int len, quic_initial_hdr_t *h)
+{
+    if (len < 7 || (p[0] & 0xC0) != 0xC0)
+        return -1;
+
+    h->version = read_u32_be(p + 1);
+    if (h->version != QUIC_VERSION_1 && h->version != QUIC_VERSION_2)
+        return -1;
+    if (!is_initial_type(p[0], h->version))
+        return -1;
+
+    int pos = 5;
+    h->dcid_len = p[pos++];
+    if (h->dcid_len > DPI_QUIC_MAX_CID || pos + h->dcid_len + 1 > len)
+        return -1;
+    h->dcid = p + pos;
+    pos += h->dcid_len;
+
+    int scid_len = p[pos++];
+    if (scid_len > DPI_QUIC_MAX_CID || pos + scid_len > len)
+        return -1;
+    pos += scid_len;
+
+    uint64_t token_len, length;
+    int n = read_varint(p + pos, len - pos, &token_len);
+    if (n < 0 || token_len > (uint64_t)(len - pos - n))
+        return -1;
+    pos += n + (int)token_len;
+
+    n = read_varint(p + pos, len - pos, &length);
+    if (n < 0 || length > (uint64_t)(len - pos - n))
+        return -1;
+    pos += n;
+
+    h->pn_offset = pos;
+    h->end = pos + (int)length;
+
+    /* Header protection samples 16 bytes at pn_offset + 4 */
+    if (h->pn_offset + 4 + QUIC_SAMPLE_LEN > h->end)
+        return -1;
+    return 0;
+}
+
+bool dpi_quic_initial_dcid(const uint8_t *payload, int len,
+                           const uint8_t **dcid, int *dcid_len)
+{
+    quic_initial_hdr_t h;
+    if (parse_initial_header(payload, len, &h) < 0)
+        return false;
+    *dcid = h.dcid;
+    *dcid_len = h.dcid_len;
+    return true;
+}
+
+int dpi_quic_initial_len(const uint8_t *payload, int len)
+{
+    quic_initial_hdr_t h;
+    if (parse_initial_header(payload, len, &h) < 0)
+        return -1;
+    return h.end;
+}
+
+bool dpi_quic_past_initial(const uint8_t *payload, int len)
+{
+    if (len < 1)
+        return false;
+
+    /* Short header: fixed bit set, long header bit clear */
+    if ((payload[0] & 0xC0) == 0x40)
+        return true;
+
+    if (len < 5 || (payload[0] & 0xC0) != 0xC0)
+        return false;
+    uint32_t version = read_u32_be(payload + 1);
+    int type = (payload[0] >> 4) & 0x03;
+    return (version == QUIC_VERSION_1 && type == 0x02) ||
+           (version == QUIC_VERSION_2 && type == 0x03);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Keys                                                               */
+/* ------------------------------------------------------------------ */
+
+static void derive_client_keys(dpi_quic_crypto_t *qc)
+{
+    bool v2 = qc->version == QUIC_VERSION_2;
+    uint8_t initial[DPI_SHA256_LEN];
+    uint8_t client[DPI_SHA256_LEN];
+
+    dpi_hkdf_extract(v2 ? g_salt_v2 : g_salt_v1, 20, qc->dcid, qc->dcid_len, initial);
+    dpi_hkdf_expand_label(initial, "client in", client, sizeof(client));
+    dpi_hkdf_expand_label(client, v2 ? "quicv2 key" : "quic key", qc->key, sizeof(qc->key));
+    dpi_hkdf_expand_label(client, v2 ? "quicv2 iv" : "quic iv", qc->iv, sizeof(qc->iv));
+    dpi_hkdf_expand_label(client, v2 ? "quicv2 hp" : "quic hp", qc->hp, sizeof(qc->hp));
+    qc->keyed = true;
+}
+
+/* ------------------------------------------------------------------ */
+/*  CRYPTO stream reassembly                                           */
+/* ------------------------------------------------------------------ */
+
+static void crypto_store(dpi_quic_crypto_t *qc, uint64_t offset,
+                         const uint8_t *data, int len)
+{
+    if (offset >= DPI_QUIC_CRYPTO_MAX)
+        return;
+    if (offset + (uint64_t)len > DPI_QUIC_CRYPTO_MAX)
+        len = DPI_QUIC_CRYPTO_MAX - (int)offset;
+
+    int off = (int)offset;
+    memcpy(qc->data + off, data, len);
+    for (int i = off; i < off + len; i++)
+        qc->have[i >> 3] |= (uint8_t)(1u << (i & 7));
+
+    while (qc->contiguous < DPI_QUIC_CRYPTO_MAX &&
+           (qc->have[qc->contiguous >> 3] & (1u << (qc->contiguous & 7))))
+        qc->contiguous++;
+}
+
+/* Walk Initial frames; only CRYPTO carries data we need */
+static int parse_frames(dpi_quic_crypto_t *qc, const uint8_t *p, int len)
+{
+    int pos = 0;
+
+    while (pos < len) {
+        uint64_t type, a, b, count;
+        int n = read_varint(p + pos, len - pos, &type);
+        if (n < 0)
+            return -1;
+        pos += n;
+
+        switch (type) {
+        case QUIC_FRAME_PADDING:
+        case QUIC_FRAME_PING:
+            break;
+
+        case QUIC_FRAME_CRYPTO:
+            n = read_varint(p + pos, len - pos, &a);     /* offset */
+            if (n < 0)
+                return -1;
+            pos += n;
+            n = read_varint(p + pos, len - pos, &b);     /* length */
+            if (n < 0 || b > (uint64_t)(len - pos - n))
+                return -1;
+            pos += n;
+            crypto_store(qc, a, p + pos, (int)b);
+            pos += (int)b;
+            break;
+
+        case QUIC_FRAME_ACK:
+        case QUIC_FRAME_ACK_ECN:
+            /* largest, delay, range count, first range, ranges... */
+            for (int i = 0; i < 4; i++) {
+                n = read_varint(p + pos, len - pos, i == 2 ? &count : &a);
+                if (n < 0)
+                    return -1;
+                pos += n;
+            }
+            if (count > (uint64_t)len)
+                return -1;
+            for (uint64_t i = 0; i < count * 2 + (type == QUIC_FRAME_ACK_ECN ? 3 : 0); i++) {
+                n = read_varint(p + pos, len - pos, &a);
+                if (n < 0)
+                    return -1;
+                pos += n;
+            }
+            break;
+
+        case QUIC_FRAME_CLOSE:
+            /* error code, frame type, reason length, reason */
+            for (int i = 0; i < 3; i++) {
+                n = read_varint(p + pos, len - pos, &a);
+                if (n < 0)
+                    return -1;
+                pos += n;
+            }
+            if (a > (uint64_t)(len - pos))
+                return -1;
+            pos += (int)a;
+            break;
+
+        default:
+            return -1;  /* not allowed in Initial packets */
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                         */
+/* ------------------------------------------------------------------ */
+
+void dpi_quic_crypto_init(dpi_quic_crypto_t *qc)
+{
+    qc->version = 0;
+    qc->dcid_len = 0;
+    qc->keyed = false;
+    qc->contiguous = 0;
+    memset(qc->have, 0, sizeof(qc->have));
+}
+
+int dpi_quic_crypto_add(dpi_quic_crypto_t *qc, const uint8_t *payload, int len)
+{
+    quic_initial_hdr_t h;
+    if (parse_initial_header(payload, len, &h) < 0)
+        return -1;
+
+    int packet_len = h.end;
+    if (packet_len > DPI_QUIC_MAX_INITIAL)
+        return -1;
+
+    if (!qc->keyed) {
+        qc->version = h.version;
+        qc->dcid_len = h.dcid_len;
+        memcpy(qc->dcid, h.dcid, h.dcid_len);
+        derive_client_keys(qc);
+    } else if (h.version != qc->version || h.dcid_len != qc->dcid_len ||
+               memcmp(h.dcid, qc->dcid, h.dcid_len) != 0) {
+        return -1;  /* a different connection */
+    }
+
+    /* Remove header protection (RFC 9001 §5.4) */
+    dpi_aes128_t aes;
+    uint8_t mask[16];
+    dpi_aes128_init(&aes, qc->hp);
+    dpi_aes128_encrypt(&aes, payload + h.pn_offset + 4, mask);
+
+    uint8_t pkt[DPI_QUIC_MAX_INITIAL];
+    memcpy(pkt, payload, h.pn_offset + 4);
+    pkt[0] ^= mask[0] & 0x0f;
+
+    int pn_len = (pkt[0] & 0x03) + 1;
+    uint64_t pn = 0;
+    for (int i = 0; i < pn_len; i++) {
+        pkt[h.pn_offset + i] ^= mask[1 + i];
+        pn = (pn << 8) | pkt[h.pn_offset + i];
+    }
+
+    int hdr_len = h.pn_offset + pn_len;
+    int ct_len = h.end - hdr_len - QUIC_TAG_LEN;
+    if (ct_len <= 0)
+        return -1;
+
+    /* Nonce = IV xor packet number (right-aligned) */
+    uint8_t nonce[12];
+    memcpy(nonce, qc->iv, sizeof(nonce));
+    for (int i = 0; i < 8; i++)
+        nonce[11 - i] ^= (uint8_t)(pn >> (8 * i));
+
+    dpi_aes128_init(&aes, qc->key);
+    uint8_t *plain = pkt + hdr_len;
+    if (dpi_aes128_gcm_decrypt(&aes, nonce, pkt, hdr_len,
+                               payload + hdr_len, ct_len,
+                               payload + hdr_len + ct_len, plain) < 0)
+        return -1;
+
+    return parse_frames(qc, plain, ct_len);
+}
+
+int dpi_quic_crypto_hello(const dpi_quic_crypto_t *qc, dpi_tls_hello_t *out)
+{
+    int ret = dpi_tls_parse_handshake(qc->data, qc->contiguous, out);
+
+    /* Without a record layer the hello is complete only at hello_len */
+    if (ret == DPI_TLS_OK && out->host_off < 0 && qc->contiguous < out->hello_len)
+        return DPI_TLS_INCOMPLETE;
+    return ret;
+}
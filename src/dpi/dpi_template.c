@@ -0,0 +1,236 @@
+/*
+ * dpi_template.c — Per-flow IP + TCP/UDP header templates
+ *
+ * A relay session always sends towards the app with the same addresses,
+ * ports, protocol and TTL. The template holds that header prebuilt, with
+ * the constant part of the IPv4 header sum and of the L4 pseudo-header
+ * sum precomputed, so each packet only writes the varying fields
+ * (length, seq, ack, flags, window) and sums the payload.
+ */
+
+#include "dpi_bypass.h"
+#include <string.h>
+
+#define IPV4_MIN_HEADER   20
+#define IPV6_HEADER       40
+#define TCP_MIN_HEADER    20
+#define UDP_HEADER_LEN     8
+
+#define IPPROTO_TCP_CONST  6
+#define IPPROTO_UDP_CONST 17
+
+static inline void write_u16_be(uint8_t *p, uint16_t val)
+{
+    p[0] = (uint8_t)(val >> 8);
+    p[1] = (uint8_t)(val & 0xFF);
+}
+
+static inline void write_u32_be(uint8_t *p, uint32_t val)
+{
+    p[0] = (uint8_t)(val >> 24);
+    p[1] = (uint8_t)(val >> 16);
+    p[2] = (uint8_t)(val >> 8);
+    p[3] = (uint8_t)(val & 0xFF);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Template setup                                                     */
+/* ------------------------------------------------------------------ */
+
+/* Fixed IP header with zero length/checksum; returns its length */
+static int template_ip_header(dpi_hdr_template_t *t,
+                              const dpi_addr_t *src, const dpi_addr_t *dst,
+                              uint8_t protocol)
+{
+    memset(t, 0, sizeof(*t));
+    t->protocol = protocol;
+
+    if (dpi_addr_is_ipv4(src)) {
+        t->hdr[0] = 0x45;                   /* version=4, IHL=5 */
+        t->hdr[8] = 64;                     /* TTL */
+        t->hdr[9] = protocol;
+        write_u32_be(t->hdr + 12, dpi_addr_to_ipv4(src));
+        write_u32_be(t->hdr + 16, dpi_addr_to_ipv4(dst));
+        t->ip_sum = dpi_checksum_add(0, t->hdr, IPV4_MIN_HEADER);
+
+        /* Pseudo-header addresses are the header's last 8 bytes */
+        t->l4_sum = dpi_checksum_add(protocol, t->hdr + 12, 8);
+        t->ip_len = IPV4_MIN_HEADER;
+    } else {
+        write_u32_be(t->hdr, 0x60000000);   /* version=6, TC=0, flow label=0 */
+        t->hdr[6] = protocol;
+        t->hdr[7] = 64;                     /* hop limit */
+        memcpy(t->hdr + 8,  src->b, 16);
+        memcpy(t->hdr + 24, dst->b, 16);
+
+        t->l4_sum = dpi_checksum_add(protocol, t->hdr + 8, 32);
+        t->ip_len = IPV6_HEADER;
+    }
+    return t->ip_len;
+}
+
+void dpi_template_init_tcp(dpi_hdr_template_t *t,
+                           const dpi_addr_t *src, const dpi_addr_t *dst,
+                           uint16_t src_port, uint16_t dst_port)
+{
+    uint8_t *tcp = t->hdr + template_ip_header(t, src, dst, IPPROTO_TCP_CONST);
+
+    write_u16_be(tcp + 0, src_port);
+    write_u16_be(tcp + 2, dst_port);
+    tcp[12] = (TCP_MIN_HEADER / 4) << 4;   /* data offset */
+
+    /* Ports and data offset; seq/ack/flags/window are added per packet */
+    t->l4_sum += (uint32_t)src_port + dst_port;
+    t->hdr_len = (uint8_t)(t->ip_len + TCP_MIN_HEADER);
+}
+
+void dpi_template_init_udp(dpi_hdr_template_t *t,
+                           const dpi_addr_t *src, const dpi_addr_t *dst,
+                           uint16_t src_port, uint16_t dst_port)
+{
+    uint8_t *udp = t->hdr + template_ip_header(t, src, dst, IPPROTO_UDP_CONST);
+
+    write_u16_be(udp + 0, src_port);
+    write_u16_be(udp + 2, dst_port);
+
+    t->l4_sum += (uint32_t)src_port + dst_port;
+    t->hdr_len = (uint8_t)(t->ip_len + UDP_HEADER_LEN);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Packet emission                                                    */
+/* ------------------------------------------------------------------ */
+
+/* Copy the template header to out, set the length fields; returns the L4 header */
+static uint8_t *template_emit(const dpi_hdr_template_t *t, uint8_t *out,
+                              int total, int l4_len)
+{
+    memcpy(out, t->hdr, t->hdr_len);
+
+    if (t->ip_len == IPV4_MIN_HEADER) {
+        write_u16_be(out + 2, (uint16_t)total);
+        write_u16_be(out + 10, dpi_checksum_fold(t->ip_sum + (uint32_t)total));
+    } else {
+        write_u16_be(out + 4, (uint16_t)l4_len);
+    }
+    return out + t->ip_len;
+}
+
+static bool template_len_ok(const dpi_hdr_template_t *t, int payload_len, int l4_len)
+{
+    return payload_len >= 0 && l4_len <= 0xFFFF &&
+           (t->ip_len != IPV4_MIN_HEADER || t->ip_len + l4_len <= 0xFFFF);
+}
+
+static inline void set_iov(struct iovec iov[2], uint8_t *hdr, int hdr_len,
+                           const uint8_t *payload, int payload_len)
+{
+    iov[0].iov_base = hdr;
+    iov[0].iov_len  = (size_t)hdr_len;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len  = payload_len > 0 ? (size_t)payload_len : 0;
+}
+
+int dpi_template_iov_tcp_opts(const dpi_hdr_template_t *t, uint8_t *hdr,
+                              uint32_t seq, uint32_t ack,
+                              uint8_t flags, uint16_t window,
+                              const uint8_t *opts, int opts_len,
+                              const uint8_t *payload, int payload_len,
+                              struct iovec iov[2])
+{
+    if (opts_len < 0 || opts_len > DPI_TCP_MAX_OPTIONS || (opts_len & 3))
+        return -1;
+
+    int tcp_hdr = TCP_MIN_HEADER + opts_len;
+    int tcp_len = tcp_hdr + payload_len;
+    int total   = t->ip_len + tcp_len;
+    if (!template_len_ok(t, payload_len, tcp_len))
+        return -1;
+
+    uint8_t *tcp = template_emit(t, hdr, total, tcp_len);
+    write_u32_be(tcp + 4, seq);
+    write_u32_be(tcp + 8, ack);
+    tcp[12] = (uint8_t)((tcp_hdr / 4) << 4);   /* data offset */
+    tcp[13] = flags;
+    write_u16_be(tcp + 14, window);
+
+    uint32_t sum = t->l4_sum + (uint32_t)tcp_len +
+                   (seq >> 16) + (seq & 0xFFFF) +
+                   (ack >> 16) + (ack & 0xFFFF) +
+                   (((uint32_t)tcp[12] << 8) | flags) + window;
+    if (opts_len > 0) {
+        memcpy(tcp + TCP_MIN_HEADER, opts, opts_len);
+        sum = dpi_checksum_add(sum, opts, opts_len);
+    }
+    sum = dpi_checksum_add(sum, payload, payload_len);
+    write_u16_be(tcp + 16, dpi_checksum_fold(sum));
+
+    if (iov)
+        set_iov(iov, hdr, t->hdr_len + opts_len, payload, payload_len);
+    return total;
+}
+
+int dpi_template_iov_tcp(const dpi_hdr_template_t *t, uint8_t *hdr,
+                         uint32_t seq, uint32_t ack,
+                         uint8_t flags, uint16_t window,
+                         const uint8_t *payload, int payload_len,
+                         struct iovec iov[2])
+{
+    return dpi_template_iov_tcp_opts(t, hdr, seq, ack, flags, window,
+                                     NULL, 0, payload, payload_len, iov);
+}
+
+int dpi_template_iov_udp(const dpi_hdr_template_t *t, uint8_t *hdr,
+                         const uint8_t *payload, int payload_len,
+                         struct iovec iov[2])
+{
+    int udp_len = UDP_HEADER_LEN + payload_len;
+    int total   = t->ip_len + udp_len;
+    if (!template_len_ok(t, payload_len, udp_len))
+        return -1;
+
+    uint8_t *udp = template_emit(t, hdr, total, udp_len);
+    write_u16_be(udp + 4, (uint16_t)udp_len);
+
+    /* Length appears in both the pseudo-header and the UDP header */
+    uint32_t sum = t->l4_sum + 2 * (uint32_t)udp_len;
+    sum = dpi_checksum_add(sum, payload, payload_len);
+    uint16_t cksum = dpi_checksum_fold(sum);
+    if (cksum == 0)
+        cksum = 0xFFFF; /* RFC 768: 0 means no checksum */
+    write_u16_be(udp + 6, cksum);
+
+    if (iov)
+        set_iov(iov, hdr, t->hdr_len, payload, payload_len);
+    return total;
+}
+
+/* Contiguous variants: payload placed behind the header unless already there */
+int dpi_template_build_tcp(const dpi_hdr_template_t *t, uint8_t *out, int out_size,
+                           uint32_t seq, uint32_t ack,
+                           uint8_t flags, uint16_t window,
+                           const uint8_t *payload, int payload_len)
+{
+    if (payload_len < 0 || out_size < t->hdr_len + payload_len)
+        return -1;
+
+    uint8_t *body = out + t->hdr_len;
+    if (payload_len > 0 && payload != body)
+        memcpy(body, payload, payload_len);
+
+    return dpi_template_iov_tcp(t, out, seq, ack, flags, window,
+                                body, payload_len, NULL);
+}
+
+int dpi_template_build_udp(const dpi_hdr_template_t *t, uint8_t *out, int out_size,
+                           const uint8_t *payload, int payload_len)
+{
+    if (payload_len < 0 || out_size < t->hdr_len + payload_len)
+        return -1;
+
+    uint8_t *body = out + t->hdr_len;
+    if (payload_len > 0 && payload != body)
+        memcpy(body, payload, payload_len);
+
+    return dpi_template_iov_udp(t, out, body, payload_len, NULL);
+}
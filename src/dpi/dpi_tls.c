@@ -0,0 +1,318 @@
+/*
+ * dpi_tls.c — Zero-copy TLS ClientHello locator and split markers
+ *
+ * Walks the ClientHello in place and reports offsets (never copies) of
+ * the extension block, SNI host name and ALPN list. Every read is
+ * bounds-checked against the available bytes.
+ */
+
+#include "dpi_bypass.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define TLS_RECORD_HEADER    5
+#define TLS_HANDSHAKE_HEADER 4
+#define TLS_CONTENT_HANDSHAKE 0x16
+#define TLS_HS_CLIENT_HELLO   0x01
+
+#define TLS_EXT_SERVER_NAME   0x0000
+#define TLS_EXT_ALPN          0x0010
+
+static inline uint16_t read_u16_be(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t read_u24_be(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+/* ------------------------------------------------------------------ */
+/*  Extension walk                                                     */
+/* ------------------------------------------------------------------ */
+
+static void parse_sni(const uint8_t *base, int off, int len, dpi_tls_hello_t *out)
+{
+    /* server_name_list: length(2) { type(1) length(2) name } */
+    if (len < 2)
+        return;
+    int list_len = read_u16_be(base + off);
+    int pos = off + 2;
+    int end = off + 2 + (list_len < len - 2 ? list_len : len - 2);
+
+    while (pos + 3 <= end) {
+        uint8_t name_type = base[pos];
+        int name_len = read_u16_be(base + pos + 1);
+        pos += 3;
+        if (pos + name_len > end)
+            return;
+        if (name_type == 0 && name_len > 0) {
+            out->host_off = pos;
+            out->host_len = name_len;
+            return;
+        }
+        pos += name_len;
+    }
+}
+
+static void parse_extensions(const uint8_t *base, int off, int end, dpi_tls_hello_t *out)
+{
+    int pos = off;
+
+    while (pos + 4 <= end) {
+        uint16_t type = read_u16_be(base + pos);
+        int ext_len = read_u16_be(base + pos + 2);
+        int data = pos + 4;
+        int avail = end - data;
+        int usable = ext_len < avail ? ext_len : avail;
+
+        if (type == TLS_EXT_SERVER_NAME) {
+            out->sni_ext_off = pos;
+            parse_sni(base, data, usable, out);
+        } else if (type == TLS_EXT_ALPN && usable >= 2) {
+            int list_len = read_u16_be(base + data);
+            if (list_len <= usable - 2) {
+                out->alpn_off = data + 2;
+                out->alpn_len = list_len;
+            }
+        }
+
+        if (ext_len > avail)
+            return; /* truncated — keep what was found */
+        pos = data + ext_len;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Handshake / record parsing                                         */
+/* ------------------------------------------------------------------ */
+
+static void hello_reset(dpi_tls_hello_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->ext_off     = -1;
+    out->sni_ext_off = -1;
+    out->host_off    = -1;
+    out->alpn_off    = -1;
+}
+
+/* Parse a ClientHello handshake message at base[off..limit) */
+static int parse_handshake_at(const uint8_t *base, int off, int limit,
+                              dpi_tls_hello_t *out)
+{
+    if (limit - off < TLS_HANDSHAKE_HEADER)
+        return DPI_TLS_INCOMPLETE;
+    if (base[off] != TLS_HS_CLIENT_HELLO)
+        return DPI_TLS_INVALID;
+
+    int body_len = (int)read_u24_be(base + off + 1);
+    out->hello_len = TLS_HANDSHAKE_HEADER + body_len;
+
+    int pos = off + TLS_HANDSHAKE_HEADER;
+    int end = pos + body_len;
+    if (end > limit)
+        end = limit; /* parse the part we have */
+
+    /* legacy_version(2) + random(32) */
+    pos += 34;
+    if (pos + 1 > end)
+        return DPI_TLS_INCOMPLETE;
+
+    /* legacy_session_id */
+    pos += 1 + base[pos];
+    if (pos + 2 > end)
+        return DPI_TLS_INCOMPLETE;
+
+    /* cipher_suites */
+    pos += 2 + read_u16_be(base + pos);
+    if (pos + 1 > end)
+        return DPI_TLS_INCOMPLETE;
+
+    /* legacy_compression_methods */
+    pos += 1 + base[pos];
+    if (pos > end)
+        return DPI_TLS_INCOMPLETE;
+    if (pos == off + out->hello_len)
+        return DPI_TLS_OK; /* no extensions */
+    if (pos + 2 > end)
+        return DPI_TLS_INCOMPLETE;
+
+    int ext_total = read_u16_be(base + pos);
+    pos += 2;
+    out->ext_off = pos;
+    out->ext_len = ext_total;
+
+    int ext_end = pos + ext_total;
+    parse_extensions(base, pos, ext_end < end ? ext_end : end, out);
+
+    if (off + out->hello_len > limit)
+        return out->host_off >= 0 ? DPI_TLS_OK : DPI_TLS_INCOMPLETE;
+    return DPI_TLS_OK;
+}
+
+int dpi_tls_parse_handshake(const uint8_t *data, int len, dpi_tls_hello_t *out)
+{
+    hello_reset(out);
+    return parse_handshake_at(data, 0, len, out);
+}
+
+int dpi_tls_parse_client_hello(const uint8_t *data, int len, dpi_tls_hello_t *out)
+{
+    hello_reset(out);
+
+    if (len < TLS_RECORD_HEADER)
+        return DPI_TLS_INCOMPLETE;
+    if (data[0] != TLS_CONTENT_HANDSHAKE || data[1] != 0x03)
+        return DPI_TLS_INVALID;
+
+    int rec_payload = read_u16_be(data + 3);
+    if (rec_payload == 0 || rec_payload > 16384 + 256)
+        return DPI_TLS_INVALID;
+
+    out->record_len = TLS_RECORD_HEADER + rec_payload;
+
+    /*
+     * Only the first record is parsed: a ClientHello fragmented across
+     * several records is located as far as the first one reaches.
+     */
+    int limit = len < out->record_len ? len : out->record_len;
+    int ret = parse_handshake_at(data, TLS_RECORD_HEADER, limit, out);
+
+    if (ret == DPI_TLS_OK && len < out->record_len && out->host_off < 0)
+        return DPI_TLS_INCOMPLETE;
+    if (ret == DPI_TLS_INCOMPLETE && len >= out->record_len)
+        return out->host_off >= 0 ? DPI_TLS_OK : DPI_TLS_INVALID;
+    return ret;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Split markers                                                      */
+/* ------------------------------------------------------------------ */
+
+static const struct {
+    const char *name;
+    dpi_split_base_t base;
+} g_marker_names[] = {
+    { "host",    DPI_SPLIT_HOST    },
+    { "endhost", DPI_SPLIT_ENDHOST },
+    { "sld",     DPI_SPLIT_SLD     },
+    { "midsld",  DPI_SPLIT_MIDSLD  },
+    { "endsld",  DPI_SPLIT_ENDSLD  },
+    { "sniext",  DPI_SPLIT_SNIEXT  },
+};
+
+static int parse_one_marker(const char *s, int n, dpi_split_marker_t *m)
+{
+    char buf[32];
+    if (n <= 0 || n >= (int)sizeof(buf))
+        return -1;
+    memcpy(buf, s, n);
+    buf[n] = '\0';
+
+    char *end;
+    long val = strtol(buf, &end, 10);
+    if (end != buf && *end == '\0') {
+        if (val < 0 || val > 0xFFFF)
+            return -1;
+        m->base   = DPI_SPLIT_ABS;
+        m->offset = (int)val;
+        return 0;
+    }
+
+    /* name[+N|-N] */
+    int name_len = 0;
+    while (name_len < n && buf[name_len] != '+' && buf[name_len] != '-')
+        name_len++;
+
+    for (size_t i = 0; i < sizeof(g_marker_names) / sizeof(g_marker_names[0]); i++) {
+        if ((int)strlen(g_marker_names[i].name) == name_len &&
+            memcmp(g_marker_names[i].name, buf, name_len) == 0) {
+            m->base   = g_marker_names[i].base;
+            m->offset = 0;
+            if (name_len < n) {
+                val = strtol(buf + name_len, &end, 10);
+                if (*end != '\0' || val < -1024 || val > 1024)
+                    return -1;
+                m->offset = (int)val;
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int dpi_split_markers_parse(const char *spec, dpi_split_marker_t *out, int max)
+{
+    int count = 0;
+    const char *p = spec;
+
+    while (p && *p) {
+        const char *comma = strchr(p, ',');
+        int n = comma ? (int)(comma - p) : (int)strlen(p);
+        if (count >= max || parse_one_marker(p, n, &out[count]) < 0)
+            return -1;
+        count++;
+        p = comma ? comma + 1 : NULL;
+    }
+    return count;
+}
+
+/* Locate the second-level label of the SNI host: [*sld_off, *sld_end) */
+static void find_sld(const uint8_t *data, const dpi_tls_hello_t *h,
+                     int *sld_off, int *sld_end)
+{
+    const uint8_t *host = data + h->host_off;
+    int end = h->host_len;
+    if (end > 0 && host[end - 1] == '.')
+        end--; /* FQDN trailing dot */
+
+    int last_dot = -1, prev_dot = -1;
+    for (int i = 0; i < end; i++) {
+        if (host[i] == '.') {
+            prev_dot = last_dot;
+            last_dot = i;
+        }
+    }
+
+    if (last_dot < 0) {
+        *sld_off = 0;              /* single label */
+        *sld_end = end;
+    } else {
+        *sld_off = prev_dot + 1;
+        *sld_end = last_dot;
+    }
+    *sld_off += h->host_off;
+    *sld_end += h->host_off;
+}
+
+int dpi_split_marker_resolve(const dpi_split_marker_t *m, const uint8_t *data,
+                             int data_len, const dpi_tls_hello_t *h)
+{
+    int pos;
+
+    if (m->base == DPI_SPLIT_ABS) {
+        pos = m->offset;
+    } else if (!h || (m->base == DPI_SPLIT_SNIEXT ? h->sni_ext_off < 0 : h->host_off < 0)) {
+        return -1;
+    } else {
+        int sld_off, sld_end;
+        switch (m->base) {
+        case DPI_SPLIT_HOST:    pos = h->host_off; break;
+        case DPI_SPLIT_ENDHOST: pos = h->host_off + h->host_len; break;
+        case DPI_SPLIT_SNIEXT:  pos = h->sni_ext_off; break;
+        default:
+            find_sld(data, h, &sld_off, &sld_end);
+            if (m->base == DPI_SPLIT_SLD)
+                pos = sld_off;
+            else if (m->base == DPI_SPLIT_ENDSLD)
+                pos = sld_end;
+            else
+                pos = sld_off + (sld_end - sld_off) / 2;
+            break;
+        }
+        pos += m->offset;
+    }
+
+    return (pos > 0 && pos < data_len) ? pos : -1;
+}
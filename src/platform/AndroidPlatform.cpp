@@ -1,6 +1,7 @@
 #include "AndroidPlatform.h"
 #include <QCoreApplication>
 #include <QDir>
+#include <QSettings>
 
 #ifdef Q_OS_ANDROID
 #include <QJniObject>
@@ -46,9 +47,25 @@ bool AndroidPlatform::setupFirewall(const Strategy &strategy)
     // Extract strategy parameters for the VPN processor
     int fakeTtl = 3;
     int fakeRepeats = 6;
+    int fakeBursts = 0;          // 0 = native default (one burst per QUIC attempt)
     QString fakeQuicPath;
+    QString quicHostlistPath;
+    QString quicHostlistExcludePath;
     int splitPos = 1;
+    QString splitMarkers;
     bool useDisorder = false;
+    QString hostlistPath;
+    QString hostlistExcludePath;
+
+    // Relay tuning, not part of a strategy: from the app settings (0 = native defaults)
+    QSettings settings("ZapretGui", "Zapret");
+    bool deferSynAck = settings.value("android/deferSynAck", true).toBool();
+    int maxTcpSessions = settings.value("android/maxTcpSessions", 0).toInt();
+    int maxUdpSessions = settings.value("android/maxUdpSessions", 0).toInt();
+
+    auto listPath = [this](const QString &name) {
+        return QDir::isAbsolutePath(name) ? name : listsDir() + "/" + name;
+    };
 
     for (const auto &filter : strategy.filters) {
         if (filter.protocol == "udp") {
@@ -56,15 +73,33 @@ bool AndroidPlatform::setupFirewall(const Strategy &strategy)
             if (!filter.fakeQuic.isEmpty()) {
                 QString dataDir = QCoreApplication::applicationDirPath() + "/../files/fake";
                 fakeQuicPath = dataDir + "/" + filter.fakeQuic;
+                quicHostlistPath = filter.hostlist.isEmpty()
+                    ? QString() : listPath(filter.hostlist);
+                quicHostlistExcludePath = filter.hostlistExclude.isEmpty()
+                    ? QString() : listPath(filter.hostlistExclude);
             }
             if (filter.desyncRepeats > 0)
                 fakeRepeats = filter.desyncRepeats;
+            // --dpi-desync-cutoff=nN: fakes for the first N client packets,
+            // i.e. up to N fake bursts per connection attempt
+            if (filter.desyncCutoff.startsWith('n')) {
+                bool ok = false;
+                int packets = filter.desyncCutoff.mid(1).toInt(&ok);
+                if (ok && packets > 0)
+                    fakeBursts = packets;
+            }
         } else if (filter.protocol == "tcp") {
             // TCP filter → extract split/disorder params
             if (filter.splitPos > 0)
                 splitPos = filter.splitPos;
+            if (!filter.splitPosStr.isEmpty())
+                splitMarkers = filter.splitPosStr;
             if (filter.desyncMethod.contains("disorder"))
                 useDisorder = true;
+            if (!filter.hostlist.isEmpty())
+                hostlistPath = listPath(filter.hostlist);
+            if (!filter.hostlistExclude.isEmpty())
+                hostlistExcludePath = listPath(filter.hostlistExclude);
         }
     }
 
@@ -77,17 +112,32 @@ bool AndroidPlatform::setupFirewall(const Strategy &strategy)
 
     // Start VPN service with strategy config
     QJniObject fakePathJni = QJniObject::fromString(fakeQuicPath);
+    QJniObject quicHostlistJni = QJniObject::fromString(quicHostlistPath);
+    QJniObject quicHostlistExcludeJni = QJniObject::fromString(quicHostlistExcludePath);
+    QJniObject splitMarkersJni = QJniObject::fromString(splitMarkers);
+    QJniObject hostlistJni = QJniObject::fromString(hostlistPath);
+    QJniObject hostlistExcludeJni = QJniObject::fromString(hostlistExcludePath);
 
     QJniObject::callStaticMethod<void>(
         "com/zapretgui/ZapretVpnService",
         "start",
-        "(Landroid/content/Context;IILjava/lang/String;IZ)V",
+        "(Landroid/content/Context;IIILjava/lang/String;Ljava/lang/String;Ljava/lang/String;"
+        "ILjava/lang/String;ZZLjava/lang/String;Ljava/lang/String;II)V",
         activity.object(),
         (jint)fakeTtl,
         (jint)fakeRepeats,
+        (jint)fakeBursts,
         fakePathJni.object<jstring>(),
+        quicHostlistJni.object<jstring>(),
+        quicHostlistExcludeJni.object<jstring>(),
         (jint)splitPos,
-        (jboolean)useDisorder);
+        splitMarkersJni.object<jstring>(),
+        (jboolean)useDisorder,
+        (jboolean)deferSynAck,
+        hostlistJni.object<jstring>(),
+        hostlistExcludeJni.object<jstring>(),
+        (jint)maxTcpSessions,
+        (jint)maxUdpSessions);
 #else
     Q_UNUSED(strategy);
 #endif
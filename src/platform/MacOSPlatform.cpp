@@ -241,6 +241,12 @@ QStringList MacOSPlatform::buildUdpBypassArgs(const Strategy &strategy) const
             if (filter.desyncRepeats > 0)
                 args << "--repeats" << QString::number(filter.desyncRepeats);
 
+            // udp-bypass decrypts the Initial SNI and matches these itself
+            if (!filter.hostlist.isEmpty())
+                args << "--hostlist" << resolveFilePath(filter.hostlist);
+            if (!filter.hostlistExclude.isEmpty())
+                args << "--hostlist-exclude" << resolveFilePath(filter.hostlistExclude);
+
             break; // Use the first matching UDP filter
         }
     }
@@ -0,0 +1,182 @@
+/*
+ * checksum-bench — microbenchmark for the dpi_checksum kernels
+ *
+ * For every kernel the CPU supports, verifies the result against a
+ * reference RFC 1071 loop and reports throughput for 64 B, 1500 B and
+ * 64 KB buffers.
+ *
+ * Cycles are read from the TSC on x86. Elsewhere pass --ghz <F> with the
+ * core clock to convert time into bytes/cycle.
+ */
+
+#include "dpi_bypass.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define MAX_BUF_SIZE 65536
+#define TARGET_BYTES (512u * 1024u * 1024u)  /* per measurement */
+
+static const int g_sizes[] = { 64, 1500, 65536 };
+
+static const struct {
+    dpi_csum_impl_t impl;
+    const char *name;
+} g_impls[] = {
+    { DPI_CSUM_SCALAR, "scalar" },
+    { DPI_CSUM_SSE2,   "sse2"   },
+    { DPI_CSUM_AVX2,   "avx2"   },
+    { DPI_CSUM_NEON,   "neon"   },
+};
+
+static uint16_t reference_checksum(const uint8_t *data, int len)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i + 1 < len; i += 2)
+        sum += (uint32_t)((data[i] << 8) | data[i + 1]);
+    if (len & 1)
+        sum += (uint32_t)data[len - 1] << 8;
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (uint16_t)(~sum & 0xFFFF);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Random lengths and misalignments against the reference implementation */
+static int verify_kernel(const uint8_t *buf, const char *name)
+{
+    for (int iter = 0; iter < 20000; iter++) {
+        int off = rand() % 64;
+        int len = rand() % (MAX_BUF_SIZE - 64);
+        uint16_t want = reference_checksum(buf + off, len);
+        uint16_t got  = dpi_checksum(buf + off, len);
+        if (want != got) {
+            fprintf(stderr, "MISMATCH %s: off=%d len=%d want=0x%04x got=0x%04x\n",
+                    name, off, len, want, got);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void bench_kernel(const uint8_t *buf, const char *name, double ghz)
+{
+    for (size_t s = 0; s < sizeof(g_sizes) / sizeof(g_sizes[0]); s++) {
+        int size = g_sizes[s];
+        long iters = (long)(TARGET_BYTES / (unsigned)size);
+        volatile uint16_t sink = 0;
+
+        /* warm-up */
+        for (long i = 0; i < iters / 16; i++)
+            sink ^= dpi_checksum(buf, size);
+
+        double t0 = now_ns();
+#ifdef HAVE_TSC
+        uint64_t c0 = __rdtsc();
+#endif
+        for (long i = 0; i < iters; i++)
+            sink ^= dpi_checksum(buf, size);
+#ifdef HAVE_TSC
+        uint64_t c1 = __rdtsc();
+#endif
+        double t1 = now_ns();
+        (void)sink;
+
+        double bytes = (double)iters * size;
+        double ns = t1 - t0;
+        double cycles = 0;
+#ifdef HAVE_TSC
+        cycles = (double)(c1 - c0);
+#endif
+        if (ghz > 0)
+            cycles = ns * ghz;
+
+        printf("%-7s %6d B  %8.1f ns/call  %7.2f GB/s",
+               name, size, ns / (double)iters, bytes / ns);
+        if (cycles > 0)
+            printf("  %6.2f B/cycle", bytes / cycles);
+        printf("\n");
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  --ghz <F>    Core clock in GHz for bytes/cycle (default: TSC on x86)\n"
+        "  --help       Show this help\n",
+        prog);
+}
+
+int main(int argc, char *argv[])
+{
+    double ghz = 0;
+
+    static struct option long_opts[] = {
+        { "ghz",  required_argument, NULL, 'g' },
+        { "help", no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "g:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'g':
+            errno = 0;
+            ghz = strtod(optarg, NULL);
+            if (errno != 0 || ghz <= 0) {
+                fprintf(stderr, "Invalid ghz: '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'h': usage(argv[0]); return 0;
+        default:  usage(argv[0]); return 1;
+        }
+    }
+
+    uint8_t *buf = malloc(MAX_BUF_SIZE + 64);
+    if (!buf) {
+        fprintf(stderr, "malloc failed\n");
+        return 1;
+    }
+    srand(1071);
+    for (int i = 0; i < MAX_BUF_SIZE + 64; i++)
+        buf[i] = (uint8_t)rand();
+
+    dpi_checksum_select(DPI_CSUM_AUTO);
+    printf("auto-selected kernel: %s\n\n", dpi_checksum_impl_name());
+
+    int failed = 0;
+    for (size_t k = 0; k < sizeof(g_impls) / sizeof(g_impls[0]); k++) {
+        if (!dpi_checksum_select(g_impls[k].impl))
+            continue;
+        if (verify_kernel(buf, g_impls[k].name) < 0) {
+            failed = 1;
+            continue;
+        }
+        bench_kernel(buf, g_impls[k].name, ghz);
+    }
+
+    free(buf);
+    return failed;
+}
@@ -0,0 +1,394 @@
+/*
+ * fuzz-dpi — libFuzzer harness for the src/dpi parsers
+ *
+ * Each input is fed through every entry point that sees attacker-
+ * controlled bytes on the relays:
+ *
+ *   - as a raw IP packet: dpi_parse_ip, TCP/UDP/option parsing and
+ *     dpi_classify_batch
+ *   - as a TCP and UDP payload wrapped by the builders, which must parse
+ *     back to the same bytes
+ *   - as a TLS record / handshake: located offsets must stay inside the
+ *     input and every split marker must resolve within it
+ *   - as a QUIC datagram: Initial header parsing and decryption
+ *     (mutated ciphertext fails authentication, so the CRYPTO frame
+ *     walker is reached through the seed Initials only)
+ *   - as a header to patch in place
+ *   - as a DNS message: query parsing, response TTLs and a round trip
+ *     through the UDP relay's answer cache (dns_cache.c)
+ *
+ * Seed it with the captures in fake/ and the DNS messages in seeds/:
+ *
+ *     mkdir corpus && fuzz-dpi corpus/ ../../fake seeds
+ *
+ * Built with DPI_FUZZ_STANDALONE (fuzz-dpi-replay) the same checks run
+ * over files given on the command line, for compilers without libFuzzer.
+ */
+
+#include "dpi_bypass.h"
+#include "dns_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZ_MAX_INPUT  (65535 - 60 - 20)
+
+#define FUZZ_CHECK(cond)                                                \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n",               \
+                    __FILE__, __LINE__, #cond);                         \
+            abort();                                                    \
+        }                                                               \
+    } while (0)
+
+static uint8_t g_pkt[65536];
+static dpi_batch_t g_batch;
+static dpi_quic_crypto_t g_quic;
+static dpi_hostlist_t g_hosts;
+static dns_cache_t g_dns;
+static uint8_t g_dns_query[DNS_MAX_MSG];
+static uint8_t g_dns_out[DNS_MAX_MSG];
+
+static const char *g_markers[] = {
+    "1", "host", "endhost", "sld", "midsld", "endsld", "sniext",
+    "host+1", "endhost-1", "midsld+2", "sniext+4",
+};
+
+static void init_once(void)
+{
+    static bool done;
+    if (done)
+        return;
+    done = true;
+
+    dpi_hostlist_init(&g_hosts);
+    dpi_hostlist_add(&g_hosts, "google.com", 10);
+    dpi_hostlist_add(&g_hosts, "rutracker.org", 13);
+    dpi_hostlist_add(&g_hosts, "googlevideo.com", 15);
+    dns_cache_init(&g_dns, 4);
+}
+
+/* Offsets reported by the TLS locator against a buffer of len bytes */
+static void check_hello(const uint8_t *base, int len, const dpi_tls_hello_t *h)
+{
+    if (h->host_off >= 0) {
+        FUZZ_CHECK(h->host_len > 0 && h->host_off + h->host_len <= len);
+        dpi_hostlist_match(&g_hosts, (const char *)base + h->host_off, h->host_len);
+    }
+    if (h->alpn_off >= 0)
+        FUZZ_CHECK(h->alpn_len >= 0 && h->alpn_off + h->alpn_len <= len);
+    if (h->sni_ext_off >= 0)
+        FUZZ_CHECK(h->sni_ext_off + 4 <= len);
+    if (h->ext_off >= 0)
+        FUZZ_CHECK(h->ext_off <= len);
+
+    for (size_t i = 0; i < sizeof(g_markers) / sizeof(g_markers[0]); i++) {
+        dpi_split_marker_t m;
+        FUZZ_CHECK(dpi_split_markers_parse(g_markers[i], &m, 1) == 1);
+        int pos = dpi_split_marker_resolve(&m, base, len, h);
+        FUZZ_CHECK(pos == -1 || (pos > 0 && pos < len));
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Entry points                                                       */
+/* ------------------------------------------------------------------ */
+
+static void fuzz_raw_packet(const uint8_t *data, int len)
+{
+    dpi_ip_info_t ip;
+    if (dpi_parse_ip(data, len, &ip) == 0) {
+        FUZZ_CHECK(ip.l4_data >= data && ip.l4_len >= 0 &&
+                   ip.l4_data + ip.l4_len <= data + len);
+
+        if (ip.protocol == 6) {
+            dpi_tcp_info_t tcp;
+            if (dpi_parse_tcp(ip.l4_data, ip.l4_len, &tcp) == 0)
+                FUZZ_CHECK(tcp.payload_len >= 0 &&
+                           tcp.payload + tcp.payload_len <= ip.l4_data + ip.l4_len);
+        } else if (ip.protocol == 17) {
+            dpi_udp_info_t udp;
+            if (dpi_parse_udp(ip.l4_data, ip.l4_len, &udp) == 0)
+                FUZZ_CHECK(udp.payload_len >= 0 &&
+                           udp.payload + udp.payload_len <= ip.l4_data + ip.l4_len);
+        }
+    }
+
+    const uint8_t *pkts[2] = { data, data };
+    int lens[2] = { len, len / 2 };
+    int n = dpi_classify_batch(pkts, lens, 2, &g_batch);
+    for (int i = 0; i < n; i++)
+        if (g_batch.protocol[i])
+            FUZZ_CHECK(g_batch.payload_off[i] >= 0 &&
+                       g_batch.payload_off[i] + g_batch.payload_len[i] <= lens[i]);
+
+    dpi_tcp_opts_t opts;
+    dpi_parse_tcp_options(data, len < DPI_TCP_MAX_OPTIONS ? len : DPI_TCP_MAX_OPTIONS, &opts);
+    FUZZ_CHECK(opts.sack_count >= 0 && opts.sack_count <= DPI_TCP_MAX_SACK);
+    uint8_t opt_out[DPI_TCP_MAX_OPTIONS];
+    int opt_len = dpi_tcp_write_options(opt_out, sizeof(opt_out), &opts);
+    FUZZ_CHECK(opt_len >= 0 && opt_len <= DPI_TCP_MAX_OPTIONS && (opt_len & 3) == 0);
+}
+
+/*
+ * The patch helpers adjust checksums incrementally; a built IPv4 packet
+ * must still carry a valid header checksum and an L4 checksum equal to
+ * a full recompute after every one of them.
+ */
+static uint8_t g_l4[65536];
+
+static void check_patched(const uint8_t *pkt)
+{
+    FUZZ_CHECK(dpi_checksum(pkt, 20) == 0);
+
+    int total = pkt[2] << 8 | pkt[3];
+    uint8_t proto = pkt[9];
+    int l4_len = total - 20;
+    int off = proto == 6 ? 16 : 6;
+    uint16_t stored = (uint16_t)(pkt[20 + off] << 8 | pkt[20 + off + 1]);
+    if (proto == 17) {
+        FUZZ_CHECK((pkt[24] << 8 | pkt[25]) == l4_len);
+        if (stored == 0)
+            return;
+    }
+
+    memcpy(g_l4, pkt + 20, l4_len);
+    g_l4[off] = g_l4[off + 1] = 0;
+    uint32_t src = (uint32_t)pkt[12] << 24 | pkt[13] << 16 | pkt[14] << 8 | pkt[15];
+    uint32_t dst = (uint32_t)pkt[16] << 24 | pkt[17] << 16 | pkt[18] << 8 | pkt[19];
+    uint16_t expect = dpi_transport_checksum(src, dst, proto, g_l4, l4_len);
+    if (proto == 17 && expect == 0)
+        expect = 0xFFFF;
+    FUZZ_CHECK(stored == expect);
+}
+
+static void fuzz_patch(const uint8_t *data, int len)
+{
+    if (len < 4 || len > (int)sizeof(g_pkt))
+        return;
+
+    /* Arbitrary bytes: must not crash */
+    memcpy(g_pkt, data, len);
+    dpi_patch_ipv4_ttl(g_pkt, len, data[0]);
+    dpi_patch_ports(g_pkt, len, (uint16_t)(data[1] << 8 | data[2]), 443);
+    dpi_patch_tcp_seq(g_pkt, len, 0x01020304);
+    dpi_patch_tcp_ack(g_pkt, len, 0x05060708);
+    dpi_patch_ipv4_length(g_pkt, len, len - data[3] % 64);
+
+    /* Built packets carrying the input: checksums must stay exact */
+    dpi_addr_t src, dst;
+    dpi_addr_from_ipv4(&src, 0x0A000002);
+    dpi_addr_from_ipv4(&dst, 0xC0000201);
+    uint32_t seq = (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+
+    for (int tcp = 0; tcp < 2; tcp++) {
+        int n = tcp ? dpi_build_ip_tcp(g_pkt, sizeof(g_pkt), &src, &dst, 40000, 443,
+                                       1, 2, DPI_TCP_ACK, 65535, data, len)
+                    : dpi_build_ip_udp(g_pkt, sizeof(g_pkt), &src, &dst, 40000, 443,
+                                       data, len);
+        if (n <= 0)
+            continue;
+        check_patched(g_pkt);
+
+        FUZZ_CHECK(dpi_patch_ipv4_ttl(g_pkt, n, data[0]) == 0);
+        check_patched(g_pkt);
+        FUZZ_CHECK(dpi_patch_ports(g_pkt, n, (uint16_t)(data[1] << 8 | data[2]),
+                                   (uint16_t)(data[2] << 8 | data[3])) == 0);
+        check_patched(g_pkt);
+        if (tcp) {
+            FUZZ_CHECK(dpi_patch_tcp_seq(g_pkt, n, seq) == 0);
+            check_patched(g_pkt);
+            FUZZ_CHECK(dpi_patch_tcp_ack(g_pkt, n, ~seq) == 0);
+            check_patched(g_pkt);
+        }
+
+        /* Trim or extend by up to 32 bytes within the buffer */
+        int new_total = n - 32 + data[3] % 64;
+        int buf_size = n + 32 < (int)sizeof(g_pkt) ? n + 32 : (int)sizeof(g_pkt);
+        if (dpi_patch_ipv4_length(g_pkt, buf_size, new_total) == 0)
+            check_patched(g_pkt);
+    }
+}
+
+/* Payload round trip through the builders, both families and protocols */
+static void fuzz_wrapped(const uint8_t *data, int len)
+{
+    dpi_addr_t src4, dst4, src6, dst6;
+    dpi_addr_from_ipv4(&src4, 0x0A000002);
+    dpi_addr_from_ipv4(&dst4, 0xC0000201);
+    memset(&src6, 0, sizeof(src6));
+    memset(&dst6, 0, sizeof(dst6));
+    src6.b[0] = 0xfd; src6.b[15] = 2;
+    dst6.b[0] = 0x20; dst6.b[1] = 0x01; dst6.b[15] = 1;
+
+    const dpi_addr_t *srcs[2] = { &src4, &src6 };
+    const dpi_addr_t *dsts[2] = { &dst4, &dst6 };
+
+    for (int fam = 0; fam < 2; fam++) {
+        for (int tcp = 0; tcp < 2; tcp++) {
+            int n = tcp ? dpi_build_ip_tcp(g_pkt, sizeof(g_pkt), srcs[fam], dsts[fam],
+                                           40000, 443, 1, 2, DPI_TCP_ACK, 65535, data, len)
+                        : dpi_build_ip_udp(g_pkt, sizeof(g_pkt), srcs[fam], dsts[fam],
+                                           40000, 443, data, len);
+            FUZZ_CHECK(n > 0);
+
+            dpi_ip_info_t ip;
+            FUZZ_CHECK(dpi_parse_ip(g_pkt, n, &ip) == 0);
+            if (fam == 0)
+                FUZZ_CHECK(dpi_checksum(g_pkt, 20) == 0);
+
+            const uint8_t *payload;
+            int payload_len;
+            if (tcp) {
+                dpi_tcp_info_t t;
+                FUZZ_CHECK(dpi_parse_tcp(ip.l4_data, ip.l4_len, &t) == 0);
+                payload = t.payload;
+                payload_len = t.payload_len;
+            } else {
+                dpi_udp_info_t u;
+                FUZZ_CHECK(dpi_parse_udp(ip.l4_data, ip.l4_len, &u) == 0);
+                payload = u.payload;
+                payload_len = u.payload_len;
+            }
+            FUZZ_CHECK(payload_len == len && memcmp(payload, data, len) == 0);
+
+            const uint8_t *pkts[1] = { g_pkt };
+            int lens[1] = { n };
+            FUZZ_CHECK(dpi_classify_batch(pkts, lens, 1, &g_batch) == 1);
+            FUZZ_CHECK(g_batch.protocol[0] == (tcp ? 6 : 17) &&
+                       g_batch.payload_len[0] == len);
+        }
+    }
+}
+
+static void fuzz_tls(const uint8_t *data, int len)
+{
+    dpi_tls_hello_t h;
+
+    dpi_is_tls_client_hello(data, len);
+    if (dpi_tls_parse_client_hello(data, len, &h) != DPI_TLS_INVALID)
+        check_hello(data, len, &h);
+    if (dpi_tls_parse_handshake(data, len, &h) != DPI_TLS_INVALID)
+        check_hello(data, len, &h);
+}
+
+static void fuzz_quic(const uint8_t *data, int len)
+{
+    const uint8_t *dcid;
+    int dcid_len;
+
+    dpi_is_quic_initial(data, len);
+    if (dpi_quic_initial_dcid(data, len, &dcid, &dcid_len))
+        FUZZ_CHECK(dcid_len >= 0 && dcid_len <= DPI_QUIC_MAX_CID &&
+                   dcid >= data && dcid + dcid_len <= data + len);
+    int initial_len = dpi_quic_initial_len(data, len);
+    FUZZ_CHECK(initial_len == -1 || (initial_len > 0 && initial_len <= len));
+    dpi_quic_past_initial(data, len);
+
+    dpi_quic_crypto_init(&g_quic);
+    if (dpi_quic_crypto_add(&g_quic, data, len) < 0)
+        return;
+
+    FUZZ_CHECK(g_quic.contiguous >= 0 && g_quic.contiguous <= DPI_QUIC_CRYPTO_MAX);
+    dpi_tls_hello_t h;
+    if (dpi_quic_crypto_hello(&g_quic, &h) != DPI_TLS_INVALID)
+        check_hello(g_quic.data, g_quic.contiguous, &h);
+}
+
+/*
+ * The input as a query, then as a response: cached under the query it
+ * answers and served back aged, which walks every record after the
+ * question.
+ */
+static void fuzz_dns(const uint8_t *data, int len)
+{
+    dpi_addr_t server;
+    dpi_addr_from_ipv4(&server, 0x01010101);
+
+    dns_query_t q;
+    if (dns_parse_query(data, len, &server, DNS_PORT, &q) == 0) {
+        FUZZ_CHECK(q.question_len > 4 && DNS_HEADER_LEN + q.question_len <= len);
+        FUZZ_CHECK(q.key_len > 0 && q.key_len <= DNS_MAX_KEY);
+    }
+
+    uint32_t ttl = dns_response_ttl(data, len);
+    FUZZ_CHECK(ttl <= DNS_CACHE_MAX_TTL);
+    if (len < DNS_HEADER_LEN || len > DNS_MAX_MSG)
+        return;
+
+    /* The query: header bits a query may carry, the question alone */
+    memcpy(g_dns_query, data, len);
+    g_dns_query[2] &= 0x01;
+    g_dns_query[3] &= 0x10;
+    memset(g_dns_query + 6, 0, 6);
+    if (dns_parse_query(g_dns_query, len, &server, DNS_PORT, &q) < 0 ||
+        !dns_response_matches(data, len, g_dns_query + DNS_HEADER_LEN, q.question_len))
+        return;
+
+    /* Served just before it expires, so every TTL is aged */
+    uint32_t keep = ttl ? ttl : 60;
+    dns_set_id(g_dns_query, (uint16_t)(dns_id(data) + 1));
+    dns_cache_put(&g_dns, &q, data, len, keep, 0);
+    int n = dns_cache_answer(&g_dns, &q, g_dns_query, g_dns_out, sizeof(g_dns_out),
+                             (int64_t)keep * 1000 - 1);
+    FUZZ_CHECK(n == len && dns_id(g_dns_out) == dns_id(g_dns_query));
+    FUZZ_CHECK(memcmp(g_dns_out + DNS_HEADER_LEN, g_dns_query + DNS_HEADER_LEN,
+                      q.question_len) == 0);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > FUZZ_MAX_INPUT)
+        return 0;
+    int len = (int)size;
+
+    init_once();
+    fuzz_raw_packet(data, len);
+    fuzz_patch(data, len);
+    fuzz_wrapped(data, len);
+    fuzz_tls(data, len);
+    fuzz_quic(data, len);
+    fuzz_dns(data, len);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Replay without libFuzzer                                           */
+/* ------------------------------------------------------------------ */
+
+#ifdef DPI_FUZZ_STANDALONE
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file>...\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f) {
+            fprintf(stderr, "Cannot open %s\n", argv[i]);
+            return 1;
+        }
+        uint8_t *tmp = malloc(FUZZ_MAX_INPUT);
+        size_t n = tmp ? fread(tmp, 1, FUZZ_MAX_INPUT, f) : 0;
+        fclose(f);
+
+        /* Exact-size copy so an overread hits the sanitizer redzone */
+        uint8_t *buf = malloc(n ? n : 1);
+        if (!tmp || !buf) {
+            fprintf(stderr, "malloc failed\n");
+            return 1;
+        }
+        memcpy(buf, tmp, n);
+        free(tmp);
+
+        LLVMFuzzerTestOneInput(buf, n);
+        free(buf);
+    }
+    printf("%d inputs OK\n", argc - 1);
+    return 0;
+}
+#endif
@@ -0,0 +1,391 @@
+/*
+ * shard-bench — scaling of the sharded VPN pipeline with worker count
+ *
+ * Reproduces vpn_processor's threading without the TUN or sockets:
+ *
+ *   reader   hashes each packet's session key to a worker and copies it
+ *            into that worker's inbound SPSC ring (the TUN thread)
+ *   workers  classify bursts with dpi_classify_batch, run the per-packet
+ *            DPI the relays do (ClientHello walk, Initial decryption) and
+ *            write a header-only reply into their outbound ring
+ *   writer   merges the outbound rings round-robin (the TUN write side)
+ *
+ * Traffic is the fake/ corpus spread over many flows, so each worker sees
+ * the same mix. Idle threads yield instead of sleeping on an eventfd,
+ * which measures the rings and the packet work rather than wakeups.
+ * Reports packets/s for 1..N workers and the speedup over one; expect
+ * it to flatten once workers + 2 exceed the cores available.
+ */
+
+#include "dpi_bypass.h"
+#include "session_table.h"
+#include "spsc_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#ifndef DPI_CORPUS_DIR
+#define DPI_CORPUS_DIR "fake"
+#endif
+
+#define MAX_CAPTURES   256
+#define MAX_WORKERS    8
+#define MAX_PKT        2048               /* corpus packets that fit a TUN MTU */
+#define FLOWS          4096
+#define RING_SLOTS     256
+#define BURST          32
+
+typedef struct {
+    uint8_t  pkt[MAX_PKT];
+    int      len;
+} flow_pkt_t;
+
+typedef struct {
+    spsc_ring_t in;
+    spsc_ring_t out;
+    dpi_batch_t batch;
+    dpi_quic_crypto_t quic;
+    pthread_t   thread;
+    uint64_t    processed;
+    uint32_t    sink;
+} worker_t;
+
+static flow_pkt_t *g_flows;
+static int g_flow_count;
+static dpi_addr_t g_app, g_srv;
+
+static worker_t *g_workers[MAX_WORKERS];
+static int g_worker_count;
+static atomic_int g_reader_done;
+static atomic_int g_workers_done;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Corpus                                                             */
+/* ------------------------------------------------------------------ */
+
+static bool has_prefix(const char *name, const char *prefix)
+{
+    return strncmp(name, prefix, strlen(prefix)) == 0;
+}
+
+/* One packet per capture that fits the TUN MTU, TCP for TLS/HTTP */
+static int load_corpus(const char *dir, flow_pkt_t *caps, bool *tcp)
+{
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Cannot open corpus '%s': %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    int count = 0;
+    struct dirent *de;
+    static uint8_t payload[MAX_PKT];
+
+    while ((de = readdir(d)) != NULL && count < MAX_CAPTURES) {
+        size_t n = strlen(de->d_name);
+        if (n < 5 || strcmp(de->d_name + n - 4, ".bin") != 0)
+            continue;
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        FILE *f = fopen(path, "rb");
+        if (!f)
+            continue;
+        int len = (int)fread(payload, 1, sizeof(payload), f);
+        bool too_big = fgetc(f) != EOF;
+        fclose(f);
+        if (len <= 0 || too_big || len > 1500 - 60)
+            continue;
+
+        tcp[count] = has_prefix(de->d_name, "tls_") || has_prefix(de->d_name, "http_");
+        caps[count].len = tcp[count]
+            ? dpi_build_ip_tcp(caps[count].pkt, MAX_PKT, &g_app, &g_srv, 40000, 443,
+                               1000, 2000, DPI_TCP_ACK | DPI_TCP_PSH, 65535, payload, len)
+            : dpi_build_ip_udp(caps[count].pkt, MAX_PKT, &g_app, &g_srv, 40000, 443,
+                               payload, len);
+        if (caps[count].len > 0)
+            count++;
+    }
+    closedir(d);
+    return count;
+}
+
+/* FLOWS packets cycling through the corpus, each on its own source port */
+static int build_flows(const char *dir)
+{
+    static flow_pkt_t caps[MAX_CAPTURES];
+    static bool tcp[MAX_CAPTURES];
+
+    int n = load_corpus(dir, caps, tcp);
+    if (n <= 0)
+        return -1;
+
+    g_flows = malloc(FLOWS * sizeof(*g_flows));
+    if (!g_flows)
+        return -1;
+
+    for (int i = 0; i < FLOWS; i++) {
+        g_flows[i] = caps[i % n];
+        dpi_patch_ports(g_flows[i].pkt, g_flows[i].len, (uint16_t)(10000 + i), 443);
+    }
+    g_flow_count = FLOWS;
+    return n;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Pipeline                                                           */
+/* ------------------------------------------------------------------ */
+
+/* Same key and hash bits as vpn_processor's flow_shard */
+static int flow_worker(const uint8_t *pkt, int len)
+{
+    dpi_ip_info_t ip;
+    if (dpi_parse_ip(pkt, len, &ip) < 0 || ip.l4_len < 4)
+        return -1;
+
+    session_key_t key;
+    key.dst_addr = ip.dst_ip;
+    key.src_port = (uint16_t)(ip.l4_data[0] << 8 | ip.l4_data[1]);
+    key.dst_port = (uint16_t)(ip.l4_data[2] << 8 | ip.l4_data[3]);
+    return (int)(((uint64_t)session_key_hash(&key) * (uint32_t)g_worker_count) >> 32);
+}
+
+/* The payload work a relay does before it forwards a packet */
+static uint32_t inspect(worker_t *w, const uint8_t *payload, int len, uint8_t proto)
+{
+    dpi_tls_hello_t h;
+
+    if (proto == 6)
+        return dpi_tls_parse_client_hello(payload, len, &h) == DPI_TLS_INVALID
+               ? 0 : (uint32_t)h.host_off;
+
+    if (!dpi_is_quic_initial(payload, len))
+        return 0;
+    dpi_quic_crypto_init(&w->quic);
+    if (dpi_quic_crypto_add(&w->quic, payload, len) < 0)
+        return 0;
+    return dpi_quic_crypto_hello(&w->quic, &h) == DPI_TLS_INVALID ? 0 : (uint32_t)h.host_off;
+}
+
+static void *worker_func(void *arg)
+{
+    worker_t *w = arg;
+    const uint8_t *pkts[BURST];
+    int lens[BURST];
+
+    for (;;) {
+        uint32_t avail = spsc_ring_available(&w->in);
+        if (avail == 0) {
+            if (atomic_load(&g_reader_done) && spsc_ring_available(&w->in) == 0)
+                break;
+            sched_yield();
+            continue;
+        }
+
+        int n = avail < BURST ? (int)avail : BURST;
+        for (int i = 0; i < n; i++) {
+            uint32_t len;
+            pkts[i] = spsc_ring_slot(&w->in, i, &len);
+            lens[i] = (int)len;
+        }
+        n = dpi_classify_batch(pkts, lens, n, &w->batch);
+
+        for (int i = 0; i < n; i++) {
+            dpi_batch_t *b = &w->batch;
+            if (!b->protocol[i])
+                continue;
+            w->sink += inspect(w, pkts[i] + b->payload_off[i], b->payload_len[i],
+                               b->protocol[i]);
+
+            /* Reply towards the app: an ACK for TCP, an empty datagram for UDP */
+            uint8_t *slot;
+            while ((slot = spsc_ring_reserve(&w->out)) == NULL)
+                sched_yield();
+            int len = b->protocol[i] == 6
+                ? dpi_build_ip_tcp(slot, w->out.slot_size, &b->dst_ip[i], &b->src_ip[i],
+                                   b->dst_port[i], b->src_port[i], b->ack[i],
+                                   b->seq[i] + b->payload_len[i], DPI_TCP_ACK, 65535, NULL, 0)
+                : dpi_build_ip_udp(slot, w->out.slot_size, &b->dst_ip[i], &b->src_ip[i],
+                                   b->dst_port[i], b->src_port[i], NULL, 0);
+            spsc_ring_commit(&w->out, (uint32_t)len);
+        }
+        spsc_ring_release(&w->in, (uint32_t)(avail < BURST ? avail : BURST));
+        w->processed += (uint64_t)n;
+    }
+
+    atomic_fetch_add(&g_workers_done, 1);
+    return NULL;
+}
+
+/* Merge the outbound rings until every worker has finished */
+static void *writer_func(void *arg)
+{
+    uint64_t *written = arg;
+
+    for (;;) {
+        uint32_t moved = 0;
+        bool done = atomic_load(&g_workers_done) == g_worker_count;
+
+        for (int s = 0; s < g_worker_count; s++) {
+            spsc_ring_t *ring = &g_workers[s]->out;
+            uint32_t n = spsc_ring_available(ring);
+            if (n > BURST)
+                n = BURST;
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t len;
+                spsc_ring_slot(ring, i, &len);
+                *written += len > 0;
+            }
+            spsc_ring_release(ring, n);
+            moved += n;
+        }
+        if (moved == 0) {
+            if (done)
+                break;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* Push total packets through workers threads; returns packets/s */
+static double run(int workers, long total)
+{
+    g_worker_count = workers;
+    atomic_store(&g_reader_done, 0);
+    atomic_store(&g_workers_done, 0);
+
+    for (int s = 0; s < workers; s++) {
+        g_workers[s] = calloc(1, sizeof(worker_t));
+        if (!g_workers[s] ||
+            spsc_ring_init(&g_workers[s]->in, RING_SLOTS, MAX_PKT) < 0 ||
+            spsc_ring_init(&g_workers[s]->out, RING_SLOTS, MAX_PKT) < 0) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    uint64_t written = 0;
+    pthread_t writer;
+    double t0 = now_ns();
+
+    for (int s = 0; s < workers; s++)
+        pthread_create(&g_workers[s]->thread, NULL, worker_func, g_workers[s]);
+    pthread_create(&writer, NULL, writer_func, &written);
+
+    /* Reader: this thread */
+    for (long i = 0; i < total; i++) {
+        const flow_pkt_t *f = &g_flows[i % g_flow_count];
+        worker_t *w = g_workers[flow_worker(f->pkt, f->len)];
+        uint8_t *slot;
+        while ((slot = spsc_ring_reserve(&w->in)) == NULL)
+            sched_yield();
+        memcpy(slot, f->pkt, f->len);
+        spsc_ring_commit(&w->in, (uint32_t)f->len);
+    }
+    atomic_store(&g_reader_done, 1);
+
+    uint64_t processed = 0;
+    for (int s = 0; s < workers; s++) {
+        pthread_join(g_workers[s]->thread, NULL);
+        processed += g_workers[s]->processed;
+    }
+    pthread_join(writer, NULL);
+    double dt = now_ns() - t0;
+
+    if (processed != (uint64_t)total || written != (uint64_t)total)
+        fprintf(stderr, "lost packets: %ld in, %llu processed, %llu written\n", total,
+                (unsigned long long)processed, (unsigned long long)written);
+
+    for (int s = 0; s < workers; s++) {
+        spsc_ring_free(&g_workers[s]->in);
+        spsc_ring_free(&g_workers[s]->out);
+        free(g_workers[s]);
+        g_workers[s] = NULL;
+    }
+    return (double)total / dt * 1e9;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  --corpus <DIR>   Capture directory (default: %s)\n"
+        "  --workers <N>    Largest worker count to run, 1..%d (default: %d)\n"
+        "  --packets <N>    Packets per run (default: 1000000)\n"
+        "  --help           Show this help\n",
+        prog, DPI_CORPUS_DIR, MAX_WORKERS, MAX_WORKERS);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *corpus = DPI_CORPUS_DIR;
+    int max_workers = MAX_WORKERS;
+    long total = 1000000;
+
+    static struct option long_opts[] = {
+        { "corpus",  required_argument, NULL, 'c' },
+        { "workers", required_argument, NULL, 'w' },
+        { "packets", required_argument, NULL, 'n' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:w:n:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'c': corpus = optarg; break;
+        case 'w': max_workers = atoi(optarg); break;
+        case 'n': total = atol(optarg); break;
+        case 'h': usage(argv[0]); return 0;
+        default:  usage(argv[0]); return 1;
+        }
+    }
+    if (max_workers < 1 || max_workers > MAX_WORKERS || total <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    dpi_addr_from_ipv4(&g_app, 0x0A000002);   /* 10.0.0.2 */
+    dpi_addr_from_ipv4(&g_srv, 0xC0000201);   /* 192.0.2.1 */
+
+    int caps = build_flows(corpus);
+    if (caps <= 0) {
+        fprintf(stderr, "No captures loaded from '%s'\n", corpus);
+        return 1;
+    }
+
+    dpi_checksum_select(DPI_CSUM_AUTO);
+    printf("%d captures over %d flows, %ld packets per run, %ld cores online\n\n",
+           caps, g_flow_count, total, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%7s %12s %8s\n", "workers", "kpps", "speedup");
+
+    double base = 0;
+    for (int w = 1; w <= max_workers; w++) {
+        double pps = run(w, total);
+        if (w == 1)
+            base = pps;
+        printf("%7d %12.1f %7.2fx\n", w, pps / 1e3, pps / base);
+    }
+
+    free(g_flows);
+    return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * udp-batch-bench — syscalls per megabyte of the UDP relay's socket side
+ *
+ * Replays udp_relay's two directions over a loopback socket pair with a
+ * QUIC-sized datagram, one datagram syscall at a time and batched:
+ *
+ *   down   drain the session socket after each burst from the "server":
+ *          recv() per datagram vs recvmmsg() of UDP_RX_BATCH, each
+ *          datagram received into a pkt_pool buffer and given its IP+UDP
+ *          header in place, as the relay does before the TUN write
+ *   up     send one TUN burst of datagrams to the server: send() per
+ *          datagram vs one sendmmsg() (udp_relay_flush for one session)
+ *
+ * Only the relay side is timed; the peer socket is filled or drained
+ * between bursts. Reports ns per datagram, MB/s and syscalls per MB.
+ */
+
+#define _GNU_SOURCE
+
+#include "dpi_bypass.h"
+#include "pkt_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define RX_BATCH     16    /* UDP_RX_BATCH */
+#define TX_BATCH     32    /* UDP_TX_BATCH, one TUN burst */
+#define MAX_DGRAM    65507
+#define BUF_PAYLOAD  1920  /* UDP_BUF_PAYLOAD */
+
+typedef struct {
+    double   ns;
+    uint64_t syscalls;
+    uint64_t datagrams;
+    uint64_t bytes;
+} result_t;
+
+static int g_relay_fd, g_server_fd;
+static dpi_hdr_template_t g_tun_hdr;
+static pkt_pool_t g_bufs;
+static uint8_t g_payload[MAX_DGRAM];
+static uint8_t g_sink[MAX_DGRAM];
+static uint32_t g_checksum_sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Sockets                                                            */
+/* ------------------------------------------------------------------ */
+
+static int bound_socket(struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int size = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(*addr);
+    if (bind(fd, (struct sockaddr *)addr, len) < 0 ||
+        getsockname(fd, (struct sockaddr *)addr, &len) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int open_pair(void)
+{
+    struct sockaddr_in relay_addr, server_addr;
+
+    g_relay_fd  = bound_socket(&relay_addr);
+    g_server_fd = bound_socket(&server_addr);
+    if (g_relay_fd < 0 || g_server_fd < 0)
+        return -1;
+    if (connect(g_relay_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 ||
+        connect(g_server_fd, (struct sockaddr *)&relay_addr, sizeof(relay_addr)) < 0)
+        return -1;
+    return 0;
+}
+
+static void server_send(int count, int size)
+{
+    for (int i = 0; i < count; i++)
+        send(g_server_fd, g_payload, size, 0);
+}
+
+static void server_drain(void)
+{
+    while (recv(g_server_fd, g_sink, sizeof(g_sink), MSG_DONTWAIT) >= 0)
+        ;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Relay side                                                         */
+/* ------------------------------------------------------------------ */
+
+/* What the relay does with each datagram before the TUN write */
+static void build_in_place(uint8_t *buf, int n)
+{
+    uint8_t *pkt = pkt_payload(buf) - g_tun_hdr.hdr_len;
+    int len = dpi_template_build_udp(&g_tun_hdr, pkt, g_tun_hdr.hdr_len + n,
+                                     pkt_payload(buf), n);
+    g_checksum_sink += (uint32_t)len + pkt[len - 1];
+}
+
+static void drain_single(result_t *r)
+{
+    for (;;) {
+        uint8_t *buf = pkt_pool_get(&g_bufs);
+        ssize_t n = recv(g_relay_fd, pkt_payload(buf), BUF_PAYLOAD, MSG_DONTWAIT);
+        r->syscalls++;
+        if (n < 0) {
+            pkt_pool_put(&g_bufs, buf);
+            return;
+        }
+        build_in_place(buf, (int)n);
+        pkt_pool_put(&g_bufs, buf);
+        r->datagrams++;
+        r->bytes += (uint64_t)n;
+    }
+}
+
+static void drain_batched(result_t *r)
+{
+    struct mmsghdr msgs[RX_BATCH];
+    struct iovec iov[RX_BATCH];
+    uint8_t *bufs[RX_BATCH];
+
+    for (;;) {
+        for (int i = 0; i < RX_BATCH; i++) {
+            bufs[i] = pkt_pool_get(&g_bufs);
+            iov[i].iov_base = pkt_payload(bufs[i]);
+            iov[i].iov_len  = BUF_PAYLOAD;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov    = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = recvmmsg(g_relay_fd, msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+        r->syscalls++;
+        for (int i = 0; i < n; i++) {
+            build_in_place(bufs[i], (int)msgs[i].msg_len);
+            r->datagrams++;
+            r->bytes += msgs[i].msg_len;
+        }
+        for (int i = 0; i < RX_BATCH; i++)
+            pkt_pool_put(&g_bufs, bufs[i]);
+        if (n < RX_BATCH)
+            return;   /* drained: a short batch saves the EAGAIN call */
+    }
+}
+
+static void send_single(result_t *r, int size)
+{
+    for (int i = 0; i < TX_BATCH; i++) {
+        send(g_relay_fd, g_payload, size, 0);
+        r->syscalls++;
+    }
+    r->datagrams += TX_BATCH;
+    r->bytes += (uint64_t)TX_BATCH * size;
+}
+
+static void send_batched(result_t *r, int size)
+{
+    struct mmsghdr msgs[TX_BATCH];
+    struct iovec iov[TX_BATCH];
+
+    for (int i = 0; i < TX_BATCH; i++) {
+        iov[i].iov_base = g_payload;
+        iov[i].iov_len  = (size_t)size;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov    = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = 0;
+    while (sent < TX_BATCH) {
+        int n = sendmmsg(g_relay_fd, msgs + sent, TX_BATCH - sent, 0);
+        r->syscalls++;
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    r->datagrams += (uint64_t)sent;
+    r->bytes += (uint64_t)sent * size;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Runs                                                               */
+/* ------------------------------------------------------------------ */
+
+static result_t run_down(bool batched, long total, int size)
+{
+    result_t r = { 0 };
+
+    for (long done = 0; done < total; done += TX_BATCH) {
+        server_send(TX_BATCH, size);
+        double t0 = now_ns();
+        if (batched)
+            drain_batched(&r);
+        else
+            drain_single(&r);
+        r.ns += now_ns() - t0;
+    }
+    return r;
+}
+
+static result_t run_up(bool batched, long total, int size)
+{
+    result_t r = { 0 };
+
+    for (long done = 0; done < total; done += TX_BATCH) {
+        double t0 = now_ns();
+        if (batched)
+            send_batched(&r, size);
+        else
+            send_single(&r, size);
+        r.ns += now_ns() - t0;
+        server_drain();
+    }
+    return r;
+}
+
+static void report(const char *name, const result_t *r)
+{
+    double mb = (double)r->bytes / 1e6;
+
+    printf("%-22s %10.0f %10.1f %12.1f\n", name,
+           r->datagrams ? r->ns / (double)r->datagrams : 0.0,
+           r->ns > 0 ? mb / (r->ns / 1e9) : 0.0,
+           mb > 0 ? (double)r->syscalls / mb : 0.0);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  --size <N>       Datagram payload bytes, 1..%d (default: 1200)\n"
+        "  --packets <N>    Datagrams per direction and mode (default: 200000)\n"
+        "  --help           Show this help\n",
+        prog, BUF_PAYLOAD);
+}
+
+int main(int argc, char *argv[])
+{
+    int size = 1200;
+    long total = 200000;
+
+    static struct option long_opts[] = {
+        { "size",    required_argument, NULL, 's' },
+        { "packets", required_argument, NULL, 'n' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:n:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 's': size = atoi(optarg); break;
+        case 'n': total = atol(optarg); break;
+        case 'h': usage(argv[0]); return 0;
+        default:  usage(argv[0]); return 1;
+        }
+    }
+    if (size < 1 || size > BUF_PAYLOAD || total <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (open_pair() < 0) {
+        fprintf(stderr, "Cannot set up loopback sockets: %s\n", strerror(errno));
+        return 1;
+    }
+    if (pkt_pool_init(&g_bufs, BUF_PAYLOAD, 2 * RX_BATCH, RX_BATCH) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    dpi_checksum_select(DPI_CSUM_AUTO);
+    dpi_addr_t app, srv;
+    dpi_addr_from_ipv4(&app, 0x0A000002);   /* 10.0.0.2 */
+    dpi_addr_from_ipv4(&srv, 0xC0000201);   /* 192.0.2.1 */
+    dpi_template_init_udp(&g_tun_hdr, &srv, &app, 443, 50000);
+    for (int i = 0; i < size; i++)
+        g_payload[i] = (uint8_t)(i * 7);
+
+    printf("%d-byte datagrams, %ld per run, bursts of %d\n\n", size, total, TX_BATCH);
+    printf("%-22s %10s %10s %12s\n", "", "ns/dgram", "MB/s", "syscalls/MB");
+
+    result_t r;
+    r = run_down(false, total, size);
+    report("down recv", &r);
+    r = run_down(true, total, size);
+    report("down recvmmsg", &r);
+    r = run_up(false, total, size);
+    report("up send", &r);
+    r = run_up(true, total, size);
+    report("up sendmmsg", &r);
+
+    if (g_checksum_sink == 0xFFFFFFFFu)
+        printf("\n");   /* keep the header builds observable */
+
+    pkt_pool_free(&g_bufs);
+    close(g_relay_fd);
+    close(g_server_fd);
+    return 0;
+}
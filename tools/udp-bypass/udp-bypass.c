@@ -3,6 +3,8 @@
  *
  * Creates a utun interface, reads routed UDP packets, injects fake QUIC
  * Initial packets with low TTL before forwarding the original.
+ * With --hostlist / --hostlist-exclude the Initial is decrypted first and
+ * only hosts passing the lists get fakes.
  *
  * PF rule directs traffic here:
  *   pass out route-to utunN inet proto udp from any to any port 443 user $USER
@@ -21,6 +23,7 @@
 #include <getopt.h>
 #include <stdbool.h>
 #include <poll.h>
+#include <time.h>
 
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -34,6 +37,8 @@
 #include <netinet/udp.h>
 #include <arpa/inet.h>
 
+#include "dpi_bypass.h"
+
 #define MAX_PKT_SIZE          65536
 #define UTUN_AF_HDR_LEN       4
 #define DEFAULT_FAKE_TTL      3
@@ -41,6 +46,10 @@
 #define MAX_FAKE_PAYLOAD_SIZE 4096
 #define PID_FILE              "/tmp/udp-bypass.pid"
 
+#define QUIC_PENDING_SLOTS      16   /* flows waiting for the rest of a ClientHello */
+#define QUIC_PENDING_HELD       4    /* datagrams held per flow */
+#define QUIC_PENDING_TIMEOUT_MS 300
+
 static volatile sig_atomic_t g_running = 1;
 
 static void signal_handler(int sig)
@@ -212,7 +221,8 @@ static int configure_utun(const char *ifname)
  * UDP header + payload. This avoids macOS ip_len/ip_off byte-order
  * issues with IP_HDRINCL entirely.
  *
- * TTL is controlled per-packet via setsockopt(IP_TTL).
+ * TTL is controlled via setsockopt(IP_TTL), changed only when the
+ * next packet needs a different one (see send_udp_raw).
  * Source IP is chosen by the kernel based on the routing table.
  */
 static int create_raw_socket(void)
@@ -295,36 +305,20 @@ static uint8_t *load_fake_payload(const char *path, size_t *out_len)
     return buf;
 }
 
-/* ------------------------------------------------------------------ */
-/*  QUIC detection                                                     */
-/* ------------------------------------------------------------------ */
-
-static bool is_quic_initial(const uint8_t *payload, int len)
-{
-    if (len < 5)
-        return false;
-
-    /* Long header (bit 7 set) */
-    if ((payload[0] & 0x80) == 0)
-        return false; /* short header */
-
-    /* Check for Long Header form: first byte 0xC0..0xFF */
-    uint32_t version;
-    memcpy(&version, payload + 1, 4);
-    version = ntohl(version);
-
-    /* QUIC v1 or v2 */
-    return version == 0x00000001 || version == 0x6b3343cf;
-}
-
 /* ------------------------------------------------------------------ */
 /*  Send UDP data via raw socket                                       */
 /* ------------------------------------------------------------------ */
 
+/* TTL the raw socket currently sends with (-1 = unknown) */
+static int g_raw_ttl = -1;
+
 /*
  * Send UDP data (UDP header + payload) via raw socket.
  * The kernel adds the IP header automatically.
- * TTL is set via setsockopt before each send.
+ * The socket's TTL is only set when it differs from the last packet's:
+ * originals all go out at the app's TTL without a setsockopt, and a fake
+ * burst costs one change to the fake TTL and one back. (macOS raw
+ * sockets ignore an IP_TTL control message, so sendmsg cannot carry it.)
  */
 static int send_udp_raw(int raw_fd, const uint8_t *udp_data, int udp_len,
                         struct in_addr dst_addr, int ttl, bool verbose)
@@ -332,10 +326,14 @@ static int send_udp_raw(int raw_fd, const uint8_t *udp_data, int udp_len,
     if (udp_len < (int)sizeof(struct udphdr))
         return -1;
 
-    if (setsockopt(raw_fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
-        if (verbose)
-            fprintf(stderr, "setsockopt(IP_TTL=%d): %s\n", ttl, strerror(errno));
-        return -1;
+    if (ttl != g_raw_ttl) {
+        if (setsockopt(raw_fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
+            if (verbose)
+                fprintf(stderr, "setsockopt(IP_TTL=%d): %s\n", ttl, strerror(errno));
+            g_raw_ttl = -1;
+            return -1;
+        }
+        g_raw_ttl = ttl;
     }
 
     struct sockaddr_in dst;
@@ -393,24 +391,194 @@ static void send_fake_packets(int raw_fd,
     }
 }
 
+/* ------------------------------------------------------------------ */
+/*  Hostlist filtering of QUIC Initials                                */
+/* ------------------------------------------------------------------ */
+
+/*
+ * A ClientHello may span several Initial datagrams (e.g. with Kyber key
+ * shares), so datagrams are held per flow until the SNI is decrypted.
+ */
+typedef struct {
+    bool     active;
+    struct in_addr dst_addr;
+    struct udphdr udph;             /* original header, reused for fakes */
+    int      ttl;
+    int64_t  since_ms;
+    int      held_count;
+    int      held_len[QUIC_PENDING_HELD];
+    uint8_t *held[QUIC_PENDING_HELD];   /* UDP header + payload */
+    dpi_quic_crypto_t crypto;
+} quic_pending_t;
+
+typedef struct {
+    int raw_fd;
+    const uint8_t *fake_payload;
+    size_t fake_len;
+    int fake_ttl;
+    int repeats;
+    const dpi_hostlist_t *hostlist;
+    const dpi_hostlist_t *hostlist_exclude;
+    bool verbose;
+} quic_filter_t;
+
+static quic_pending_t g_pending[QUIC_PENDING_SLOTS];
+static int g_pending_count;
+
+static int64_t monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Send fakes if wanted, then every held datagram, and free the slot */
+static void release_pending(const quic_filter_t *qf, quic_pending_t *p, bool fakes)
+{
+    if (fakes)
+        send_fake_packets(qf->raw_fd, p->dst_addr, &p->udph,
+                          qf->fake_payload, qf->fake_len,
+                          qf->fake_ttl, qf->repeats, qf->verbose);
+
+    for (int i = 0; i < p->held_count; i++) {
+        send_udp_raw(qf->raw_fd, p->held[i], p->held_len[i], p->dst_addr,
+                     p->ttl, qf->verbose);
+        free(p->held[i]);
+    }
+    p->held_count = 0;
+    p->active = false;
+    g_pending_count--;
+}
+
+static quic_pending_t *get_pending(const quic_filter_t *qf, struct in_addr dst_addr,
+                                   const struct udphdr *udph, int ttl)
+{
+    quic_pending_t *free_slot = NULL;
+    quic_pending_t *oldest = NULL;
+
+    for (int i = 0; i < QUIC_PENDING_SLOTS; i++) {
+        quic_pending_t *p = &g_pending[i];
+        if (!p->active) {
+            if (!free_slot)
+                free_slot = p;
+            continue;
+        }
+        if (p->dst_addr.s_addr == dst_addr.s_addr &&
+            p->udph.uh_sport == udph->uh_sport &&
+            p->udph.uh_dport == udph->uh_dport)
+            return p;
+        if (!oldest || p->since_ms < oldest->since_ms)
+            oldest = p;
+    }
+
+    if (!free_slot) {
+        /* Table full: give up on the oldest flow */
+        release_pending(qf, oldest, qf->hostlist == NULL);
+        free_slot = oldest;
+    }
+
+    free_slot->active = true;
+    free_slot->dst_addr = dst_addr;
+    free_slot->udph = *udph;
+    free_slot->ttl = ttl;
+    free_slot->since_ms = monotonic_ms();
+    free_slot->held_count = 0;
+    dpi_quic_crypto_init(&free_slot->crypto);
+    g_pending_count++;
+    return free_slot;
+}
+
+/* Hold or forward a QUIC Initial depending on its (decrypted) SNI */
+static void filter_quic_initial(const quic_filter_t *qf, struct in_addr dst_addr,
+                                const uint8_t *udp_raw, int udp_raw_len, int ttl)
+{
+    const struct udphdr *udph = (const struct udphdr *)udp_raw;
+    const uint8_t *payload = udp_raw + sizeof(struct udphdr);
+    int payload_len = udp_raw_len - (int)sizeof(struct udphdr);
+
+    quic_pending_t *p = get_pending(qf, dst_addr, udph, ttl);
+
+    dpi_tls_hello_t hello;
+    int ret = DPI_TLS_INVALID;
+    if (dpi_quic_crypto_add(&p->crypto, payload, payload_len) == 0)
+        ret = dpi_quic_crypto_hello(&p->crypto, &hello);
+
+    /* Queue this datagram behind the ones already held */
+    uint8_t *copy = p->held_count < QUIC_PENDING_HELD ? malloc(udp_raw_len) : NULL;
+    if (copy) {
+        memcpy(copy, udp_raw, udp_raw_len);
+        p->held[p->held_count] = copy;
+        p->held_len[p->held_count] = udp_raw_len;
+        p->held_count++;
+        if (ret == DPI_TLS_INCOMPLETE && p->held_count < QUIC_PENDING_HELD)
+            return;
+    }
+
+    bool fakes;
+    if (ret == DPI_TLS_OK && hello.host_off >= 0) {
+        const char *host = (const char *)p->crypto.data + hello.host_off;
+        fakes = dpi_hostlist_allows(qf->hostlist, qf->hostlist_exclude,
+                                    host, hello.host_len);
+        if (qf->verbose)
+            fprintf(stderr, "udp-bypass:QUIC SNI %.*s -> %s\n", hello.host_len, host,
+                    fakes ? "fakes" : "pass");
+    } else {
+        fakes = dpi_hostlist_allows(qf->hostlist, qf->hostlist_exclude, NULL, 0);
+    }
+
+    release_pending(qf, p, fakes);
+    if (!copy)
+        send_udp_raw(qf->raw_fd, udp_raw, udp_raw_len, dst_addr, ttl, qf->verbose);
+}
+
+/* Release flows whose ClientHello never completed */
+static void expire_pending(const quic_filter_t *qf)
+{
+    if (g_pending_count == 0)
+        return;
+
+    int64_t now = monotonic_ms();
+    for (int i = 0; i < QUIC_PENDING_SLOTS; i++) {
+        quic_pending_t *p = &g_pending[i];
+        if (p->active && now - p->since_ms >= QUIC_PENDING_TIMEOUT_MS)
+            release_pending(qf, p, qf->hostlist == NULL);
+    }
+}
+
 /* ------------------------------------------------------------------ */
 /*  Main loop                                                          */
 /* ------------------------------------------------------------------ */
 
 static void main_loop(int utun_fd, int raw_fd,
                       const uint8_t *fake_payload, size_t fake_len,
-                      int fake_ttl, int repeats, bool verbose)
+                      int fake_ttl, int repeats,
+                      const dpi_hostlist_t *hostlist,
+                      const dpi_hostlist_t *hostlist_exclude,
+                      bool verbose)
 {
     uint8_t buf[MAX_PKT_SIZE];
 
+    const quic_filter_t qf = {
+        .raw_fd           = raw_fd,
+        .fake_payload     = fake_payload,
+        .fake_len         = fake_len,
+        .fake_ttl         = fake_ttl,
+        .repeats          = repeats,
+        .hostlist         = hostlist,
+        .hostlist_exclude = hostlist_exclude,
+        .verbose          = verbose
+    };
+
     struct pollfd pfd = {
         .fd     = utun_fd,
         .events = POLLIN
     };
 
     while (g_running) {
-        /* poll() with 1s timeout — no FD_SETSIZE limit unlike select() */
-        int ret = poll(&pfd, 1, 1000);
+        /* poll() with 1s timeout — no FD_SETSIZE limit unlike select().
+         * Shorter while Initials are held so they are not delayed long. */
+        int ret = poll(&pfd, 1, g_pending_count ? 50 : 1000);
+        expire_pending(&qf);
         if (ret < 0) {
             if (errno == EINTR)
                 continue;
@@ -491,7 +659,12 @@ static void main_loop(int utun_fd, int raw_fd,
         /* If QUIC Initial detected and we have a fake payload, inject fakes */
         if (fake_payload && fake_len > 0 && udp_payload_len > 0) {
             const uint8_t *udp_data = ip_pkt + udp_payload_off;
-            if (is_quic_initial(udp_data, udp_payload_len)) {
+            if (dpi_is_quic_initial(udp_data, udp_payload_len) &&
+                (hostlist || hostlist_exclude)) {
+                filter_quic_initial(&qf, dst_addr, udp_raw, udp_raw_len, orig_ttl);
+                continue;
+            }
+            if (dpi_is_quic_initial(udp_data, udp_payload_len)) {
                 if (verbose)
                     fprintf(stderr, "udp-bypass:QUIC Initial detected, injecting fakes\n");
                 send_fake_packets(raw_fd, dst_addr, udph,
@@ -516,6 +689,8 @@ static void usage(const char *prog)
         "\n"
         "Options:\n"
         "  --fake-quic <file>   Fake QUIC Initial payload (.bin)\n"
+        "  --hostlist <file>    Inject fakes only for SNIs in this domain list\n"
+        "  --hostlist-exclude <file>  Never inject fakes for SNIs in this list\n"
         "  --fake-ttl <N>       TTL for fake packets (default: %d, range: 1-255)\n"
         "  --repeats <N>        Number of fake packet repeats (default: %d, range: 1-100)\n"
         "  --utun-start <N>     Starting utun unit number to try (default: 20, range: 0-255)\n"
@@ -527,6 +702,8 @@ static void usage(const char *prog)
 int main(int argc, char *argv[])
 {
     const char *fake_quic_path = NULL;
+    const char *hostlist_path = NULL;
+    const char *hostlist_exclude_path = NULL;
     int fake_ttl   = DEFAULT_FAKE_TTL;
     int repeats    = DEFAULT_REPEATS;
     int utun_start = 20;
@@ -534,6 +711,8 @@ int main(int argc, char *argv[])
 
     static struct option long_opts[] = {
         { "fake-quic",  required_argument, NULL, 'q' },
+        { "hostlist",   required_argument, NULL, 'l' },
+        { "hostlist-exclude", required_argument, NULL, 'x' },
         { "fake-ttl",   required_argument, NULL, 't' },
         { "repeats",    required_argument, NULL, 'r' },
         { "utun-start", required_argument, NULL, 'u' },
@@ -543,9 +722,11 @@ int main(int argc, char *argv[])
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "q:t:r:u:vh", long_opts, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "q:l:x:t:r:u:vh", long_opts, NULL)) != -1) {
         switch (opt) {
         case 'q': fake_quic_path = optarg; break;
+        case 'l': hostlist_path = optarg; break;
+        case 'x': hostlist_exclude_path = optarg; break;
         case 't': fake_ttl   = parse_int_arg(optarg, 1, 255, "fake-ttl"); break;
         case 'r': repeats    = parse_int_arg(optarg, 1, 100, "repeats"); break;
         case 'u': utun_start = parse_int_arg(optarg, 0, 255, "utun-start"); break;
@@ -590,6 +771,19 @@ int main(int argc, char *argv[])
             fprintf(stderr, "udp-bypass:Loaded fake QUIC payload: %zu bytes\n", fake_len);
     }
 
+    /* Load hostlists (missing files are fatal: filtering would silently stop) */
+    dpi_hostlist_t hostlist, hostlist_exclude;
+    dpi_hostlist_init(&hostlist);
+    dpi_hostlist_init(&hostlist_exclude);
+    if ((hostlist_path && dpi_hostlist_load_file(&hostlist, hostlist_path) < 0) ||
+        (hostlist_exclude_path &&
+         dpi_hostlist_load_file(&hostlist_exclude, hostlist_exclude_path) < 0)) {
+        fprintf(stderr, "Failed to load hostlist: %s\n", strerror(errno));
+        free(fake_payload);
+        remove_pidfile();
+        return 1;
+    }
+
     /* Create utun interface */
     char ifname[32];
     int utun_fd = create_utun(utun_start, ifname, sizeof(ifname));
@@ -630,7 +824,10 @@ int main(int argc, char *argv[])
             ifname, fake_ttl, repeats);
 
     /* Enter main loop */
-    main_loop(utun_fd, raw_fd, fake_payload, fake_len, fake_ttl, repeats, verbose);
+    main_loop(utun_fd, raw_fd, fake_payload, fake_len, fake_ttl, repeats,
+              hostlist_path ? &hostlist : NULL,
+              hostlist_exclude_path ? &hostlist_exclude : NULL,
+              verbose);
 
     fprintf(stderr, "udp-bypass:Shutting down\n");
 